@@ -0,0 +1,206 @@
+//------------------------------------------------------------------------------
+// Copyright (C) 2012, Robert Johansson, Raditex AB
+// All rights reserved.
+//
+// This file is part of rSCADA.
+//
+// rSCADA
+// http://www.rSCADA.se
+// info@rscada.se
+//------------------------------------------------------------------------------
+
+//S
+//S rs-canopen-bench-soa
+//S --------------------
+//S
+//S Measure the bulk frame parse and pack routines (canopen-soa.h) against a
+//S loop of canopen_frame_parse and canopen_frame_pack over the same frames.
+//S The frames are random: mostly standard frames, some extended, RTR and
+//S error frames, with random lengths. The bulk results are checked against
+//S the per-frame ones before timing. Not installed.
+//S
+//S The application is called as::
+//S
+//S     $ rs-canopen-bench-soa [FRAMES [ROUNDS]]
+//S
+//S where FRAMES is the number of frames in the buffer (default 1000000) and
+//S ROUNDS the number of passes timed over it (default 10). The best pass of
+//S each routine is printed, in millions of frames per second.
+//S
+
+#include <linux/can.h>
+
+#include <time.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <canopen/canopen.h>
+#include <canopen/canopen-soa.h>
+
+#define BENCH_FRAMES 1000000
+#define BENCH_ROUNDS 10
+
+static double
+bench_now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (double)ts.tv_sec + ts.tv_nsec / 1.0e9;
+}
+
+//------------------------------------------------------------------------------
+// Random frames, as canopen_frame_parse would see them on a bus.
+//------------------------------------------------------------------------------
+static void
+bench_frames_fill(struct can_frame *frames, int n)
+{
+    int i, j, r;
+
+    srand(1);
+
+    for (i = 0; i < n; i++)
+    {
+        memset(&frames[i], 0, sizeof(struct can_frame));
+
+        r = rand() % 100;
+        if (r < 85)
+            frames[i].can_id = rand() & CAN_SFF_MASK;
+        else if (r < 95)
+            frames[i].can_id = (rand() & CAN_EFF_MASK) | CAN_EFF_FLAG;
+        else if (r < 98)
+            frames[i].can_id = (rand() & CAN_SFF_MASK) | CAN_RTR_FLAG;
+        else
+            frames[i].can_id = (rand() & CAN_ERR_MASK) | CAN_ERR_FLAG;
+
+        frames[i].can_dlc = rand() % (CAN_MAX_DLEN + 1);
+        for (j = 0; j < frames[i].can_dlc; j++)
+            frames[i].data[j] = rand();
+    }
+}
+
+//------------------------------------------------------------------------------
+// The bulk routines must give what the per-frame ones give.
+//------------------------------------------------------------------------------
+static int
+bench_check(canopen_frame_soa_t *soa, canopen_frame_t *parsed, struct can_frame *frames,
+            struct can_frame *packed, struct can_frame *packed_n, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++)
+    {
+        if (soa->ids[i] != parsed[i].id || soa->fcs[i] != parsed[i].function_code ||
+            soa->types[i] != parsed[i].type || soa->rtrs[i] != parsed[i].rtr ||
+            soa->dlc[i] != parsed[i].data_len ||
+            memcmp(&(soa->payload[CANOPEN_FRAME_DATA_LEN * i]), parsed[i].payload.data, soa->dlc[i]) != 0)
+        {
+            fprintf(stderr, "Error: canopen_frame_parse_n differs at frame %d (0x%.8X).\n", i, frames[i].can_id);
+            return -1;
+        }
+
+        if (packed[i].can_id != packed_n[i].can_id || packed[i].can_dlc != packed_n[i].can_dlc ||
+            memcmp(packed[i].data, packed_n[i].data, packed[i].can_dlc) != 0)
+        {
+            fprintf(stderr, "Error: canopen_frame_pack_n differs at frame %d (0x%.8X).\n", i, frames[i].can_id);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static void
+bench_print(const char *name, double best, int n)
+{
+    printf("%-28s %8.1f Mframes/s\n", name, n / best / 1.0e6);
+}
+
+int
+main(int argc, char **argv)
+{
+    struct can_frame *frames, *packed, *packed_n;
+    canopen_frame_t *parsed;
+    canopen_frame_soa_t *soa;
+    double t, best[4] = { 1.0e9, 1.0e9, 1.0e9, 1.0e9 };
+    int n = BENCH_FRAMES, rounds = BENCH_ROUNDS, i, round;
+
+    if (argc > 3)
+    {
+        fprintf(stderr, "usage: %s [FRAMES [ROUNDS]]\n", argv[0]);
+        return -1;
+    }
+
+    if (argc > 1)
+        n = atoi(argv[1]);
+    if (argc > 2)
+        rounds = atoi(argv[2]);
+
+    if (n <= 0 || rounds <= 0)
+    {
+        fprintf(stderr, "Error: FRAMES and ROUNDS must be positive.\n");
+        return -1;
+    }
+
+    frames   = (struct can_frame *)malloc(n * sizeof(struct can_frame));
+    packed   = (struct can_frame *)malloc(n * sizeof(struct can_frame));
+    packed_n = (struct can_frame *)malloc(n * sizeof(struct can_frame));
+    parsed   = (canopen_frame_t *)malloc(n * sizeof(canopen_frame_t));
+    soa      = canopen_frame_soa_new(n);
+
+    if (frames == NULL || packed == NULL || packed_n == NULL || parsed == NULL || soa == NULL)
+    {
+        fprintf(stderr, "Error: Failed to allocate %d frames.\n", n);
+        return -1;
+    }
+
+    bench_frames_fill(frames, n);
+
+    for (round = 0; round < rounds; round++)
+    {
+        t = bench_now();
+        for (i = 0; i < n; i++)
+            canopen_frame_parse(&parsed[i], &frames[i]);
+        t = bench_now() - t;
+        if (t < best[0])
+            best[0] = t;
+
+        t = bench_now();
+        canopen_frame_parse_n(soa, frames, n);
+        t = bench_now() - t;
+        if (t < best[1])
+            best[1] = t;
+
+        t = bench_now();
+        for (i = 0; i < n; i++)
+            canopen_frame_pack(&parsed[i], &packed[i]);
+        t = bench_now() - t;
+        if (t < best[2])
+            best[2] = t;
+
+        t = bench_now();
+        canopen_frame_pack_n(soa, packed_n, n);
+        t = bench_now() - t;
+        if (t < best[3])
+            best[3] = t;
+
+        if (round == 0 && bench_check(soa, parsed, frames, packed, packed_n, n) != 0)
+            return 1;
+    }
+
+    printf("%d frames, best of %d rounds\n", n, rounds);
+    bench_print("canopen_frame_parse (loop)", best[0], n);
+    bench_print("canopen_frame_parse_n", best[1], n);
+    bench_print("canopen_frame_pack (loop)", best[2], n);
+    bench_print("canopen_frame_pack_n", best[3], n);
+
+    canopen_frame_soa_free(soa);
+    free(parsed);
+    free(packed_n);
+    free(packed);
+    free(frames);
+
+    return 0;
+}
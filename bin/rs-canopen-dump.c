@@ -18,6 +18,14 @@
 //S This program connects to CAN bus and attempt to parse all incoming frames, and
 //S print the frame in a human-readable format on the standard output.
 //S 
+//S The application is called as::
+//S 
+//S     $ rs-canopen-dump CAN-DEVICE [NODE ...]
+//S 
+//S where CAN-DEVICE is, e.g., can0 or can1, etc. If one or more NODE IDs are
+//S given, kernel filters are installed so that only frames to or from these
+//S nodes are received.
+//S 
 
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -30,19 +38,51 @@
 
 #include <string.h>
 #include <stdio.h> 
+#include <stdlib.h> 
+#include <errno.h> 
 
 #include <canopen/canopen.h>
+#include <canopen/canopen-com.h>
+#include <canopen/can-if.h>
+#include <canopen/canopen-view.h>
+
+//------------------------------------------------------------------------------
+// Write the whole buffer, also if the output is a pipe that takes less.
+//------------------------------------------------------------------------------
+static int
+write_all(int fd, const char *buf, size_t len)
+{
+    ssize_t n;
+
+    while (len > 0)
+    {
+        if ((n = write(fd, buf, len)) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+
+    return 0;
+}
 
 int
 main(int argc, char **argv)
 {
-    struct can_frame can_frame;
+    struct canfd_frame can_frames[CANOPEN_FRAME_BATCH_MAX];
+    canopen_frame_view_t views[CANOPEN_FRAME_BATCH_MAX];
     canopen_frame_t canopen_frame;
-    int sock, bytes_read;
+    canopen_decoder_t decoder;
+    can_subscription_t sub;
+    static char out[CANOPEN_FRAME_BATCH_MAX * CANOPEN_FRAME_FORMAT_MAX];
+    int sock, i, n, len;
 
-    if (argc != 2)
+    if (argc < 2)
     {
-        fprintf(stderr, "usage: %s can-interface\n", argv[0]);
+        fprintf(stderr, "usage: %s can-interface [NODE ...]\n", argv[0]);
         return -1;
     }
 
@@ -52,32 +92,59 @@ main(int argc, char **argv)
         fprintf(stderr, "Error: Failed to create socket.\n");
         return -1;
     }
+
+    if (argc > 2)
+    {
+        bzero((void *)&sub, sizeof(sub));
+        sub.type    = CAN_SUB_NODES;
+        sub.fc_mask = 0xFFFF;
+
+        for (i = 2; i < argc; i++)
+        {
+            CAN_SUB_NODE_SET(&sub, strtol(argv[i], NULL, 16));
+        }
+
+        if (can_filter_subscribe(sock, &sub, 1) != 0)
+        {
+            fprintf(stderr, "Warning: Failed to set CAN filters.\n");
+        }
+    }
  
-    printf("sizeof can_frame = %d\n", sizeof(struct can_frame));
+    printf("sizeof can_frame = %zu\n", sizeof(struct can_frame));
+    fflush(stdout); // frames are written straight to the file descriptor
+
+    canopen_decoder_init(&decoder);
  
     while (1)
     {
+        // drain all frames queued on the socket with one system call, and
+        // decode each in turn straight from the receive buffer
+        n = canopen_frame_recv_batch_raw(sock, can_frames, views, NULL, CANOPEN_FRAME_BATCH_MAX);
 
-        bytes_read = read(sock, &can_frame, sizeof(struct can_frame));
-
-        if (bytes_read < 0)
+        if (n < 0)
         {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                // read timeout on a quiet bus
+                continue;
+            }
+
             perror("read: can raw socket read");
             return 1;
         }
 
-        if (bytes_read < (int)sizeof(struct can_frame))
+        // format the whole batch, and write it out at once
+        for (i = 0, len = 0; i < n; i++)
         {
-            fprintf(stderr, "read: incomplete CAN frame\n");
-            return 1;
+            canopen_frame_view_parse(&views[i], &canopen_frame);
+            len += canopen_decoder_format(&decoder, &canopen_frame, out + len, CANOPEN_FRAME_FORMAT_MAX);
         }
 
-        if (canopen_frame_parse(&canopen_frame, &can_frame) != 0)
+        if (len > 0 && write_all(STDOUT_FILENO, out, len) != 0)
         {
-            fprintf(stderr, "CANopen failed to parse frame\n");
+            perror("write");
+            return 1;
         }
-    
-        canopen_frame_dump_short(&canopen_frame);
     }
 
     return 0;
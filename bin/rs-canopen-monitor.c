@@ -21,9 +21,12 @@
 //S 
 //S The application is called as::
 //S 
-//S     $ rs-canopen-monitor CAN-DEVICE
+//S     $ rs-canopen-monitor CAN-DEVICE [CAN-DEVICE ...]
 //S 
-//S where CAN-DEVICE is, e.g., can0 or can1, etc.
+//S where CAN-DEVICE is, e.g., can0 or can1, etc. All given CAN buses are
+//S monitored from a single thread. Below the frame list, the health of each
+//S bus is shown: controller error state, error frame counters and the
+//S number of frames dropped by the kernel.
 //S 
 
 
@@ -37,39 +40,61 @@
 #include <linux/can/raw.h>
 
 #include <string.h>
+#include <errno.h>
+#include <time.h>
 #include <stdio.h> 
 #include <stdlib.h>
 
 #include <canopen/canopen.h>
+#include <canopen/canopen-com.h>
+#include <canopen/canopen-event.h>
+#include <canopen/canopen-view.h>
+#include <canopen/can-if.h>
+
+#define MONITOR_REFRESH_MS 250
+
+#define MONITOR_CACHE_KEY(view) (canopen_frame_view_can_id(view) & ~CAN_RTR_FLAG)
 
 //------------------------------------------------------------------------------
 // Frame cache management
 //
 
+typedef struct _monitor_if {
+
+    char *interface;
+    can_if_stats_t stats;
+    canopen_decoder_t decoder;  // protocol state for the print-out of this bus
+    int err;                    // last socket read error, 0 once frames arrive again
+    int removed;                // the socket failed for good and is not monitored
+
+} monitor_if_t;
+
 typedef struct _can_frame_cache {
 
-    struct timeval tv;
+    monitor_if_t *mif;
+    uint32_t can_id;        // cache key: identifier without the RTR flag
+    struct timespec ts;
     double period;
-    canopen_frame_t frame;
-
+    char text[CANOPEN_FRAME_FORMAT_MAX];   // the last frame, as decoded on reception
+    size_t text_len;
 
     void *next;
 } can_frame_cache_t;
 
 static can_frame_cache_t *frame_cache = NULL;
 
+static monitor_if_t *monitor_ifs = NULL;
+static int monitor_if_count = 0;
+
 double
-timeval_diff(struct timeval *tv0, struct timeval *tv1)
+timespec_diff(struct timespec *ts0, struct timespec *ts1)
 {
-    double t0, t1;
-
-    if (tv0 == NULL || tv1 == NULL)
+    if (ts0 == NULL || ts1 == NULL)
         return 0.0;
 
-    t0 = tv0->tv_sec + tv0->tv_usec / 1.0e6;
-    t1 = tv1->tv_sec + tv1->tv_usec / 1.0e6;
-    
-    return t1 - t0;
+    // subtract the integer parts first to keep nanosecond resolution
+    return (double)(ts1->tv_sec - ts0->tv_sec) + 
+           (ts1->tv_nsec - ts0->tv_nsec) / 1.0e9;
 }
 
 can_frame_cache_t *
@@ -84,23 +109,28 @@ can_frame_cache_new()
     }
 
     fc->period = 0.0;
+    fc->text_len = 0;
     fc->next = NULL;
+
+    return fc;
 }
 
 can_frame_cache_t *
-can_frame_cache_add(canopen_frame_t *frame, struct timeval *tv)
+can_frame_cache_add(monitor_if_t *mif, const canopen_frame_view_t *view, struct timespec *ts)
 {
     can_frame_cache_t *fc;
 
-    fc = can_frame_cache_new();
-    memcpy((void *)&(fc->frame), (void *)frame, sizeof(canopen_frame_t));
-    fc->tv.tv_sec = tv->tv_sec;
-    fc->tv.tv_usec = tv->tv_usec;
+    if ((fc = can_frame_cache_new()) == NULL)
+        return NULL;
+
+    fc->mif = mif;
+    fc->can_id = MONITOR_CACHE_KEY(view);
+    fc->ts = *ts;
 
     if (frame_cache == NULL)
     {   
         frame_cache = fc;
-        return;
+        return fc;
     }
 
     fc->next = frame_cache;
@@ -109,42 +139,98 @@ can_frame_cache_add(canopen_frame_t *frame, struct timeval *tv)
     return fc;
 }
 
+//
+// Look up the frame by its identifier in the received frame itself. The
+// caller stores the decoded text in the entry returned.
+//
 can_frame_cache_t *
-can_frame_cache_update(canopen_frame_t *frame, struct timeval *tv)
+can_frame_cache_update(monitor_if_t *mif, const canopen_frame_view_t *view, struct timespec *ts)
 {
     can_frame_cache_t *iter;
+    uint32_t can_id = MONITOR_CACHE_KEY(view);
 
     for (iter = frame_cache; iter; iter = iter->next)
     {
-        if (iter->frame.id == frame->id &&
-            iter->frame.function_code == frame->function_code)
+        if (iter->can_id == can_id && iter->mif == mif)
         {
-            double delay = timeval_diff(&(iter->tv), tv);
-            iter->tv.tv_sec = tv->tv_sec;
-            iter->tv.tv_usec = tv->tv_usec;
+            double delay = timespec_diff(&(iter->ts), ts);
+            iter->ts = *ts;
 
             iter->period = (iter->period + delay) / 2.0;
 
-            memcpy((void *)&(iter->frame), (void *)frame, sizeof(canopen_frame_t));
-
             return iter;
         }
     }
     
-    return can_frame_cache_add(frame, tv);
+    return can_frame_cache_add(mif, view, ts);
 }
 
 void
 can_frame_cache_print()
 {
     can_frame_cache_t *iter;
+    static char *out = NULL;
+    static size_t out_size = 0;
+    size_t len = 0, n = 0;
 
-    system("clear");
+    for (iter = frame_cache; iter; iter = iter->next)
+        n++;
+
+    // room for the interface name and period in front of each frame
+    if (out_size < n * (CANOPEN_FRAME_FORMAT_MAX + 64))
+    {
+        free(out);
+        out_size = n * (CANOPEN_FRAME_FORMAT_MAX + 64);
+        if ((out = (char *)malloc(out_size)) == NULL)
+        {
+            out_size = 0;
+            return;
+        }
+    }
 
     for (iter = frame_cache; iter; iter = iter->next)
     {
-        printf("%.6fs ", iter->period);
-        canopen_frame_dump_short(&(iter->frame));
+        len += snprintf(out + len, 64, "%s %.6fs ", iter->mif->interface, iter->period);
+        memcpy(out + len, iter->text, iter->text_len);
+        len += iter->text_len;
+    }
+
+    fflush(stdout);
+    system("clear");
+
+    // the whole frame list with one write
+    if (len > 0 && write(STDOUT_FILENO, out, len) < 0)
+    {
+        perror("write");
+    }
+}
+
+void
+monitor_if_print()
+{
+    can_if_stats_t *st;
+    int i;
+
+    printf("\n");
+    for (i = 0; i < monitor_if_count; i++)
+    {
+        st = &(monitor_ifs[i].stats);
+
+        printf("%s: %s frames=%llu errors=%llu [bus-off=%llu arb-lost=%llu ack=%llu prot=%llu "
+               "ctrl-overflow=%llu tx-timeout=%llu] tec=%u rec=%u dropped=%llu\n",
+               monitor_ifs[i].interface, can_if_state_str(st->state),
+               (unsigned long long)st->frames, (unsigned long long)st->error_frames,
+               (unsigned long long)st->bus_off, (unsigned long long)st->arbitration_lost,
+               (unsigned long long)st->ack, (unsigned long long)st->protocol,
+               (unsigned long long)(st->rx_overflow + st->tx_overflow), 
+               (unsigned long long)st->tx_timeout,
+               st->tx_err_count, st->rx_err_count, (unsigned long long)st->drops);
+
+        if (monitor_ifs[i].err)
+        {
+            printf("%s: %s%s\n", monitor_ifs[i].interface, strerror(monitor_ifs[i].err),
+                   monitor_ifs[i].removed ? " (no longer monitored)" : "");
+        }
     }
 }
 
@@ -152,81 +238,180 @@ can_frame_cache_print()
 //
 //------------------------------------------------------------------------------
 
+//------------------------------------------------------------------------------
+// Event loop callbacks
+//
+
+static int cache_dirty = 0;
+
+void
+monitor_frame_cb(canopen_event_loop_t *loop, int sock, const canopen_frame_view_t *view,
+                 canopen_frame_meta_t *meta, void *arg)
+{
+    monitor_if_t *mif = (monitor_if_t *)arg;
+    can_frame_cache_t *fc;
+    canopen_frame_t frame;
+    struct timespec ts;
+    int len;
+
+    (void)loop;
+    (void)sock;
+
+    if (mif->err && !mif->removed)
+    {
+        mif->err = 0;
+        cache_dirty = 1;
+    }
+
+    // only error frames are decoded for the statistics
+    if (canopen_frame_view_is_error(view))
+    {
+        canopen_frame_view_parse(view, &frame);
+        if (can_if_stats_update(&(mif->stats), &frame, meta) != 0)
+            cache_dirty = 1;
+        return;
+    }
+
+    if (can_if_stats_update(&(mif->stats), NULL, meta) != 0)
+        cache_dirty = 1;
+
+    // without a receive time stamp (e.g. enabling them failed), the time
+    // of the callback stands in for it, on the same clock
+    ts = meta->ts;
+    if (ts.tv_sec == 0 && ts.tv_nsec == 0)
+        clock_gettime(CLOCK_REALTIME, &ts);
+
+    if ((fc = can_frame_cache_update(mif, view, &ts)) == NULL)
+    {
+        fprintf(stderr, "Failed to lookup frame\n");        
+        return;
+    }
+
+    // every frame goes through the decoder, in the order received, so
+    // that it can follow the SDO transfers
+    canopen_frame_view_parse(view, &frame);
+    len = canopen_decoder_format(&(mif->decoder), &frame, fc->text, sizeof(fc->text));
+
+    if (len < 0)
+        fc->text_len = 0;
+    else if ((size_t)len >= sizeof(fc->text))
+        fc->text_len = sizeof(fc->text) - 1;
+    else
+        fc->text_len = len;
+
+    cache_dirty = 1;
+}
 
+//
+// A bus that cannot be read, e.g. because its interface went down, is only
+// flagged in the summary: the other buses are served as usual.
+//
+void
+monitor_error_cb(canopen_event_loop_t *loop, int sock, int err, int removed, void *arg)
+{
+    monitor_if_t *mif = (monitor_if_t *)arg;
+
+    (void)loop;
+    (void)sock;
+
+    mif->err = err;
+    mif->removed = removed;
+    cache_dirty = 1;
+}
+
+void
+monitor_refresh_cb(canopen_event_loop_t *loop, int timer, uint64_t expirations, void *arg)
+{
+    (void)loop;
+    (void)timer;
+    (void)expirations;
+    (void)arg;
+
+    // redraw at a fixed rate rather than for every received frame
+    if (cache_dirty)
+    {
+        can_frame_cache_print();
+        monitor_if_print();
+        cache_dirty = 0;
+    }
+}
+
+//
+//
+//------------------------------------------------------------------------------
 
 int
 main(int argc, char **argv)
 {
-    struct sockaddr_can addr;
-    struct ifreq ifr;
-    struct can_frame can_frame;
-    struct timeval tv;
-    canopen_frame_t canopen_frame;
-    can_frame_cache_t *fc;
-    int sock, bytes_read;
+    canopen_event_loop_t *loop;
+    int sock, i;
 
-    if (argc != 2)
+    if (argc < 2)
     {
-        fprintf(stderr, "usage: %s can-interface\n", argv[0]);
+        fprintf(stderr, "usage: %s can-interface [can-interface ...]\n", argv[0]);
         return -1;
     }
 
-    /* Create the socket */
-    if ((sock = socket(PF_CAN, SOCK_RAW, CAN_RAW)) < 0)
+    monitor_if_count = argc - 1;
+    if ((monitor_ifs = (monitor_if_t *)calloc(monitor_if_count, sizeof(monitor_if_t))) == NULL)
     {
-        fprintf(stderr, "Error: Failed to create socket.\n");
+        fprintf(stderr, "Error: Failed to allocate interface statistics.\n");
         return -1;
     }
- 
-    /* Locate the interface you wish to use */
-    strcpy(ifr.ifr_name, argv[1]);
-    ioctl(sock, SIOCGIFINDEX, &ifr); /* ifr.ifr_ifindex gets filled 
-                                      * with that device's index */
-                                     // XXX add check
- 
-    /* Select that CAN interface, and bind the socket to it. */
-    addr.can_family = AF_CAN;
-    addr.can_ifindex = ifr.ifr_ifindex;
-    bind(sock, (struct sockaddr*)&addr, sizeof(addr)); // XXX Add check
- 
-    /* Send a message to the CAN bus * /
-    frame.can_id = 0x123;
-    strcpy(frame.data, "foo");
-    frame.can_dlc = strlen(frame.data);
-    int bytes_sent = write(sock, &frame, sizeof(frame));
-    */
 
-    while (1)
+    if ((loop = canopen_event_loop_new()) == NULL)
     {
-        bytes_read = read(sock, &can_frame, sizeof(struct can_frame));
+        fprintf(stderr, "Error: Failed to create event loop.\n");
+        return -1;
+    }
 
-        if (bytes_read < 0)
+    for (i = 1; i < argc; i++)
+    {
+        /* Create the socket, without read timeout */
+        if ((sock = can_socket_open_timeout(argv[i], 0)) < 0)
         {
-            perror("read: can raw socket read");
-            return 1;
+            fprintf(stderr, "Error: Failed to create socket.\n");
+            return -1;
         }
 
-        if (bytes_read < (int)sizeof(struct can_frame))
+        // let the kernel time stamp each frame on reception
+        if (can_socket_timestamp_enable(sock, CAN_TIMESTAMP_HARDWARE) != 0)
         {
-            fprintf(stderr, "read: incomplete CAN frame\n");
-            return 1;
+            fprintf(stderr, "Warning: Failed to enable receive time stamps.\n");
         }
 
-        ioctl(sock, SIOCGSTAMP, &tv);
-
-        if (canopen_frame_parse(&canopen_frame, &can_frame) != 0)
+        // error frames and socket drop counts for the bus health summary
+        if (can_socket_error_enable(sock, 0) != 0)
         {
-            fprintf(stderr, "CANopen failed to parse frame\n");
+            fprintf(stderr, "Warning: Failed to enable error frames.\n");
         }
 
-        if ((fc = can_frame_cache_update(&canopen_frame, &tv)) == NULL)
+        monitor_ifs[i - 1].interface = argv[i];
+        canopen_decoder_init(&(monitor_ifs[i - 1].decoder));
+
+        if (canopen_event_loop_add_socket_view(loop, sock, monitor_frame_cb, &monitor_ifs[i - 1]) != 0)
         {
-            fprintf(stderr, "Failed to lookup frame\n");        
-            continue;
+            fprintf(stderr, "Error: Failed to add socket to event loop.\n");
+            return -1;
         }
 
-        can_frame_cache_print();
+        canopen_event_loop_socket_error_cb(loop, sock, monitor_error_cb);
+    }
+
+    if (canopen_event_loop_add_timer(loop, MONITOR_REFRESH_MS, MONITOR_REFRESH_MS, 
+                                     monitor_refresh_cb, NULL) < 0)
+    {
+        fprintf(stderr, "Error: Failed to add refresh timer.\n");
+        return -1;
+    }
+ 
+    if (canopen_event_loop_run(loop) != 0)
+    {
+        perror("epoll_wait");
+        return 1;
     }
 
+    canopen_event_loop_free(loop);
+
     return 0;
 }
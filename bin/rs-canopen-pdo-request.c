@@ -32,6 +32,7 @@
 #include <stdio.h> 
 
 #include <canopen/canopen.h>
+#include <canopen/can-if.h>
 
 int
 main(int argc, char **argv)
@@ -40,6 +41,7 @@ main(int argc, char **argv)
     struct ifreq ifr;
     struct can_frame can_frame;
     canopen_frame_t canopen_frame;
+    can_subscription_t sub;
     int sock, nbytes, n = 0;
     uint8_t node, subindex;
     uint16_t index;
@@ -68,6 +70,17 @@ main(int argc, char **argv)
    
     node     = strtol(argv[2], NULL, 16);
 
+    // only wake up for the TPDO1 reply from our node
+    bzero((void *)&sub, sizeof(sub));
+    sub.type    = CAN_SUB_NODES;
+    sub.fc_mask = CAN_SUB_FC(CANOPEN_FC_PDO1_TX);
+    CAN_SUB_NODE_SET(&sub, node);
+
+    if (can_filter_subscribe(sock, &sub, 1) != 0)
+    {
+        fprintf(stderr, "Warning: Failed to set CAN filters.\n");
+    }
+
     printf("DEBUG: Send PDO REQUEST to Node=0x%.2X\n", node);
 
     canopen_frame_set_pdo_request(&canopen_frame, node);
@@ -95,8 +108,6 @@ main(int argc, char **argv)
 
     while (1)
     {
-        // set filters for our node?
-
         nbytes = read(sock, &can_frame, sizeof(struct can_frame));
 
         if (nbytes < 0)
@@ -32,6 +32,7 @@
 #include <stdio.h> 
 
 #include <canopen/canopen.h>
+#include <canopen/can-if.h>
 
 int
 main(int argc, char **argv)
@@ -70,6 +71,12 @@ main(int argc, char **argv)
     index    = strtol(argv[3], NULL, 16);
     subindex = strtol(argv[4], NULL, 16);
 
+    // only wake up for the SDO replies from our node
+    if (can_filter_sdo_set(sock, node) != 0)
+    {
+        fprintf(stderr, "Warning: Failed to set CAN filters.\n");
+    }
+
     printf("DEBUG: Send PDO UPLOAD to Node=0x%.2X Index=0x%.4X SubIndex=0x%.2X\n", node, index, subindex);
 
     // XXX: incomplete
@@ -98,8 +105,6 @@ main(int argc, char **argv)
 
     while (1)
     {
-        // set filters for our node?
-
         nbytes = read(sock, &can_frame, sizeof(struct can_frame));
 
         if (nbytes < 0)
@@ -0,0 +1,156 @@
+//------------------------------------------------------------------------------
+// Copyright (C) 2012, Robert Johansson, Raditex AB
+// All rights reserved.
+//
+// This file is part of rSCADA.
+//
+// rSCADA
+// http://www.rSCADA.se
+// info@rscada.se
+//------------------------------------------------------------------------------
+
+//S
+//S rs-canopen-scan
+//S ---------------
+//S
+//S Find the CANopen nodes on a bus and print their identity object (0x1018:
+//S vendor ID, product code, revision number and serial number). All 127 node
+//S IDs are asked at the same time by default, so the scan takes about one
+//S SDO timeout; with a smaller WINDOW it takes about 127 / WINDOW of them.
+//S
+//S The application is called as::
+//S
+//S     $ rs-canopen-scan CAN-DEVICE [TIMEOUT-MS [WINDOW]]
+//S
+//S where CAN-DEVICE is, e.g., can0 or can1, etc., TIMEOUT-MS how long to wait
+//S for a node to answer (default 1000), and WINDOW the number of nodes asked
+//S at a time (default 127, 0 for all). A smaller window spreads the requests
+//S out on a busy bus. Requests that do not fit in the interface's transmit
+//S queue are sent again once there is room.
+//S
+//S Nodes that could not be asked because of a send or receive error are
+//S listed apart from the nodes found.
+//S
+
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <net/if.h>
+#include <unistd.h>
+
+#include <linux/can.h>
+#include <linux/can/raw.h>
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <canopen/canopen.h>
+#include <canopen/canopen-com.h>
+#include <canopen/canopen-sdo.h>
+
+#define SCAN_NODE_MIN   1
+#define SCAN_NODE_MAX   127
+#define SCAN_SUBINDICES 4   // 0x1018 sub 1..4
+#define SCAN_WINDOW     (SCAN_NODE_MAX - SCAN_NODE_MIN + 1) // every node at once
+
+int
+main(int argc, char **argv)
+{
+    struct sockaddr_can addr;
+    struct ifreq ifr;
+    canopen_transport_t tp;
+    canopen_sdo_read_t reads[(SCAN_NODE_MAX - SCAN_NODE_MIN + 1) * SCAN_SUBINDICES], *r;
+    int sock, node, sub, n = 0, window = SCAN_WINDOW, found = 0, failed = 0;
+
+    if (argc < 2 || argc > 4)
+    {
+        fprintf(stderr, "usage: %s can-interface [TIMEOUT-MS [WINDOW]]\n", argv[0]);
+        return -1;
+    }
+
+    /* Create the socket */
+    if ((sock = socket(PF_CAN, SOCK_RAW, CAN_RAW)) < 0)
+    {
+        fprintf(stderr, "Error: Failed to create socket.\n");
+        return -1;
+    }
+
+    /* Locate the interface you wish to use */
+    strcpy(ifr.ifr_name, argv[1]);
+    ioctl(sock, SIOCGIFINDEX, &ifr); // XXX add check
+
+    /* Select that CAN interface, and bind the socket to it. */
+    addr.can_family = AF_CAN;
+    addr.can_ifindex = ifr.ifr_ifindex;
+    bind(sock, (struct sockaddr*)&addr, sizeof(addr)); // XXX Add check
+
+    canopen_transport_socket_init(&tp, sock);
+
+    if (argc > 2)
+        tp.sdo_timeout_ms = strtol(argv[2], NULL, 10);
+    if (argc > 3)
+        window = strtol(argv[3], NULL, 10);
+
+    bzero((void *)reads, sizeof(reads));
+
+    for (node = SCAN_NODE_MIN; node <= SCAN_NODE_MAX; node++)
+    {
+        for (sub = 1; sub <= SCAN_SUBINDICES; sub++, n++)
+        {
+            reads[n].node     = node;
+            reads[n].index    = 0x1018;
+            reads[n].subindex = sub;
+        }
+    }
+
+    if (canopen_sdo_read_n(&tp, reads, n, window) < 0)
+    {
+        fprintf(stderr, "Error: SDO scan failed.\n");
+        return -1;
+    }
+
+    printf("Node  Vendor ID   Product     Revision    Serial\n");
+
+    for (r = reads; r < reads + n; r += SCAN_SUBINDICES)
+    {
+        // a node that does not answer times out on the first read
+        if (r[0].result.status == CANOPEN_SDO_ERR_TIMEOUT)
+            continue;
+
+        if (r[0].result.status == CANOPEN_SDO_ERR_IO)
+        {
+            failed++;
+            continue;
+        }
+
+        found++;
+        printf("0x%.2X", r[0].node);
+
+        for (sub = 0; sub < SCAN_SUBINDICES; sub++)
+        {
+            if (r[sub].result.status == CANOPEN_SDO_OK)
+                printf("  0x%.8X", r[sub].value);
+            else
+                printf("  %-10s", "-");
+        }
+        printf("\n");
+    }
+
+    printf("%d node(s) found\n", found);
+
+    if (failed)
+    {
+        printf("%d node(s) not asked because of an I/O error:", failed);
+
+        for (r = reads; r < reads + n; r += SCAN_SUBINDICES)
+        {
+            if (r[0].result.status == CANOPEN_SDO_ERR_IO)
+                printf(" 0x%.2X", r[0].node);
+        }
+        printf("\n");
+    }
+
+    return 0;
+}
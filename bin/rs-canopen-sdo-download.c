@@ -32,6 +32,7 @@
 #include <stdio.h> 
 
 #include <canopen/canopen.h>
+#include <canopen/canopen-com.h>
 
 int
 main(int argc, char **argv)
@@ -120,7 +121,8 @@ main(int argc, char **argv)
         }
         else
         {
-            printf("ERROR: Expediated SDO download failed.\n");
+            printf("ERROR: Expediated SDO download failed: %s\n",
+                   canopen_sdo_result_str(canopen_sdo_result_last()));
         }
     }
     else if (mode == 1)
@@ -132,7 +134,8 @@ main(int argc, char **argv)
         }
         else
         {
-            printf("ERROR: Segmented SDO download failed.\n");
+            printf("ERROR: Segmented SDO download failed: %s\n",
+                   canopen_sdo_result_str(canopen_sdo_result_last()));
         }
     }
     else if (mode == 2)
@@ -144,7 +147,8 @@ main(int argc, char **argv)
         }
         else
         {
-            printf("ERROR: Block SDO download failed.\n");
+            printf("ERROR: Block SDO download failed: %s\n",
+                   canopen_sdo_result_str(canopen_sdo_result_last()));
         }
     }
 
@@ -32,6 +32,7 @@
 #include <stdio.h> 
 
 #include <canopen/canopen.h>
+#include <canopen/canopen-com.h>
 
 int
 main(int argc, char **argv)
@@ -44,12 +45,13 @@ main(int argc, char **argv)
     uint8_t node, subindex, data_array[256];
     uint16_t index;
     uint32_t data;
+    static uint8_t block_array[65536];
 
     bzero((void *)data_array, sizeof(data_array));
 
     if (argc != 5 && argc != 6)
     {
-        fprintf(stderr, "usage: %s can-interface NODE INDEX SUBINDEX\n", argv[0]);
+        fprintf(stderr, "usage: %s can-interface NODE INDEX SUBINDEX [SEG|BLOCK]\n", argv[0]);
         return -1;
     }
 
@@ -77,8 +79,28 @@ main(int argc, char **argv)
     {
         exp = 0;
     }
+    else if (argc == 6 && strcmp(argv[5], "BLOCK") == 0)
+    {
+        exp = 2;
+    }
 
-    if (exp)
+    if (exp == 2)
+    {
+        // block upload
+        int len, i;
+        if ((len = canopen_sdo_upload_block(sock, node, index, subindex, block_array, sizeof(block_array))) >= 0)
+        {
+            for (i = 0; i < len; i++)
+                printf("%.2x", block_array[i]);
+            printf("\n");
+        }
+        else
+        {
+            printf("ERROR: block SDO upload failed: %s\n",
+                   canopen_sdo_result_str(canopen_sdo_result_last()));
+        }
+    }
+    else if (exp)
     {
         // expediated upload
         if (canopen_sdo_upload_exp(sock, node, index, subindex, &data) == 0)
@@ -87,7 +109,8 @@ main(int argc, char **argv)
         }
         else
         {
-            printf("ERROR: expediated SDO upload failed\n");
+            printf("ERROR: expediated SDO upload failed: %s\n",
+                   canopen_sdo_result_str(canopen_sdo_result_last()));
         }
     }
     else
@@ -106,7 +129,8 @@ main(int argc, char **argv)
         }
         else
         {
-            printf("ERROR: segmented SDO upload failed\n");
+            printf("ERROR: segmented SDO upload failed: %s\n",
+                   canopen_sdo_result_str(canopen_sdo_result_last()));
         }
     }
     return 0;
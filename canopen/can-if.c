@@ -18,15 +18,28 @@
  
 #include <linux/can.h>
 #include <linux/can/raw.h>
+#include <linux/can/bcm.h>
+#include <linux/net_tstamp.h>
+#include <linux/sockios.h>
 
 #include <stdio.h> 
 #include <string.h>
 #include <strings.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <errno.h>
 
+#include <canopen/canopen.h>
+#include <canopen/canopen-com.h>
 #include <canopen/can-if.h>
 
+#define CAN_BCM_SYNC_MAX 240 // largest SYNC counter overflow value
+
+typedef struct _can_filter_term {
+    uint16_t id;
+    uint16_t mask;
+} can_filter_term_t;
+
 int
 can_socket_open(char *interface)
 {
@@ -66,6 +79,46 @@ can_socket_open_timeout(char *interface, unsigned int timeout_sec)
     return sock;
 }
 
+//------------------------------------------------------------------------------
+// Open a CAN socket that also sends and receives CAN FD frames (up to 64
+// bytes payload). Fails if the kernel does not support CAN FD.
+//------------------------------------------------------------------------------
+int
+can_socket_open_fd(char *interface, unsigned int timeout_sec)
+{
+    int sock, on = 1;
+
+    if ((sock = can_socket_open_timeout(interface, timeout_sec)) < 0)
+    {
+        return -1;
+    }
+
+    if (setsockopt(sock, SOL_CAN_RAW, CAN_RAW_FD_FRAMES, &on, sizeof(on)) != 0)
+    {
+        fprintf(stderr, "Error: Failed to enable CAN FD frames.\n");
+        close(sock);
+        return -1;
+    }
+
+    return sock;
+}
+
+//------------------------------------------------------------------------------
+// Check if CAN FD frames are enabled on the socket.
+//------------------------------------------------------------------------------
+int
+can_socket_is_fd(int sock)
+{
+    int on = 0;
+    socklen_t len = sizeof(on);
+
+    if (getsockopt(sock, SOL_CAN_RAW, CAN_RAW_FD_FRAMES, &on, &len) != 0)
+    {
+        return 0;
+    }
+
+    return on;
+}
 
 int
 can_socket_close(int socket)
@@ -73,18 +126,487 @@ can_socket_close(int socket)
     return close(socket);
 }
 
+//------------------------------------------------------------------------------
+// Make the CAN device the socket is bound to time stamp all received frames
+// (SIOCSHWTSTAMP), unless it already does. Returns 0 if it does.
+//------------------------------------------------------------------------------
+static int
+can_socket_hwtstamp_enable(int sock)
+{
+    struct sockaddr_can addr;
+    socklen_t len = sizeof(addr);
+    struct hwtstamp_config cfg;
+    struct ifreq ifr;
+
+    // a socket bound to all interfaces has no single device clock
+    if (getsockname(sock, (struct sockaddr *)&addr, &len) != 0 || addr.can_ifindex == 0)
+        return -1;
+
+    bzero((void *)&ifr, sizeof(ifr));
+    if (if_indextoname(addr.can_ifindex, ifr.ifr_name) == NULL)
+        return -1;
+
+    bzero((void *)&cfg, sizeof(cfg));
+    ifr.ifr_data = (void *)&cfg;
+
+    if (ioctl(sock, SIOCGHWTSTAMP, &ifr) == 0 && cfg.rx_filter != HWTSTAMP_FILTER_NONE)
+        return 0;
+
+    bzero((void *)&cfg, sizeof(cfg));
+    cfg.tx_type   = HWTSTAMP_TX_OFF;
+    cfg.rx_filter = HWTSTAMP_FILTER_ALL;
+
+    return ioctl(sock, SIOCSHWTSTAMP, &ifr);
+}
+
+//------------------------------------------------------------------------------
+// Enable kernel receive time stamps on the socket. The time stamps are
+// delivered as ancillary data with each frame, so reading them costs no
+// extra system calls. With CAN_TIMESTAMP_HARDWARE the device of a bound
+// socket is set up to time stamp frames, and only its stamps are taken;
+// if it cannot, only kernel software stamps are, so that the stamps of a
+// socket never mix two clocks (canopen_frame_meta_t.ts_hw tells which).
+//------------------------------------------------------------------------------
+int
+can_socket_timestamp_enable(int sock, int mode)
+{
+    int on = 1, off = 0, flags;
+
+    switch (mode)
+    {
+        case CAN_TIMESTAMP_NONE:
+            setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPING, &off, sizeof(off));
+            return setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPNS, &off, sizeof(off));
+
+        case CAN_TIMESTAMP_SOFTWARE:
+            return setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on));
+
+        case CAN_TIMESTAMP_HARDWARE:
+            if (can_socket_hwtstamp_enable(sock) == 0)
+                flags = SOF_TIMESTAMPING_RX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE;
+            else
+                flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+
+            return setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags));
+    }
+
+    return -1;
+}
+
+//------------------------------------------------------------------------------
+// Receive error frames of the classes in err_mask (0: all classes) on the
+// socket, and have the kernel report how many frames the socket dropped
+// because its receive queue was full (SO_RXQ_OVFL). Both show up in the
+// frames and meta data passed to can_if_stats_update.
+//------------------------------------------------------------------------------
+int
+can_socket_error_enable(int sock, can_err_mask_t err_mask)
+{
+    int on = 1;
+
+    if (err_mask == 0)
+        err_mask = CAN_ERR_MASK;
+
+    if (setsockopt(sock, SOL_CAN_RAW, CAN_RAW_ERR_FILTER, &err_mask, sizeof(err_mask)) != 0)
+    {
+        fprintf(stderr, "Error: Failed to set CAN error filter.\n");
+        return -1;
+    }
+
+    return setsockopt(sock, SOL_SOCKET, SO_RXQ_OVFL, &on, sizeof(on));
+}
+
+//------------------------------------------------------------------------------
+// Account a received frame (and its meta data, may be NULL) in the
+// interface statistics: error frames are decoded into the error counters
+// and the controller state. frame may be NULL for a frame already known
+// not to be an error frame. Returns the CAN_IF_EVENT_* that occurred.
+//------------------------------------------------------------------------------
+int
+can_if_stats_update(can_if_stats_t *stats, canopen_frame_t *frame, canopen_frame_meta_t *meta)
+{
+    uint32_t err;
+    uint8_t *data, state;
+    int events = 0;
+
+    // SO_RXQ_OVFL is a running count per socket, only sent once non-zero
+    if (meta && meta->drops != 0 && meta->drops != stats->drops_last)
+    {
+        stats->drops += (uint32_t)(meta->drops - stats->drops_last);
+        stats->drops_last = meta->drops;
+        events |= CAN_IF_EVENT_DROPS;
+    }
+
+    if (frame == NULL || frame->type != CANOPEN_FLAG_ERROR)
+    {
+        stats->frames++;
+        return events;
+    }
+
+    err   = frame->id;
+    data  = frame->payload.data;
+    state = stats->state;
+
+    stats->error_frames++;
+    events |= CAN_IF_EVENT_ERROR;
+
+    if (err & CAN_ERR_TX_TIMEOUT)
+        stats->tx_timeout++;
+
+    if (err & CAN_ERR_LOSTARB)
+        stats->arbitration_lost++;
+
+    if (err & CAN_ERR_CRTL)
+    {
+        stats->controller++;
+
+        if (data[1] & CAN_ERR_CRTL_RX_OVERFLOW)
+            stats->rx_overflow++;
+        if (data[1] & CAN_ERR_CRTL_TX_OVERFLOW)
+            stats->tx_overflow++;
+
+        if (data[1] & (CAN_ERR_CRTL_RX_PASSIVE | CAN_ERR_CRTL_TX_PASSIVE))
+            state = CAN_IF_STATE_PASSIVE;
+        else if (data[1] & (CAN_ERR_CRTL_RX_WARNING | CAN_ERR_CRTL_TX_WARNING))
+            state = CAN_IF_STATE_WARNING;
+        else if (data[1] & CAN_ERR_CRTL_ACTIVE)
+            state = CAN_IF_STATE_ACTIVE;
+    }
+
+    if (err & CAN_ERR_PROT)
+        stats->protocol++;
+
+    if (err & CAN_ERR_TRX)
+        stats->transceiver++;
+
+    if (err & CAN_ERR_ACK)
+        stats->ack++;
+
+    if (err & CAN_ERR_BUSERROR)
+        stats->bus_error++;
+
+    if (err & CAN_ERR_BUSOFF)
+    {
+        stats->bus_off++;
+        state = CAN_IF_STATE_BUS_OFF;
+    }
+
+    if (err & CAN_ERR_RESTARTED)
+    {
+        stats->restarted++;
+        state = CAN_IF_STATE_ACTIVE;
+    }
+
+#ifdef CAN_ERR_CNT
+    if (err & CAN_ERR_CNT)
+    {
+        stats->tx_err_count = data[6];
+        stats->rx_err_count = data[7];
+    }
+#endif
+
+    if (state != stats->state)
+    {
+        stats->state = state;
+        events |= CAN_IF_EVENT_STATE;
+    }
+
+    return events;
+}
+
+//------------------------------------------------------------------------------
+// Name of a controller error state.
+//------------------------------------------------------------------------------
+const char *
+can_if_state_str(uint8_t state)
+{
+    switch (state)
+    {
+        case CAN_IF_STATE_ACTIVE:   return "error-active";
+        case CAN_IF_STATE_WARNING:  return "error-warning";
+        case CAN_IF_STATE_PASSIVE:  return "error-passive";
+        case CAN_IF_STATE_BUS_OFF:  return "bus-off";
+    }
+
+    return "unknown";
+}
+
+//------------------------------------------------------------------------------
+// Mark all COB-IDs selected by a subscription in the bitmap.
+//------------------------------------------------------------------------------
+static void
+can_filter_bitmap_add(uint32_t *bitmap, can_subscription_t *sub)
+{
+    int cob_id, fc, node;
+
+    switch (sub->type)
+    {
+        case CAN_SUB_COB_RANGE:
+            for (cob_id = sub->cob_id_min; cob_id <= sub->cob_id_max && cob_id < CAN_COB_ID_COUNT; cob_id++)
+                bitmap[cob_id >> 5] |= 1U << (cob_id & 0x1F);
+            break;
+
+        case CAN_SUB_FUNCTION:
+        case CAN_SUB_NODES:
+            for (fc = 0; fc < 16; fc++)
+            {
+                if (!(sub->fc_mask & CAN_SUB_FC(fc)))
+                    continue;
+
+                for (node = 0; node < 128; node++)
+                {
+                    if (sub->type == CAN_SUB_NODES && 
+                        !(sub->node_mask[node >> 5] & (1U << (node & 0x1F))))
+                        continue;
+
+                    cob_id = (fc << 7) | node;
+                    bitmap[cob_id >> 5] |= 1U << (cob_id & 0x1F);
+                }
+            }
+            break;
+    }
+}
+
+//------------------------------------------------------------------------------
+//SF
+//SF .. c:function:: void can_filter_bitmap(can_subscription_t *subs, int n_subs, uint32_t *bitmap)
+//SF
+//SF     Fill *bitmap* (CAN_COB_ID_COUNT bits) with the COB-IDs selected by
+//SF     the subscriptions, for transports that filter in software.
+//SF
+//------------------------------------------------------------------------------
+void
+can_filter_bitmap(can_subscription_t *subs, int n_subs, uint32_t *bitmap)
+{
+    int i;
+
+    bzero((void *)bitmap, CAN_COB_ID_COUNT / 8);
+    for (i = 0; i < n_subs; i++)
+    {
+        can_filter_bitmap_add(bitmap, &subs[i]);
+    }
+}
+
+//------------------------------------------------------------------------------
+// Cover the COB-IDs set in the bitmap with as few (id, mask) terms as
+// possible: first split each run of IDs into aligned power-of-two blocks,
+// then repeatedly merge terms that differ in exactly one compared bit.
+// Returns the number of terms.
+//------------------------------------------------------------------------------
+static int
+can_filter_terms(uint32_t *bitmap, can_filter_term_t *terms)
+{
+    int cob_id = 0, n = 0, i, j, merged;
+    uint16_t size, diff;
+
+    while (cob_id < CAN_COB_ID_COUNT)
+    {
+        if (!(bitmap[cob_id >> 5] & (1U << (cob_id & 0x1F))))
+        {
+            cob_id++;
+            continue;
+        }
+
+        // largest aligned block starting at cob_id that is fully set
+        for (size = 1; ; size <<= 1)
+        {
+            int next = size << 1, k;
+
+            if ((cob_id & (next - 1)) || cob_id + next > CAN_COB_ID_COUNT)
+                break;
+
+            for (k = cob_id + size; k < cob_id + next; k++)
+                if (!(bitmap[k >> 5] & (1U << (k & 0x1F))))
+                    break;
+
+            if (k < cob_id + next)
+                break;
+        }
+
+        terms[n].id   = cob_id;
+        terms[n].mask = (CAN_COB_ID_COUNT - 1) & ~(size - 1);
+        n++;
+
+        cob_id += size;
+    }
+
+    do
+    {
+        merged = 0;
+
+        for (i = 0; i < n; i++)
+        {
+            for (j = i + 1; j < n; j++)
+            {
+                if (terms[i].mask != terms[j].mask)
+                    continue;
+
+                diff = terms[i].id ^ terms[j].id;
+
+                if ((diff & (diff - 1)) == 0 && (diff & terms[i].mask))
+                {
+                    terms[i].id   &= ~diff;
+                    terms[i].mask &= ~diff;
+                    terms[j--] = terms[--n];
+                    merged = 1;
+                }
+            }
+        }
+    } while (merged);
+
+    return n;
+}
+
+//------------------------------------------------------------------------------
+//SF 
+//SF .. c:function:: int can_filter_compile(can_subscription_t *subs, int n_subs, struct can_filter *filters, int max_filters, int allow_join, int *join)
+//SF    
+//SF     Compile a table of frame subscriptions into a minimal array of
+//SF     kernel CAN filters. If *allow_join* is set and it gives fewer
+//SF     entries, the complement of the subscribed set is installed as
+//SF     inverted filters that must all match (CAN_RAW_JOIN_FILTERS), and
+//SF     *join* is set to 1.
+//SF 
+//SF     Returns the number of filters written to *filters*, or -1 if they
+//SF     do not fit in *max_filters* entries.
+//SF 
+//------------------------------------------------------------------------------
+int
+can_filter_compile(can_subscription_t *subs, int n_subs, 
+                   struct can_filter *filters, int max_filters,
+                   int allow_join, int *join)
+{
+    uint32_t bitmap[CAN_COB_ID_COUNT / 32], complement[CAN_COB_ID_COUNT / 32];
+    can_filter_term_t terms[CAN_COB_ID_COUNT], inv_terms[CAN_COB_ID_COUNT];
+    int i, n, n_inv = CAN_COB_ID_COUNT;
+
+    if (filters == NULL || join == NULL || (subs == NULL && n_subs > 0))
+    {
+        return -1;
+    }
+
+    *join = 0;
+
+    can_filter_bitmap(subs, n_subs, bitmap);
+
+    n = can_filter_terms(bitmap, terms);
+
+    if (allow_join && n > 2)
+    {
+        for (i = 0; i < CAN_COB_ID_COUNT / 32; i++)
+            complement[i] = ~bitmap[i];
+
+        n_inv = can_filter_terms(complement, inv_terms);
+    }
+
+    if (n_inv + 1 < n)
+    {
+        // reject everything in the complement, and all extended frames
+        if (n_inv + 1 > max_filters)
+            return -1;
+
+        for (i = 0; i < n_inv; i++)
+        {
+            filters[i].can_id   = inv_terms[i].id | CAN_INV_FILTER;
+            filters[i].can_mask = inv_terms[i].mask;
+        }
+        filters[n_inv].can_id   = CAN_EFF_FLAG | CAN_INV_FILTER;
+        filters[n_inv].can_mask = CAN_EFF_FLAG;
+
+        *join = 1;
+        return n_inv + 1;
+    }
+
+    if (n > max_filters)
+        return -1;
+
+    for (i = 0; i < n; i++)
+    {
+        filters[i].can_id   = terms[i].id;
+        filters[i].can_mask = terms[i].mask | CAN_EFF_FLAG;
+    }
+
+    return n;
+}
+
+//------------------------------------------------------------------------------
+//SF 
+//SF .. c:function:: int can_filter_subscribe(int sock, can_subscription_t *subs, int n_subs)
+//SF    
+//SF     Install kernel receive filters on the socket so that only frames
+//SF     matching the subscription table wake up the reader.
+//SF 
+//------------------------------------------------------------------------------
+int
+can_filter_subscribe(int sock, can_subscription_t *subs, int n_subs)
+{
+    struct can_filter filters[CAN_RAW_FILTER_MAX];
+    int n, join, on = 1, off = 0;
+
+    if ((n = can_filter_compile(subs, n_subs, filters, CAN_RAW_FILTER_MAX, 1, &join)) < 0)
+    {
+        return -1;
+    }
+
+    if (join && setsockopt(sock, SOL_CAN_RAW, CAN_RAW_JOIN_FILTERS, &on, sizeof(on)) != 0)
+    {
+        // kernel without CAN_RAW_JOIN_FILTERS support, use plain filters
+        if ((n = can_filter_compile(subs, n_subs, filters, CAN_RAW_FILTER_MAX, 0, &join)) < 0)
+        {
+            return -1;
+        }
+    }
+
+    if (!join)
+    {
+        setsockopt(sock, SOL_CAN_RAW, CAN_RAW_JOIN_FILTERS, &off, sizeof(off));
+    }
+
+    return setsockopt(sock, SOL_CAN_RAW, CAN_RAW_FILTER, filters, n * sizeof(struct can_filter));
+}
+
+//------------------------------------------------------------------------------
+// Only receive frames to or from the given node (all function codes).
+//------------------------------------------------------------------------------
 int
 can_filter_node_set(int sock, uint8_t node)
 {
-    struct can_filter rfilter[1];
+    can_subscription_t sub;
 
-    rfilter[0].can_id   = node;
-    rfilter[0].can_mask = 0x00;
+    if (node > CAN_SUB_NODE_MAX)
+    {
+        errno = EINVAL;
+        return -1;
+    }
 
-    // seems not to work to chance filters after bind
-    setsockopt(sock, SOL_CAN_RAW, CAN_RAW_FILTER, &rfilter, sizeof(rfilter));
+    bzero((void *)&sub, sizeof(sub));
+    sub.type    = CAN_SUB_NODES;
+    sub.fc_mask = 0xFFFF;
+    CAN_SUB_NODE_SET(&sub, node);
 
-    return 0;
+    return can_filter_subscribe(sock, &sub, 1);
+}
+
+//------------------------------------------------------------------------------
+// Only receive the SDO replies (server to client) from the given node.
+//------------------------------------------------------------------------------
+int
+can_filter_sdo_set(int sock, uint8_t node)
+{
+    can_subscription_t sub;
+
+    if (node > CAN_SUB_NODE_MAX)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    bzero((void *)&sub, sizeof(sub));
+    sub.type    = CAN_SUB_NODES;
+    sub.fc_mask = CAN_SUB_FC(CANOPEN_FC_SDO_TX);
+    CAN_SUB_NODE_SET(&sub, node);
+
+    return can_filter_subscribe(sock, &sub, 1);
 }
 
 
@@ -92,9 +614,304 @@ int
 can_filter_clear(int sock)
 {
     struct can_filter rfilter[1];
+    int off = 0;
 
     rfilter[0].can_id   = 0x00;
     rfilter[0].can_mask = 0x00; // accept anything
 
+    setsockopt(sock, SOL_CAN_RAW, CAN_RAW_JOIN_FILTERS, &off, sizeof(off));
+
     return setsockopt(sock, SOL_CAN_RAW, CAN_RAW_FILTER, &rfilter, sizeof(rfilter));
 }
+
+//------------------------------------------------------------------------------
+// Keep the socket's current filter (and filter joining) in saved, to put it
+// back with can_filter_restore once a temporary filter is no longer needed.
+//------------------------------------------------------------------------------
+int
+can_filter_save(int sock, can_filter_saved_t *saved)
+{
+    socklen_t len = sizeof(saved->filters);
+
+    saved->n    = -1;
+    saved->join = 0;
+
+    if (getsockopt(sock, SOL_CAN_RAW, CAN_RAW_FILTER, saved->filters, &len) != 0)
+    {
+        return -1;
+    }
+
+    saved->n = len / sizeof(struct can_filter);
+
+    len = sizeof(saved->join);
+    if (getsockopt(sock, SOL_CAN_RAW, CAN_RAW_JOIN_FILTERS, &(saved->join), &len) != 0)
+    {
+        saved->join = 0; // kernel without CAN_RAW_JOIN_FILTERS support
+    }
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+// Put back a filter kept by can_filter_save. If it could not be read, the
+// socket receives everything again.
+//------------------------------------------------------------------------------
+int
+can_filter_restore(int sock, can_filter_saved_t *saved)
+{
+    if (saved->n < 0)
+    {
+        return can_filter_clear(sock);
+    }
+
+    setsockopt(sock, SOL_CAN_RAW, CAN_RAW_JOIN_FILTERS, &(saved->join), sizeof(saved->join));
+
+    return setsockopt(sock, SOL_CAN_RAW, CAN_RAW_FILTER, saved->n ? saved->filters : NULL,
+                      saved->n * sizeof(struct can_filter));
+}
+
+//==============================================================================
+// BROADCAST MANAGER
+//==============================================================================
+
+typedef struct _can_bcm_msg {
+    struct bcm_msg_head head;
+    struct can_frame    frames[CAN_BCM_SYNC_MAX];
+} can_bcm_msg_t;
+
+typedef struct _can_bcm_msg_fd {
+    struct bcm_msg_head head;
+    struct canfd_frame  frame;
+} can_bcm_msg_fd_t;
+
+//------------------------------------------------------------------------------
+// Convert a period in microseconds to a BCM timer value.
+//------------------------------------------------------------------------------
+static void
+can_bcm_timeval(struct bcm_timeval *tv, unsigned int us)
+{
+    tv->tv_sec  = us / 1000000;
+    tv->tv_usec = us % 1000000;
+}
+
+//------------------------------------------------------------------------------
+// Write a BCM operation for a single frame (classic or CAN FD). The frame
+// may be NULL for operations that only need the COB-ID.
+//------------------------------------------------------------------------------
+static int
+can_bcm_op(int bcm, uint32_t opcode, uint32_t flags, canid_t cob_id,
+           canopen_frame_t *frame, unsigned int ival1_us, unsigned int ival2_us)
+{
+    can_bcm_msg_fd_t msg;
+    int mtu = 0, len;
+
+    bzero((void *)&msg, sizeof(msg));
+
+    if (frame)
+    {
+        if ((mtu = canopen_frame_pack_mtu(frame, &msg.frame)) < 0)
+            return -1;
+
+        if (mtu == CANFD_MTU)
+            flags |= CAN_FD_FRAME;
+
+        msg.head.nframes = 1;
+    }
+
+    msg.head.opcode = opcode;
+    msg.head.flags  = flags;
+    msg.head.can_id = cob_id;
+    can_bcm_timeval(&msg.head.ival1, ival1_us);
+    can_bcm_timeval(&msg.head.ival2, ival2_us);
+
+    len = sizeof(struct bcm_msg_head) + mtu;
+
+    return write(bcm, &msg, len) == len ? 0 : -1;
+}
+
+//------------------------------------------------------------------------------
+// Open a broadcast manager socket on the given CAN interface.
+//------------------------------------------------------------------------------
+int
+can_bcm_open(char *interface)
+{
+    struct sockaddr_can addr;
+    struct ifreq ifr;
+    int bcm;
+
+    if ((bcm = socket(PF_CAN, SOCK_DGRAM, CAN_BCM)) < 0)
+    {
+        fprintf(stderr, "Error: Failed to create BCM socket.\n");
+        return -1;
+    }
+
+    bzero((void *)&ifr, sizeof(ifr));
+    strncpy(ifr.ifr_name, interface, IFNAMSIZ - 1);
+    if (ioctl(bcm, SIOCGIFINDEX, &ifr) < 0)
+    {
+        fprintf(stderr, "Error: Unknown CAN interface %s.\n", interface);
+        close(bcm);
+        return -1;
+    }
+
+    bzero((void *)&addr, sizeof(addr));
+    addr.can_family  = AF_CAN;
+    addr.can_ifindex = ifr.ifr_ifindex;
+
+    if (connect(bcm, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        fprintf(stderr, "Error: Failed to connect BCM socket.\n");
+        close(bcm);
+        return -1;
+    }
+
+    return bcm;
+}
+
+//------------------------------------------------------------------------------
+// Let the kernel send a SYNC every interval_us microseconds. With a
+// counter_overflow value of 2..240 the SYNC carries a counter that runs
+// from 1 to counter_overflow (the kernel cycles through one prepared frame
+// per counter value); 0 sends SYNC without data.
+//------------------------------------------------------------------------------
+int
+can_bcm_sync_start(int bcm, unsigned int interval_us, uint8_t counter_overflow)
+{
+    can_bcm_msg_t msg;
+    canopen_frame_t frame;
+    int i, n, len;
+
+    if (counter_overflow == 1 || counter_overflow > CAN_BCM_SYNC_MAX)
+        return -1;
+
+    n = counter_overflow ? counter_overflow : 1;
+
+    bzero((void *)&msg, sizeof(struct bcm_msg_head));
+    msg.head.opcode  = TX_SETUP;
+    msg.head.flags   = SETTIMER | STARTTIMER;
+    msg.head.can_id  = CANOPEN_FC_SYNC << 7;
+    msg.head.nframes = n;
+    can_bcm_timeval(&msg.head.ival2, interval_us);
+
+    canopen_frame_set_sync(&frame);
+
+    for (i = 0; i < n; i++)
+    {
+        if (counter_overflow)
+        {
+            frame.payload.data[0] = i + 1;
+            frame.data_len = 1;
+        }
+
+        if (canopen_frame_pack(&frame, &msg.frames[i]) != 0)
+            return -1;
+    }
+
+    len = sizeof(struct bcm_msg_head) + n * sizeof(struct can_frame);
+
+    return write(bcm, &msg, len) == len ? 0 : -1;
+}
+
+int
+can_bcm_sync_stop(int bcm)
+{
+    return can_bcm_op(bcm, TX_DELETE, 0, CANOPEN_FC_SYNC << 7, NULL, 0, 0);
+}
+
+//------------------------------------------------------------------------------
+// Let the kernel send a frame (e.g. an RPDO) every interval_us
+// microseconds, until can_bcm_cyclic_stop. Starting a job again for the
+// same COB-ID replaces it.
+//------------------------------------------------------------------------------
+int
+can_bcm_cyclic_start(int bcm, canopen_frame_t *frame, unsigned int interval_us)
+{
+    return can_bcm_op(bcm, TX_SETUP, SETTIMER | STARTTIMER,
+                      (frame->function_code << 7) | frame->id, frame, 0, interval_us);
+}
+
+//------------------------------------------------------------------------------
+// Change the data of a running cyclic job, without disturbing its timing:
+// the new data goes out with the next cycle.
+//------------------------------------------------------------------------------
+int
+can_bcm_cyclic_update(int bcm, canopen_frame_t *frame)
+{
+    return can_bcm_op(bcm, TX_SETUP, 0,
+                      (frame->function_code << 7) | frame->id, frame, 0, 0);
+}
+
+int
+can_bcm_cyclic_stop(int bcm, canopen_frame_t *frame)
+{
+    return can_bcm_op(bcm, TX_DELETE, 0,
+                      (frame->function_code << 7) | frame->id, NULL, 0, 0);
+}
+
+//------------------------------------------------------------------------------
+// Watch the frames with the COB-ID of *frame* (e.g. a TPDO) and only report
+// them when the data bits selected by mask (frame->data_len bytes, NULL:
+// all bits) or the length change, instead of every received copy. With a
+// timeout_us other than 0 a CAN_BCM_EVENT_TIMEOUT is reported when the
+// frame has not been received for that long.
+//------------------------------------------------------------------------------
+int
+can_bcm_watch_start(int bcm, canopen_frame_t *frame, uint8_t *mask, unsigned int timeout_us)
+{
+    canopen_frame_t filter;
+    uint32_t flags = RX_CHECK_DLC;
+
+    memcpy(&filter, frame, sizeof(canopen_frame_t));
+
+    if (mask)
+        memcpy(filter.payload.data, mask, filter.data_len);
+    else
+        memset(filter.payload.data, 0xFF, filter.data_len);
+
+    if (timeout_us)
+        flags |= SETTIMER | RX_ANNOUNCE_RESUME;
+
+    return can_bcm_op(bcm, RX_SETUP, flags,
+                      (frame->function_code << 7) | frame->id, &filter, timeout_us, 0);
+}
+
+int
+can_bcm_watch_stop(int bcm, canopen_frame_t *frame)
+{
+    return can_bcm_op(bcm, RX_DELETE, 0,
+                      (frame->function_code << 7) | frame->id, NULL, 0, 0);
+}
+
+//------------------------------------------------------------------------------
+// Read the next notification of a watched frame. *event* is set to
+// CAN_BCM_EVENT_CHANGED (and *frame* to the new content) or
+// CAN_BCM_EVENT_TIMEOUT (*frame* only carries the COB-ID). Returns 0 on
+// success, 1 on error.
+//------------------------------------------------------------------------------
+int
+can_bcm_recv(int bcm, canopen_frame_t *frame, uint32_t *event)
+{
+    can_bcm_msg_fd_t msg;
+    int nbytes;
+
+    nbytes = read(bcm, &msg, sizeof(msg));
+
+    if (nbytes < (int)sizeof(struct bcm_msg_head))
+        return 1;
+
+    *event = msg.head.opcode;
+
+    if (msg.head.opcode == RX_CHANGED && msg.head.nframes == 1)
+    {
+        if (msg.head.flags & CAN_FD_FRAME)
+            return canopen_frame_parse_fd(frame, &msg.frame) == 0 ? 0 : 1;
+
+        return canopen_frame_parse(frame, (struct can_frame *)&msg.frame) == 0 ? 0 : 1;
+    }
+
+    bzero((void *)frame, sizeof(canopen_frame_t));
+    frame->function_code = (msg.head.can_id >> 7) & 0xF;
+    frame->id            = msg.head.can_id & 0x7F;
+
+    return msg.head.opcode == RX_TIMEOUT ? 0 : 1;
+}
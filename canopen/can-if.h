@@ -25,15 +25,141 @@
  
 #include <linux/can.h>
 #include <linux/can/raw.h>
+#include <linux/can/bcm.h>
+#include <linux/can/error.h>
 
 #include <string.h>
 #include <stdint.h> 
 
+#include "canopen.h"
+
 int can_socket_open(char *interface);
 int can_socket_open_timeout(char *interface, unsigned int timeout_sec);
+int can_socket_open_fd(char *interface, unsigned int timeout_sec);
+int can_socket_is_fd(int socket);
 int can_socket_close(int socket);
 
+// kernel receive time stamps, delivered as ancillary data (see
+// canopen_frame_recv_meta)
+#define CAN_TIMESTAMP_NONE      0x0
+#define CAN_TIMESTAMP_SOFTWARE  0x1 // SO_TIMESTAMPNS
+#define CAN_TIMESTAMP_HARDWARE  0x2 // SO_TIMESTAMPING, software if the device has no clock
+
+int can_socket_timestamp_enable(int socket, int mode);
+
+//
+// Bus health: error frames (CAN_RAW_ERR_FILTER) and socket receive queue
+// drops (SO_RXQ_OVFL), accumulated per interface by can_if_stats_update
+// from the frames and meta data returned by canopen_frame_recv_meta.
+//
+#define CAN_IF_STATE_ACTIVE     0
+#define CAN_IF_STATE_WARNING    1
+#define CAN_IF_STATE_PASSIVE    2
+#define CAN_IF_STATE_BUS_OFF    3
+
+// events reported by can_if_stats_update
+#define CAN_IF_EVENT_ERROR      0x1 // an error frame was received
+#define CAN_IF_EVENT_STATE      0x2 // the controller error state changed
+#define CAN_IF_EVENT_DROPS      0x4 // the socket dropped frames
+
+typedef struct _can_if_stats {
+
+    uint64_t frames;            // data frames received
+    uint64_t error_frames;      // error frames received
+
+    uint64_t tx_timeout;
+    uint64_t arbitration_lost;
+    uint64_t controller;        // controller problems (see below)
+    uint64_t rx_overflow;       // controller receive buffer overflow
+    uint64_t tx_overflow;       // controller transmit buffer overflow
+    uint64_t protocol;          // protocol violations (bit, form, stuff errors)
+    uint64_t transceiver;
+    uint64_t ack;               // no ACK on transmission
+    uint64_t bus_off;
+    uint64_t bus_error;
+    uint64_t restarted;
+
+    uint64_t drops;             // frames dropped by the socket queue
+    uint32_t drops_last;        // last SO_RXQ_OVFL counter seen
+
+    uint8_t  state;             // CAN_IF_STATE_*
+    uint8_t  tx_err_count;      // controller error counters, if reported
+    uint8_t  rx_err_count;
+
+} can_if_stats_t;
+
+int can_socket_error_enable(int socket, can_err_mask_t err_mask);
+int can_if_stats_update(can_if_stats_t *stats, canopen_frame_t *frame, canopen_frame_meta_t *meta);
+const char *can_if_state_str(uint8_t state);
+
+//
+// Frame subscriptions, compiled into a minimal set of kernel CAN_RAW_FILTER
+// entries so that the socket is only woken up for frames of interest. Only
+// standard (11-bit) frames are matched.
+//
+#define CAN_COB_ID_COUNT    2048    // 11-bit standard frame identifiers
+
+#define CAN_SUB_COB_RANGE   0x01    // COB-IDs cob_id_min .. cob_id_max
+#define CAN_SUB_FUNCTION    0x02    // function codes in fc_mask, all nodes
+#define CAN_SUB_NODES       0x03    // function codes in fc_mask, nodes in node_mask
+
+typedef struct _can_subscription {
+    uint8_t  type;
+    uint16_t cob_id_min;
+    uint16_t cob_id_max;
+    uint16_t fc_mask;       // bit n selects function code n
+    uint32_t node_mask[4];  // bit n selects node id n (0..127)
+} can_subscription_t;
+
+#define CAN_SUB_NODE_MAX             0x7F
+
+#define CAN_SUB_FC(fc)               (1U << (fc))
+// node ids above CAN_SUB_NODE_MAX select nothing
+#define CAN_SUB_NODE_SET(sub, node)  ((sub)->node_mask[((node) >> 5) & 0x3] |= \
+                                      (unsigned)((unsigned)(node) <= CAN_SUB_NODE_MAX) << ((node) & 0x1F))
+
+// the kernel filter of a socket, to put back after a temporary change;
+// transports that filter frames themselves keep theirs as a bitmap
+typedef struct _can_filter_saved {
+    struct can_filter filters[CAN_RAW_FILTER_MAX];
+    int n;
+    int join;
+    uint32_t bitmap[CAN_COB_ID_COUNT / 32];   // standard COB-IDs received
+    int bitmap_eff;                           // extended frames received
+} can_filter_saved_t;
+
+int can_filter_compile(can_subscription_t *subs, int n_subs, 
+                       struct can_filter *filters, int max_filters,
+                       int allow_join, int *join);
+void can_filter_bitmap(can_subscription_t *subs, int n_subs, uint32_t *bitmap);
+int can_filter_subscribe(int socket, can_subscription_t *subs, int n_subs);
+
 int can_filter_node_set(int socket, uint8_t node);
+int can_filter_sdo_set(int socket, uint8_t node);
 int can_filter_clear(int socket);
+int can_filter_save(int socket, can_filter_saved_t *saved);
+int can_filter_restore(int socket, can_filter_saved_t *saved);
+
+//
+// Kernel broadcast manager (CAN_BCM): cyclic transmission timed by the
+// kernel (SYNC, periodic RPDOs) and content-change filtering of received
+// frames (TPDOs). Each cyclic job or receive filter is identified by its
+// COB-ID; one BCM socket can hold any number of them.
+//
+#define CAN_BCM_EVENT_CHANGED   RX_CHANGED  // watched frame changed content
+#define CAN_BCM_EVENT_TIMEOUT   RX_TIMEOUT  // watched frame stopped arriving
+
+int can_bcm_open(char *interface);
+
+int can_bcm_sync_start(int bcm, unsigned int interval_us, uint8_t counter_overflow);
+int can_bcm_sync_stop(int bcm);
+
+int can_bcm_cyclic_start(int bcm, canopen_frame_t *frame, unsigned int interval_us);
+int can_bcm_cyclic_update(int bcm, canopen_frame_t *frame);
+int can_bcm_cyclic_stop(int bcm, canopen_frame_t *frame);
+
+int can_bcm_watch_start(int bcm, canopen_frame_t *frame, uint8_t *mask, unsigned int timeout_us);
+int can_bcm_watch_stop(int bcm, canopen_frame_t *frame);
+int can_bcm_recv(int bcm, canopen_frame_t *frame, uint32_t *event);
 
 #endif /* _CAN_IF_H */
@@ -0,0 +1,305 @@
+//------------------------------------------------------------------------------
+// Copyright (C) 2012, Robert Johansson, Raditex AB
+// All rights reserved.
+//
+// This file is part of the rSCADA system.
+//
+// rSCADA
+// http://www.rSCADA.se
+// info@rscada.se
+//
+//------------------------------------------------------------------------------
+
+//
+// Inline frame builders: the NMT and SDO client frames of the
+// canopen_frame_set_* functions, written straight into the SocketCAN frame
+// to send, without a canopen_frame_t and canopen_frame_pack in between.
+//
+// Each builder takes a struct canfd_frame (a struct can_frame may be passed
+// for the classic CAN frames: only its CAN_MTU bytes are written) and
+// returns the number of bytes to send, CAN_MTU or CANFD_MTU.
+//
+
+#ifndef _CANOPEN_BUILD_H_
+#define _CANOPEN_BUILD_H_
+
+#include <linux/can.h>
+
+#include <string.h>
+#include <stdint.h>
+
+#include "canopen.h"
+#include "canopen-types.h"
+
+// batched frame I/O: one system call for up to CANOPEN_FRAME_BATCH_MAX frames
+#define CANOPEN_FRAME_BATCH_MAX 64
+
+//
+// A batch of frames to send: build each frame in the next slot, then add
+// it with the length returned by the builder.
+//
+typedef struct _canopen_frame_batch {
+
+    int                n;
+    int                mtu[CANOPEN_FRAME_BATCH_MAX];
+    struct canfd_frame cf[CANOPEN_FRAME_BATCH_MAX];
+
+} canopen_frame_batch_t;
+
+static inline struct canfd_frame *
+canopen_frame_batch_slot(canopen_frame_batch_t *batch)
+{
+    return &(batch->cf[batch->n]);
+}
+
+static inline void
+canopen_frame_batch_add(canopen_frame_batch_t *batch, int mtu)
+{
+    batch->mtu[batch->n++] = mtu;
+}
+
+static inline int
+canopen_frame_batch_full(const canopen_frame_batch_t *batch)
+{
+    return batch->n == CANOPEN_FRAME_BATCH_MAX;
+}
+
+//------------------------------------------------------------------------------
+// Frame header and payload
+//------------------------------------------------------------------------------
+
+// as canopen_frame_fd_len
+static inline uint8_t
+canopen_build_fd_len(uint8_t len)
+{
+    if (len <= 8)
+        return len;
+    if (len <= 24)
+        return (len + 3) & ~3;
+
+    return len <= 32 ? 32 : (len <= 48 ? 48 : 64);
+}
+
+static inline void
+canopen_build_header(struct canfd_frame *cf, uint8_t function_code, uint8_t node, uint8_t len)
+{
+    cf->can_id = (function_code << 7) | node;
+    cf->len    = len;
+    cf->flags  = 0;
+    cf->__res0 = 0;
+    cf->__res1 = 0;
+}
+
+// classic frame with an 8 byte payload, given as a little-endian integer
+static inline int
+canopen_build_frame8(struct canfd_frame *cf, uint8_t function_code, uint8_t node, uint64_t payload)
+{
+    canopen_build_header(cf, function_code, node, 8);
+    canopen_encode_u64(cf->data, payload);
+
+    return CAN_MTU;
+}
+
+// SDO command byte, index and subindex, as the low bytes of a payload
+static inline uint64_t
+canopen_build_sdo_mux(uint8_t command, uint16_t index, uint8_t subindex)
+{
+    return command | ((uint64_t)index << 8) | ((uint64_t)subindex << 24);
+}
+
+// command byte and len (0..63) data bytes, padded to a valid frame length
+static inline int
+canopen_build_segment(struct canfd_frame *cf, uint8_t node, uint8_t command, const uint8_t *data,
+                      uint8_t len)
+{
+    uint8_t data_len;
+
+    if (len > CANOPEN_SDO_SEG_MAX_FD)
+        len = CANOPEN_SDO_SEG_MAX_FD;
+
+    // segments with more than 7 bytes of data are sent as CAN FD frames
+    data_len = (len < CANOPEN_SDO_SEG_MAX) ? 8 : canopen_build_fd_len(len + 1);
+
+    canopen_build_header(cf, CANOPEN_FC_SDO_RX, node, data_len);
+
+    if (data_len == 8)
+        canopen_encode_u64(cf->data, 0);
+    else
+        memset(cf->data + len + 1, 0, data_len - len - 1);
+
+    cf->data[0] = command;
+    memcpy(cf->data + 1, data, len);
+
+    return data_len > CANOPEN_FRAME_DATA_LEN ? CANFD_MTU : CAN_MTU;
+}
+
+//------------------------------------------------------------------------------
+// NMT and SYNC
+//------------------------------------------------------------------------------
+
+static inline int
+canopen_build_nmt_mc(struct canfd_frame *cf, uint8_t cs, uint8_t node)
+{
+    canopen_build_header(cf, CANOPEN_FC_NMT_MC, 0, 2);
+    cf->data[0] = cs;
+    cf->data[1] = node;
+
+    return CAN_MTU;
+}
+
+static inline int
+canopen_build_nmt_ng(struct canfd_frame *cf, uint8_t node)
+{
+    canopen_build_header(cf, CANOPEN_FC_NMT_NG, node, 0);
+    cf->can_id |= CAN_RTR_FLAG;
+
+    return CAN_MTU;
+}
+
+static inline int
+canopen_build_sync(struct canfd_frame *cf)
+{
+    canopen_build_header(cf, CANOPEN_FC_SYNC, 0, 0);
+
+    return CAN_MTU;
+}
+
+//------------------------------------------------------------------------------
+// SDO client requests
+//------------------------------------------------------------------------------
+
+static inline int
+canopen_build_sdo_idu(struct canfd_frame *cf, uint8_t node, uint16_t index, uint8_t subindex)
+{
+    return canopen_build_frame8(cf, CANOPEN_FC_SDO_RX, node,
+                                canopen_build_sdo_mux(CANOPEN_SDO_CS_RX_IDU, index, subindex));
+}
+
+// expedited download of len (1..4) bytes
+static inline int
+canopen_build_sdo_idd(struct canfd_frame *cf, uint8_t node, uint16_t index, uint8_t subindex,
+                      uint32_t data, uint8_t len)
+{
+    uint8_t command = CANOPEN_SDO_CS_RX_IDD | CANOPEN_SDO_CS_ID_E_FLAG | CANOPEN_SDO_CS_ID_S_FLAG |
+                      (((4 - len) & 0x03) << CANOPEN_SDO_CS_ID_N_SHIFT);
+
+    return canopen_build_frame8(cf, CANOPEN_FC_SDO_RX, node,
+                                canopen_build_sdo_mux(command, index, subindex) | ((uint64_t)data << 32));
+}
+
+// segmented download initiate, size 0 if not indicated
+static inline int
+canopen_build_sdo_idd_seg(struct canfd_frame *cf, uint8_t node, uint16_t index, uint8_t subindex,
+                          uint32_t size)
+{
+    uint8_t command = CANOPEN_SDO_CS_RX_IDD | (size ? CANOPEN_SDO_CS_ID_S_FLAG : 0);
+
+    return canopen_build_frame8(cf, CANOPEN_FC_SDO_RX, node,
+                                canopen_build_sdo_mux(command, index, subindex) | ((uint64_t)size << 32));
+}
+
+static inline int
+canopen_build_sdo_uds(struct canfd_frame *cf, uint8_t node, uint16_t index, uint8_t subindex,
+                      uint8_t toggle)
+{
+    uint8_t command = CANOPEN_SDO_CS_RX_UDS | (toggle ? CANOPEN_SDO_CS_DS_T_FLAG : 0);
+
+    return canopen_build_frame8(cf, CANOPEN_FC_SDO_RX, node, canopen_build_sdo_mux(command, index, subindex));
+}
+
+// download segment, cont set on the last segment
+static inline int
+canopen_build_sdo_dds(struct canfd_frame *cf, uint8_t node, const uint8_t *data, uint8_t len,
+                      uint8_t toggle, uint8_t cont)
+{
+    uint8_t n, command;
+
+    if (len > CANOPEN_SDO_SEG_MAX_FD)
+        len = CANOPEN_SDO_SEG_MAX_FD;
+
+    n = (len < CANOPEN_SDO_SEG_MAX) ? CANOPEN_SDO_SEG_MAX - len : canopen_build_fd_len(len + 1) - 1 - len;
+
+    command = CANOPEN_SDO_CS_RX_DDS | ((n & 0x07) << CANOPEN_SDO_CS_DS_N_SHIFT) |
+              (toggle ? CANOPEN_SDO_CS_DS_T_FLAG : 0) | (cont ? CANOPEN_SDO_CS_DS_C_FLAG : 0);
+
+    return canopen_build_segment(cf, node, command, data, len);
+}
+
+// block download initiate, size 0 if not indicated, crc set if the client
+// supports the CRC
+static inline int
+canopen_build_sdo_ibd(struct canfd_frame *cf, uint8_t node, uint16_t index, uint8_t subindex,
+                      uint32_t size, uint8_t crc)
+{
+    uint8_t command = CANOPEN_SDO_CS_RX_BD | CANOPEN_SDO_CS_DB_CS_IBD | (size ? CANOPEN_SDO_CS_BD_S_FLAG : 0) |
+                      (crc ? CANOPEN_SDO_CS_BD_CRC_FLAG : 0);
+
+    return canopen_build_frame8(cf, CANOPEN_FC_SDO_RX, node,
+                                canopen_build_sdo_mux(command, index, subindex) | ((uint64_t)size << 32));
+}
+
+// end block download: n bytes of the last segment hold no data
+static inline int
+canopen_build_sdo_ebd(struct canfd_frame *cf, uint8_t node, uint8_t n, uint16_t crc)
+{
+    uint8_t command = CANOPEN_SDO_CS_RX_BD | CANOPEN_SDO_CS_DB_CS_EBD |
+                      ((n & CANOPEN_SDO_CS_DB_N_MASK) << CANOPEN_SDO_CS_DB_N_SHIFT);
+
+    return canopen_build_frame8(cf, CANOPEN_FC_SDO_RX, node, command | ((uint64_t)crc << 8));
+}
+
+// block download sub-block segment, cont set on the last segment of the
+// transfer
+static inline int
+canopen_build_sdo_bd(struct canfd_frame *cf, uint8_t node, const uint8_t *data, uint8_t len,
+                     uint8_t seqno, uint8_t cont)
+{
+    return canopen_build_segment(cf, node, seqno | (cont ? CANOPEN_SDO_CS_BD_C_FLAG : 0), data, len);
+}
+
+// abort the transfer of index/subindex with an abort code
+static inline int
+canopen_build_sdo_abort(struct canfd_frame *cf, uint8_t node, uint16_t index, uint8_t subindex,
+                        uint32_t abort_code)
+{
+    return canopen_build_frame8(cf, CANOPEN_FC_SDO_RX, node,
+                                canopen_build_sdo_mux(CANOPEN_SDO_CS_RX_ADT, index, subindex) |
+                                ((uint64_t)abort_code << 32));
+}
+
+// block upload initiate: sub-block size, protocol switch threshold (0: none)
+static inline int
+canopen_build_sdo_ibu(struct canfd_frame *cf, uint8_t node, uint16_t index, uint8_t subindex,
+                      uint8_t blksize, uint8_t pst, uint8_t crc)
+{
+    uint8_t command = CANOPEN_SDO_CS_RX_BU | CANOPEN_SDO_CS_BU_CS_IBU | (crc ? CANOPEN_SDO_CS_BD_CRC_FLAG : 0);
+
+    return canopen_build_frame8(cf, CANOPEN_FC_SDO_RX, node,
+                                canopen_build_sdo_mux(command, index, subindex) |
+                                ((uint64_t)blksize << 32) | ((uint64_t)pst << 40));
+}
+
+// block upload: start sending, after the initiate response
+static inline int
+canopen_build_sdo_bu_start(struct canfd_frame *cf, uint8_t node)
+{
+    return canopen_build_frame8(cf, CANOPEN_FC_SDO_RX, node, CANOPEN_SDO_CS_RX_BU | CANOPEN_SDO_CS_BU_CS_START);
+}
+
+// block upload: sub-block received up to segment ackseq, next sub-block size
+static inline int
+canopen_build_sdo_bu_ack(struct canfd_frame *cf, uint8_t node, uint8_t ackseq, uint8_t blksize)
+{
+    return canopen_build_frame8(cf, CANOPEN_FC_SDO_RX, node,
+                                (CANOPEN_SDO_CS_RX_BU | CANOPEN_SDO_CS_BU_CS_ACK) | (ackseq << 8) |
+                                ((uint64_t)blksize << 16));
+}
+
+// block upload: end response
+static inline int
+canopen_build_sdo_ebu(struct canfd_frame *cf, uint8_t node)
+{
+    return canopen_build_frame8(cf, CANOPEN_FC_SDO_RX, node, CANOPEN_SDO_CS_RX_BU | CANOPEN_SDO_CS_BU_CS_EBU);
+}
+
+#endif /* _CANOPEN_BUILD_H_ */
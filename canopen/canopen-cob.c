@@ -0,0 +1,291 @@
+//------------------------------------------------------------------------------
+// Copyright (C) 2012, Robert Johansson, Raditex AB
+// All rights reserved.
+//
+// This file is part of the rSCADA system.
+//
+// rSCADA
+// http://www.rSCADA.se
+// info@rscada.se
+//
+//------------------------------------------------------------------------------
+
+#include <canopen.h>
+#include <canopen-cob.h>
+
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+//==============================================================================
+// PREDEFINED CONNECTION SET
+//==============================================================================
+
+//
+// The table is generated by the preprocessor: COB_CLASS(c) gives the
+// entry of COB-ID c from its function code (bits 7-10) and node ID
+// (bits 0-6). Node ID 0 is classified by function code as well, except
+// for the broadcast services (NMT, SYNC, TIME) that live there.
+//
+#define COB_FC(c)   ((c) >> 7)
+#define COB_NODE(c) ((c) & 0x7F)
+
+#define COB_SERVICE(c)                                                          \
+    ((c) == 0x7E4 || (c) == 0x7E5         ? CANOPEN_SERVICE_LSS :              \
+     COB_FC(c) == CANOPEN_FC_NMT_MC       ? (COB_NODE(c) == 0 ? CANOPEN_SERVICE_NMT  : CANOPEN_SERVICE_UNKNOWN) : \
+     COB_FC(c) == CANOPEN_FC_SYNC         ? (COB_NODE(c) == 0 ? CANOPEN_SERVICE_SYNC : CANOPEN_SERVICE_EMCY)    : \
+     COB_FC(c) == CANOPEN_FC_TIMESTAMP    ? (COB_NODE(c) == 0 ? CANOPEN_SERVICE_TIME : CANOPEN_SERVICE_UNKNOWN) : \
+     COB_FC(c) >= CANOPEN_FC_PDO1_TX &&                                         \
+     COB_FC(c) <= CANOPEN_FC_PDO4_RX      ? CANOPEN_SERVICE_PDO :              \
+     COB_FC(c) == CANOPEN_FC_SDO_TX ||                                          \
+     COB_FC(c) == CANOPEN_FC_SDO_RX       ? CANOPEN_SERVICE_SDO :              \
+     COB_FC(c) == CANOPEN_FC_NMT_NG       ? CANOPEN_SERVICE_NMT_EC :           \
+                                            CANOPEN_SERVICE_UNKNOWN)
+
+// PDOs: odd function codes are transmitted by the node, even received
+#define COB_DIRECTION(c)                                                        \
+    ((c) == 0x7E4                         ? CANOPEN_COB_DIR_TX :               \
+     (c) == 0x7E5                         ? CANOPEN_COB_DIR_RX :               \
+     COB_SERVICE(c) == CANOPEN_SERVICE_EMCY   ||                                \
+     COB_SERVICE(c) == CANOPEN_SERVICE_NMT_EC ||                                \
+     COB_FC(c) == CANOPEN_FC_SDO_TX       ? CANOPEN_COB_DIR_TX :               \
+     COB_FC(c) == CANOPEN_FC_SDO_RX       ? CANOPEN_COB_DIR_RX :               \
+     COB_SERVICE(c) == CANOPEN_SERVICE_PDO                                      \
+                                          ? (COB_FC(c) & 1 ? CANOPEN_COB_DIR_TX : CANOPEN_COB_DIR_RX) : \
+                                            CANOPEN_COB_DIR_NONE)
+
+#define COB_NODE_ID(c)                                                          \
+    (COB_SERVICE(c) == CANOPEN_SERVICE_EMCY || COB_SERVICE(c) == CANOPEN_SERVICE_PDO || \
+     COB_SERVICE(c) == CANOPEN_SERVICE_SDO  || COB_SERVICE(c) == CANOPEN_SERVICE_NMT_EC ? COB_NODE(c) : 0)
+
+#define COB_SDO(c)  (COB_SERVICE(c) == CANOPEN_SERVICE_SDO ? 1 : 0)
+#define COB_PDO(c)  (COB_SERVICE(c) == CANOPEN_SERVICE_PDO ? (COB_FC(c) - 1) / 2 : 0)
+
+#define COB_CLASS(c) { COB_SERVICE(c), COB_DIRECTION(c), COB_NODE_ID(c), COB_SDO(c), COB_PDO(c) }
+
+#define COB_CLASS_16(c)                                                         \
+    COB_CLASS((c) + 0x0), COB_CLASS((c) + 0x1), COB_CLASS((c) + 0x2), COB_CLASS((c) + 0x3), \
+    COB_CLASS((c) + 0x4), COB_CLASS((c) + 0x5), COB_CLASS((c) + 0x6), COB_CLASS((c) + 0x7), \
+    COB_CLASS((c) + 0x8), COB_CLASS((c) + 0x9), COB_CLASS((c) + 0xA), COB_CLASS((c) + 0xB), \
+    COB_CLASS((c) + 0xC), COB_CLASS((c) + 0xD), COB_CLASS((c) + 0xE), COB_CLASS((c) + 0xF)
+
+#define COB_CLASS_256(c)                                                        \
+    COB_CLASS_16((c) + 0x00), COB_CLASS_16((c) + 0x10), COB_CLASS_16((c) + 0x20), COB_CLASS_16((c) + 0x30), \
+    COB_CLASS_16((c) + 0x40), COB_CLASS_16((c) + 0x50), COB_CLASS_16((c) + 0x60), COB_CLASS_16((c) + 0x70), \
+    COB_CLASS_16((c) + 0x80), COB_CLASS_16((c) + 0x90), COB_CLASS_16((c) + 0xA0), COB_CLASS_16((c) + 0xB0), \
+    COB_CLASS_16((c) + 0xC0), COB_CLASS_16((c) + 0xD0), COB_CLASS_16((c) + 0xE0), COB_CLASS_16((c) + 0xF0)
+
+const canopen_cob_class_t canopen_cob_table[CAN_COB_ID_COUNT] = {
+    COB_CLASS_256(0x000), COB_CLASS_256(0x100), COB_CLASS_256(0x200), COB_CLASS_256(0x300),
+    COB_CLASS_256(0x400), COB_CLASS_256(0x500), COB_CLASS_256(0x600), COB_CLASS_256(0x700)
+};
+
+static const char *canopen_cob_service_names[] = {
+    "UNKNOWN", "NMT", "SYNC", "EMCY", "TIME", "PDO", "SDO", "NMT EC", "LSS"
+};
+
+//------------------------------------------------------------------------------
+//SF
+//SF .. c:function:: const char *canopen_cob_service_str(uint8_t service)
+//SF
+//SF     Name of a CANOPEN_SERVICE_* constant.
+//SF
+//------------------------------------------------------------------------------
+const char *
+canopen_cob_service_str(uint8_t service)
+{
+    if (service >= sizeof(canopen_cob_service_names) / sizeof(canopen_cob_service_names[0]))
+        return canopen_cob_service_names[CANOPEN_SERVICE_UNKNOWN];
+
+    return canopen_cob_service_names[service];
+}
+
+//==============================================================================
+// RUNTIME COB-ID MAP
+//==============================================================================
+
+//------------------------------------------------------------------------------
+//SF
+//SF .. c:function:: canopen_cob_map_t *canopen_cob_map_new()
+//SF
+//SF     Allocate a COB-ID map, initialized with the predefined connection
+//SF     set. Pass it to canopen_cob_classify after updating it with the
+//SF     COB-IDs configured on the nodes.
+//SF
+//------------------------------------------------------------------------------
+canopen_cob_map_t *
+canopen_cob_map_new()
+{
+    canopen_cob_map_t *map;
+
+    if ((map = (canopen_cob_map_t *)malloc(sizeof(canopen_cob_map_t))) == NULL)
+    {
+        fprintf(stderr, "%s: failed to allocate COB-ID map\n", __PRETTY_FUNCTION__);
+        return NULL;
+    }
+
+    canopen_cob_map_reset(map);
+
+    return map;
+}
+
+void
+canopen_cob_map_free(canopen_cob_map_t *map)
+{
+    free(map);
+}
+
+// back to the predefined connection set
+void
+canopen_cob_map_reset(canopen_cob_map_t *map)
+{
+    memcpy(map->cls, canopen_cob_table, sizeof(map->cls));
+}
+
+//------------------------------------------------------------------------------
+//SF
+//SF .. c:function:: int canopen_cob_map_set(canopen_cob_map_t *map, uint16_t cob_id, const canopen_cob_class_t *cls)
+//SF
+//SF     Classify *cob_id* as *cls*, or as unknown if *cls* is NULL (for a
+//SF     predefined COB-ID that a node no longer uses). Returns 0, or -1 if
+//SF     the COB-ID is not an 11-bit identifier.
+//SF
+//------------------------------------------------------------------------------
+int
+canopen_cob_map_set(canopen_cob_map_t *map, uint16_t cob_id, const canopen_cob_class_t *cls)
+{
+    if (map == NULL || cob_id >= CAN_COB_ID_COUNT)
+    {
+        return -1;
+    }
+
+    if (cls)
+        map->cls[cob_id] = *cls;
+    else
+        bzero((void *)&(map->cls[cob_id]), sizeof(canopen_cob_class_t));
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+// COB-ID entries of the communication parameter objects: bit 31 set means
+// the PDO/SDO is not valid, bit 29 a 29-bit identifier.
+//------------------------------------------------------------------------------
+#define COB_VALUE_INVALID   0x80000000U
+#define COB_VALUE_EXTENDED  0x20000000U
+
+//------------------------------------------------------------------------------
+// Forget the COB-ID a PDO or SDO had so far (predefined or configured):
+// once it is moved, frames with the old COB-ID are no longer its frames.
+//------------------------------------------------------------------------------
+static void
+canopen_cob_map_unset(canopen_cob_map_t *map, const canopen_cob_class_t *cls)
+{
+    canopen_cob_class_t *c;
+    int i;
+
+    for (i = 0; i < CAN_COB_ID_COUNT; i++)
+    {
+        c = &(map->cls[i]);
+
+        if (c->service == cls->service && c->direction == cls->direction && c->node == cls->node &&
+            c->sdo == cls->sdo && c->pdo == cls->pdo)
+        {
+            bzero((void *)c, sizeof(canopen_cob_class_t));
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+//SF
+//SF .. c:function:: int canopen_cob_map_pdo_param(canopen_cob_map_t *map, uint8_t node, uint16_t index, uint32_t cob_value)
+//SF
+//SF     Update the map with the COB-ID entry (subindex 1) of a PDO
+//SF     communication parameter object read from *node*: 0x1400-0x15FF for
+//SF     RPDOs, 0x1800-0x19FF for TPDOs. The COB-ID the PDO had before is
+//SF     classified as unknown; an invalid PDO gets no new one.
+//SF
+//SF     Returns 0 on success, -1 on error (unknown object, or a 29-bit
+//SF     identifier, which the map does not cover).
+//SF
+//------------------------------------------------------------------------------
+int
+canopen_cob_map_pdo_param(canopen_cob_map_t *map, uint8_t node, uint16_t index, uint32_t cob_value)
+{
+    canopen_cob_class_t cls;
+
+    if (map == NULL)
+        return -1;
+
+    bzero((void *)&cls, sizeof(cls));
+    cls.service = CANOPEN_SERVICE_PDO;
+    cls.node    = node;
+
+    if (index >= 0x1400 && index <= 0x15FF)
+    {
+        cls.direction = CANOPEN_COB_DIR_RX;
+        cls.pdo       = index - 0x1400 + 1;
+    }
+    else if (index >= 0x1800 && index <= 0x19FF)
+    {
+        cls.direction = CANOPEN_COB_DIR_TX;
+        cls.pdo       = index - 0x1800 + 1;
+    }
+    else
+    {
+        return -1;
+    }
+
+    canopen_cob_map_unset(map, &cls);
+
+    if (cob_value & COB_VALUE_INVALID)
+        return 0;
+
+    if (cob_value & COB_VALUE_EXTENDED)
+        return -1;
+
+    return canopen_cob_map_set(map, cob_value & CAN_SFF_MASK, &cls);
+}
+
+//------------------------------------------------------------------------------
+//SF
+//SF .. c:function:: int canopen_cob_map_sdo_param(canopen_cob_map_t *map, uint8_t node, uint16_t index, uint8_t subindex, uint32_t cob_value)
+//SF
+//SF     Update the map with a COB-ID entry of an SDO server parameter
+//SF     object (0x1200-0x127F) read from *node*: subindex 1 is client to
+//SF     server, subindex 2 server to client. As for PDOs, the COB-ID the
+//SF     entry had before is classified as unknown, and an invalid entry
+//SF     gets no new one.
+//SF
+//SF     Returns 0 on success, -1 on error.
+//SF
+//------------------------------------------------------------------------------
+int
+canopen_cob_map_sdo_param(canopen_cob_map_t *map, uint8_t node, uint16_t index, uint8_t subindex,
+                          uint32_t cob_value)
+{
+    canopen_cob_class_t cls;
+
+    if (map == NULL || index < 0x1200 || index > 0x127F || (subindex != 1 && subindex != 2))
+    {
+        return -1;
+    }
+
+    bzero((void *)&cls, sizeof(cls));
+    cls.service   = CANOPEN_SERVICE_SDO;
+    cls.direction = subindex == 1 ? CANOPEN_COB_DIR_RX : CANOPEN_COB_DIR_TX;
+    cls.node      = node;
+    cls.sdo       = index - 0x1200 + 1;
+
+    canopen_cob_map_unset(map, &cls);
+
+    if (cob_value & COB_VALUE_INVALID)
+        return 0;
+
+    if (cob_value & COB_VALUE_EXTENDED)
+        return -1;
+
+    return canopen_cob_map_set(map, cob_value & CAN_SFF_MASK, &cls);
+}
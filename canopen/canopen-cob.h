@@ -0,0 +1,84 @@
+//------------------------------------------------------------------------------
+// Copyright (C) 2012, Robert Johansson, Raditex AB
+// All rights reserved.
+//
+// This file is part of the rSCADA system.
+//
+// rSCADA
+// http://www.rSCADA.se
+// info@rscada.se
+//
+//------------------------------------------------------------------------------
+
+//
+// CANopen COB-ID classification: a table that maps each 11-bit COB-ID to
+// the service it carries, so that a frame is classified with one load.
+// The constant table holds the CiA 301 predefined connection set; a
+// COB-ID map is a copy of it that follows the PDO and SDO COB-IDs
+// configured on the nodes (objects 0x1200, 0x1400 and 0x1800).
+//
+
+#ifndef _CANOPEN_COB_H_
+#define _CANOPEN_COB_H_
+
+#include <stdint.h>
+
+#include "canopen.h"
+#include "can-if.h"
+
+// services
+#define CANOPEN_SERVICE_UNKNOWN 0
+#define CANOPEN_SERVICE_NMT     1   // NMT module control
+#define CANOPEN_SERVICE_SYNC    2
+#define CANOPEN_SERVICE_EMCY    3
+#define CANOPEN_SERVICE_TIME    4
+#define CANOPEN_SERVICE_PDO     5
+#define CANOPEN_SERVICE_SDO     6
+#define CANOPEN_SERVICE_NMT_EC  7   // NMT error control: heartbeat, node guarding
+#define CANOPEN_SERVICE_LSS     8
+
+// direction, seen from the node
+#define CANOPEN_COB_DIR_NONE    0   // broadcast by the master or a producer
+#define CANOPEN_COB_DIR_TX      1   // sent by the node: TPDO, SDO response, EMCY, ...
+#define CANOPEN_COB_DIR_RX      2   // received by the node: RPDO, SDO request, ...
+
+typedef struct _canopen_cob_class {
+
+    uint8_t  service;   // CANOPEN_SERVICE_*
+    uint8_t  direction; // CANOPEN_COB_DIR_*
+    uint8_t  node;      // node ID, 0 for broadcast services
+    uint8_t  sdo;       // SDO channel, 1 for the default SDO, 0 if not an SDO
+    uint16_t pdo;       // PDO number (1..512), 0 if not a PDO
+
+} canopen_cob_class_t;
+
+typedef struct _canopen_cob_map {
+
+    canopen_cob_class_t cls[CAN_COB_ID_COUNT];
+
+} canopen_cob_map_t;
+
+extern const canopen_cob_class_t canopen_cob_table[CAN_COB_ID_COUNT];
+
+//
+// Classify a COB-ID with map, or with the predefined connection set if
+// map is NULL.
+//
+static inline const canopen_cob_class_t *
+canopen_cob_classify(const canopen_cob_map_t *map, uint16_t cob_id)
+{
+    return map ? &(map->cls[cob_id & CAN_SFF_MASK]) : &(canopen_cob_table[cob_id & CAN_SFF_MASK]);
+}
+
+canopen_cob_map_t *canopen_cob_map_new();
+void               canopen_cob_map_free(canopen_cob_map_t *map);
+void               canopen_cob_map_reset(canopen_cob_map_t *map);
+
+int canopen_cob_map_set(canopen_cob_map_t *map, uint16_t cob_id, const canopen_cob_class_t *cls);
+int canopen_cob_map_pdo_param(canopen_cob_map_t *map, uint8_t node, uint16_t index, uint32_t cob_value);
+int canopen_cob_map_sdo_param(canopen_cob_map_t *map, uint8_t node, uint16_t index, uint8_t subindex,
+                              uint32_t cob_value);
+
+const char *canopen_cob_service_str(uint8_t service);
+
+#endif /* _CANOPEN_COB_H_ */
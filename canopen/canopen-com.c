@@ -10,41 +10,89 @@
 //
 //------------------------------------------------------------------------------
 
+#define _GNU_SOURCE // recvmmsg/sendmmsg
+
 #include <canopen.h> 
 #include <canopen-com.h> 
+#include <can-if.h> 
+#include <canopen-transport.h>
+#include <canopen-view.h>
+#include <canopen-sdo.h>
+#include <canopen-types.h>
 
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/ioctl.h>
 #include <net/if.h>
+#include <poll.h>
+#include <time.h>
 #include <unistd.h>
  
 #include <linux/can.h>
 #include <linux/can/raw.h>
+#include <linux/errqueue.h>
 
 #include <string.h>
 #include <stdint.h> 
 #include <stdio.h> 
+#include <errno.h> 
 
 static int canopen_com_debug = 0;
 
+// per thread, so that threads running SDO transfers on their own sockets
+// do not see each other's settings and results
+static __thread unsigned int canopen_sdo_timeout_ms = CANOPEN_SDO_TIMEOUT_MS;
+static __thread canopen_sdo_result_t canopen_sdo_last_result;
+
+//------------------------------------------------------------------------------
+// Pack a CANopen frame as a classic CAN frame, or as a CAN FD frame if the
+// payload does not fit in 8 bytes. Returns the number of bytes to write
+// (CAN_MTU or CANFD_MTU), or -1 on error.
+//------------------------------------------------------------------------------
+int
+canopen_frame_pack_mtu(canopen_frame_t *canopen_frame, struct canfd_frame *canfd_frame)
+{
+    if (canopen_frame->data_len > CANOPEN_FRAME_DATA_LEN || 
+        (canopen_frame->fd & CANOPEN_FD_FLAG_FDF))
+    {
+        return canopen_frame_pack_fd(canopen_frame, canfd_frame) == 0 ? (int)CANFD_MTU : -1;
+    }
+
+    return canopen_frame_pack(canopen_frame, (struct can_frame *)canfd_frame) == 0 ? (int)CAN_MTU : -1;
+}
+
+//------------------------------------------------------------------------------
+// Parse a received classic CAN frame or CAN FD frame (told apart by the
+// number of bytes read, as the two structs share the same layout).
+//------------------------------------------------------------------------------
+int
+canopen_frame_parse_mtu(canopen_frame_t *canopen_frame, struct canfd_frame *canfd_frame, int nbytes)
+{
+    if (nbytes == CANFD_MTU)
+    {
+        return canopen_frame_parse_fd(canopen_frame, canfd_frame);
+    }
+
+    return canopen_frame_parse(canopen_frame, (struct can_frame *)canfd_frame);
+}
+
 //------------------------------------------------------------------------------
 //
 //------------------------------------------------------------------------------
 int
 canopen_frame_send(int sock, canopen_frame_t *canopen_frame)
 {
-    int nbytes;
-    struct can_frame can_frame;
+    int nbytes, mtu;
+    struct canfd_frame can_frame;
 
-    if (canopen_frame_pack(canopen_frame, &can_frame) != 0)
+    if ((mtu = canopen_frame_pack_mtu(canopen_frame, &can_frame)) < 0)
     {
         fprintf(stderr, "CANopen failed to parse frame\n");
         return 1;
     }
 
     // send the frame to the CAN bus
-    nbytes = write(sock, &can_frame, sizeof(can_frame));
+    nbytes = write(sock, &can_frame, mtu);
 
     if (nbytes < 0)
     {
@@ -52,7 +100,7 @@ canopen_frame_send(int sock, canopen_frame_t *canopen_frame)
         return 1;
     }
 
-    if (nbytes < (int)sizeof(struct can_frame))
+    if (nbytes < mtu)
     {
         fprintf(stderr, "write: incomplete CAN frame\n");
         return 1;
@@ -68,11 +116,11 @@ int
 canopen_frame_recv(int sock, canopen_frame_t *canopen_frame)
 {
     int nbytes;
-    struct can_frame can_frame;
+    struct canfd_frame can_frame;
 
     // set filters for our node?
 
-    nbytes = read(sock, &can_frame, sizeof(struct can_frame));
+    nbytes = read(sock, &can_frame, sizeof(struct canfd_frame));
 
     if (nbytes < 0)
     {
@@ -80,13 +128,13 @@ canopen_frame_recv(int sock, canopen_frame_t *canopen_frame)
         return 1;
     }
 
-    if (nbytes < (int)sizeof(struct can_frame))
+    if (nbytes != CAN_MTU && nbytes != CANFD_MTU)
     {
         fprintf(stderr, "read: incomplete CAN frame\n");
         return 1;
     }
 
-    if (canopen_frame_parse(canopen_frame, &can_frame) != 0)
+    if (canopen_frame_parse_mtu(canopen_frame, &can_frame, nbytes) != 0)
     {
         fprintf(stderr, "CANopen failed to parse frame\n");
     }
@@ -94,631 +142,722 @@ canopen_frame_recv(int sock, canopen_frame_t *canopen_frame)
     return 0;
 }
 
-//==============================================================================
-// EXPEDIATED TRANSFERS
-//==============================================================================
+//------------------------------------------------------------------------------
+// Extract the receive meta data (time stamps, drop count) from the
+// ancillary data of a received message.
+//------------------------------------------------------------------------------
+static void
+canopen_frame_meta_parse(struct msghdr *msg, canopen_frame_meta_t *meta)
+{
+    struct cmsghdr *cmsg;
+
+    bzero((void *)meta, sizeof(canopen_frame_meta_t));
+
+    for (cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg))
+    {
+        if (cmsg->cmsg_level != SOL_SOCKET)
+            continue;
+
+        if (cmsg->cmsg_type == SO_RXQ_OVFL)
+        {
+            memcpy((void *)&(meta->drops), CMSG_DATA(cmsg), sizeof(uint32_t));
+        }
+        else if (cmsg->cmsg_type == SCM_TIMESTAMPNS)
+        {
+            memcpy((void *)&(meta->ts), CMSG_DATA(cmsg), sizeof(struct timespec));
+        }
+        else if (cmsg->cmsg_type == SCM_TIMESTAMPING)
+        {
+            struct scm_timestamping tss;
+
+            memcpy((void *)&tss, CMSG_DATA(cmsg), sizeof(tss));
+
+            // ts[2] is the raw hardware time stamp, ts[0] the software one
+            if (tss.ts[2].tv_sec || tss.ts[2].tv_nsec)
+            {
+                meta->ts    = tss.ts[2];
+                meta->ts_hw = 1;
+            }
+            else
+            {
+                meta->ts    = tss.ts[0];
+            }
+        }
+    }
+}
 
 //------------------------------------------------------------------------------
-//
+// Receive one frame with recvmsg, and its meta data if meta is not NULL.
 //------------------------------------------------------------------------------
-int 
-canopen_sdo_upload_exp(int sock, uint8_t node, uint16_t index, 
-                                 uint8_t subindex, uint32_t *data)
+static int
+canopen_frame_recvmsg(int sock, canopen_frame_t *canopen_frame, canopen_frame_meta_t *meta, int flags)
 {
-    int frame_count = 0;
-    canopen_frame_t canopen_frame;
+    int nbytes;
+    struct canfd_frame can_frame;
+    struct iovec iov;
+    struct msghdr msg;
+    uint64_t ctrl[CANOPEN_FRAME_CMSG_SIZE / sizeof(uint64_t)]; // cmsg aligned
 
-    if (canopen_com_debug)
-        printf("DEBUG: Send SDO EXP UPLOAD from Node=0x%.2X Index=0x%.4X SubIndex=0x%.2X\n", node, index, subindex);
+    iov.iov_base = &can_frame;
+    iov.iov_len  = sizeof(struct canfd_frame);
 
-    canopen_frame_set_sdo_idu(&canopen_frame, node, index, subindex);
+    bzero((void *)&msg, sizeof(msg));
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = ctrl;
+    msg.msg_controllen = sizeof(ctrl);
 
-    if (canopen_frame_send(sock, &canopen_frame) != 0)
+    nbytes = recvmsg(sock, &msg, flags);
+
+    if (nbytes < 0)
     {
+        //perror("recvmsg: can raw socket read");
         return 1;
     }
 
-    if (can_filter_node_set(sock, node) < 0)
+    if (nbytes != CAN_MTU && nbytes != CANFD_MTU)
     {
-        printf("%s: Error, failed to set CAN filters\n", __PRETTY_FUNCTION__);
+        fprintf(stderr, "read: incomplete CAN frame\n");
+        return 1;
     }
 
-    while (frame_count < 100) // still needed?
+    if (canopen_frame_parse_mtu(canopen_frame, &can_frame, nbytes) != 0)
     {
-        if (canopen_frame_recv(sock, &canopen_frame) != 0)
-        {
-            return 1;
-        }
+        fprintf(stderr, "CANopen failed to parse frame\n");
+    }
 
-        if (canopen_frame.id == node && canopen_frame.function_code == CANOPEN_FC_SDO_TX)
-        {
-            switch (canopen_frame.payload.sdo.command & CANOPEN_SDO_CS_MASK)
-            {
-                case CANOPEN_SDO_CS_TX_IDU:
-                {
-                    int s = canopen_sdo_get_size(&(canopen_frame.payload.sdo));
-         
-                    // matching our node id and we got a SDO TX: process package   
-                    if (canopen_com_debug)
-                        printf("REPLY [%d] (%d): 0x%.2X 0x%.2X 0x%.2X 0x%.2X -> %.8x\n", 
-                               frame_count, s, canopen_frame.payload.sdo.data[0], canopen_frame.payload.sdo.data[1],
-                               canopen_frame.payload.sdo.data[2], canopen_frame.payload.sdo.data[3],
-			       canopen_decode_uint((uint8_t *)&(canopen_frame.payload.sdo.data), s));
-
-                    *data = canopen_decode_uint((uint8_t *)&(canopen_frame.payload.sdo.data), s);
-                    return 0;
-                }
-                case CANOPEN_SDO_CS_TX_UDS:
-                    fprintf(stderr, "SDO read error: Fallback to %s protocol\n",
-                                    CANOPEN_SDO_CS_UDS_STR);
-                    return 1;
-                case CANOPEN_SDO_CS_TX_ADT:
-                    fprintf(stderr, "SDO read error: %s [%s]\n",
-                                    CANOPEN_SDO_CS_ADT_STR, 
-                                    canopen_sdo_abort_code_lookup(&(canopen_frame.payload.sdo)));
-                    return 1;
-                default:
-                    if (canopen_com_debug)
-                        printf("[unknown cs] ");
-            }           
-        }
-        // else: not our frame, read a new one
-        frame_count++;
+    if (meta)
+    {
+        canopen_frame_meta_parse(&msg, meta);
     }
 
-    return 1;
+    return 0;
 }
 
-
+//------------------------------------------------------------------------------
+//SF 
+//SF .. c:function:: int canopen_frame_recv_meta(int sock, canopen_frame_t *canopen_frame, canopen_frame_meta_t *meta)
+//SF    
+//SF     Same as canopen_frame_recv, but also fill in the receive meta data
+//SF     (kernel time stamp) for the frame.
+//SF 
+//------------------------------------------------------------------------------
+int
+canopen_frame_recv_meta(int sock, canopen_frame_t *canopen_frame, canopen_frame_meta_t *meta)
+{
+    return canopen_frame_recvmsg(sock, canopen_frame, meta, 0);
+}
 
 //------------------------------------------------------------------------------
-//
+//SF 
+//SF .. c:function:: int canopen_frame_recv_timeout(int sock, canopen_frame_t *canopen_frame, canopen_frame_meta_t *meta, int timeout_ms)
+//SF    
+//SF     Wait at most *timeout_ms* milliseconds for a frame (with poll, so
+//SF     the SO_RCVTIMEO of the socket does not apply) and read it without
+//SF     blocking. *meta* may be NULL.
+//SF 
+//SF     Returns 0 on success, 1 on error or timeout (errno is EAGAIN).
+//SF 
 //------------------------------------------------------------------------------
 int
-canopen_sdo_download_exp(int sock, uint8_t node,     uint16_t index, 
-                                   uint8_t subindex, uint32_t data, uint16_t len)
+canopen_frame_recv_timeout(int sock, canopen_frame_t *canopen_frame, 
+                           canopen_frame_meta_t *meta, int timeout_ms)
 {
-    int frame_count = 0;
-    canopen_frame_t canopen_frame;
+    struct pollfd pfd;
+    int ret;
 
-    canopen_frame_set_sdo_idd(&canopen_frame, node, index, subindex, data, len);
+    pfd.fd      = sock;
+    pfd.events  = POLLIN;
+    pfd.revents = 0;
 
-    if (canopen_frame_send(sock, &canopen_frame) != 0)
+    while ((ret = poll(&pfd, 1, timeout_ms)) < 0 && errno == EINTR)
+        ;
+
+    if (ret < 0)
+        return 1;
+
+    if (ret == 0)
     {
+        errno = EAGAIN;
         return 1;
     }
 
-    if (can_filter_node_set(sock, node) < 0)
+    return canopen_frame_recvmsg(sock, canopen_frame, meta, MSG_DONTWAIT);
+}
+
+//------------------------------------------------------------------------------
+//SF 
+//SF .. c:function:: int canopen_frame_send_batch(int sock, canopen_frame_t *frames, int n)
+//SF    
+//SF     Pack and send up to *n* CANopen frames using as few system calls as
+//SF     possible (one sendmmsg per CANOPEN_FRAME_BATCH_MAX frames).
+//SF 
+//SF     Returns the number of frames that was sent, or -1 if no frame could
+//SF     be sent (errno is set by the failing system call).
+//SF 
+//------------------------------------------------------------------------------
+int
+canopen_frame_send_batch(int sock, canopen_frame_t *frames, int n)
+{
+    struct canfd_frame can_frames[CANOPEN_FRAME_BATCH_MAX];
+    int                mtu[CANOPEN_FRAME_BATCH_MAX];
+    int i, count, sent = 0, nsent;
+
+    if (frames == NULL || n < 0)
     {
-        printf("%s: Error, failed to set CAN filters\n", __PRETTY_FUNCTION__);
-    }    
+        return -1;
+    }
 
-    while (frame_count < 1000)
+    while (sent < n)
     {
-        if (canopen_frame_recv(sock, &canopen_frame) != 0)
+        count = n - sent;
+        if (count > CANOPEN_FRAME_BATCH_MAX)
+            count = CANOPEN_FRAME_BATCH_MAX;
+
+        for (i = 0; i < count; i++)
         {
-            return 1;
+            if ((mtu[i] = canopen_frame_pack_mtu(&frames[sent + i], &can_frames[i])) < 0)
+            {
+                fprintf(stderr, "CANopen failed to pack frame\n");
+                return sent ? sent : -1;
+            }
         }
 
-        if (canopen_frame.id == node && canopen_frame.function_code == CANOPEN_FC_SDO_TX)
-        {   
-            if (canopen_com_debug)
-                printf("DEBUG: GOT REPLY [%d]\n", frame_count);
-
-            return 0;
+        if ((nsent = canopen_frame_send_raw(sock, can_frames, mtu, count)) < 0)
+        {
+            return sent ? sent : -1;
         }
 
-        frame_count++;
+        sent += nsent;
+
+        if (nsent < count)
+        {
+            // the socket queue is full (ENOBUFS), let the caller retry
+            break;
+        }
     }
 
-    return 1;
+    return sent;
 }
 
+//------------------------------------------------------------------------------
+//SF 
+//SF .. c:function:: int canopen_frame_send_raw(int sock, struct canfd_frame *can_frames, const int *mtu, int n)
+//SF    
+//SF     Send *n* frames that are already in SocketCAN format (see
+//SF     canopen-build.h), *mtu[i]* bytes (CAN_MTU or CANFD_MTU) of
+//SF     *can_frames[i]*, with one sendmmsg per CANOPEN_FRAME_BATCH_MAX frames.
+//SF 
+//SF     Returns the number of frames that was sent, or -1 as for
+//SF     canopen_frame_send_batch.
+//SF 
+//------------------------------------------------------------------------------
+int
+canopen_frame_send_raw(int sock, struct canfd_frame *can_frames, const int *mtu, int n)
+{
+    struct iovec       iov[CANOPEN_FRAME_BATCH_MAX];
+    struct mmsghdr     msgs[CANOPEN_FRAME_BATCH_MAX];
+    int i, count, sent = 0, nmsgs;
 
-//==============================================================================
-// SEGMENTED
-//==============================================================================
+    if (can_frames == NULL || mtu == NULL || n < 0)
+    {
+        return -1;
+    }
+
+    while (sent < n)
+    {
+        count = n - sent;
+        if (count > CANOPEN_FRAME_BATCH_MAX)
+            count = CANOPEN_FRAME_BATCH_MAX;
+
+        bzero((void *)msgs, count * sizeof(struct mmsghdr));
+
+        for (i = 0; i < count; i++)
+        {
+            iov[i].iov_base = &can_frames[sent + i];
+            iov[i].iov_len  = mtu[sent + i];
+            msgs[i].msg_hdr.msg_iov    = &iov[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        if ((nmsgs = sendmmsg(sock, msgs, count, 0)) < 0)
+        {
+            //perror("sendmmsg: CAN raw socket write failed");
+            return sent ? sent : -1;
+        }
+
+        sent += nmsgs;
+
+        if (nmsgs < count)
+        {
+            // the socket queue is full (ENOBUFS), let the caller retry
+            break;
+        }
+    }
+
+    return sent;
+}
 
 //------------------------------------------------------------------------------
-//
+//SF 
+//SF .. c:function:: int canopen_frame_recv_batch(int sock, canopen_frame_t *frames, int n)
+//SF    
+//SF     Receive and parse up to *n* CANopen frames with a single recvmmsg
+//SF     system call. The call blocks (subject to the socket timeout) until
+//SF     at least one frame is available, and then drains whatever else is
+//SF     already queued on the socket without blocking again.
+//SF 
+//SF     Returns the number of frames that was received, or -1 on error
+//SF     (errno is set by recvmmsg, EAGAIN on timeout).
+//SF 
 //------------------------------------------------------------------------------
 int
-canopen_sdo_upload_seg(int sock, uint8_t node,  uint16_t index, uint8_t subindex,
-                                 uint8_t *data, uint16_t data_len)
+canopen_frame_recv_batch(int sock, canopen_frame_t *frames, int n)
 {
-    int frame_count = 0, n = 0, sdo_data_len = 0, toggle = 0, offset = 0;
-    canopen_frame_t canopen_frame;
-
-    if (canopen_com_debug)
-        printf("DEBUG: Send SEG SDO UPLOAD request to Node=0x%.2X Index=0x%.4X SubIndex=0x%.2X\n", node, index, subindex);
+    return canopen_frame_recv_batch_meta(sock, frames, NULL, n);
+}
 
-    canopen_frame_set_sdo_idu(&canopen_frame, node, index, subindex);
+//------------------------------------------------------------------------------
+//SF 
+//SF .. c:function:: int canopen_frame_recv_batch_meta(int sock, canopen_frame_t *frames, canopen_frame_meta_t *meta, int n)
+//SF    
+//SF     Same as canopen_frame_recv_batch, but also fill in the receive meta
+//SF     data for each frame in the *meta* array (which must be at least as
+//SF     long as *frames*). *meta* may be NULL.
+//SF 
+//------------------------------------------------------------------------------
+int
+canopen_frame_recv_batch_meta(int sock, canopen_frame_t *frames, 
+                              canopen_frame_meta_t *meta, int n)
+{
+    struct canfd_frame   can_frames[CANOPEN_FRAME_BATCH_MAX];
+    canopen_frame_view_t views[CANOPEN_FRAME_BATCH_MAX];
+    int i, nviews, count = 0;
 
-    if (canopen_frame_send(sock, &canopen_frame) != 0)
+    if (frames == NULL || n <= 0)
     {
         return -1;
     }
 
-    if (can_filter_node_set(sock, node) < 0)
+    if ((nviews = canopen_frame_recv_batch_raw(sock, can_frames, views, meta, n)) < 0)
     {
-        printf("%s: Error, failed to set CAN filters\n", __PRETTY_FUNCTION__);
-    }   
+        return -1;
+    }
 
-    while (frame_count < 1000)
+    for (i = 0; i < nviews; i++)
     {
-        if (canopen_frame_recv(sock, &canopen_frame) != 0)
+        if (canopen_frame_view_parse(&views[i], &frames[count]) != 0)
         {
-            return -1;
+            fprintf(stderr, "CANopen failed to parse frame\n");
+            continue;
         }
 
-        if (canopen_frame.id == node && canopen_frame.function_code == CANOPEN_FC_SDO_TX)
+        if (meta && count != i)
         {
-            switch (canopen_frame.payload.sdo.command & CANOPEN_SDO_CS_MASK)
-            {
-                case CANOPEN_SDO_CS_TX_IDU:
-                {
-                    if (canopen_frame.payload.sdo.command & CANOPEN_SDO_CS_ID_E_FLAG)
-                    {
-                        // expediated reply
-                        int s = canopen_sdo_get_size(&(canopen_frame.payload.sdo));
-         
-                        if (canopen_com_debug)
-                            printf("IDU EXP [%d] (%d): 0x%.2X 0x%.2X 0x%.2X 0x%.2X \n", 
-                                   n, s, canopen_frame.payload.sdo.data[0], canopen_frame.payload.sdo.data[1],
-                                         canopen_frame.payload.sdo.data[2], canopen_frame.payload.sdo.data[3]);
-
-                        for (n = 0; n < s && n < data_len; n++)
-                            data[n] = canopen_frame.payload.sdo.data[n];
-                       
-                        return n;
-                    }
-                    else
-                    {
-                        sdo_data_len = canopen_frame.payload.sdo.data[0];
-                        // segmented IDU
-
-                        if (canopen_com_debug)
-                           printf("IDU SEG [%d] (%d): 0x%.2X 0x%.2X 0x%.2X 0x%.2X \n", 
-                                  n, sdo_data_len,
-                                  canopen_frame.payload.sdo.data[0],
-                                  canopen_frame.payload.sdo.data[1],
-                                  canopen_frame.payload.sdo.data[2],
-                                  canopen_frame.payload.sdo.data[3]);
-
-                        toggle = 0;
-                        canopen_frame_set_sdo_uds(&canopen_frame, node, index, subindex, toggle);
-
-                        if (canopen_frame_send(sock, &canopen_frame) != 0)
-                        {
-                            return -1;
-                        }
-
-
-                    }
-                    break;
-                }
-                case CANOPEN_SDO_CS_TX_UDS:
-                {
-                    int s = (canopen_frame.payload.sdo.command & CANOPEN_SDO_CS_DS_N_MASK) >> CANOPEN_SDO_CS_DS_N_SHIFT;
-    
-                    if (canopen_com_debug)
-                        printf("UDS [%d : %d] [%s]: 0x%.2X 0x%.2X 0x%.2X 0x%.2X 0x%.2X 0x%.2X 0x%.2X 0x%.2X \n", 
-                               n, s, (canopen_frame.payload.sdo.command & CANOPEN_SDO_CS_DS_C_FLAG) ? "LAST" : "CONT",
-                               canopen_frame.payload.sdo.data[0], canopen_frame.payload.sdo.data[1],
-                               canopen_frame.payload.sdo.data[2], canopen_frame.payload.sdo.data[3],
-                               canopen_frame.payload.sdo.data[4], canopen_frame.payload.sdo.data[5],
-                               canopen_frame.payload.sdo.data[6], canopen_frame.payload.sdo.data[7]);
-
-                    for (n = 1; n < (8-s) && offset < data_len; n++)
-                        data[offset++] = canopen_frame.payload.data[n];
-
-                    if (!(canopen_frame.payload.sdo.command & CANOPEN_SDO_CS_DS_C_FLAG))
-                    {
-                        toggle = ~toggle;
-                        canopen_frame_set_sdo_uds(&canopen_frame, node, index, subindex, toggle);
-
-                        if (canopen_frame_send(sock, &canopen_frame) != 0)
-                        {
-                            return -1;
-                        }
-                    }
-                    else
-                    {
-                        // we finished
-                        return offset;
-                    }
-
-                    break;
-                }
-                case CANOPEN_SDO_CS_TX_ADT:
-                {
-                    fprintf(stderr, "SDO read error: %s [%s]\n",
-                                    CANOPEN_SDO_CS_ADT_STR, 
-                                    canopen_sdo_abort_code_lookup(&(canopen_frame.payload.sdo)));
-                    return -1;
-                }
-                default:
-                    if (canopen_com_debug)
-                        printf("[unknown cs = 0x%.2X]\n", canopen_frame.payload.sdo.command);
-            }           
+            meta[count] = meta[i];
         }
-        // else: not our frame, read a new one
-        frame_count++;
+
+        count++;
     }
 
-    return 1;
+    return count;
 }
 
-
-
 //------------------------------------------------------------------------------
-//
+//SF 
+//SF .. c:function:: int canopen_frame_recv_batch_raw(int sock, struct canfd_frame *can_frames, canopen_frame_view_t *views, canopen_frame_meta_t *meta, int n)
+//SF    
+//SF     Receive up to *n* frames into *can_frames* with a single recvmmsg
+//SF     system call, without parsing them: *views[i]* is set up over each
+//SF     complete frame (see canopen-view.h) and stays valid as long as
+//SF     *can_frames* is not reused. *meta* may be NULL.
+//SF 
+//SF     Returns the number of views, or -1 on error (errno as for
+//SF     canopen_frame_recv_batch).
+//SF 
 //------------------------------------------------------------------------------
 int
-canopen_sdo_download_seg(int sock, uint8_t node, uint16_t index, uint8_t subindex,
-                                   uint8_t *data, uint16_t data_len)
+canopen_frame_recv_batch_raw(int sock, struct canfd_frame *can_frames, 
+                             canopen_frame_view_t *views, canopen_frame_meta_t *meta, int n)
 {
-    int frame_count = 0;
-    int toggle = 0, offset = 0, remaining = data_len;
-    canopen_frame_t canopen_frame;
+    struct iovec       iov[CANOPEN_FRAME_BATCH_MAX];
+    struct mmsghdr     msgs[CANOPEN_FRAME_BATCH_MAX];
+    uint64_t           ctrl[CANOPEN_FRAME_BATCH_MAX][CANOPEN_FRAME_CMSG_SIZE / sizeof(uint64_t)];
+    int i, nmsgs, count = 0;
 
-    if (canopen_com_debug)
-        printf("DEBUG: Send SEG SDO DOWNLOAD request to Node=0x%.2X Index=0x%.4X SubIndex=0x%.2X\n", node, index, subindex);
+    if (can_frames == NULL || views == NULL || n <= 0)
+    {
+        return -1;
+    }
 
-    canopen_frame_set_sdo_idd_seg(&canopen_frame, node, index, subindex, data_len);
+    if (n > CANOPEN_FRAME_BATCH_MAX)
+        n = CANOPEN_FRAME_BATCH_MAX;
 
-    if (canopen_frame_send(sock, &canopen_frame) != 0)
+    bzero((void *)msgs, n * sizeof(struct mmsghdr));
+
+    for (i = 0; i < n; i++)
     {
-        return 1;
+        iov[i].iov_base = &can_frames[i];
+        iov[i].iov_len  = sizeof(struct canfd_frame);
+        msgs[i].msg_hdr.msg_iov    = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+
+        if (meta)
+        {
+            msgs[i].msg_hdr.msg_control    = ctrl[i];
+            msgs[i].msg_hdr.msg_controllen = sizeof(ctrl[i]);
+        }
     }
 
-    if (can_filter_node_set(sock, node) < 0)
+    if ((nmsgs = recvmmsg(sock, msgs, n, MSG_WAITFORONE, NULL)) < 0)
     {
-        printf("%s: Error, failed to set CAN filters\n", __PRETTY_FUNCTION__);
-    }       
+        //perror("recvmmsg: can raw socket read");
+        return -1;
+    }
 
-    while (frame_count < 1000)
+    for (i = 0; i < nmsgs; i++)
     {
-        if (canopen_frame_recv(sock, &canopen_frame) != 0)
+        if (msgs[i].msg_len != CAN_MTU && msgs[i].msg_len != CANFD_MTU)
         {
-            return 1;
+            fprintf(stderr, "read: incomplete CAN frame\n");
+            continue;
         }
 
-        if (canopen_frame.id == node && canopen_frame.function_code == CANOPEN_FC_SDO_TX)
+        canopen_frame_view_init(&views[count], &can_frames[i], msgs[i].msg_len);
+
+        if (meta)
         {
-            switch (canopen_frame.payload.sdo.command & CANOPEN_SDO_CS_MASK)
-            {
-                case CANOPEN_SDO_CS_TX_IDD:
-                    // check toogle in incoming frame ?
-                    if (canopen_com_debug)
-                        printf("DEBUG: IDD reply\n");
-                    toggle = 0;
-                case CANOPEN_SDO_CS_TX_DDS:
-                {
-                    int i, n, c;
-
-                    if (remaining == 0)
-                    {
-                        // we finished
-                        return 0;
-                    }
-
-                    if (remaining <= 7)
-                    {
-                        n = remaining;
-                        c = 1; // last frame
-                    }
-                    else
-                    {
-                        n = 7;
-                        c = 0; // more frames to follow
-                    }
-                
-                    canopen_frame_set_sdo_dds(&canopen_frame, node, &data[offset], n, toggle, c);
-
-
-                    if (canopen_frame_send(sock, &canopen_frame) != 0)
-                    {
-                        return 1;
-                    }
-
-                    if (canopen_com_debug)
-                    {
-                        printf("DEBUG: DDS [%d : %d : %d] [%s]: ", 
-                               data_len, n, remaining, 
-                               (canopen_frame.payload.sdo.command & CANOPEN_SDO_CS_DS_C_FLAG) ? "LAST" : "CONT");
-    
-                        for (i = 0; i < n; i++)
-                            printf("0x%.2X ", data[offset + i]);
-    
-                        printf("\n");
-                    }
-
-                    offset    += n;
-                    remaining -= n;
-                    toggle = ~toggle;
-
-                    break;
-                }
-                case CANOPEN_SDO_CS_TX_ADT:
-                {
-                    fprintf(stderr, "SDO read error: %s [%s]\n",
-                                    CANOPEN_SDO_CS_ADT_STR, 
-                                    canopen_sdo_abort_code_lookup(&(canopen_frame.payload.sdo)));
-                    return 1;
-                }
-                default:
-                    if (canopen_com_debug)
-                        printf("[unknown cs = 0x%.2X]\n", canopen_frame.payload.sdo.command);
-            }           
+            canopen_frame_meta_parse(&msgs[i].msg_hdr, &meta[count]);
         }
-        // else: not our frame, read a new one
-        frame_count++;
+
+        count++;
     }
 
-    return 1;
+    return count;
+}
+
+//------------------------------------------------------------------------------
+//SF
+//SF .. c:function:: void canopen_sdo_timeout_set(unsigned int timeout_ms)
+//SF
+//SF     Set how long the SDO routines on a plain socket, called from this
+//SF     thread, wait for each response of the SDO server (default
+//SF     CANOPEN_SDO_TIMEOUT_MS). For a transport, set its sdo_timeout_ms
+//SF     field instead.
+//SF
+//------------------------------------------------------------------------------
+void
+canopen_sdo_timeout_set(unsigned int timeout_ms)
+{
+    canopen_sdo_timeout_ms = timeout_ms;
 }
 
+//------------------------------------------------------------------------------
+// Run one transfer to its end on tp: the SDO routines below are the state
+// machines of canopen-sdo.c, fed from the transport until done. The
+// outcome is left in tp->sdo_result. Returns 0, or -1 on error.
+//------------------------------------------------------------------------------
+static int
+canopen_sdo_run(canopen_transport_t *tp, canopen_sdo_transfer_t *xfer, uint8_t type, uint8_t node,
+                uint16_t index, uint8_t subindex, uint8_t *data, uint32_t data_len)
+{
+    canopen_sdo_client_t client;
+    can_filter_saved_t filter;
+    int saved;
+
+    if (canopen_com_debug)
+        printf("DEBUG: SDO transfer %d with Node=0x%.2X Index=0x%.4X SubIndex=0x%.2X [Size=%d]\n",
+               type, node, index, subindex, data_len);
+
+    canopen_sdo_client_init(&client, tp);
+
+    // only the server's replies during the transfer, then the caller's
+    // filter again (other frames are skipped by the client anyway, so a
+    // filter that cannot be kept is left alone)
+    if ((saved = (canopen_transport_filter_save(tp, &filter) == 0)) &&
+        canopen_transport_filter_sdo(tp, node) < 0)
+    {
+        printf("%s: Error, failed to set CAN filters\n", __PRETTY_FUNCTION__);
+    }
+
+    if (canopen_sdo_client_start(&client, xfer, type, node, index, subindex, data, data_len, NULL, NULL) == 0)
+    {
+        canopen_sdo_client_run(&client);
+    }
+
+    if (saved)
+        canopen_transport_filter_restore(tp, &filter);
+
+    tp->sdo_result = xfer->result;
+
+    return xfer->result.status == CANOPEN_SDO_OK ? 0 : -1;
+}
 
 //==============================================================================
-// BLOCK TRANSFERS
+// EXPEDIATED TRANSFERS
 //==============================================================================
 
+//------------------------------------------------------------------------------
+//
+//------------------------------------------------------------------------------
+int 
+canopen_sdo_upload_exp_tp(canopen_transport_t *tp, uint8_t node, uint16_t index, 
+                                 uint8_t subindex, uint32_t *data)
+{
+    canopen_sdo_transfer_t xfer;
+    uint8_t buf[4];
+
+    if (canopen_sdo_run(tp, &xfer, CANOPEN_SDO_UPLOAD_EXP, node, index, subindex, buf, sizeof(buf)) != 0)
+    {
+        return 1;
+    }
+
+    *data = canopen_decode_uint(buf, xfer.size);
+    return 0;
+}
+
 //------------------------------------------------------------------------------
 //
 //------------------------------------------------------------------------------
 int
-canopen_sdo_upload_block(int sock, uint8_t node,  uint16_t index, uint8_t subindex,
-                                   uint8_t *data, uint32_t data_len)
+canopen_sdo_download_exp_tp(canopen_transport_t *tp, uint8_t node,     uint16_t index, 
+                                   uint8_t subindex, uint32_t data, uint16_t len)
 {
-    return -1;
+    canopen_sdo_transfer_t xfer;
+    uint8_t buf[4];
+
+    canopen_encode_u32(buf, data);
+
+    return canopen_sdo_run(tp, &xfer, CANOPEN_SDO_DOWNLOAD_EXP, node, index, subindex, buf,
+                           len > 4 ? 4 : len) == 0 ? 0 : 1;
 }
 
+//==============================================================================
+// SEGMENTED
+//==============================================================================
+
+//------------------------------------------------------------------------------
+// Returns the number of bytes uploaded, or -1 on error.
+//------------------------------------------------------------------------------
+int
+canopen_sdo_upload_seg_tp(canopen_transport_t *tp, uint8_t node,  uint16_t index, uint8_t subindex,
+                                 uint8_t *data, uint16_t data_len)
+{
+    canopen_sdo_transfer_t xfer;
+
+    if (canopen_sdo_run(tp, &xfer, CANOPEN_SDO_UPLOAD_SEG, node, index, subindex, data, data_len) != 0)
+    {
+        return -1;
+    }
+
+    return xfer.size;
+}
 
 //------------------------------------------------------------------------------
 //
 //------------------------------------------------------------------------------
 int
-canopen_sdo_download_block(int sock, uint8_t node, uint16_t index, uint8_t subindex,
-                                   uint8_t *data, uint32_t data_len)
+canopen_sdo_download_seg_tp(canopen_transport_t *tp, uint8_t node, uint16_t index, uint8_t subindex,
+                                   uint8_t *data, uint16_t data_len)
 {
-    int frame_count = 0;
-    uint32_t offset = 0, remaining = data_len;
-    int use_crc = 0, len = 0, cont, ack_seq; 
-    int blk_size, blk_size_new, seq_no, seq_count = 0, blk_count = 0;
-    uint8_t excess_bytes; 
+    canopen_sdo_transfer_t xfer;
 
-    canopen_frame_t canopen_frame;
+    return canopen_sdo_run(tp, &xfer, CANOPEN_SDO_DOWNLOAD_SEG, node, index, subindex, data, data_len) == 0 ? 0 : 1;
+}
 
-    if (canopen_com_debug)
-        printf("DEBUG: SDO BLOCK DOWNLOAD request to Node=0x%.2X Index=0x%.4X SubIndex=0x%.2X [Size=%d]\n",
-                node, index, subindex, data_len);
+//==============================================================================
+// BLOCK TRANSFERS
+//==============================================================================
 
-    canopen_frame_set_sdo_ibd(&canopen_frame, node, index, subindex, data_len);
+//------------------------------------------------------------------------------
+// Block upload, with tp->sdo_block_size segments per sub-block and the
+// protocol switch threshold tp->sdo_block_pst (the server may then answer
+// with an expedited or segmented upload). Returns the number of bytes
+// uploaded, or -1 on error.
+//------------------------------------------------------------------------------
+int
+canopen_sdo_upload_block_tp(canopen_transport_t *tp, uint8_t node,  uint16_t index, uint8_t subindex,
+                                   uint8_t *data, uint32_t data_len)
+{
+    canopen_sdo_transfer_t xfer;
 
-    if (canopen_frame_send(sock, &canopen_frame) != 0)
+    if (canopen_sdo_run(tp, &xfer, CANOPEN_SDO_UPLOAD_BLOCK, node, index, subindex, data, data_len) != 0)
     {
-        return 1;
+        return -1;
     }
 
-    if (can_filter_node_set(sock, node) < 0)
-    {
-        printf("%s: Error, failed to set CAN filters\n", __PRETTY_FUNCTION__);
-    }   
+    return xfer.size;
+}
 
-    while (frame_count < 1000)
-    {
-        if (canopen_frame_recv(sock, &canopen_frame) != 0)
-        {
-            return 1;
-        }
+//------------------------------------------------------------------------------
+//
+//------------------------------------------------------------------------------
+int
+canopen_sdo_download_block_tp(canopen_transport_t *tp, uint8_t node, uint16_t index, uint8_t subindex,
+                                   uint8_t *data, uint32_t data_len)
+{
+    canopen_sdo_transfer_t xfer;
 
-        if (canopen_frame.id == node && canopen_frame.function_code == CANOPEN_FC_SDO_TX)
-        {
-            frame_count = 0;
-            switch (canopen_frame.payload.sdo.command & (CANOPEN_SDO_CS_MASK|CANOPEN_SDO_CS_DB_SS_MASK))
-            {
-                case CANOPEN_SDO_CS_TX_BD|CANOPEN_SDO_CS_DB_SS_IBD_ACK:
-                {
-                    // we got an ack for a block download initiate
-                    use_crc  = (canopen_frame.payload.sdo.command & CANOPEN_SDO_CS_BD_CRC_FLAG) ? 1 : 0;
-                    blk_size = canopen_frame.payload.sdo.data[0];
-                    if (canopen_com_debug)
-                        printf("DEBUG: IBD reply [CRC = %d, block size = %d]\n", use_crc, blk_size);
-
-                    //
-                    // recalculate block size if we dont have enough data to 
-                    // fill all blocks
-                    //
-                    /* dont worry about this
-                    if (blk_size * 7 - remaining > 7)
-                    {
-                        // we can't fill all the blocks
-                        blk_size_new = (int)(remaining / 7.0);
-    
-                        if (canopen_com_debug)
-                            printf("DEBUG: IBD reassinged block size = %d from %d [len = %d < %d]\n",
-                                   blk_size_new, blk_size, remaining, blk_size_new * 7);
-
-                        blk_size = blk_size_new;
-                    }
-                    */
-
-                    //
-                    // send all segments in block no 1
-                    //
-                    for (seq_no = 1; seq_no <= blk_size; seq_no++)
-                    {
-                        //len  = (remaining > 7)          ? 7 : remaining;
-                        //cont = remaining == 0 ? 1 : 0; //cont = (seq_no == blk_size) ? 1 : 0; 
-                        cont = 0;
-                        if (remaining > 7)
-                        {
-                            len = 7;
-                        }
-                        else
-                        {
-                            len = remaining;
-                            cont = 1;
-                            excess_bytes = 7 - remaining;
-                        }
-
-                        canopen_frame_set_sdo_bd(&canopen_frame, node, &data[offset], len, seq_no, cont);
-
-                        if (canopen_com_debug)
-                            printf("DEBUG: BD download [seq_no = %d, blk_size = %d, remaining = %d, offset = %d, cont = %d]\n",
-                                   seq_no, blk_size, remaining, offset, cont);
-
-                        if (canopen_frame_send(sock, &canopen_frame) != 0)
-                            return 1;
-
-                        remaining -= len;
-                        offset    += len;
-
-                        seq_count++;
-                    }
-
-                    blk_count++;
-
-                    break;
-                }
-                case CANOPEN_SDO_CS_TX_BD|CANOPEN_SDO_CS_DB_SS_BD_ACK:
-                {
-                    // we got an ack for a block
-
-                    ack_seq      = canopen_frame.payload.data[1];
-                    blk_size_new = canopen_frame.payload.data[2];
-
-                    if (canopen_com_debug)
-                        printf("DEBUG: BD reply [ack seq = %d, block size = %d]\n", ack_seq, blk_size_new);
-
-                    if (ack_seq != blk_size)
-                    {
-                        // not all segments was delivered properly, must resend
-                        // seqments with seq_no > ack_seq
-                        if (canopen_com_debug)
-                           printf("DEBUG: Warning: Must resend segments with seq_no > %d [%d bytes]\n",
-                                  ack_seq, 7 * (blk_size - ack_seq));
-
-
-                        // rewind the appropriate amount
-                        remaining += 7 * (blk_size - ack_seq); // XXX: might be wrong in the last seg ?
-                        offset    -= 7 * (blk_size - ack_seq); // XXX: might be wrong in the last seg ?
-
-                        // XXX: should the resent data be included in next block
-                        // or should be resend part of the previous block ?!?
-    
-                        // assume that we can let the data to be resent be included
-                        // in the next block...
-                    }
-                    
-                    // move on to next block (possibly with rewinded data offsets)
-                    blk_size = blk_size_new;
-
-                    //
-                    // if we have no data left, send the end of block download command
-                    //
-                    if (remaining <= 0)
-                    {
-                         uint16_t crc = 0;
-
-                        //excess_bytes = blk_count * 7 - data_len;
-
-                        if (use_crc)
-                            crc = 0x0000; // canopen_sdo_block_crc(data, data_len);
-    
-                        if (canopen_com_debug)
-                           printf("DEBUG: remaining = %d: sending EBD: blk_count = %d, seq_count = %d, "
-                                  "offset = %d, data_len = %d: excess = %d, crc = 0x%.4X\n",
-                                  remaining, blk_count, seq_count, offset, data_len, excess_bytes, crc);
-
-                        canopen_frame_set_sdo_ebd(&canopen_frame, node, excess_bytes, crc);
-
-                        if (canopen_frame_send(sock, &canopen_frame) != 0)
-                            return 1;
-
-                        break;
-                    }
-
-                    //
-                    // recalculate block size if we dont have enough data to 
-                    // fill all blocks
-                    //
-                    if ((signed long)blk_size * 7 - (signed long)remaining > 7)
-                    {
-                        printf("DEBUG: Alert: requiring BD reassinged block size = %d from %d [len = %d < %d] ??\n",
-                               blk_size_new, blk_size, remaining, blk_size_new * 7);
-
-                        // we can't fill all the blocks
-                        //blk_size_new = (int)(remaining / 7.0);
-    
-                        //if (canopen_com_debug)
-                        //    printf("DEBUG: BD reassinged block size = %d from %d [len = %d < %d]\n",
-                        //           blk_size_new, blk_size, remaining, blk_size_new * 7);
-
-                        //blk_size = blk_size_new;
-                    }
-
-                    //
-                    // send all segments in block
-                    //
-                    for (seq_no = 1; seq_no <= blk_size; seq_no++)
-                    {
-                        //len  = (remaining > 7)      ? 7 : remaining;
-                        //cont =  ? 1 : 0; //seq_no 0; //cont = (seq_no == blk_size) ? 1 : 0; 
-                        cont = 0;
-                        if (remaining > 7)
-                        {
-                            len = 7;
-                        }
-                        else
-                        {
-                            len = remaining;
-                            cont = 1;
-                            excess_bytes = 7 - remaining;
-                        }
-
-                        canopen_frame_set_sdo_bd(&canopen_frame, node, &data[offset], len, seq_no, cont);
-
-                        if (canopen_com_debug)
-                            printf("DEBUG: BD download [seq_no = %d, blk_size = %d, remaining = %d, offset = %d, cont = %d]\n",
-                                   seq_no, blk_size, remaining, offset, cont);
-
-                        if (canopen_frame_send(sock, &canopen_frame) != 0)
-                            return 1;
-
-                        remaining -= len;
-                        offset    += len;
-                        seq_count++;
-                    }
-                    blk_count++;
-
-                    break;
-                }
-                case CANOPEN_SDO_CS_TX_BD|CANOPEN_SDO_CS_DB_SS_BD_END:
-                {
-                    if (canopen_com_debug)
-                        printf("DEBUG: EDB ack received. Finished.\n");
-
-                    return 0;
-                }
-                case CANOPEN_SDO_CS_TX_ADT:
-                {
-                    fprintf(stderr, "SDO read error: %s [%s]\n",
-                                    CANOPEN_SDO_CS_ADT_STR, 
-                                    canopen_sdo_abort_code_lookup(&(canopen_frame.payload.sdo)));
-                    return 1;
-                }
-                default:
-                    if (canopen_com_debug)
-                        printf("[unknown cs = 0x%.2X]\n", canopen_frame.payload.sdo.command);
-            }           
-        }
-        // else: not our frame, read a new one
-        frame_count++;
-    }
+    return canopen_sdo_run(tp, &xfer, CANOPEN_SDO_DOWNLOAD_BLOCK, node, index, subindex, data, data_len) == 0 ? 0 : 1;
+}
+
+//==============================================================================
+// SOCKETCAN ENTRY POINTS
+//==============================================================================
+
+//------------------------------------------------------------------------------
+//SF
+//SF .. c:function:: const canopen_sdo_result_t *canopen_sdo_result_last()
+//SF
+//SF     The outcome of the last SDO transfer on a plain socket (see below)
+//SF     made by the calling thread: timeout, abort (with the abort code) or
+//SF     protocol error. The _r variants of the routines return it through
+//SF     their *result* argument instead, and the transport based routines
+//SF     leave it in the transport's sdo_result.
+//SF
+//------------------------------------------------------------------------------
+const canopen_sdo_result_t *
+canopen_sdo_result_last()
+{
+    return &canopen_sdo_last_result;
+}
+
+//------------------------------------------------------------------------------
+// The SDO routines on a plain SocketCAN socket: run the transport based
+// engines above on a socket transport. The outcome is stored in *result
+// (if not NULL).
+//------------------------------------------------------------------------------
+int 
+canopen_sdo_upload_exp_r(int sock, uint8_t node, uint16_t index, uint8_t subindex,
+                         uint32_t *data, canopen_sdo_result_t *result)
+{
+    canopen_transport_t tp;
+    int ret;
+
+    canopen_transport_socket_init(&tp, sock);
+    tp.sdo_timeout_ms = canopen_sdo_timeout_ms;
+    ret = canopen_sdo_upload_exp_tp(&tp, node, index, subindex, data);
+    if (result)
+        *result = tp.sdo_result;
+    return ret;
+}
+
+int
+canopen_sdo_download_exp_r(int sock, uint8_t node, uint16_t index, uint8_t subindex,
+                           uint32_t data, uint16_t len, canopen_sdo_result_t *result)
+{
+    canopen_transport_t tp;
+    int ret;
+
+    canopen_transport_socket_init(&tp, sock);
+    tp.sdo_timeout_ms = canopen_sdo_timeout_ms;
+    ret = canopen_sdo_download_exp_tp(&tp, node, index, subindex, data, len);
+    if (result)
+        *result = tp.sdo_result;
+    return ret;
+}
+
+int
+canopen_sdo_upload_seg_r(int sock, uint8_t node, uint16_t index, uint8_t subindex,
+                         uint8_t *data, uint16_t data_len, canopen_sdo_result_t *result)
+{
+    canopen_transport_t tp;
+    int ret;
+
+    canopen_transport_socket_init(&tp, sock);
+    tp.sdo_timeout_ms = canopen_sdo_timeout_ms;
+    ret = canopen_sdo_upload_seg_tp(&tp, node, index, subindex, data, data_len);
+    if (result)
+        *result = tp.sdo_result;
+    return ret;
+}
+
+int
+canopen_sdo_download_seg_r(int sock, uint8_t node, uint16_t index, uint8_t subindex,
+                           uint8_t *data, uint16_t data_len, canopen_sdo_result_t *result)
+{
+    canopen_transport_t tp;
+    int ret;
+
+    canopen_transport_socket_init(&tp, sock);
+    tp.sdo_timeout_ms = canopen_sdo_timeout_ms;
+    ret = canopen_sdo_download_seg_tp(&tp, node, index, subindex, data, data_len);
+    if (result)
+        *result = tp.sdo_result;
+    return ret;
+}
+
+int
+canopen_sdo_upload_block_r(int sock, uint8_t node, uint16_t index, uint8_t subindex,
+                           uint8_t *data, uint32_t data_len, canopen_sdo_result_t *result)
+{
+    canopen_transport_t tp;
+    int ret;
+
+    canopen_transport_socket_init(&tp, sock);
+    tp.sdo_timeout_ms = canopen_sdo_timeout_ms;
+    ret = canopen_sdo_upload_block_tp(&tp, node, index, subindex, data, data_len);
+    if (result)
+        *result = tp.sdo_result;
+    return ret;
+}
 
-    printf("%s: Warning: frame count overflow\n", __PRETTY_FUNCTION__);
-    return 1;
+int
+canopen_sdo_download_block_r(int sock, uint8_t node, uint16_t index, uint8_t subindex,
+                             uint8_t *data, uint32_t data_len, canopen_sdo_result_t *result)
+{
+    canopen_transport_t tp;
+    int ret;
+
+    canopen_transport_socket_init(&tp, sock);
+    tp.sdo_timeout_ms = canopen_sdo_timeout_ms;
+    ret = canopen_sdo_download_block_tp(&tp, node, index, subindex, data, data_len);
+    if (result)
+        *result = tp.sdo_result;
+    return ret;
+}
+
+//------------------------------------------------------------------------------
+// As above, leaving the outcome for canopen_sdo_result_last().
+//------------------------------------------------------------------------------
+int 
+canopen_sdo_upload_exp(int sock, uint8_t node, uint16_t index, 
+                                 uint8_t subindex, uint32_t *data)
+{
+    return canopen_sdo_upload_exp_r(sock, node, index, subindex, data, &canopen_sdo_last_result);
 }
 
+int
+canopen_sdo_download_exp(int sock, uint8_t node,     uint16_t index, 
+                                   uint8_t subindex, uint32_t data, uint16_t len)
+{
+    return canopen_sdo_download_exp_r(sock, node, index, subindex, data, len, &canopen_sdo_last_result);
+}
+
+int
+canopen_sdo_upload_seg(int sock, uint8_t node,  uint16_t index, uint8_t subindex,
+                                 uint8_t *data, uint16_t data_len)
+{
+    return canopen_sdo_upload_seg_r(sock, node, index, subindex, data, data_len, &canopen_sdo_last_result);
+}
+
+int
+canopen_sdo_download_seg(int sock, uint8_t node, uint16_t index, uint8_t subindex,
+                                   uint8_t *data, uint16_t data_len)
+{
+    return canopen_sdo_download_seg_r(sock, node, index, subindex, data, data_len, &canopen_sdo_last_result);
+}
+
+int
+canopen_sdo_upload_block(int sock, uint8_t node,  uint16_t index, uint8_t subindex,
+                                   uint8_t *data, uint32_t data_len)
+{
+    return canopen_sdo_upload_block_r(sock, node, index, subindex, data, data_len, &canopen_sdo_last_result);
+}
+
+int
+canopen_sdo_download_block(int sock, uint8_t node, uint16_t index, uint8_t subindex,
+                                   uint8_t *data, uint32_t data_len)
+{
+    return canopen_sdo_download_block_r(sock, node, index, subindex, data, data_len, &canopen_sdo_last_result);
+}
@@ -30,6 +30,12 @@
 #include <stdint.h> 
 
 #include "canopen.h"
+#include "canopen-transport.h"
+#include "canopen-view.h"
+#include "canopen-build.h"
+
+// how long the SDO routines wait for each server response (per thread)
+void canopen_sdo_timeout_set(unsigned int timeout_ms);
 
 int canopen_sdo_upload_exp(int sock, uint8_t node, uint16_t index, uint8_t subindex, uint32_t *data);
 int canopen_sdo_download_exp(int sock, uint8_t node, uint16_t index, uint8_t subindex, uint32_t data, uint16_t len);
@@ -40,7 +46,56 @@ int canopen_sdo_download_seg(int sock, uint8_t node, uint16_t index, uint8_t sub
 int canopen_sdo_upload_block(int sock, uint8_t node, uint16_t index, uint8_t subindex, uint8_t *data, uint32_t len);
 int canopen_sdo_download_block(int sock, uint8_t node, uint16_t index, uint8_t subindex, uint8_t *data, uint32_t len);
 
+// why the last of the above failed in the calling thread
+const canopen_sdo_result_t *canopen_sdo_result_last();
+
+// the same, returning the outcome in *result (if not NULL)
+int canopen_sdo_upload_exp_r(int sock, uint8_t node, uint16_t index, uint8_t subindex, uint32_t *data,
+                             canopen_sdo_result_t *result);
+int canopen_sdo_download_exp_r(int sock, uint8_t node, uint16_t index, uint8_t subindex, uint32_t data, uint16_t len,
+                               canopen_sdo_result_t *result);
+
+int canopen_sdo_upload_seg_r(int sock, uint8_t node, uint16_t index, uint8_t subindex, uint8_t *data, uint16_t len,
+                             canopen_sdo_result_t *result);
+int canopen_sdo_download_seg_r(int sock, uint8_t node, uint16_t index, uint8_t subindex, uint8_t *data, uint16_t len,
+                               canopen_sdo_result_t *result);
+
+int canopen_sdo_upload_block_r(int sock, uint8_t node, uint16_t index, uint8_t subindex, uint8_t *data, uint32_t len,
+                               canopen_sdo_result_t *result);
+int canopen_sdo_download_block_r(int sock, uint8_t node, uint16_t index, uint8_t subindex, uint8_t *data, uint32_t len,
+                                 canopen_sdo_result_t *result);
+
+// the same, over any transport (canopen-transport.h); the outcome is left
+// in tp->sdo_result
+int canopen_sdo_upload_exp_tp(canopen_transport_t *tp, uint8_t node, uint16_t index, uint8_t subindex, uint32_t *data);
+int canopen_sdo_download_exp_tp(canopen_transport_t *tp, uint8_t node, uint16_t index, uint8_t subindex, uint32_t data, uint16_t len);
+
+int canopen_sdo_upload_seg_tp(canopen_transport_t *tp, uint8_t node, uint16_t index, uint8_t subindex, uint8_t *data, uint16_t len);
+int canopen_sdo_download_seg_tp(canopen_transport_t *tp, uint8_t node, uint16_t index, uint8_t subindex, uint8_t *data, uint16_t len);
+
+int canopen_sdo_upload_block_tp(canopen_transport_t *tp, uint8_t node, uint16_t index, uint8_t subindex, uint8_t *data, uint32_t len);
+int canopen_sdo_download_block_tp(canopen_transport_t *tp, uint8_t node, uint16_t index, uint8_t subindex, uint8_t *data, uint32_t len);
+
+// pack/parse a classic CAN or CAN FD frame, sized by CAN_MTU/CANFD_MTU
+int canopen_frame_pack_mtu(canopen_frame_t *canopen_frame, struct canfd_frame *canfd_frame);
+int canopen_frame_parse_mtu(canopen_frame_t *canopen_frame, struct canfd_frame *canfd_frame, int nbytes);
+
 int canopen_frame_send(int sock, canopen_frame_t *canopen_frame);
 int canopen_frame_recv(int sock, canopen_frame_t *canopen_frame);
+int canopen_frame_recv_meta(int sock, canopen_frame_t *canopen_frame, canopen_frame_meta_t *meta);
+int canopen_frame_recv_timeout(int sock, canopen_frame_t *canopen_frame, canopen_frame_meta_t *meta, int timeout_ms);
+
+// batched frame I/O: one system call for up to CANOPEN_FRAME_BATCH_MAX frames
+// (canopen-build.h)
+
+// room for the receive ancillary data of one frame (time stamps)
+#define CANOPEN_FRAME_CMSG_SIZE 128
+
+int canopen_frame_send_batch(int sock, canopen_frame_t *frames, int n);
+int canopen_frame_send_raw(int sock, struct canfd_frame *can_frames, const int *mtu, int n);
+int canopen_frame_recv_batch(int sock, canopen_frame_t *frames, int n);
+int canopen_frame_recv_batch_meta(int sock, canopen_frame_t *frames, canopen_frame_meta_t *meta, int n);
+int canopen_frame_recv_batch_raw(int sock, struct canfd_frame *can_frames, canopen_frame_view_t *views,
+                                 canopen_frame_meta_t *meta, int n);
 
 #endif /* _OPENCAN_COM_H */
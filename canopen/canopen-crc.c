@@ -0,0 +1,235 @@
+//------------------------------------------------------------------------------
+// Copyright (C) 2012, Robert Johansson, Raditex AB
+// All rights reserved.
+//
+// This file is part of the rSCADA system.
+//
+// rSCADA
+// http://www.rSCADA.se
+// info@rscada.se
+//
+//------------------------------------------------------------------------------
+
+#include <canopen-crc.h>
+
+#include <string.h>
+#include <stdint.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define CANOPEN_CRC_X86
+#endif
+
+#define CANOPEN_CRC16_POLY 0x1021
+
+//
+// canopen_crc16_table[k][v] is v * x^(16 + 8k) mod P: the CRC contribution
+// of byte v followed by k bytes. The fold constants are x^n mod P for the
+// carry-less multiplication path. Both are computed on first use.
+//
+static uint16_t canopen_crc16_table[8][256];
+static uint64_t canopen_crc16_fold512[2];  // x^576, x^512 mod P
+static uint64_t canopen_crc16_fold128[2];  // x^192, x^128 mod P
+
+#define CRC_INIT_NONE 0
+#define CRC_INIT_BUSY 1
+#define CRC_INIT_DONE 2
+
+static int canopen_crc16_state = CRC_INIT_NONE;
+
+// one bit at a time, while the tables are not ready
+static uint16_t
+canopen_crc16_bitwise(uint16_t crc, const uint8_t *data, size_t len)
+{
+    int b;
+
+    while (len--)
+    {
+        crc ^= (uint16_t)*data++ << 8;
+        for (b = 0; b < 8; b++)
+            crc = (crc & 0x8000) ? (crc << 1) ^ CANOPEN_CRC16_POLY : (crc << 1);
+    }
+
+    return crc;
+}
+
+static uint16_t
+canopen_crc16_xpow(int n)
+{
+    uint32_t r = 1;
+
+    while (n--)
+    {
+        r <<= 1;
+        if (r & 0x10000)
+            r ^= 0x10000 | CANOPEN_CRC16_POLY;
+    }
+
+    return r;
+}
+
+//------------------------------------------------------------------------------
+// Build the tables once. A thread that finds another one building them
+// uses the bitwise loop meanwhile.
+//------------------------------------------------------------------------------
+static int
+canopen_crc16_ready()
+{
+    int state = CRC_INIT_NONE;
+    uint8_t v;
+    int k, i;
+
+    if (__atomic_load_n(&canopen_crc16_state, __ATOMIC_ACQUIRE) == CRC_INIT_DONE)
+        return 1;
+
+    if (!__atomic_compare_exchange_n(&canopen_crc16_state, &state, CRC_INIT_BUSY, 0,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE))
+        return 0;
+
+    for (i = 0; i < 256; i++)
+    {
+        v = i;
+        canopen_crc16_table[0][i] = canopen_crc16_bitwise(0, &v, 1);
+    }
+
+    for (k = 1; k < 8; k++)
+        for (i = 0; i < 256; i++)
+            canopen_crc16_table[k][i] = (canopen_crc16_table[k-1][i] << 8) ^
+                                        canopen_crc16_table[0][canopen_crc16_table[k-1][i] >> 8];
+
+    canopen_crc16_fold512[0] = canopen_crc16_xpow(576);
+    canopen_crc16_fold512[1] = canopen_crc16_xpow(512);
+    canopen_crc16_fold128[0] = canopen_crc16_xpow(192);
+    canopen_crc16_fold128[1] = canopen_crc16_xpow(128);
+
+    __atomic_store_n(&canopen_crc16_state, CRC_INIT_DONE, __ATOMIC_RELEASE);
+
+    return 1;
+}
+
+//------------------------------------------------------------------------------
+// Slice-by-8: the CRC folded into the first two bytes, then each of the 8
+// bytes looked up in the table for its distance from the end.
+//------------------------------------------------------------------------------
+static uint16_t
+canopen_crc16_slice8(uint16_t crc, const uint8_t *data, size_t len)
+{
+    const uint16_t (*t)[256] = canopen_crc16_table;
+
+    for (; len >= 8; len -= 8, data += 8)
+    {
+        crc ^= (data[0] << 8) | data[1];
+
+        crc = t[7][crc >> 8]  ^ t[6][crc & 0xFF] ^
+              t[5][data[2]]   ^ t[4][data[3]]    ^ t[3][data[4]] ^
+              t[2][data[5]]   ^ t[1][data[6]]    ^ t[0][data[7]];
+    }
+
+    while (len--)
+        crc = (crc << 8) ^ t[0][(crc >> 8) ^ *data++];
+
+    return crc;
+}
+
+#ifdef CANOPEN_CRC_X86
+
+//------------------------------------------------------------------------------
+// Carry-less multiplication: the data is loaded as 128-bit polynomials
+// (byte-swapped, first byte highest) and each one is folded into the
+// next: A * x^n = A_hi * x^(n+64) + A_lo * x^n, with the powers of x
+// reduced mod P, leaves a polynomial below x^80 with the same remainder.
+// Four accumulators run 64 bytes apart; the last 16 bytes go through the
+// tables. len is a multiple of 16, at least 64.
+//------------------------------------------------------------------------------
+__attribute__((target("pclmul,ssse3")))
+static inline __m128i
+canopen_crc16_fold(__m128i a, __m128i k, __m128i next)
+{
+    return _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(a, k, 0x01), _mm_clmulepi64_si128(a, k, 0x10)),
+                         next);
+}
+
+__attribute__((target("pclmul,ssse3")))
+static uint16_t
+canopen_crc16_clmul(uint16_t crc, const uint8_t *data, size_t len)
+{
+    const __m128i swap = _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+    const __m128i k512 = _mm_set_epi64x(canopen_crc16_fold512[1], canopen_crc16_fold512[0]);
+    const __m128i k128 = _mm_set_epi64x(canopen_crc16_fold128[1], canopen_crc16_fold128[0]);
+    __m128i x0, x1, x2, x3;
+    uint8_t last[16];
+
+#define CRC_LOAD(p) _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(p)), swap)
+
+    x0 = _mm_xor_si128(CRC_LOAD(data), _mm_slli_si128(_mm_cvtsi32_si128(crc), 14));
+    x1 = CRC_LOAD(data + 16);
+    x2 = CRC_LOAD(data + 32);
+    x3 = CRC_LOAD(data + 48);
+
+    for (data += 64, len -= 64; len >= 64; data += 64, len -= 64)
+    {
+        x0 = canopen_crc16_fold(x0, k512, CRC_LOAD(data));
+        x1 = canopen_crc16_fold(x1, k512, CRC_LOAD(data + 16));
+        x2 = canopen_crc16_fold(x2, k512, CRC_LOAD(data + 32));
+        x3 = canopen_crc16_fold(x3, k512, CRC_LOAD(data + 48));
+    }
+
+    x0 = canopen_crc16_fold(x0, k128, x1);
+    x0 = canopen_crc16_fold(x0, k128, x2);
+    x0 = canopen_crc16_fold(x0, k128, x3);
+
+    for (; len >= 16; data += 16, len -= 16)
+        x0 = canopen_crc16_fold(x0, k128, CRC_LOAD(data));
+
+#undef CRC_LOAD
+
+    _mm_storeu_si128((__m128i *)last, _mm_shuffle_epi8(x0, swap));
+
+    return canopen_crc16_slice8(0, last, 16);
+}
+
+#endif /* CANOPEN_CRC_X86 */
+
+//------------------------------------------------------------------------------
+//SF
+//SF .. c:function:: uint16_t canopen_crc16_update(uint16_t crc, const uint8_t *data, size_t len)
+//SF
+//SF     Continue the block transfer CRC *crc* (CANOPEN_CRC16_INIT at the
+//SF     start) over *len* more bytes, so that a transfer can be checked as
+//SF     its segments arrive.
+//SF
+//------------------------------------------------------------------------------
+uint16_t
+canopen_crc16_update(uint16_t crc, const uint8_t *data, size_t len)
+{
+    if (!canopen_crc16_ready())
+    {
+        return canopen_crc16_bitwise(crc, data, len);
+    }
+
+#ifdef CANOPEN_CRC_X86
+    if (len >= 128 && __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("ssse3"))
+    {
+        size_t n = len & ~(size_t)15;
+
+        crc = canopen_crc16_clmul(crc, data, n);
+        data += n;
+        len  -= n;
+    }
+#endif
+
+    return canopen_crc16_slice8(crc, data, len);
+}
+
+//------------------------------------------------------------------------------
+//SF
+//SF .. c:function:: uint16_t canopen_crc16(const uint8_t *data, size_t len)
+//SF
+//SF     The CRC of an SDO block transfer of *len* bytes.
+//SF
+//------------------------------------------------------------------------------
+uint16_t
+canopen_crc16(const uint8_t *data, size_t len)
+{
+    return canopen_crc16_update(CANOPEN_CRC16_INIT, data, len);
+}
@@ -0,0 +1,34 @@
+//------------------------------------------------------------------------------
+// Copyright (C) 2012, Robert Johansson, Raditex AB
+// All rights reserved.
+//
+// This file is part of the rSCADA system.
+//
+// rSCADA
+// http://www.rSCADA.se
+// info@rscada.se
+//
+//------------------------------------------------------------------------------
+
+//
+// CRC-16-CCITT of SDO block transfers (CiA 301): polynomial 0x1021,
+// initial value 0, no reflection, no final XOR. The data is processed 8
+// bytes at a time with lookup tables, or 64 bytes at a time with
+// carry-less multiplication (PCLMULQDQ) where the CPU supports it.
+//
+
+#ifndef _CANOPEN_CRC_H_
+#define _CANOPEN_CRC_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define CANOPEN_CRC16_INIT 0x0000
+
+// continue crc over len more bytes
+uint16_t canopen_crc16_update(uint16_t crc, const uint8_t *data, size_t len);
+
+// crc of len bytes
+uint16_t canopen_crc16(const uint8_t *data, size_t len);
+
+#endif /* _CANOPEN_CRC_H_ */
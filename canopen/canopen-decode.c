@@ -0,0 +1,369 @@
+//------------------------------------------------------------------------------
+// Copyright (C) 2012, Robert Johansson, Raditex AB
+// All rights reserved.
+//
+// This file is part of the rSCADA system.
+//
+// rSCADA
+// http://www.rSCADA.se
+// info@rscada.se
+//
+//------------------------------------------------------------------------------
+
+#include <canopen.h>
+#include <canopen-cob.h>
+#include <canopen-decode.h>
+#include <canopen-types.h>
+
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+
+// data bytes of a segment, n bytes at the end hold no data
+static void
+canopen_decode_sdo_segment(canopen_frame_t *frame, canopen_decoded_sdo_t *s, int n)
+{
+    s->data     = &(frame->payload.data[1]);
+    s->data_len = (frame->data_len > 1 + n) ? frame->data_len - 1 - n : 0;
+}
+
+// index, subindex and (expedited) data of an initiate frame
+static void
+canopen_decode_sdo_initiate(canopen_frame_t *frame, canopen_decoded_sdo_t *s)
+{
+    canopen_sdo_t *sdo = &(frame->payload.sdo);
+    int n;
+
+    s->index     = SDO_index((*sdo));
+    s->subindex  = sdo->subindex;
+    s->expedited = (sdo->command & CANOPEN_SDO_CS_ID_E_FLAG) ? 1 : 0;
+    s->size_set  = (sdo->command & CANOPEN_SDO_CS_ID_S_FLAG) ? 1 : 0;
+
+    if (s->expedited)
+    {
+        n = (sdo->command & CANOPEN_SDO_CS_ID_N_MASK) >> CANOPEN_SDO_CS_ID_N_SHIFT;
+        s->data     = sdo->data;
+        s->data_len = s->size_set ? 4 - n : 4;
+        s->size     = s->size_set ? s->data_len : 0;
+    }
+    else if (s->size_set)
+    {
+        s->size = canopen_decode_u32(sdo->data);
+    }
+}
+
+//------------------------------------------------------------------------------
+// SDO frames, by direction (CANOPEN_COB_DIR_RX: client to server). The
+// per node block transfer state is followed in state, if not NULL.
+//------------------------------------------------------------------------------
+static void
+canopen_decode_sdo(canopen_frame_t *frame, uint8_t direction, uint8_t *state, canopen_decoded_sdo_t *s)
+{
+    canopen_sdo_t *sdo = &(frame->payload.sdo);
+    uint8_t cmd = sdo->command;
+
+    s->command = cmd;
+
+    if (direction == CANOPEN_COB_DIR_RX)
+    {
+        if (state && *state == CANOPEN_DECODER_SDO_BLOCK)
+        {
+            s->op    = CANOPEN_SDO_OP_BLOCK_SEGMENT;
+            s->seqno = cmd & 0x7F;
+            s->last  = (cmd & CANOPEN_SDO_CS_BD_C_FLAG) ? 1 : 0;
+            canopen_decode_sdo_segment(frame, s, 0);
+
+            if (s->last)
+                *state = CANOPEN_DECODER_SDO_IDLE;
+            return;
+        }
+
+        switch (cmd & CANOPEN_SDO_CS_MASK)
+        {
+            case CANOPEN_SDO_CS_RX_IDD:
+                s->op = CANOPEN_SDO_OP_INIT_DOWNLOAD;
+                canopen_decode_sdo_initiate(frame, s);
+                break;
+
+            case CANOPEN_SDO_CS_RX_DDS:
+                s->op     = CANOPEN_SDO_OP_DOWNLOAD_SEGMENT;
+                s->toggle = (cmd & CANOPEN_SDO_CS_DS_T_FLAG) ? 1 : 0;
+                s->last   = (cmd & CANOPEN_SDO_CS_DS_C_FLAG) ? 1 : 0;
+                canopen_decode_sdo_segment(frame, s, (cmd & CANOPEN_SDO_CS_DS_N_MASK) >> CANOPEN_SDO_CS_DS_N_SHIFT);
+                break;
+
+            case CANOPEN_SDO_CS_RX_IDU:
+                s->op       = CANOPEN_SDO_OP_INIT_UPLOAD;
+                s->index    = SDO_index((*sdo));
+                s->subindex = sdo->subindex;
+                break;
+
+            case CANOPEN_SDO_CS_RX_UDS:
+                s->op     = CANOPEN_SDO_OP_UPLOAD_SEGMENT;
+                s->toggle = (cmd & CANOPEN_SDO_CS_DS_T_FLAG) ? 1 : 0;
+                break;
+
+            case CANOPEN_SDO_CS_RX_ADT:
+                s->op         = CANOPEN_SDO_OP_ABORT;
+                s->index      = SDO_index((*sdo));
+                s->subindex   = sdo->subindex;
+                s->abort_code = canopen_decode_u32(sdo->data);
+                if (state)
+                    *state = CANOPEN_DECODER_SDO_IDLE;
+                break;
+
+            case CANOPEN_SDO_CS_RX_BD:
+                if ((cmd & 0x01) == CANOPEN_SDO_CS_DB_CS_IBD)
+                {
+                    s->op       = CANOPEN_SDO_OP_BLOCK_INIT;
+                    s->crc_set  = (cmd & CANOPEN_SDO_CS_BD_CRC_FLAG) ? 1 : 0;
+                    s->index    = SDO_index((*sdo));
+                    s->subindex = sdo->subindex;
+                    s->size_set = (cmd & CANOPEN_SDO_CS_BD_S_FLAG) ? 1 : 0;
+                    s->size     = s->size_set ? canopen_decode_u32(sdo->data) : 0;
+                }
+                else
+                {
+                    s->op      = CANOPEN_SDO_OP_BLOCK_END;
+                    s->unused  = (cmd >> CANOPEN_SDO_CS_DB_N_SHIFT) & CANOPEN_SDO_CS_DB_N_MASK;
+                    s->crc     = canopen_decode_u16(&(frame->payload.data[1]));
+                    if (state)
+                        *state = CANOPEN_DECODER_SDO_IDLE;
+                }
+                break;
+
+            case CANOPEN_SDO_CS_RX_BU:
+                switch (cmd & CANOPEN_SDO_CS_BU_CS_MASK)
+                {
+                    case CANOPEN_SDO_CS_BU_CS_IBU:
+                        s->op       = CANOPEN_SDO_OP_BLOCK_INIT;
+                        s->crc_set  = (cmd & CANOPEN_SDO_CS_BD_CRC_FLAG) ? 1 : 0;
+                        s->index    = SDO_index((*sdo));
+                        s->subindex = sdo->subindex;
+                        s->blksize  = sdo->data[0];
+                        break;
+
+                    case CANOPEN_SDO_CS_BU_CS_EBU:
+                        s->op = CANOPEN_SDO_OP_BLOCK_END;
+                        break;
+
+                    case CANOPEN_SDO_CS_BU_CS_ACK:
+                        s->op      = CANOPEN_SDO_OP_BLOCK_ACK;
+                        s->seqno   = frame->payload.data[1];
+                        s->blksize = frame->payload.data[2];
+                        break;
+
+                    case CANOPEN_SDO_CS_BU_CS_START:
+                        s->op = CANOPEN_SDO_OP_BLOCK_START;
+                        if (state)
+                            *state = CANOPEN_DECODER_SDO_BLOCK_UPLOAD; // sub-blocks follow
+                        break;
+                }
+                break;
+        }
+
+        return;
+    }
+
+    if (state && *state == CANOPEN_DECODER_SDO_BLOCK_UPLOAD)
+    {
+        s->op    = CANOPEN_SDO_OP_BLOCK_SEGMENT;
+        s->seqno = cmd & 0x7F;
+        s->last  = (cmd & CANOPEN_SDO_CS_BD_C_FLAG) ? 1 : 0;
+        canopen_decode_sdo_segment(frame, s, 0);
+
+        if (s->last)
+            *state = CANOPEN_DECODER_SDO_IDLE;
+        return;
+    }
+
+    switch (cmd & CANOPEN_SDO_CS_MASK)
+    {
+        case CANOPEN_SDO_CS_TX_IDD:
+            s->op       = CANOPEN_SDO_OP_INIT_DOWNLOAD;
+            s->index    = SDO_index((*sdo));
+            s->subindex = sdo->subindex;
+            break;
+
+        case CANOPEN_SDO_CS_TX_DDS:
+            s->op     = CANOPEN_SDO_OP_DOWNLOAD_SEGMENT;
+            s->toggle = (cmd & CANOPEN_SDO_CS_DS_T_FLAG) ? 1 : 0;
+            break;
+
+        case CANOPEN_SDO_CS_TX_IDU:
+            s->op = CANOPEN_SDO_OP_INIT_UPLOAD;
+            canopen_decode_sdo_initiate(frame, s);
+            break;
+
+        case CANOPEN_SDO_CS_TX_UDS:
+            s->op     = CANOPEN_SDO_OP_UPLOAD_SEGMENT;
+            s->toggle = (cmd & CANOPEN_SDO_CS_DS_T_FLAG) ? 1 : 0;
+            s->last   = (cmd & CANOPEN_SDO_CS_DS_C_FLAG) ? 1 : 0;
+            canopen_decode_sdo_segment(frame, s, (cmd & CANOPEN_SDO_CS_DS_N_MASK) >> CANOPEN_SDO_CS_DS_N_SHIFT);
+            break;
+
+        case CANOPEN_SDO_CS_TX_ADT:
+            s->op         = CANOPEN_SDO_OP_ABORT;
+            s->index      = SDO_index((*sdo));
+            s->subindex   = sdo->subindex;
+            s->abort_code = canopen_decode_u32(sdo->data);
+            if (state)
+                *state = CANOPEN_DECODER_SDO_IDLE;
+            break;
+
+        case CANOPEN_SDO_CS_TX_BD:
+            switch (cmd & CANOPEN_SDO_CS_DB_SS_MASK)
+            {
+                case CANOPEN_SDO_CS_DB_SS_IBD_ACK:
+                    s->op       = CANOPEN_SDO_OP_BLOCK_INIT;
+                    s->crc_set  = (cmd & CANOPEN_SDO_CS_BD_CRC_FLAG) ? 1 : 0;
+                    s->index    = SDO_index((*sdo));
+                    s->subindex = sdo->subindex;
+                    s->blksize  = sdo->data[0];
+                    if (state)
+                        *state = CANOPEN_DECODER_SDO_BLOCK; // sub-blocks follow
+                    break;
+
+                case CANOPEN_SDO_CS_DB_SS_BD_END:
+                    s->op = CANOPEN_SDO_OP_BLOCK_END;
+                    if (state)
+                        *state = CANOPEN_DECODER_SDO_IDLE;
+                    break;
+
+                case CANOPEN_SDO_CS_DB_SS_BD_ACK:
+                    s->op      = CANOPEN_SDO_OP_BLOCK_ACK;
+                    s->seqno   = frame->payload.data[1];
+                    s->blksize = frame->payload.data[2];
+                    break;
+            }
+            break;
+
+        case CANOPEN_SDO_CS_TX_BU:
+            if ((cmd & CANOPEN_SDO_CS_BU_SS_MASK) == CANOPEN_SDO_CS_BU_SS_IBU)
+            {
+                s->op       = CANOPEN_SDO_OP_BLOCK_INIT;
+                s->crc_set  = (cmd & CANOPEN_SDO_CS_BD_CRC_FLAG) ? 1 : 0;
+                s->index    = SDO_index((*sdo));
+                s->subindex = sdo->subindex;
+                s->size_set = (cmd & CANOPEN_SDO_CS_BD_S_FLAG) ? 1 : 0;
+                s->size     = s->size_set ? canopen_decode_u32(sdo->data) : 0;
+            }
+            else
+            {
+                s->op     = CANOPEN_SDO_OP_BLOCK_END;
+                s->unused = (cmd >> CANOPEN_SDO_CS_DB_N_SHIFT) & CANOPEN_SDO_CS_DB_N_MASK;
+                s->crc    = canopen_decode_u16(&(frame->payload.data[1]));
+                if (state)
+                    *state = CANOPEN_DECODER_SDO_IDLE;
+            }
+            break;
+    }
+}
+
+//------------------------------------------------------------------------------
+//SF
+//SF .. c:function:: int canopen_decoder_decode(canopen_decoder_t *dec, canopen_frame_t *frame, canopen_decoded_t *d)
+//SF
+//SF     Decode a frame into *d*: its service (see canopen-cob.h, classified
+//SF     with the decoder's COB-ID map), and the protocol fields of that
+//SF     service in the member of *d->u* that it selects. Pointers in *d*
+//SF     point into *frame*.
+//SF
+//SF     *dec* follows the SDO block transfers across frames, as for
+//SF     canopen_decoder_format; feed one stream of frames to either of them.
+//SF     With a NULL *dec* block download segments are not recognized.
+//SF
+//SF     Returns 0, or -1 on error.
+//SF
+//------------------------------------------------------------------------------
+int
+canopen_decoder_decode(canopen_decoder_t *dec, canopen_frame_t *frame, canopen_decoded_t *d)
+{
+    const canopen_cob_class_t *cls;
+    uint8_t *data;
+
+    if (frame == NULL || d == NULL)
+    {
+        return -1;
+    }
+
+    bzero((void *)d, sizeof(canopen_decoded_t));
+    d->type = frame->type;
+
+    if (frame->type != CANOPEN_FLAG_STANDARD)
+    {
+        return 0;
+    }
+
+    cls  = canopen_cob_classify(dec ? dec->cob_map : NULL, (frame->function_code<<7)|frame->id);
+    data = frame->payload.data;
+
+    d->service   = cls->service;
+    d->direction = cls->direction;
+    d->node      = cls->node;
+
+    switch (cls->service)
+    {
+        case CANOPEN_SERVICE_NMT:
+            d->u.nmt.command = frame->payload.nmt_mc.cs;
+            d->u.nmt.node    = frame->payload.nmt_mc.id;
+            break;
+
+        case CANOPEN_SERVICE_NMT_EC:
+            if (frame->rtr && frame->data_len == 0)
+            {
+                d->u.nmt_ec.request = 1;
+                break;
+            }
+            d->u.nmt_ec.state  = data[0] & CANOPEN_NMT_NG_STATE_MASK;
+            d->u.nmt_ec.toggle = data[0] >> 7;
+            break;
+
+        case CANOPEN_SERVICE_SYNC:
+            d->u.sync.counter_set = frame->data_len > 0;
+            d->u.sync.counter     = data[0];
+            break;
+
+        case CANOPEN_SERVICE_EMCY:
+            d->u.emcy.code = canopen_decode_u16(data);
+            d->u.emcy.reg  = data[2];
+            memcpy(d->u.emcy.vendor, &data[3], sizeof(d->u.emcy.vendor));
+            break;
+
+        case CANOPEN_SERVICE_TIME:
+        {
+            canopen_time_t t = canopen_decode_time(data);
+
+            d->u.time.ms   = t.ms;
+            d->u.time.days = t.days;
+            break;
+        }
+
+        case CANOPEN_SERVICE_PDO:
+            d->u.pdo.number   = cls->pdo;
+            d->u.pdo.data     = data;
+            d->u.pdo.data_len = frame->data_len;
+            break;
+
+        case CANOPEN_SERVICE_SDO:
+            canopen_decode_sdo(frame, cls->direction, dec ? &(dec->sdo_state[cls->node & 0x7F]) : NULL,
+                               &(d->u.sdo));
+            break;
+    }
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+//SF
+//SF .. c:function:: int canopen_frame_decode(canopen_frame_t *frame, canopen_decoded_t *d)
+//SF
+//SF     Decode a single frame, without state from earlier frames (see
+//SF     canopen_decoder_decode).
+//SF
+//------------------------------------------------------------------------------
+int
+canopen_frame_decode(canopen_frame_t *frame, canopen_decoded_t *d)
+{
+    return canopen_decoder_decode(NULL, frame, d);
+}
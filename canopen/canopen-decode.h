@@ -0,0 +1,114 @@
+//------------------------------------------------------------------------------
+// Copyright (C) 2012, Robert Johansson, Raditex AB
+// All rights reserved.
+//
+// This file is part of the rSCADA system.
+//
+// rSCADA
+// http://www.rSCADA.se
+// info@rscada.se
+//
+//------------------------------------------------------------------------------
+
+//
+// Structured CANopen frame decoding: the fields that the print-outs show,
+// as a tagged struct, for monitors, loggers and bindings.
+//
+
+#ifndef _CANOPEN_DECODE_H_
+#define _CANOPEN_DECODE_H_
+
+#include <stdint.h>
+
+#include "canopen.h"
+#include "canopen-cob.h"
+
+// what an SDO frame does
+#define CANOPEN_SDO_OP_UNKNOWN          0
+#define CANOPEN_SDO_OP_INIT_DOWNLOAD    1   // request or response
+#define CANOPEN_SDO_OP_DOWNLOAD_SEGMENT 2
+#define CANOPEN_SDO_OP_INIT_UPLOAD      3
+#define CANOPEN_SDO_OP_UPLOAD_SEGMENT   4
+#define CANOPEN_SDO_OP_ABORT            5
+#define CANOPEN_SDO_OP_BLOCK_INIT       6   // block download or upload initiate
+#define CANOPEN_SDO_OP_BLOCK_SEGMENT    7   // block download or upload sub-block segment
+#define CANOPEN_SDO_OP_BLOCK_ACK        8
+#define CANOPEN_SDO_OP_BLOCK_END        9
+#define CANOPEN_SDO_OP_BLOCK_START      10  // block upload: client starts the sub-blocks
+
+typedef struct _canopen_decoded_sdo {
+
+    uint8_t  command;   // raw command byte
+    uint8_t  op;        // CANOPEN_SDO_OP_*
+    uint16_t index;     // initiate, abort and block initiate
+    uint8_t  subindex;
+    uint8_t  expedited;
+    uint8_t  size_set;  // size is indicated
+    uint8_t  toggle;
+    uint8_t  last;      // no more segments follow
+    uint8_t  seqno;     // block segment number, or acknowledged sequence
+    uint8_t  blksize;   // block size (download initiate response, upload
+                        // initiate request, ack)
+    uint8_t  crc_set;   // block CRC supported
+    uint8_t  unused;    // block end: bytes of the last segment without data
+    uint16_t crc;       // block end
+    uint32_t size;      // indicated transfer size, if size_set
+    uint32_t abort_code;
+
+    const uint8_t *data;    // data bytes carried by this frame (in the frame)
+    uint8_t        data_len;
+
+} canopen_decoded_sdo_t;
+
+typedef struct _canopen_decoded {
+
+    // classification (service is CANOPEN_SERVICE_UNKNOWN for extended
+    // and error frames)
+    uint8_t  type;      // CANOPEN_FLAG_STANDARD, _EXTENDED or _ERROR
+    uint8_t  service;   // CANOPEN_SERVICE_*, selects the member of u
+    uint8_t  direction; // CANOPEN_COB_DIR_*
+    uint8_t  node;
+
+    union {
+        struct {
+            uint8_t command;    // CANOPEN_NMT_MC_CS_*
+            uint8_t node;       // addressed node, 0 for all
+        } nmt;
+
+        struct {
+            uint8_t request;    // RTR node guarding request, no state
+            uint8_t state;      // CANOPEN_NMT_NG_STATE_*
+            uint8_t toggle;     // node guarding toggle bit
+        } nmt_ec;
+
+        struct {
+            uint8_t counter_set;
+            uint8_t counter;
+        } sync;
+
+        struct {
+            uint16_t code;
+            uint8_t  reg;       // error register (object 0x1001)
+            uint8_t  vendor[5]; // manufacturer specific error field
+        } emcy;
+
+        struct {
+            uint32_t ms;        // milliseconds after midnight
+            uint16_t days;      // days since January 1, 1984
+        } time;
+
+        struct {
+            uint16_t number;
+            const uint8_t *data;    // in the frame
+            uint8_t  data_len;
+        } pdo;
+
+        canopen_decoded_sdo_t sdo;
+    } u;
+
+} canopen_decoded_t;
+
+int canopen_frame_decode(canopen_frame_t *frame, canopen_decoded_t *d);
+int canopen_decoder_decode(canopen_decoder_t *dec, canopen_frame_t *frame, canopen_decoded_t *d);
+
+#endif /* _CANOPEN_DECODE_H_ */
@@ -0,0 +1,571 @@
+//------------------------------------------------------------------------------
+// Copyright (C) 2012, Robert Johansson, Raditex AB
+// All rights reserved.
+//
+// This file is part of the rSCADA system.
+//
+// rSCADA
+// http://www.rSCADA.se
+// info@rscada.se
+//
+//------------------------------------------------------------------------------
+
+#include <canopen.h>
+#include <canopen-com.h>
+#include <canopen-event.h>
+
+#include <sys/types.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+
+#define CANOPEN_EVENT_MAX 32 // events handled per epoll_wait
+
+#define CANOPEN_EVENT_SOCKET_ERRORS_MAX 16 // failed reads in a row before a socket is dropped
+
+#define CANOPEN_EVENT_SOCKET 0x1
+#define CANOPEN_EVENT_TIMER  0x2
+
+typedef struct _canopen_event_source {
+
+    int type;   // CANOPEN_EVENT_SOCKET or CANOPEN_EVENT_TIMER
+    int fd;     // CAN socket or timerfd
+    int dead;   // removed, freed after the current dispatch round
+    int view;   // socket frames are passed as views (cb.view)
+    int errors; // socket reads failed in a row
+
+    canopen_event_error_cb_t error_cb;
+
+    union {
+        canopen_event_frame_cb_t frame;
+        canopen_event_view_cb_t  view;
+        canopen_event_timer_cb_t timer;
+    } cb;
+    void *arg;
+
+    struct _canopen_event_source *next;
+} canopen_event_source_t;
+
+struct _canopen_event_loop {
+
+    int epoll_fd;
+    int running;
+
+    canopen_event_source_t *sources;
+};
+
+//------------------------------------------------------------------------------
+//SF
+//SF .. c:function:: canopen_event_loop_t *canopen_event_loop_new()
+//SF
+//SF     Create a new event loop. Any number of CAN sockets and timers can be
+//SF     registered with the loop, and are then served by the thread that
+//SF     calls canopen_event_loop_run.
+//SF
+//------------------------------------------------------------------------------
+canopen_event_loop_t *
+canopen_event_loop_new()
+{
+    canopen_event_loop_t *loop;
+
+    if ((loop = (canopen_event_loop_t *)malloc(sizeof(canopen_event_loop_t))) == NULL)
+    {
+        return NULL;
+    }
+
+    bzero((void *)loop, sizeof(canopen_event_loop_t));
+
+    if ((loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+    {
+        fprintf(stderr, "Error: Failed to create epoll instance.\n");
+        free(loop);
+        return NULL;
+    }
+
+    return loop;
+}
+
+//------------------------------------------------------------------------------
+//SF
+//SF .. c:function:: void canopen_event_loop_free(canopen_event_loop_t *loop)
+//SF
+//SF     Free the event loop and close its timers. Registered CAN sockets
+//SF     are not closed.
+//SF
+//------------------------------------------------------------------------------
+void
+canopen_event_loop_free(canopen_event_loop_t *loop)
+{
+    canopen_event_source_t *src, *next;
+
+    if (loop == NULL)
+        return;
+
+    for (src = loop->sources; src; src = next)
+    {
+        next = src->next;
+
+        if (src->type == CANOPEN_EVENT_TIMER && !src->dead)
+            close(src->fd);
+
+        free(src);
+    }
+
+    close(loop->epoll_fd);
+    free(loop);
+}
+
+//------------------------------------------------------------------------------
+// Register a new event source with the loop.
+//------------------------------------------------------------------------------
+static canopen_event_source_t *
+canopen_event_source_add(canopen_event_loop_t *loop, int type, int fd, void *arg)
+{
+    canopen_event_source_t *src;
+    struct epoll_event ev;
+
+    if ((src = (canopen_event_source_t *)malloc(sizeof(canopen_event_source_t))) == NULL)
+    {
+        return NULL;
+    }
+
+    bzero((void *)src, sizeof(canopen_event_source_t));
+    src->type = type;
+    src->fd   = fd;
+    src->arg  = arg;
+
+    bzero((void *)&ev, sizeof(ev));
+    ev.events   = EPOLLIN;
+    ev.data.ptr = src;
+
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0)
+    {
+        free(src);
+        return NULL;
+    }
+
+    src->next     = loop->sources;
+    loop->sources = src;
+
+    return src;
+}
+
+//------------------------------------------------------------------------------
+// Unregister an event source. The source is only marked as dead here, since
+// its events may still be pending in the current dispatch round.
+//------------------------------------------------------------------------------
+static int
+canopen_event_source_remove(canopen_event_loop_t *loop, int type, int fd)
+{
+    canopen_event_source_t *src;
+
+    for (src = loop->sources; src; src = src->next)
+    {
+        if (src->type == type && src->fd == fd && !src->dead)
+        {
+            epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+            src->dead = 1;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+//------------------------------------------------------------------------------
+// Free all sources that were removed.
+//------------------------------------------------------------------------------
+static void
+canopen_event_source_reap(canopen_event_loop_t *loop)
+{
+    canopen_event_source_t **iter = &(loop->sources), *src;
+
+    while ((src = *iter) != NULL)
+    {
+        if (src->dead)
+        {
+            *iter = src->next;
+            free(src);
+        }
+        else
+        {
+            iter = &(src->next);
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+//SF
+//SF .. c:function:: int canopen_event_loop_add_socket(canopen_event_loop_t *loop, int sock, canopen_event_frame_cb_t cb, void *arg)
+//SF
+//SF     Register a CAN socket with the loop. Each time the socket becomes
+//SF     readable, all queued frames are read in one batch and *cb* is
+//SF     called once per frame.
+//SF
+//------------------------------------------------------------------------------
+int
+canopen_event_loop_add_socket(canopen_event_loop_t *loop, int sock,
+                              canopen_event_frame_cb_t cb, void *arg)
+{
+    canopen_event_source_t *src;
+
+    if (loop == NULL || cb == NULL)
+        return -1;
+
+    if ((src = canopen_event_source_add(loop, CANOPEN_EVENT_SOCKET, sock, arg)) == NULL)
+    {
+        return -1;
+    }
+
+    src->cb.frame = cb;
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+//SF
+//SF .. c:function:: int canopen_event_loop_add_socket_view(canopen_event_loop_t *loop, int sock, canopen_event_view_cb_t cb, void *arg)
+//SF
+//SF     Same as canopen_event_loop_add_socket, but *cb* gets a view over
+//SF     each received frame (see canopen-view.h) instead of a parsed
+//SF     CANopen frame. Remove it with canopen_event_loop_remove_socket.
+//SF
+//------------------------------------------------------------------------------
+int
+canopen_event_loop_add_socket_view(canopen_event_loop_t *loop, int sock,
+                                   canopen_event_view_cb_t cb, void *arg)
+{
+    canopen_event_source_t *src;
+
+    if (loop == NULL || cb == NULL)
+        return -1;
+
+    if ((src = canopen_event_source_add(loop, CANOPEN_EVENT_SOCKET, sock, arg)) == NULL)
+    {
+        return -1;
+    }
+
+    src->view    = 1;
+    src->cb.view = cb;
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+//SF
+//SF .. c:function:: int canopen_event_loop_remove_socket(canopen_event_loop_t *loop, int sock)
+//SF
+//SF     Unregister a CAN socket. It is safe to call this from a callback.
+//SF
+//------------------------------------------------------------------------------
+int
+canopen_event_loop_remove_socket(canopen_event_loop_t *loop, int sock)
+{
+    if (loop == NULL)
+        return -1;
+
+    return canopen_event_source_remove(loop, CANOPEN_EVENT_SOCKET, sock);
+}
+
+//------------------------------------------------------------------------------
+//SF
+//SF .. c:function:: int canopen_event_loop_socket_error_cb(canopen_event_loop_t *loop, int sock, canopen_event_error_cb_t cb)
+//SF
+//SF     Set the function called with the socket's *arg* when reading the
+//SF     registered socket *sock* fails. Errors the kernel reports once,
+//SF     such as ENETDOWN while the interface is down, leave the socket in
+//SF     the loop. A socket that is not usable, or keeps failing, is
+//SF     removed first, and *cb* is told so; it may add the socket again.
+//SF     Without a callback, the error is printed on stderr.
+//SF
+//------------------------------------------------------------------------------
+int
+canopen_event_loop_socket_error_cb(canopen_event_loop_t *loop, int sock,
+                                   canopen_event_error_cb_t cb)
+{
+    canopen_event_source_t *src;
+
+    if (loop == NULL)
+        return -1;
+
+    for (src = loop->sources; src; src = src->next)
+    {
+        if (src->type == CANOPEN_EVENT_SOCKET && src->fd == sock && !src->dead)
+        {
+            src->error_cb = cb;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+//------------------------------------------------------------------------------
+//SF
+//SF .. c:function:: int canopen_event_loop_add_timer(canopen_event_loop_t *loop, unsigned int delay_ms, unsigned int interval_ms, canopen_event_timer_cb_t cb, void *arg)
+//SF
+//SF     Add a timer that first fires after *delay_ms*, and then every
+//SF     *interval_ms* (or only once if *interval_ms* is zero). The timer runs
+//SF     on CLOCK_MONOTONIC.
+//SF
+//SF     Returns a timer handle (>= 0), or -1 on error.
+//SF
+//------------------------------------------------------------------------------
+int
+canopen_event_loop_add_timer(canopen_event_loop_t *loop,
+                             unsigned int delay_ms, unsigned int interval_ms,
+                             canopen_event_timer_cb_t cb, void *arg)
+{
+    canopen_event_source_t *src;
+    struct itimerspec its;
+    int fd;
+
+    if (loop == NULL || cb == NULL)
+        return -1;
+
+    if ((fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0)
+    {
+        return -1;
+    }
+
+    // a zero it_value would disarm the timer
+    if (delay_ms == 0)
+        delay_ms = interval_ms ? interval_ms : 1;
+
+    its.it_value.tv_sec     =  delay_ms / 1000;
+    its.it_value.tv_nsec    = (delay_ms % 1000) * 1000000;
+    its.it_interval.tv_sec  =  interval_ms / 1000;
+    its.it_interval.tv_nsec = (interval_ms % 1000) * 1000000;
+
+    if (timerfd_settime(fd, 0, &its, NULL) != 0 ||
+        (src = canopen_event_source_add(loop, CANOPEN_EVENT_TIMER, fd, arg)) == NULL)
+    {
+        close(fd);
+        return -1;
+    }
+
+    src->cb.timer = cb;
+
+    return fd;
+}
+
+//------------------------------------------------------------------------------
+//SF
+//SF .. c:function:: int canopen_event_loop_remove_timer(canopen_event_loop_t *loop, int timer)
+//SF
+//SF     Stop and remove a timer. It is safe to call this from a callback.
+//SF
+//------------------------------------------------------------------------------
+int
+canopen_event_loop_remove_timer(canopen_event_loop_t *loop, int timer)
+{
+    if (loop == NULL)
+        return -1;
+
+    if (canopen_event_source_remove(loop, CANOPEN_EVENT_TIMER, timer) != 0)
+        return -1;
+
+    return close(timer);
+}
+
+//------------------------------------------------------------------------------
+// A socket read failed. Errors the kernel reports once (such as ENETDOWN
+// when the interface goes down) leave the socket in the loop, so that it
+// is served again when the bus comes back. Only a socket that is not
+// usable any more, or that keeps failing, is dropped: since it is level-
+// triggered, epoll would otherwise report it ready again at once. The
+// error is reported to the socket's error callback, if it has one.
+//------------------------------------------------------------------------------
+static void
+canopen_event_socket_error(canopen_event_loop_t *loop, canopen_event_source_t *src)
+{
+    int err = errno, removed = 0;
+
+    if (err == EAGAIN || err == EWOULDBLOCK || err == EINTR)
+        return;
+
+    if (err == EBADF || err == ENOTSOCK || err == EFAULT || err == EINVAL ||
+        ++src->errors >= CANOPEN_EVENT_SOCKET_ERRORS_MAX)
+    {
+        canopen_event_source_remove(loop, CANOPEN_EVENT_SOCKET, src->fd);
+        removed = 1;
+    }
+
+    if (src->error_cb)
+    {
+        src->error_cb(loop, src->fd, err, removed, src->arg);
+    }
+    else
+    {
+        fprintf(stderr, "%s: CAN socket read failed: %s%s\n", __PRETTY_FUNCTION__,
+                strerror(err), removed ? " (socket removed)" : "");
+    }
+}
+
+//------------------------------------------------------------------------------
+// Read all queued frames from a socket and dispatch views over them.
+//------------------------------------------------------------------------------
+static void
+canopen_event_socket_dispatch_view(canopen_event_loop_t *loop, canopen_event_source_t *src)
+{
+    struct canfd_frame   can_frames[CANOPEN_FRAME_BATCH_MAX];
+    canopen_frame_view_t views[CANOPEN_FRAME_BATCH_MAX];
+    canopen_frame_meta_t meta[CANOPEN_FRAME_BATCH_MAX];
+    int i, n;
+
+    if ((n = canopen_frame_recv_batch_raw(src->fd, can_frames, views, meta, CANOPEN_FRAME_BATCH_MAX)) < 0)
+    {
+        canopen_event_socket_error(loop, src);
+        return;
+    }
+
+    src->errors = 0;
+
+    for (i = 0; i < n && !src->dead; i++)
+    {
+        src->cb.view(loop, src->fd, &views[i], &meta[i], src->arg);
+    }
+}
+
+//------------------------------------------------------------------------------
+// Read all queued frames from a socket and dispatch them.
+//------------------------------------------------------------------------------
+static void
+canopen_event_socket_dispatch(canopen_event_loop_t *loop, canopen_event_source_t *src)
+{
+    canopen_frame_t      frames[CANOPEN_FRAME_BATCH_MAX];
+    canopen_frame_meta_t meta[CANOPEN_FRAME_BATCH_MAX];
+    int i, n;
+
+    if (src->view)
+    {
+        canopen_event_socket_dispatch_view(loop, src);
+        return;
+    }
+
+    if ((n = canopen_frame_recv_batch_meta(src->fd, frames, meta, CANOPEN_FRAME_BATCH_MAX)) < 0)
+    {
+        canopen_event_socket_error(loop, src);
+        return;
+    }
+
+    src->errors = 0;
+
+    // stop dispatching if the callback removes the socket
+    for (i = 0; i < n && !src->dead; i++)
+    {
+        src->cb.frame(loop, src->fd, &frames[i], &meta[i], src->arg);
+    }
+}
+
+//------------------------------------------------------------------------------
+// Acknowledge a timer expiration and dispatch it.
+//------------------------------------------------------------------------------
+static void
+canopen_event_timer_dispatch(canopen_event_loop_t *loop, canopen_event_source_t *src)
+{
+    uint64_t expirations;
+
+    if (read(src->fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+    {
+        return;
+    }
+
+    src->cb.timer(loop, src->fd, expirations, src->arg);
+}
+
+//------------------------------------------------------------------------------
+//SF
+//SF .. c:function:: int canopen_event_loop_run_once(canopen_event_loop_t *loop, int timeout_ms)
+//SF
+//SF     Wait up to *timeout_ms* (-1 = forever) for events, and dispatch all
+//SF     ready sockets and timers. A socket read error only concerns that
+//SF     socket: it is passed to the socket's error callback (see
+//SF     canopen_event_loop_socket_error_cb), and the other sources are
+//SF     served as usual.
+//SF
+//SF     Returns the number of event sources dispatched, or -1 if waiting
+//SF     for events failed.
+//SF
+//------------------------------------------------------------------------------
+int
+canopen_event_loop_run_once(canopen_event_loop_t *loop, int timeout_ms)
+{
+    struct epoll_event events[CANOPEN_EVENT_MAX];
+    canopen_event_source_t *src;
+    int i, n;
+
+    if (loop == NULL)
+        return -1;
+
+    if ((n = epoll_wait(loop->epoll_fd, events, CANOPEN_EVENT_MAX, timeout_ms)) < 0)
+    {
+        return (errno == EINTR) ? 0 : -1;
+    }
+
+    for (i = 0; i < n; i++)
+    {
+        src = (canopen_event_source_t *)events[i].data.ptr;
+
+        if (src->dead)
+            continue;
+
+        if (src->type == CANOPEN_EVENT_SOCKET)
+            canopen_event_socket_dispatch(loop, src);
+        else
+            canopen_event_timer_dispatch(loop, src);
+    }
+
+    canopen_event_source_reap(loop);
+
+    return n;
+}
+
+//------------------------------------------------------------------------------
+//SF
+//SF .. c:function:: int canopen_event_loop_run(canopen_event_loop_t *loop)
+//SF
+//SF     Dispatch events until canopen_event_loop_stop is called. Returns
+//SF     -1 if waiting for events failed.
+//SF
+//------------------------------------------------------------------------------
+int
+canopen_event_loop_run(canopen_event_loop_t *loop)
+{
+    if (loop == NULL)
+        return -1;
+
+    loop->running = 1;
+
+    while (loop->running)
+    {
+        if (canopen_event_loop_run_once(loop, -1) < 0)
+        {
+            loop->running = 0;
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+//SF
+//SF .. c:function:: void canopen_event_loop_stop(canopen_event_loop_t *loop)
+//SF
+//SF     Make canopen_event_loop_run return after the current dispatch round.
+//SF
+//------------------------------------------------------------------------------
+void
+canopen_event_loop_stop(canopen_event_loop_t *loop)
+{
+    if (loop)
+        loop->running = 0;
+}
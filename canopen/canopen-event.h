@@ -0,0 +1,68 @@
+//------------------------------------------------------------------------------
+// Copyright (C) 2012, Robert Johansson, Raditex AB
+// All rights reserved.
+//
+// This file is part of the rSCADA system.
+//
+// rSCADA
+// http://www.rSCADA.se
+// info@rscada.se
+//
+//------------------------------------------------------------------------------
+
+//
+// CANopen event loop: multiplexes many CAN sockets and timers in one thread
+// (epoll + timerfd).
+//
+
+#ifndef _CANOPEN_EVENT_H_
+#define _CANOPEN_EVENT_H_
+
+#include <stdint.h>
+
+#include "canopen.h"
+#include "canopen-view.h"
+
+typedef struct _canopen_event_loop canopen_event_loop_t;
+
+// called for every frame received on a registered socket
+typedef void (*canopen_event_frame_cb_t)(canopen_event_loop_t *loop, int sock,
+                                         canopen_frame_t *frame,
+                                         canopen_frame_meta_t *meta, void *arg);
+
+// as above, with a view over the received frame (valid during the call only)
+typedef void (*canopen_event_view_cb_t)(canopen_event_loop_t *loop, int sock,
+                                        const canopen_frame_view_t *view,
+                                        canopen_frame_meta_t *meta, void *arg);
+
+// called when a registered socket cannot be read (err = errno). If
+// removed is set, the socket was taken out of the loop and may be added
+// again (also from this callback).
+typedef void (*canopen_event_error_cb_t)(canopen_event_loop_t *loop, int sock,
+                                         int err, int removed, void *arg);
+
+// called when a timer expires (expirations > 1 if the loop fell behind)
+typedef void (*canopen_event_timer_cb_t)(canopen_event_loop_t *loop, int timer,
+                                         uint64_t expirations, void *arg);
+
+canopen_event_loop_t *canopen_event_loop_new();
+void                  canopen_event_loop_free(canopen_event_loop_t *loop);
+
+int canopen_event_loop_add_socket(canopen_event_loop_t *loop, int sock,
+                                  canopen_event_frame_cb_t cb, void *arg);
+int canopen_event_loop_add_socket_view(canopen_event_loop_t *loop, int sock,
+                                       canopen_event_view_cb_t cb, void *arg);
+int canopen_event_loop_remove_socket(canopen_event_loop_t *loop, int sock);
+int canopen_event_loop_socket_error_cb(canopen_event_loop_t *loop, int sock,
+                                       canopen_event_error_cb_t cb);
+
+int canopen_event_loop_add_timer(canopen_event_loop_t *loop,
+                                 unsigned int delay_ms, unsigned int interval_ms,
+                                 canopen_event_timer_cb_t cb, void *arg);
+int canopen_event_loop_remove_timer(canopen_event_loop_t *loop, int timer);
+
+int  canopen_event_loop_run_once(canopen_event_loop_t *loop, int timeout_ms);
+int  canopen_event_loop_run(canopen_event_loop_t *loop);
+void canopen_event_loop_stop(canopen_event_loop_t *loop);
+
+#endif /* _CANOPEN_EVENT_H_ */
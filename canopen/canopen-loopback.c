@@ -0,0 +1,479 @@
+//------------------------------------------------------------------------------
+// Copyright (C) 2012, Robert Johansson, Raditex AB
+// All rights reserved.
+//
+// This file is part of the rSCADA system.
+//
+// rSCADA
+// http://www.rSCADA.se
+// info@rscada.se
+//
+//------------------------------------------------------------------------------
+
+#include <canopen.h>
+#include <canopen-com.h>
+#include <canopen-transport.h>
+#include <canopen-loopback.h>
+#include <can-if.h>
+
+#include <sched.h>
+#include <time.h>
+
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+
+#define CANOPEN_LOOPBACK_SPIN 64 // polls before yielding the CPU
+
+typedef struct _canopen_loopback_slot {
+
+    uint32_t        seq;    // position the slot is ready for (see below)
+    canopen_frame_t frame;
+    struct timespec ts;
+
+} canopen_loopback_slot_t;
+
+//
+// Receive queue of an endpoint: a bounded multi-producer queue where each
+// slot carries a sequence number. A slot at position pos is free for a
+// producer when seq == pos, and holds a frame for the consumer when
+// seq == pos + 1.
+//
+typedef struct _canopen_loopback_ep {
+
+    canopen_transport_t      tp;    // must be first
+    canopen_loopback_bus_t  *bus;
+
+    canopen_loopback_slot_t *slots;
+    uint32_t                 mask;
+    uint32_t                 tail;  // next position for producers
+    uint32_t                 head;  // next position for the consumer
+
+    uint32_t                 filter[CAN_COB_ID_COUNT / 32]; // accepted COB-IDs
+    int                      filter_eff;    // extended frames accepted
+    int                      closed;
+    int                      ts_mode;
+    unsigned int             timeout_ms;
+    uint64_t                 drops; // frames lost to a full queue
+
+} canopen_loopback_ep_t;
+
+struct _canopen_loopback_bus {
+
+    uint32_t               queue_len;
+    uint32_t               n_eps;
+    canopen_loopback_ep_t *eps[CANOPEN_LOOPBACK_ENDPOINTS_MAX];
+};
+
+//------------------------------------------------------------------------------
+// Queue a frame for an endpoint. Returns 0, or -1 if the queue is full.
+//------------------------------------------------------------------------------
+static int
+canopen_loopback_push(canopen_loopback_ep_t *ep, canopen_frame_t *frame, struct timespec *ts)
+{
+    canopen_loopback_slot_t *slot;
+    uint32_t pos, seq;
+    int32_t diff;
+
+    pos = __atomic_load_n(&ep->tail, __ATOMIC_RELAXED);
+
+    for (;;)
+    {
+        slot = &ep->slots[pos & ep->mask];
+        seq  = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        diff = (int32_t)(seq - pos);
+
+        if (diff == 0)
+        {
+            // free slot: claim it (pos is reloaded if another producer won)
+            if (__atomic_compare_exchange_n(&ep->tail, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        }
+        else if (diff < 0)
+        {
+            return -1; // consumer has not freed the slot yet: queue full
+        }
+        else
+        {
+            pos = __atomic_load_n(&ep->tail, __ATOMIC_RELAXED);
+        }
+    }
+
+    memcpy(&slot->frame, frame, sizeof(canopen_frame_t));
+    slot->ts = *ts;
+
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+// Take the next frame from the endpoint's queue. Returns 0, or -1 if empty.
+//------------------------------------------------------------------------------
+static int
+canopen_loopback_pop(canopen_loopback_ep_t *ep, canopen_frame_t *frame, canopen_frame_meta_t *meta)
+{
+    canopen_loopback_slot_t *slot;
+
+    slot = &ep->slots[ep->head & ep->mask];
+
+    if ((int32_t)(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - (ep->head + 1)) < 0)
+        return -1;
+
+    memcpy(frame, &slot->frame, sizeof(canopen_frame_t));
+
+    if (meta)
+    {
+        bzero((void *)meta, sizeof(canopen_frame_meta_t));
+        if (ep->ts_mode != CAN_TIMESTAMP_NONE)
+            meta->ts = slot->ts;
+    }
+
+    // hand the slot back to the producers for the next lap of the ring
+    __atomic_store_n(&slot->seq, ep->head + ep->mask + 1, __ATOMIC_RELEASE);
+    ep->head++;
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+// Hand a frame sent at ts to every other endpoint whose filter accepts it.
+//------------------------------------------------------------------------------
+static int
+canopen_loopback_deliver(canopen_loopback_ep_t *self, canopen_frame_t *frame, struct timespec *ts)
+{
+    canopen_loopback_bus_t *bus = self->bus;
+    canopen_loopback_ep_t *ep;
+    uint32_t i, n, cob_id;
+
+    if (frame->data_len > CANOPEN_FRAME_DATA_LEN_FD ||
+        (frame->data_len > CANOPEN_FRAME_DATA_LEN && !self->tp.fd_frames))
+    {
+        errno = EINVAL;
+        return 1;
+    }
+
+    cob_id = ((frame->function_code & 0xF) << 7) | (frame->id & 0x7F);
+
+    n = __atomic_load_n(&bus->n_eps, __ATOMIC_ACQUIRE);
+
+    for (i = 0; i < n; i++)
+    {
+        ep = __atomic_load_n(&bus->eps[i], __ATOMIC_ACQUIRE);
+
+        if (ep == NULL || ep == self || __atomic_load_n(&ep->closed, __ATOMIC_RELAXED))
+            continue;
+
+        // a frame is received by all other endpoints, as on a real bus
+        if (frame->type == CANOPEN_FLAG_STANDARD ?
+            !(__atomic_load_n(&ep->filter[cob_id >> 5], __ATOMIC_RELAXED) & (1U << (cob_id & 0x1F))) :
+            !__atomic_load_n(&ep->filter_eff, __ATOMIC_RELAXED))
+            continue;
+
+        if (canopen_loopback_push(ep, frame, ts) != 0)
+            __atomic_fetch_add(&ep->drops, 1, __ATOMIC_RELAXED);
+    }
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+// Transport operations
+//------------------------------------------------------------------------------
+static int
+canopen_loopback_send(canopen_transport_t *tp, canopen_frame_t *frame)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    return canopen_loopback_deliver((canopen_loopback_ep_t *)tp, frame, &ts);
+}
+
+//------------------------------------------------------------------------------
+// Frames built in SocketCAN format: the endpoint queues hold parsed frames,
+// so each is parsed, but the batch shares one time stamp, as frames sent
+// back to back would get on a real bus.
+//------------------------------------------------------------------------------
+static int
+canopen_loopback_send_raw(canopen_transport_t *tp, struct canfd_frame *cf, const int *mtu, int n)
+{
+    canopen_frame_t frame;
+    struct timespec ts;
+    int i;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    for (i = 0; i < n; i++)
+    {
+        if (canopen_frame_parse_mtu(&frame, &cf[i], mtu[i]) != 0 ||
+            canopen_loopback_deliver((canopen_loopback_ep_t *)tp, &frame, &ts) != 0)
+            return i ? i : -1;
+    }
+
+    return n;
+}
+
+static int
+canopen_loopback_recv(canopen_transport_t *tp, canopen_frame_t *frame, canopen_frame_meta_t *meta,
+                      int timeout_ms)
+{
+    canopen_loopback_ep_t *ep = (canopen_loopback_ep_t *)tp;
+    struct timespec now, deadline;
+    int spin = 0;
+
+    if (canopen_loopback_pop(ep, frame, meta) == 0)
+        return 0;
+
+    if (timeout_ms < 0)
+        timeout_ms = ep->timeout_ms; // 0: wait forever
+    else if (timeout_ms == 0)
+    {
+        errno = EAGAIN;
+        return 1;
+    }
+
+    if (timeout_ms)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec  += timeout_ms / 1000;
+        deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+    }
+
+    for (;;)
+    {
+        if (canopen_loopback_pop(ep, frame, meta) == 0)
+            return 0;
+
+        if (++spin < CANOPEN_LOOPBACK_SPIN)
+            continue;
+
+        spin = 0;
+        sched_yield();
+
+        if (timeout_ms)
+        {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            if (now.tv_sec > deadline.tv_sec ||
+                (now.tv_sec == deadline.tv_sec && now.tv_nsec >= deadline.tv_nsec))
+            {
+                errno = EAGAIN;
+                return 1;
+            }
+        }
+    }
+}
+
+static int
+canopen_loopback_set_filter(canopen_transport_t *tp, can_subscription_t *subs, int n)
+{
+    canopen_loopback_ep_t *ep = (canopen_loopback_ep_t *)tp;
+    uint32_t bitmap[CAN_COB_ID_COUNT / 32];
+    int i;
+
+    if (n == 0)
+        memset(bitmap, 0xFF, sizeof(bitmap));
+    else
+        can_filter_bitmap(subs, n, bitmap);
+
+    // senders may race with the update, as with a kernel filter change
+    for (i = 0; i < CAN_COB_ID_COUNT / 32; i++)
+        __atomic_store_n(&ep->filter[i], bitmap[i], __ATOMIC_RELAXED);
+
+    // subscriptions only match standard frames, like the kernel filters
+    __atomic_store_n(&ep->filter_eff, n == 0, __ATOMIC_RELAXED);
+
+    return 0;
+}
+
+static int
+canopen_loopback_filter_save(canopen_transport_t *tp, can_filter_saved_t *saved)
+{
+    canopen_loopback_ep_t *ep = (canopen_loopback_ep_t *)tp;
+    int i;
+
+    saved->n = -1;
+    for (i = 0; i < CAN_COB_ID_COUNT / 32; i++)
+        saved->bitmap[i] = __atomic_load_n(&ep->filter[i], __ATOMIC_RELAXED);
+    saved->bitmap_eff = __atomic_load_n(&ep->filter_eff, __ATOMIC_RELAXED);
+
+    return 0;
+}
+
+static int
+canopen_loopback_filter_restore(canopen_transport_t *tp, can_filter_saved_t *saved)
+{
+    canopen_loopback_ep_t *ep = (canopen_loopback_ep_t *)tp;
+    int i;
+
+    for (i = 0; i < CAN_COB_ID_COUNT / 32; i++)
+        __atomic_store_n(&ep->filter[i], saved->bitmap[i], __ATOMIC_RELAXED);
+    __atomic_store_n(&ep->filter_eff, saved->bitmap_eff, __ATOMIC_RELAXED);
+
+    return 0;
+}
+
+static int
+canopen_loopback_timestamp(canopen_transport_t *tp, int mode)
+{
+    ((canopen_loopback_ep_t *)tp)->ts_mode = mode;
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+// Closing an endpoint only detaches it, senders may still be looking at it;
+// the memory is released by canopen_loopback_bus_free.
+//------------------------------------------------------------------------------
+static void
+canopen_loopback_close(canopen_transport_t *tp)
+{
+    __atomic_store_n(&((canopen_loopback_ep_t *)tp)->closed, 1, __ATOMIC_RELEASE);
+}
+
+static const canopen_transport_ops_t canopen_loopback_ops = {
+    canopen_loopback_send,
+    canopen_loopback_recv,
+    canopen_loopback_set_filter,
+    canopen_loopback_timestamp,
+    canopen_loopback_close,
+    canopen_loopback_send_raw,
+    canopen_loopback_filter_save,
+    canopen_loopback_filter_restore
+};
+
+//------------------------------------------------------------------------------
+//SF
+//SF .. c:function:: canopen_loopback_bus_t *canopen_loopback_bus_new(unsigned int queue_len)
+//SF
+//SF     Create an in-process CAN bus. Each endpoint can hold queue_len
+//SF     unread frames (rounded up to a power of two, 0 selects
+//SF     CANOPEN_LOOPBACK_QUEUE_LEN); further frames are dropped and counted.
+//SF
+//------------------------------------------------------------------------------
+canopen_loopback_bus_t *
+canopen_loopback_bus_new(unsigned int queue_len)
+{
+    canopen_loopback_bus_t *bus;
+    uint32_t len = 1;
+
+    if (queue_len == 0)
+        queue_len = CANOPEN_LOOPBACK_QUEUE_LEN;
+
+    while (len < queue_len)
+        len <<= 1;
+
+    if ((bus = (canopen_loopback_bus_t *)malloc(sizeof(canopen_loopback_bus_t))) == NULL)
+        return NULL;
+
+    bzero((void *)bus, sizeof(canopen_loopback_bus_t));
+    bus->queue_len = len;
+
+    return bus;
+}
+
+//------------------------------------------------------------------------------
+//SF
+//SF .. c:function:: void canopen_loopback_bus_free(canopen_loopback_bus_t *bus)
+//SF
+//SF     Free the bus and all its endpoints. No endpoint may be in use.
+//SF
+//------------------------------------------------------------------------------
+void
+canopen_loopback_bus_free(canopen_loopback_bus_t *bus)
+{
+    uint32_t i;
+
+    if (bus == NULL)
+        return;
+
+    for (i = 0; i < bus->n_eps; i++)
+    {
+        if (bus->eps[i])
+        {
+            free(bus->eps[i]->slots);
+            free(bus->eps[i]);
+        }
+    }
+
+    free(bus);
+}
+
+//------------------------------------------------------------------------------
+//SF
+//SF .. c:function:: canopen_transport_t *canopen_loopback_open(canopen_loopback_bus_t *bus, unsigned int timeout_ms)
+//SF
+//SF     Attach a new endpoint to the bus. Receiving waits at most
+//SF     timeout_ms for a frame (0: wait forever). The endpoint accepts all
+//SF     frames until a filter is set, and carries CAN FD frames if the
+//SF     caller sets fd_frames in the returned transport.
+//SF
+//------------------------------------------------------------------------------
+canopen_transport_t *
+canopen_loopback_open(canopen_loopback_bus_t *bus, unsigned int timeout_ms)
+{
+    canopen_loopback_ep_t *ep;
+    uint32_t i, idx;
+
+    if ((ep = (canopen_loopback_ep_t *)malloc(sizeof(canopen_loopback_ep_t))) == NULL)
+        return NULL;
+
+    bzero((void *)ep, sizeof(canopen_loopback_ep_t));
+
+    if ((ep->slots = (canopen_loopback_slot_t *)malloc(bus->queue_len * sizeof(canopen_loopback_slot_t))) == NULL)
+    {
+        free(ep);
+        return NULL;
+    }
+
+    for (i = 0; i < bus->queue_len; i++)
+        ep->slots[i].seq = i;
+
+    ep->tp.ops     = &canopen_loopback_ops;
+    ep->tp.sock    = -1;
+    ep->tp.priv    = bus;
+    ep->tp.sdo_timeout_ms = CANOPEN_SDO_TIMEOUT_MS;
+    ep->bus        = bus;
+    ep->mask       = bus->queue_len - 1;
+    ep->timeout_ms = timeout_ms;
+    memset(ep->filter, 0xFF, sizeof(ep->filter));
+    ep->filter_eff = 1;
+
+    // reserve a slot, then publish the endpoint in it
+    idx = __atomic_load_n(&bus->n_eps, __ATOMIC_RELAXED);
+    do
+    {
+        if (idx >= CANOPEN_LOOPBACK_ENDPOINTS_MAX)
+        {
+            free(ep->slots);
+            free(ep);
+            return NULL;
+        }
+    } while (!__atomic_compare_exchange_n(&bus->n_eps, &idx, idx + 1, 1,
+                                          __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+    __atomic_store_n(&bus->eps[idx], ep, __ATOMIC_RELEASE);
+
+    return &ep->tp;
+}
+
+//------------------------------------------------------------------------------
+//SF
+//SF .. c:function:: uint64_t canopen_loopback_drops(canopen_transport_t *tp)
+//SF
+//SF     Number of frames dropped because the endpoint's queue was full.
+//SF
+//------------------------------------------------------------------------------
+uint64_t
+canopen_loopback_drops(canopen_transport_t *tp)
+{
+    return __atomic_load_n(&((canopen_loopback_ep_t *)tp)->drops, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,42 @@
+//------------------------------------------------------------------------------
+// Copyright (C) 2012, Robert Johansson, Raditex AB
+// All rights reserved.
+//
+// This file is part of the rSCADA system.
+//
+// rSCADA
+// http://www.rSCADA.se
+// info@rscada.se
+//
+//------------------------------------------------------------------------------
+
+//
+// CANopen in-process loopback bus: a software CAN bus for simulated nodes,
+// tests and benchmarks that run without a kernel CAN device. Every
+// endpoint is a canopen_transport_t; a frame sent on one endpoint is
+// delivered to all other endpoints whose filter accepts it. Each endpoint
+// has a lock-free multi-producer receive queue, so endpoints may be served
+// by different threads.
+//
+
+#ifndef _CANOPEN_LOOPBACK_H_
+#define _CANOPEN_LOOPBACK_H_
+
+#include <stdint.h>
+
+#include "canopen.h"
+#include "canopen-transport.h"
+
+#define CANOPEN_LOOPBACK_ENDPOINTS_MAX 64   // endpoints per bus
+#define CANOPEN_LOOPBACK_QUEUE_LEN     1024 // default receive queue length
+
+typedef struct _canopen_loopback_bus canopen_loopback_bus_t;
+
+canopen_loopback_bus_t *canopen_loopback_bus_new(unsigned int queue_len);
+void                    canopen_loopback_bus_free(canopen_loopback_bus_t *bus);
+
+canopen_transport_t *canopen_loopback_open(canopen_loopback_bus_t *bus, unsigned int timeout_ms);
+
+uint64_t canopen_loopback_drops(canopen_transport_t *tp);
+
+#endif /* _CANOPEN_LOOPBACK_H_ */
@@ -0,0 +1,178 @@
+//------------------------------------------------------------------------------
+// Copyright (C) 2012, Robert Johansson, Raditex AB
+// All rights reserved.
+//
+// This file is part of the rSCADA system.
+//
+// rSCADA
+// http://www.rSCADA.se
+// info@rscada.se
+//
+//------------------------------------------------------------------------------
+
+#include <canopen.h>
+#include <canopen-pool.h>
+
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+static canopen_frame_pool_t *canopen_frame_pool = NULL;
+
+//------------------------------------------------------------------------------
+//SF
+//SF .. c:function:: canopen_frame_pool_t *canopen_frame_pool_new(unsigned int capacity)
+//SF
+//SF     Allocate a pool of capacity frames. Returns NULL on error.
+//SF
+//------------------------------------------------------------------------------
+canopen_frame_pool_t *
+canopen_frame_pool_new(unsigned int capacity)
+{
+    canopen_frame_pool_t *pool;
+    uint32_t i;
+
+    if (capacity == 0)
+    {
+        return NULL;
+    }
+
+    if ((pool = (canopen_frame_pool_t *)malloc(sizeof(canopen_frame_pool_t))) == NULL)
+    {
+        fprintf(stderr, "%s: failed to allocate frame pool\n", __PRETTY_FUNCTION__);
+        return NULL;
+    }
+
+    bzero((void *)pool, sizeof(canopen_frame_pool_t));
+
+    pool->frames = (canopen_frame_t *)malloc(capacity * sizeof(canopen_frame_t));
+    pool->next   = (uint32_t *)malloc(capacity * sizeof(uint32_t));
+    if (pool->frames == NULL || pool->next == NULL)
+    {
+        fprintf(stderr, "%s: failed to allocate frame pool\n", __PRETTY_FUNCTION__);
+        canopen_frame_pool_free(pool);
+        return NULL;
+    }
+
+    // all frames free, in order
+    for (i = 0; i < capacity; i++)
+        pool->next[i] = (i + 1 < capacity) ? i + 2 : 0;
+
+    pool->capacity = capacity;
+    pool->head     = 1;
+    pool->n_free   = capacity;
+
+    return pool;
+}
+
+//------------------------------------------------------------------------------
+//SF
+//SF .. c:function:: void canopen_frame_pool_free(canopen_frame_pool_t *pool)
+//SF
+//SF     Release the pool. Its frames must no longer be in use, and it must
+//SF     not be the pool installed with canopen_frame_pool_set.
+//SF
+//------------------------------------------------------------------------------
+void
+canopen_frame_pool_free(canopen_frame_pool_t *pool)
+{
+    if (pool == NULL)
+        return;
+
+    free(pool->frames);
+    free(pool->next);
+    free(pool);
+}
+
+//------------------------------------------------------------------------------
+//SF
+//SF .. c:function:: canopen_frame_t *canopen_frame_pool_get(canopen_frame_pool_t *pool)
+//SF
+//SF     Take a frame from the pool. The frame is not cleared. Returns NULL
+//SF     if the pool is empty.
+//SF
+//------------------------------------------------------------------------------
+canopen_frame_t *
+canopen_frame_pool_get(canopen_frame_pool_t *pool)
+{
+    uint64_t head, new_head;
+    uint32_t slot;
+
+    head = __atomic_load_n(&pool->head, __ATOMIC_ACQUIRE);
+
+    do
+    {
+        if ((slot = (uint32_t)head) == 0)
+            return NULL;
+
+        // the tag in the upper half changes on every update (ABA)
+        new_head = ((head >> 32) + 1) << 32 | __atomic_load_n(&pool->next[slot - 1], __ATOMIC_RELAXED);
+    }
+    while (!__atomic_compare_exchange_n(&pool->head, &head, new_head, 1, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE));
+
+    __atomic_fetch_sub(&pool->n_free, 1, __ATOMIC_RELAXED);
+
+    return &(pool->frames[slot - 1]);
+}
+
+//------------------------------------------------------------------------------
+//SF
+//SF .. c:function:: void canopen_frame_pool_put(canopen_frame_pool_t *pool, canopen_frame_t *frame)
+//SF
+//SF     Return a frame taken from the pool.
+//SF
+//------------------------------------------------------------------------------
+void
+canopen_frame_pool_put(canopen_frame_pool_t *pool, canopen_frame_t *frame)
+{
+    uint64_t head, new_head;
+    uint32_t slot = (uint32_t)(frame - pool->frames) + 1;
+
+    head = __atomic_load_n(&pool->head, __ATOMIC_RELAXED);
+
+    do
+    {
+        __atomic_store_n(&pool->next[slot - 1], (uint32_t)head, __ATOMIC_RELAXED);
+        new_head = ((head >> 32) + 1) << 32 | slot;
+    }
+    while (!__atomic_compare_exchange_n(&pool->head, &head, new_head, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+    __atomic_fetch_add(&pool->n_free, 1, __ATOMIC_RELAXED);
+}
+
+// frame was taken from the pool
+int
+canopen_frame_pool_owns(canopen_frame_pool_t *pool, canopen_frame_t *frame)
+{
+    return pool && frame >= pool->frames && frame < pool->frames + pool->capacity;
+}
+
+// number of free frames (a snapshot when other threads use the pool)
+unsigned int
+canopen_frame_pool_available(canopen_frame_pool_t *pool)
+{
+    return __atomic_load_n(&pool->n_free, __ATOMIC_RELAXED);
+}
+
+//------------------------------------------------------------------------------
+//SF
+//SF .. c:function:: void canopen_frame_pool_set(canopen_frame_pool_t *pool)
+//SF
+//SF     Let canopen_frame_new and canopen_frame_free use pool, or the heap
+//SF     again if pool is NULL. Only replace a pool once the frames taken
+//SF     from it have been freed.
+//SF
+//------------------------------------------------------------------------------
+void
+canopen_frame_pool_set(canopen_frame_pool_t *pool)
+{
+    __atomic_store_n(&canopen_frame_pool, pool, __ATOMIC_RELEASE);
+}
+
+canopen_frame_pool_t *
+canopen_frame_pool_current()
+{
+    return __atomic_load_n(&canopen_frame_pool, __ATOMIC_ACQUIRE);
+}
@@ -0,0 +1,50 @@
+//------------------------------------------------------------------------------
+// Copyright (C) 2012, Robert Johansson, Raditex AB
+// All rights reserved.
+//
+// This file is part of the rSCADA system.
+//
+// rSCADA
+// http://www.rSCADA.se
+// info@rscada.se
+//
+//------------------------------------------------------------------------------
+
+//
+// CANopen frame pool: a fixed number of frames allocated once, handed out
+// and returned without locks, from any thread. Once a pool is installed
+// with canopen_frame_pool_set, canopen_frame_new and canopen_frame_free
+// take their frames from it (falling back to the heap when it is empty),
+// so capture and queueing code does no heap allocation per frame.
+//
+
+#ifndef _CANOPEN_POOL_H_
+#define _CANOPEN_POOL_H_
+
+#include <stdint.h>
+
+#include "canopen.h"
+
+typedef struct _canopen_frame_pool {
+
+    canopen_frame_t *frames;
+    uint32_t        *next;      // free list links, index + 1 (0 ends the list)
+    uint32_t         capacity;
+    uint64_t         head;      // free list head: ABA tag << 32 | index + 1
+    uint32_t         n_free;
+
+} canopen_frame_pool_t;
+
+canopen_frame_pool_t *canopen_frame_pool_new(unsigned int capacity);
+void                  canopen_frame_pool_free(canopen_frame_pool_t *pool);
+
+canopen_frame_t *canopen_frame_pool_get(canopen_frame_pool_t *pool);
+void             canopen_frame_pool_put(canopen_frame_pool_t *pool, canopen_frame_t *frame);
+int              canopen_frame_pool_owns(canopen_frame_pool_t *pool, canopen_frame_t *frame);
+unsigned int     canopen_frame_pool_available(canopen_frame_pool_t *pool);
+
+// the pool behind canopen_frame_new/free (NULL: the heap)
+void                  canopen_frame_pool_set(canopen_frame_pool_t *pool);
+canopen_frame_pool_t *canopen_frame_pool_current();
+
+#endif /* _CANOPEN_POOL_H_ */
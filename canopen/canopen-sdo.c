@@ -0,0 +1,1225 @@
+//------------------------------------------------------------------------------
+// Copyright (C) 2012, Robert Johansson, Raditex AB
+// All rights reserved.
+//
+// This file is part of the rSCADA system.
+//
+// rSCADA
+// http://www.rSCADA.se
+// info@rscada.se
+//
+//------------------------------------------------------------------------------
+
+#include <canopen.h>
+#include <canopen-sdo.h>
+#include <canopen-transport.h>
+#include <canopen-build.h>
+#include <canopen-types.h>
+#include <canopen-crc.h>
+
+#include <time.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+
+static int canopen_sdo_debug = 0;
+
+// transfer states
+#define SDO_STATE_INIT      0   // initiate request sent
+#define SDO_STATE_SEGMENT   1   // segments or sub-blocks under way
+#define SDO_STATE_END       2   // block transfers: waiting for the end
+#define SDO_STATE_DONE      3
+
+// abort codes sent by the client
+#define SDO_ABORT_TOGGLE    0x05030000
+#define SDO_ABORT_TIMEOUT   0x05040000
+#define SDO_ABORT_BLKSIZE   0x05040002
+#define SDO_ABORT_CRC       0x05040004
+#define SDO_ABORT_MEMORY    0x05040005
+#define SDO_ABORT_LENGTH    0x06070012  // length of service parameter too high
+
+//------------------------------------------------------------------------------
+// Helpers
+//------------------------------------------------------------------------------
+static uint64_t
+canopen_sdo_now_ms()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+// the server has the transfer's timeout (0: tp->sdo_timeout_ms) from now
+// to respond
+static void
+canopen_sdo_deadline(canopen_sdo_client_t *client, canopen_sdo_transfer_t *xfer)
+{
+    xfer->deadline_ms = canopen_sdo_now_ms() +
+                        (xfer->timeout_ms ? xfer->timeout_ms : client->tp->sdo_timeout_ms);
+}
+
+static int
+canopen_sdo_send(canopen_sdo_client_t *client, struct canfd_frame *cf, int mtu)
+{
+    return canopen_transport_send_raw(client->tp, cf, &mtu, 1) == 1 ? 0 : -1;
+}
+
+//------------------------------------------------------------------------------
+// End a transfer and call back. The node is free again before the callback,
+// which may start the next transfer on it (or release xfer).
+//------------------------------------------------------------------------------
+static void
+canopen_sdo_finish(canopen_sdo_client_t *client, canopen_sdo_transfer_t *xfer, uint8_t status,
+                   uint32_t abort_code)
+{
+    client->xfer[xfer->node & 0x7F] = NULL;
+    client->active--;
+
+    xfer->state             = SDO_STATE_DONE;
+    xfer->result.status     = status;
+    xfer->result.abort_code = abort_code;
+
+    if (canopen_sdo_debug)
+        printf("DEBUG: SDO transfer Node=0x%.2X Index=0x%.4X SubIndex=0x%.2X done: %s\n",
+               xfer->node, xfer->index, xfer->subindex, canopen_sdo_result_str(&(xfer->result)));
+
+    if (xfer->cb)
+        xfer->cb(client, xfer, xfer->arg);
+}
+
+// abort the transfer towards the server, then end it with status
+static void
+canopen_sdo_abort(canopen_sdo_client_t *client, canopen_sdo_transfer_t *xfer, uint32_t abort_code,
+                  uint8_t status)
+{
+    struct canfd_frame cf;
+
+    canopen_sdo_send(client, &cf, canopen_build_sdo_abort(&cf, xfer->node, xfer->index, xfer->subindex,
+                                                          abort_code));
+
+    canopen_sdo_finish(client, xfer, status, abort_code);
+}
+
+//------------------------------------------------------------------------------
+// Number of data bytes to put in the next segmented or block SDO segment.
+// On a CAN FD socket a segment carries up to 63 bytes, but a frame can only
+// be padded up to the next valid CAN FD length when it is the last segment
+// and the padding fits in the 3-bit 'n' field. Returns the segment length.
+//------------------------------------------------------------------------------
+static int
+canopen_sdo_seg_len(uint32_t remaining, int seg_max)
+{
+    int len;
+
+    if (remaining > (uint32_t)seg_max)
+        return seg_max;
+
+    if (remaining <= CANOPEN_SDO_SEG_MAX ||
+        canopen_frame_fd_len(remaining + 1) - 1 - remaining <= CANOPEN_SDO_SEG_MAX)
+        return remaining; // last segment
+
+    // largest segment that needs no padding, the rest follows
+    for (len = remaining; canopen_frame_fd_len(len + 1) != len + 1; len--)
+        ;
+
+    return len;
+}
+
+static int
+canopen_sdo_seg_max(canopen_sdo_client_t *client)
+{
+    return client->tp->fd_frames ? CANOPEN_SDO_SEG_MAX_FD : CANOPEN_SDO_SEG_MAX;
+}
+
+//==============================================================================
+// EXPEDIATED AND SEGMENTED UPLOAD
+//==============================================================================
+
+static void
+canopen_sdo_upload_frame(canopen_sdo_client_t *client, canopen_sdo_transfer_t *xfer, canopen_frame_t *frame)
+{
+    canopen_sdo_t *sdo = &(frame->payload.sdo);
+    struct canfd_frame cf;
+    int i, n;
+
+    switch (sdo->command & CANOPEN_SDO_CS_MASK)
+    {
+        case CANOPEN_SDO_CS_TX_IDU:
+        {
+            if (xfer->state != SDO_STATE_INIT)
+                return;
+
+            if (sdo->command & CANOPEN_SDO_CS_ID_E_FLAG)
+            {
+                // expediated reply
+                n = canopen_sdo_get_size(sdo);
+                for (i = 0; i < n && (uint32_t)i < xfer->data_len; i++)
+                    xfer->data[i] = sdo->data[i];
+
+                xfer->size = i;
+                canopen_sdo_finish(client, xfer, CANOPEN_SDO_OK, 0);
+                return;
+            }
+
+            if (xfer->type == CANOPEN_SDO_UPLOAD_EXP)
+            {
+                // segmented reply: go on with a segmented upload if the
+                // size given fits in the buffer, else abort it, so that
+                // the server is not left in the middle of the transfer
+                if (!(sdo->command & CANOPEN_SDO_CS_ID_S_FLAG) ||
+                    canopen_decode_u32(sdo->data) > xfer->data_len)
+                {
+                    canopen_sdo_abort(client, xfer, SDO_ABORT_LENGTH, CANOPEN_SDO_ERR_PROTOCOL);
+                    return;
+                }
+
+                xfer->type = CANOPEN_SDO_UPLOAD_SEG;
+            }
+
+            xfer->state  = SDO_STATE_SEGMENT;
+            xfer->toggle = 0;
+            break;
+        }
+        case CANOPEN_SDO_CS_TX_UDS:
+        {
+            if (xfer->state != SDO_STATE_SEGMENT)
+            {
+                canopen_sdo_finish(client, xfer, CANOPEN_SDO_ERR_PROTOCOL, 0);
+                return;
+            }
+
+            if (((sdo->command & CANOPEN_SDO_CS_DS_T_FLAG) ? 1 : 0) != xfer->toggle)
+            {
+                canopen_sdo_abort(client, xfer, SDO_ABORT_TOGGLE, CANOPEN_SDO_ERR_PROTOCOL);
+                return;
+            }
+
+            n = (sdo->command & CANOPEN_SDO_CS_DS_N_MASK) >> CANOPEN_SDO_CS_DS_N_SHIFT;
+            for (i = 1; i < frame->data_len - n && xfer->offset < xfer->data_len; i++)
+                xfer->data[xfer->offset++] = frame->payload.data[i];
+
+            if (sdo->command & CANOPEN_SDO_CS_DS_C_FLAG)
+            {
+                // we finished
+                xfer->size = xfer->offset;
+                canopen_sdo_finish(client, xfer, CANOPEN_SDO_OK, 0);
+                return;
+            }
+
+            xfer->toggle ^= 1;
+            break;
+        }
+        case CANOPEN_SDO_CS_TX_ADT:
+        {
+            canopen_sdo_finish(client, xfer, CANOPEN_SDO_ERR_ABORT, canopen_sdo_abort_code(sdo));
+            return;
+        }
+        default:
+            return;
+    }
+
+    // request the next segment
+    if (canopen_sdo_send(client, &cf, canopen_build_sdo_uds(&cf, xfer->node, xfer->index, xfer->subindex,
+                                                            xfer->toggle)) != 0)
+    {
+        canopen_sdo_finish(client, xfer, CANOPEN_SDO_ERR_IO, 0);
+        return;
+    }
+
+    canopen_sdo_deadline(client, xfer);
+}
+
+//==============================================================================
+// EXPEDIATED AND SEGMENTED DOWNLOAD
+//==============================================================================
+
+// send the next segment, or end the transfer if all were acknowledged
+static void
+canopen_sdo_download_segment(canopen_sdo_client_t *client, canopen_sdo_transfer_t *xfer)
+{
+    struct canfd_frame cf;
+    uint32_t remaining = xfer->data_len - xfer->offset;
+    int len;
+
+    if (remaining == 0)
+    {
+        xfer->size = xfer->offset;
+        canopen_sdo_finish(client, xfer, CANOPEN_SDO_OK, 0);
+        return;
+    }
+
+    len = canopen_sdo_seg_len(remaining, canopen_sdo_seg_max(client));
+
+    if (canopen_sdo_send(client, &cf, canopen_build_sdo_dds(&cf, xfer->node, &(xfer->data[xfer->offset]), len,
+                                                            xfer->toggle, (uint32_t)len == remaining)) != 0)
+    {
+        canopen_sdo_finish(client, xfer, CANOPEN_SDO_ERR_IO, 0);
+        return;
+    }
+
+    xfer->offset += len;
+    xfer->toggle ^= 1;
+
+    canopen_sdo_deadline(client, xfer);
+}
+
+static void
+canopen_sdo_download_frame(canopen_sdo_client_t *client, canopen_sdo_transfer_t *xfer, canopen_frame_t *frame)
+{
+    canopen_sdo_t *sdo = &(frame->payload.sdo);
+
+    switch (sdo->command & CANOPEN_SDO_CS_MASK)
+    {
+        case CANOPEN_SDO_CS_TX_IDD:
+            if (xfer->state != SDO_STATE_INIT)
+                return;
+
+            if (xfer->type == CANOPEN_SDO_DOWNLOAD_EXP)
+            {
+                xfer->size = xfer->data_len;
+                canopen_sdo_finish(client, xfer, CANOPEN_SDO_OK, 0);
+                return;
+            }
+
+            xfer->state  = SDO_STATE_SEGMENT;
+            xfer->toggle = 0;
+            canopen_sdo_download_segment(client, xfer);
+            return;
+
+        case CANOPEN_SDO_CS_TX_DDS:
+            if (xfer->state != SDO_STATE_SEGMENT)
+                return;
+
+            // the ack carries the toggle of the segment last sent: a late
+            // or repeated ack must not move the transfer on
+            if (((sdo->command & CANOPEN_SDO_CS_DS_T_FLAG) ? 1 : 0) == xfer->toggle)
+            {
+                canopen_sdo_abort(client, xfer, SDO_ABORT_TOGGLE, CANOPEN_SDO_ERR_PROTOCOL);
+                return;
+            }
+
+            canopen_sdo_download_segment(client, xfer);
+            return;
+
+        case CANOPEN_SDO_CS_TX_ADT:
+            canopen_sdo_finish(client, xfer, CANOPEN_SDO_ERR_ABORT, canopen_sdo_abort_code(sdo));
+            return;
+    }
+}
+
+//==============================================================================
+// BLOCK UPLOAD
+//==============================================================================
+
+//------------------------------------------------------------------------------
+// A segment of a sub-block. Only segments in sequence are kept (padding
+// included, until the end tells its size); at the end of the sub-block the
+// last of them is acknowledged and the server sends the rest again.
+//------------------------------------------------------------------------------
+static void
+canopen_sdo_upload_block_segment(canopen_sdo_client_t *client, canopen_sdo_transfer_t *xfer,
+                                 canopen_frame_t *frame)
+{
+    uint8_t command = frame->payload.sdo.command;
+    uint8_t seq_no  = command & 0x7F;
+    struct canfd_frame cf;
+    int i, last = 0;
+
+    if (seq_no == 0)
+    {
+        // abort: no segment has sequence number 0
+        canopen_sdo_finish(client, xfer, CANOPEN_SDO_ERR_ABORT, canopen_sdo_abort_code(&(frame->payload.sdo)));
+        return;
+    }
+
+    if (seq_no == xfer->seq_no)
+    {
+        for (i = 1; i < frame->data_len; i++, xfer->offset++)
+            if (xfer->offset < xfer->data_len)
+                xfer->data[xfer->offset] = frame->payload.data[i];
+
+        xfer->seq_no++;
+        last = (command & CANOPEN_SDO_CS_BD_C_FLAG) ? 1 : 0;
+    }
+    else if (canopen_sdo_debug)
+    {
+        printf("DEBUG: BU segment out of sequence [seq_no = %d, expected %d]\n", seq_no, xfer->seq_no);
+    }
+
+    if (seq_no == xfer->blk_size || (command & CANOPEN_SDO_CS_BD_C_FLAG))
+    {
+        if (canopen_sdo_send(client, &cf, canopen_build_sdo_bu_ack(&cf, xfer->node, xfer->seq_no - 1,
+                                                                   xfer->blk_size)) != 0)
+        {
+            canopen_sdo_finish(client, xfer, CANOPEN_SDO_ERR_IO, 0);
+            return;
+        }
+
+        // CRC of the acknowledged data, but for the padding of the last segment
+        if (xfer->crc_set && !last && xfer->offset <= xfer->data_len)
+        {
+            xfer->crc = canopen_crc16_update(xfer->crc, &(xfer->data[xfer->crc_offset]),
+                                             xfer->offset - xfer->crc_offset);
+            xfer->crc_offset = xfer->offset;
+        }
+
+        xfer->seq_no = 1;
+        if (last)
+            xfer->state = SDO_STATE_END;
+    }
+
+    canopen_sdo_deadline(client, xfer);
+}
+
+static void
+canopen_sdo_upload_block_frame(canopen_sdo_client_t *client, canopen_sdo_transfer_t *xfer,
+                               canopen_frame_t *frame)
+{
+    canopen_sdo_t *sdo = &(frame->payload.sdo);
+    struct canfd_frame cf;
+    uint32_t size;
+    int n;
+
+    if (xfer->state == SDO_STATE_SEGMENT)
+    {
+        canopen_sdo_upload_block_segment(client, xfer, frame);
+        return;
+    }
+
+    switch (sdo->command & CANOPEN_SDO_CS_MASK)
+    {
+        case CANOPEN_SDO_CS_TX_ADT:
+            canopen_sdo_finish(client, xfer, CANOPEN_SDO_ERR_ABORT, canopen_sdo_abort_code(sdo));
+            return;
+
+        case CANOPEN_SDO_CS_TX_IDU:
+            // protocol switch: the server answered with a segmented upload
+            if (xfer->state == SDO_STATE_INIT)
+            {
+                xfer->type = CANOPEN_SDO_UPLOAD_SEG;
+                canopen_sdo_upload_frame(client, xfer, frame);
+            }
+            return;
+
+        case CANOPEN_SDO_CS_TX_BU:
+            break;
+
+        default:
+            return;
+    }
+
+    if (xfer->state == SDO_STATE_INIT && (sdo->command & CANOPEN_SDO_CS_BU_SS_MASK) == CANOPEN_SDO_CS_BU_SS_IBU)
+    {
+        // initiate response: size and CRC support
+        xfer->crc_set = (sdo->command & CANOPEN_SDO_CS_BD_CRC_FLAG) ? 1 : 0;
+        size          = (sdo->command & CANOPEN_SDO_CS_BD_S_FLAG) ? canopen_decode_u32(sdo->data) : 0;
+
+        if (size > xfer->data_len)
+        {
+            canopen_sdo_abort(client, xfer, SDO_ABORT_MEMORY, CANOPEN_SDO_ERR_PROTOCOL);
+            return;
+        }
+
+        if (canopen_sdo_send(client, &cf, canopen_build_sdo_bu_start(&cf, xfer->node)) != 0)
+        {
+            canopen_sdo_finish(client, xfer, CANOPEN_SDO_ERR_IO, 0);
+            return;
+        }
+
+        xfer->state  = SDO_STATE_SEGMENT;
+        xfer->seq_no = 1;
+        xfer->crc    = CANOPEN_CRC16_INIT;
+    }
+    else if (xfer->state == SDO_STATE_END &&
+             (sdo->command & CANOPEN_SDO_CS_BU_SS_MASK) == CANOPEN_SDO_CS_BU_SS_EBU)
+    {
+        // end: the last segment had n bytes without data
+        n    = (sdo->command >> CANOPEN_SDO_CS_DB_N_SHIFT) & CANOPEN_SDO_CS_DB_N_MASK;
+        size = xfer->offset > (uint32_t)n ? xfer->offset - n : 0;
+
+        if (size > xfer->data_len)
+        {
+            canopen_sdo_abort(client, xfer, SDO_ABORT_MEMORY, CANOPEN_SDO_ERR_PROTOCOL);
+            return;
+        }
+
+        if (xfer->crc_set)
+        {
+            if (xfer->crc_offset <= size)
+                xfer->crc = canopen_crc16_update(xfer->crc, &(xfer->data[xfer->crc_offset]),
+                                                 size - xfer->crc_offset);
+
+            if (xfer->crc != canopen_decode_u16(&(frame->payload.data[1])))
+            {
+                canopen_sdo_abort(client, xfer, SDO_ABORT_CRC, CANOPEN_SDO_ERR_PROTOCOL);
+                return;
+            }
+        }
+
+        if (canopen_sdo_send(client, &cf, canopen_build_sdo_ebu(&cf, xfer->node)) != 0)
+        {
+            canopen_sdo_finish(client, xfer, CANOPEN_SDO_ERR_IO, 0);
+            return;
+        }
+
+        xfer->size = size;
+        canopen_sdo_finish(client, xfer, CANOPEN_SDO_OK, 0);
+        return;
+    }
+    else
+    {
+        return;
+    }
+
+    canopen_sdo_deadline(client, xfer);
+}
+
+//==============================================================================
+// BLOCK DOWNLOAD
+//==============================================================================
+
+//------------------------------------------------------------------------------
+// Send the segments of the next sub-block, from xfer->offset, in batches.
+// Returns 0, or -1 on error.
+//------------------------------------------------------------------------------
+static int
+canopen_sdo_download_block_segments(canopen_sdo_client_t *client, canopen_sdo_transfer_t *xfer)
+{
+    int seq_no, len, cont = 0, seg_max = canopen_sdo_seg_max(client);
+    canopen_frame_batch_t batch;
+    struct canfd_frame *cf;
+    uint32_t remaining;
+
+    batch.n = 0;
+    xfer->blk_start = xfer->offset;
+
+    for (seq_no = 1; seq_no <= xfer->blk_size && !cont; seq_no++)
+    {
+        remaining = xfer->data_len - xfer->offset;
+        len       = canopen_sdo_seg_len(remaining, seg_max);
+        cont      = ((uint32_t)len == remaining) ? 1 : 0; // last segment of the transfer
+
+        cf = canopen_frame_batch_slot(&batch);
+        canopen_frame_batch_add(&batch, canopen_build_sdo_bd(cf, xfer->node, &(xfer->data[xfer->offset]), len,
+                                                             seq_no, cont));
+        if (cont)
+            xfer->excess = cf->len - 1 - len;
+
+        if (canopen_frame_batch_full(&batch) && canopen_transport_send_batch(client->tp, &batch) != 0)
+            return -1;
+
+        xfer->offset += len;
+    }
+
+    if (batch.n > 0 && canopen_transport_send_batch(client->tp, &batch) != 0)
+        return -1;
+
+    xfer->blk_sent = seq_no - 1;
+
+    return 0;
+}
+
+static void
+canopen_sdo_download_block_frame(canopen_sdo_client_t *client, canopen_sdo_transfer_t *xfer,
+                                 canopen_frame_t *frame)
+{
+    canopen_sdo_t *sdo = &(frame->payload.sdo);
+    int ack_seq, i, seg_max = canopen_sdo_seg_max(client);
+    struct canfd_frame cf;
+    uint16_t crc = 0;
+
+    switch (sdo->command & (CANOPEN_SDO_CS_MASK|CANOPEN_SDO_CS_DB_SS_MASK))
+    {
+        case CANOPEN_SDO_CS_TX_BD|CANOPEN_SDO_CS_DB_SS_IBD_ACK:
+        {
+            if (xfer->state != SDO_STATE_INIT)
+                return;
+
+            xfer->crc_set  = (sdo->command & CANOPEN_SDO_CS_BD_CRC_FLAG) ? 1 : 0;
+            xfer->blk_size = sdo->data[0] & 0x7F;
+            xfer->state    = SDO_STATE_SEGMENT;
+            break;
+        }
+        case CANOPEN_SDO_CS_TX_BD|CANOPEN_SDO_CS_DB_SS_BD_ACK:
+        {
+            if (xfer->state != SDO_STATE_SEGMENT)
+                return;
+
+            ack_seq        = frame->payload.data[1];
+            xfer->blk_size = frame->payload.data[2] & 0x7F;
+
+            if (ack_seq < xfer->blk_sent)
+            {
+                // not all segments were delivered: resend those after ack_seq
+                xfer->offset = xfer->blk_start;
+                for (i = 0; i < ack_seq; i++)
+                    xfer->offset += canopen_sdo_seg_len(xfer->data_len - xfer->offset, seg_max);
+            }
+            else if (xfer->offset == xfer->data_len)
+            {
+                // all data delivered: end the transfer
+                if (xfer->crc_set)
+                    crc = canopen_crc16(xfer->data, xfer->data_len);
+
+                if (canopen_sdo_send(client, &cf, canopen_build_sdo_ebd(&cf, xfer->node, xfer->excess, crc)) != 0)
+                {
+                    canopen_sdo_finish(client, xfer, CANOPEN_SDO_ERR_IO, 0);
+                    return;
+                }
+
+                xfer->state = SDO_STATE_END;
+                canopen_sdo_deadline(client, xfer);
+                return;
+            }
+            break;
+        }
+        case CANOPEN_SDO_CS_TX_BD|CANOPEN_SDO_CS_DB_SS_BD_END:
+        {
+            if (xfer->state != SDO_STATE_END)
+                return;
+
+            xfer->size = xfer->data_len;
+            canopen_sdo_finish(client, xfer, CANOPEN_SDO_OK, 0);
+            return;
+        }
+        case CANOPEN_SDO_CS_TX_ADT:
+        {
+            canopen_sdo_finish(client, xfer, CANOPEN_SDO_ERR_ABORT, canopen_sdo_abort_code(sdo));
+            return;
+        }
+        default:
+            return;
+    }
+
+    // send the next sub-block
+    if (xfer->blk_size == 0)
+    {
+        canopen_sdo_abort(client, xfer, SDO_ABORT_BLKSIZE, CANOPEN_SDO_ERR_PROTOCOL);
+        return;
+    }
+
+    if (canopen_sdo_download_block_segments(client, xfer) != 0)
+    {
+        canopen_sdo_finish(client, xfer, CANOPEN_SDO_ERR_IO, 0);
+        return;
+    }
+
+    canopen_sdo_deadline(client, xfer);
+}
+
+//==============================================================================
+// CLIENT
+//==============================================================================
+
+//------------------------------------------------------------------------------
+//SF
+//SF .. c:function:: void canopen_sdo_client_init(canopen_sdo_client_t *client, canopen_transport_t *tp)
+//SF
+//SF     Set up an SDO client on the caller's storage, talking through *tp*
+//SF     (nothing to free). canopen_sdo_client_new allocates one.
+//SF
+//------------------------------------------------------------------------------
+void
+canopen_sdo_client_init(canopen_sdo_client_t *client, canopen_transport_t *tp)
+{
+    bzero((void *)client, sizeof(canopen_sdo_client_t));
+    client->tp = tp;
+}
+
+canopen_sdo_client_t *
+canopen_sdo_client_new(canopen_transport_t *tp)
+{
+    canopen_sdo_client_t *client;
+
+    if ((client = (canopen_sdo_client_t *)malloc(sizeof(canopen_sdo_client_t))) == NULL)
+    {
+        fprintf(stderr, "%s: failed to allocate SDO client\n", __PRETTY_FUNCTION__);
+        return NULL;
+    }
+
+    canopen_sdo_client_init(client, tp);
+
+    return client;
+}
+
+void
+canopen_sdo_client_free(canopen_sdo_client_t *client)
+{
+    free(client);
+}
+
+//------------------------------------------------------------------------------
+//SF
+//SF .. c:function:: int canopen_sdo_client_start(canopen_sdo_client_t *client, canopen_sdo_transfer_t *xfer, uint8_t type, uint8_t node, uint16_t index, uint8_t subindex, uint8_t *data, uint32_t data_len, canopen_sdo_done_cb_t cb, void *arg)
+//SF
+//SF     Start a transfer of *type* (CANOPEN_SDO_UPLOAD_* or _DOWNLOAD_*)
+//SF     of object *index*/*subindex* on *node*: send the initiate request
+//SF     and return. *cb* (may be NULL) is called with *arg* when the
+//SF     transfer ends; *xfer->result* then tells how, and *xfer->size* the
+//SF     number of bytes transferred. Uploads are stored in *data*, up to
+//SF     *data_len* bytes.
+//SF
+//SF     Returns 0, or -1 if the transfer could not be started: *node* is
+//SF     not a node id (errno EINVAL), the node already has a transfer in
+//SF     flight (errno EBUSY), or the request could not be sent (see
+//SF     *xfer->result*). *cb* is not called then.
+//SF
+//------------------------------------------------------------------------------
+int
+canopen_sdo_client_start(canopen_sdo_client_t *client, canopen_sdo_transfer_t *xfer, uint8_t type,
+                         uint8_t node, uint16_t index, uint8_t subindex, uint8_t *data, uint32_t data_len,
+                         canopen_sdo_done_cb_t cb, void *arg)
+{
+    struct canfd_frame cf;
+    uint8_t blk_size = client->tp->sdo_block_size;
+    int mtu, len;
+
+    bzero((void *)xfer, sizeof(canopen_sdo_transfer_t));
+
+    xfer->type     = type;
+    xfer->node     = node;
+    xfer->index    = index;
+    xfer->subindex = subindex;
+    xfer->data     = data;
+    xfer->data_len = data_len;
+    xfer->cb       = cb;
+    xfer->arg      = arg;
+
+    xfer->result.status   = CANOPEN_SDO_OK;
+    xfer->result.node     = node;
+    xfer->result.index    = index;
+    xfer->result.subindex = subindex;
+
+    if (node > CAN_SUB_NODE_MAX)
+    {
+        errno = EINVAL;
+        xfer->result.status = CANOPEN_SDO_ERR_PROTOCOL;
+        return -1;
+    }
+
+    if (client->xfer[node & 0x7F] != NULL)
+    {
+        errno = EBUSY;
+        return -1;
+    }
+
+    switch (type)
+    {
+        case CANOPEN_SDO_UPLOAD_EXP:
+        case CANOPEN_SDO_UPLOAD_SEG:
+            mtu = canopen_build_sdo_idu(&cf, node, index, subindex);
+            break;
+
+        case CANOPEN_SDO_UPLOAD_BLOCK:
+            if (blk_size == 0 || blk_size > CANOPEN_SDO_BLOCK_SIZE_MAX)
+                blk_size = CANOPEN_SDO_BLOCK_SIZE_MAX;
+
+            xfer->blk_size = blk_size;
+            mtu = canopen_build_sdo_ibu(&cf, node, index, subindex, blk_size, client->tp->sdo_block_pst, 1);
+            break;
+
+        case CANOPEN_SDO_DOWNLOAD_EXP:
+            len = data_len > 4 ? 4 : data_len;
+            mtu = canopen_build_sdo_idd(&cf, node, index, subindex, canopen_decode_un(data, len), len);
+            break;
+
+        case CANOPEN_SDO_DOWNLOAD_SEG:
+            mtu = canopen_build_sdo_idd_seg(&cf, node, index, subindex, data_len);
+            break;
+
+        case CANOPEN_SDO_DOWNLOAD_BLOCK:
+            mtu = canopen_build_sdo_ibd(&cf, node, index, subindex, data_len, 1);
+            break;
+
+        default:
+            errno = EINVAL;
+            xfer->result.status = CANOPEN_SDO_ERR_PROTOCOL;
+            return -1;
+    }
+
+    if (canopen_sdo_debug)
+        printf("DEBUG: SDO transfer %d to Node=0x%.2X Index=0x%.4X SubIndex=0x%.2X [Size=%d]\n",
+               type, node, index, subindex, data_len);
+
+    if (canopen_sdo_send(client, &cf, mtu) != 0)
+    {
+        xfer->result.status = CANOPEN_SDO_ERR_IO;
+        return -1;
+    }
+
+    xfer->state = SDO_STATE_INIT;
+    client->xfer[node & 0x7F] = xfer;
+    client->active++;
+
+    canopen_sdo_deadline(client, xfer);
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+//SF
+//SF .. c:function:: void canopen_sdo_client_timeout(canopen_sdo_client_t *client, canopen_sdo_transfer_t *xfer, unsigned int timeout_ms)
+//SF
+//SF     Give the transfer its own timeout: how long to wait for each
+//SF     response of the SDO server, starting with the one now awaited (0:
+//SF     the transport's sdo_timeout_ms, the default). Call it right after
+//SF     canopen_sdo_client_start.
+//SF
+//------------------------------------------------------------------------------
+void
+canopen_sdo_client_timeout(canopen_sdo_client_t *client, canopen_sdo_transfer_t *xfer,
+                           unsigned int timeout_ms)
+{
+    xfer->timeout_ms = timeout_ms;
+
+    if (xfer->state != SDO_STATE_DONE)
+        canopen_sdo_deadline(client, xfer);
+}
+
+// a transfer is in flight on node
+int
+canopen_sdo_client_busy(canopen_sdo_client_t *client, uint8_t node)
+{
+    return client->xfer[node & 0x7F] != NULL;
+}
+
+//------------------------------------------------------------------------------
+//SF
+//SF .. c:function:: int canopen_sdo_client_frame(canopen_sdo_client_t *client, canopen_frame_t *frame)
+//SF
+//SF     Advance the transfer of the node that sent *frame*, if it is an SDO
+//SF     server response. Returns 1 if the frame went to a transfer, else 0.
+//SF
+//------------------------------------------------------------------------------
+int
+canopen_sdo_client_frame(canopen_sdo_client_t *client, canopen_frame_t *frame)
+{
+    canopen_sdo_transfer_t *xfer;
+
+    if (frame->type != CANOPEN_FLAG_STANDARD || frame->function_code != CANOPEN_FC_SDO_TX)
+        return 0;
+
+    if ((xfer = client->xfer[frame->id & 0x7F]) == NULL)
+        return 0;
+
+    switch (xfer->type)
+    {
+        case CANOPEN_SDO_UPLOAD_EXP:
+        case CANOPEN_SDO_UPLOAD_SEG:
+            canopen_sdo_upload_frame(client, xfer, frame);
+            break;
+
+        case CANOPEN_SDO_UPLOAD_BLOCK:
+            canopen_sdo_upload_block_frame(client, xfer, frame);
+            break;
+
+        case CANOPEN_SDO_DOWNLOAD_EXP:
+        case CANOPEN_SDO_DOWNLOAD_SEG:
+            canopen_sdo_download_frame(client, xfer, frame);
+            break;
+
+        case CANOPEN_SDO_DOWNLOAD_BLOCK:
+            canopen_sdo_download_block_frame(client, xfer, frame);
+            break;
+    }
+
+    return 1;
+}
+
+//------------------------------------------------------------------------------
+//SF
+//SF .. c:function:: int canopen_sdo_client_tick(canopen_sdo_client_t *client)
+//SF
+//SF     Abort the transfers whose server did not respond in time (ending
+//SF     them with CANOPEN_SDO_ERR_TIMEOUT). Returns the number of transfers
+//SF     still in flight.
+//SF
+//------------------------------------------------------------------------------
+int
+canopen_sdo_client_tick(canopen_sdo_client_t *client)
+{
+    uint64_t now = canopen_sdo_now_ms();
+    int node;
+
+    for (node = 0; node < CANOPEN_SDO_NODE_MAX && client->active > 0; node++)
+    {
+        if (client->xfer[node] && client->xfer[node]->deadline_ms <= now)
+        {
+            canopen_sdo_abort(client, client->xfer[node], SDO_ABORT_TIMEOUT, CANOPEN_SDO_ERR_TIMEOUT);
+        }
+    }
+
+    return client->active;
+}
+
+// ms until the next timeout, -1 if no transfer is in flight
+int
+canopen_sdo_client_next_ms(canopen_sdo_client_t *client)
+{
+    uint64_t now = canopen_sdo_now_ms(), next = UINT64_MAX;
+    int node;
+
+    if (client->active == 0)
+        return -1;
+
+    for (node = 0; node < CANOPEN_SDO_NODE_MAX; node++)
+    {
+        if (client->xfer[node] && client->xfer[node]->deadline_ms < next)
+            next = client->xfer[node]->deadline_ms;
+    }
+
+    return next > now ? (int)(next - now) : 0;
+}
+
+//------------------------------------------------------------------------------
+//SF
+//SF .. c:function:: int canopen_sdo_client_poll(canopen_sdo_client_t *client, int timeout_ms)
+//SF
+//SF     Receive a frame from the client's transport, waiting at most until
+//SF     the next SDO timeout (or *timeout_ms*, if not -1), then advance
+//SF     the transfers. Returns the number of transfers still in flight, or
+//SF     -1 on a receive error.
+//SF
+//------------------------------------------------------------------------------
+int
+canopen_sdo_client_poll(canopen_sdo_client_t *client, int timeout_ms)
+{
+    canopen_frame_t frame;
+    int wait;
+
+    if (client->active == 0)
+        return 0;
+
+    wait = canopen_sdo_client_next_ms(client);
+    if (timeout_ms >= 0 && timeout_ms < wait)
+        wait = timeout_ms;
+
+    if (canopen_transport_recv_timeout(client->tp, &frame, NULL, wait) == 0)
+    {
+        canopen_sdo_client_frame(client, &frame);
+    }
+    else if (errno != EAGAIN && errno != ETIMEDOUT && errno != EINTR)
+    {
+        return -1;
+    }
+
+    return canopen_sdo_client_tick(client);
+}
+
+//------------------------------------------------------------------------------
+//SF
+//SF .. c:function:: int canopen_sdo_client_run(canopen_sdo_client_t *client)
+//SF
+//SF     Poll until all transfers have ended, including those started from
+//SF     the callbacks meanwhile. On a receive error the transfers in flight
+//SF     end with CANOPEN_SDO_ERR_IO and -1 is returned, else 0.
+//SF
+//------------------------------------------------------------------------------
+int
+canopen_sdo_client_run(canopen_sdo_client_t *client)
+{
+    int node;
+
+    while (client->active > 0)
+    {
+        if (canopen_sdo_client_poll(client, -1) < 0)
+        {
+            for (node = 0; node < CANOPEN_SDO_NODE_MAX; node++)
+            {
+                if (client->xfer[node])
+                    canopen_sdo_finish(client, client->xfer[node], CANOPEN_SDO_ERR_IO, 0);
+            }
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+//==============================================================================
+// BULK UPLOAD
+//==============================================================================
+
+//
+// The reads of each node are chained in array order (head, next) and run
+// one after the other; up to window nodes are served at the same time,
+// in the order they first appear. A read that cannot be sent because the
+// transmit queue is full waits (still holding its node's window slot) and
+// is sent again every SDO_BULK_RETRY_MS, for up to one SDO timeout.
+//
+#define SDO_BULK_RETRY_MS   5
+
+typedef struct _canopen_sdo_bulk {
+
+    canopen_sdo_client_t client;
+    canopen_sdo_read_t  *reads;
+    int                 *next;      // next read of the same node, -1 at the end
+    int                  stop;      // receive error: start no more reads
+
+    int     head[CANOPEN_SDO_NODE_MAX];     // next read to start, by node
+    int     current[CANOPEN_SDO_NODE_MAX];  // read in flight, by node
+    uint8_t value[CANOPEN_SDO_NODE_MAX][4]; // expedited reads, by node
+    uint8_t nodes[CANOPEN_SDO_NODE_MAX];    // nodes, in order of appearance
+    int     n_nodes, next_node;
+
+    uint8_t  wait[CANOPEN_SDO_NODE_MAX];    // nodes with a read waiting to be sent
+    int      n_wait;
+    uint64_t wait_until_ms[CANOPEN_SDO_NODE_MAX]; // by node, 0 if not waiting
+
+    canopen_sdo_transfer_t xfer[CANOPEN_SDO_NODE_MAX];
+
+} canopen_sdo_bulk_t;
+
+static void canopen_sdo_bulk_done(canopen_sdo_client_t *client, canopen_sdo_transfer_t *xfer, void *arg);
+
+// start the next read of node; returns 1 if it is under way or waiting
+// to be sent, or 0 if the node has none left
+static int
+canopen_sdo_bulk_start(canopen_sdo_bulk_t *bulk, int node)
+{
+    canopen_sdo_read_t *read;
+    uint64_t now;
+    int i;
+
+    while (!bulk->stop && (i = bulk->head[node]) >= 0)
+    {
+        read = &(bulk->reads[i]);
+        bulk->head[node] = bulk->next[i];
+
+        if (canopen_sdo_client_start(&(bulk->client), &(bulk->xfer[node]),
+                                     read->data ? CANOPEN_SDO_UPLOAD_SEG : CANOPEN_SDO_UPLOAD_EXP,
+                                     read->node, read->index, read->subindex,
+                                     read->data ? read->data : bulk->value[node],
+                                     read->data ? read->data_len : 4, canopen_sdo_bulk_done, bulk) == 0)
+        {
+            bulk->current[node]       = i;
+            bulk->wait_until_ms[node] = 0;
+            return 1;
+        }
+
+        if (bulk->xfer[node].result.status == CANOPEN_SDO_ERR_IO && (errno == ENOBUFS || errno == EAGAIN))
+        {
+            now = canopen_sdo_now_ms();
+
+            if (bulk->wait_until_ms[node] == 0)
+                bulk->wait_until_ms[node] = now + bulk->client.tp->sdo_timeout_ms;
+
+            if (now < bulk->wait_until_ms[node])
+            {
+                bulk->head[node] = i;
+                bulk->wait[bulk->n_wait++] = node;
+                return 1;
+            }
+
+            // nothing could be sent for a whole timeout: the node's other
+            // reads would not fare better, leave them failed
+            bulk->wait_until_ms[node] = 0;
+            bulk->head[node] = -1;
+        }
+
+        read->result = bulk->xfer[node].result;
+    }
+
+    return 0;
+}
+
+// start the reads of the next node waiting
+static void
+canopen_sdo_bulk_start_node(canopen_sdo_bulk_t *bulk)
+{
+    while (bulk->next_node < bulk->n_nodes)
+    {
+        if (canopen_sdo_bulk_start(bulk, bulk->nodes[bulk->next_node++]))
+            return;
+    }
+}
+
+// send the reads waiting for room in the transmit queue again
+static void
+canopen_sdo_bulk_retry(canopen_sdo_bulk_t *bulk)
+{
+    uint8_t wait[CANOPEN_SDO_NODE_MAX];
+    int i, n = bulk->n_wait;
+
+    memcpy(wait, bulk->wait, n);
+    bulk->n_wait = 0;
+
+    for (i = 0; i < n; i++)
+    {
+        if (!canopen_sdo_bulk_start(bulk, wait[i]))
+            canopen_sdo_bulk_start_node(bulk);
+    }
+}
+
+//------------------------------------------------------------------------------
+// A read ended: keep its outcome, go on with the node, or with the next
+// node. Once a node did not respond its other reads time out too, without
+// waiting for each.
+//------------------------------------------------------------------------------
+static void
+canopen_sdo_bulk_done(canopen_sdo_client_t *client, canopen_sdo_transfer_t *xfer, void *arg)
+{
+    canopen_sdo_bulk_t *bulk = (canopen_sdo_bulk_t *)arg;
+    int node = xfer->node & 0x7F, i;
+    canopen_sdo_read_t *read = &(bulk->reads[bulk->current[node]]);
+
+    (void)client; // bulk->client
+
+    read->result = xfer->result;
+    read->size   = xfer->size;
+
+    if (read->data == NULL && xfer->result.status == CANOPEN_SDO_OK)
+        read->value = canopen_decode_uint(bulk->value[node], xfer->size);
+
+    if (xfer->result.status == CANOPEN_SDO_ERR_TIMEOUT)
+    {
+        for (i = bulk->head[node]; i >= 0; i = bulk->next[i])
+        {
+            bulk->reads[i].result          = xfer->result;
+            bulk->reads[i].result.index    = bulk->reads[i].index;
+            bulk->reads[i].result.subindex = bulk->reads[i].subindex;
+        }
+        bulk->head[node] = -1;
+    }
+
+    if (!canopen_sdo_bulk_start(bulk, node))
+        canopen_sdo_bulk_start_node(bulk);
+}
+
+//------------------------------------------------------------------------------
+//SF
+//SF .. c:function:: int canopen_sdo_read_n(canopen_transport_t *tp, canopen_sdo_read_t *reads, int n, int window)
+//SF
+//SF     Read the *n* objects in *reads*, with one transfer in flight per
+//SF     node and up to *window* nodes at a time (0: all of them). The reads
+//SF     of a node run in array order; after a timeout the node's remaining
+//SF     reads are not tried. A read that finds the transmit queue full is
+//SF     sent again once there is room; if there is none for an SDO timeout
+//SF     it fails with CANOPEN_SDO_ERR_IO, as do the node's remaining reads.
+//SF     The outcome of each read is left in its *result*, *size* and
+//SF     *value*. The transport's receive filter is replaced by the nodes'
+//SF     SDO replies meanwhile, and put back afterwards (if the transport
+//SF     cannot keep its filter, it is left as it is).
+//SF
+//SF     Returns the number of successful reads, or -1 on error (a receive
+//SF     error: the reads not done fail with CANOPEN_SDO_ERR_IO).
+//SF
+//------------------------------------------------------------------------------
+int
+canopen_sdo_read_n(canopen_transport_t *tp, canopen_sdo_read_t *reads, int n, int window)
+{
+    canopen_sdo_bulk_t *bulk;
+    can_subscription_t sub;
+    can_filter_saved_t filter;
+    int i, node, saved, ok = 0, ret = 0;
+
+    if (tp == NULL || reads == NULL || n < 0)
+    {
+        return -1;
+    }
+
+    if ((bulk = (canopen_sdo_bulk_t *)malloc(sizeof(canopen_sdo_bulk_t))) == NULL ||
+        (bulk->next = (int *)malloc((n + 1) * sizeof(int))) == NULL)
+    {
+        fprintf(stderr, "%s: failed to allocate bulk read state\n", __PRETTY_FUNCTION__);
+        free(bulk);
+        return -1;
+    }
+
+    canopen_sdo_client_init(&(bulk->client), tp);
+    bulk->reads     = reads;
+    bulk->stop      = 0;
+    bulk->n_nodes   = 0;
+    bulk->next_node = 0;
+    bulk->n_wait    = 0;
+
+    bzero((void *)&sub, sizeof(sub));
+    sub.type    = CAN_SUB_NODES;
+    sub.fc_mask = CAN_SUB_FC(CANOPEN_FC_SDO_TX);
+
+    for (node = 0; node < CANOPEN_SDO_NODE_MAX; node++)
+    {
+        bulk->head[node]          = -1;
+        bulk->wait_until_ms[node] = 0;
+    }
+
+    for (i = n - 1; i >= 0; i--)
+    {
+        node = reads[i].node & 0x7F;
+
+        bzero((void *)&(reads[i].result), sizeof(canopen_sdo_result_t));
+        reads[i].result.status   = CANOPEN_SDO_ERR_IO;
+        reads[i].result.node     = reads[i].node;
+        reads[i].result.index    = reads[i].index;
+        reads[i].result.subindex = reads[i].subindex;
+        reads[i].size            = 0;
+
+        bulk->next[i]    = bulk->head[node];
+        bulk->head[node] = i;
+    }
+
+    for (i = 0; i < n; i++)
+    {
+        node = reads[i].node & 0x7F;
+
+        if (bulk->head[node] == i)
+        {
+            bulk->nodes[bulk->n_nodes++] = node;
+            CAN_SUB_NODE_SET(&sub, node);
+        }
+    }
+
+    if ((saved = (canopen_transport_filter_save(tp, &filter) == 0)) &&
+        canopen_transport_set_filter(tp, &sub, 1) < 0)
+    {
+        printf("%s: Error, failed to set CAN filters\n", __PRETTY_FUNCTION__);
+    }
+
+    if (window <= 0 || window > bulk->n_nodes)
+        window = bulk->n_nodes;
+
+    while (bulk->client.active + bulk->n_wait < window && bulk->next_node < bulk->n_nodes)
+        canopen_sdo_bulk_start_node(bulk);
+
+    while (bulk->client.active > 0 || bulk->n_wait > 0)
+    {
+        if (bulk->client.active == 0)
+        {
+            // nothing to receive, only reads waiting to be sent
+            usleep(SDO_BULK_RETRY_MS * 1000);
+        }
+        else if (canopen_sdo_client_poll(&(bulk->client), bulk->n_wait ? SDO_BULK_RETRY_MS : -1) < 0)
+        {
+            bulk->stop   = 1;
+            bulk->n_wait = 0;
+            for (node = 0; node < CANOPEN_SDO_NODE_MAX; node++)
+            {
+                if (bulk->client.xfer[node])
+                    canopen_sdo_finish(&(bulk->client), bulk->client.xfer[node], CANOPEN_SDO_ERR_IO, 0);
+            }
+            ret = -1;
+        }
+
+        canopen_sdo_bulk_retry(bulk);
+    }
+
+    if (saved)
+        canopen_transport_filter_restore(tp, &filter);
+
+    for (i = 0; i < n; i++)
+    {
+        if (reads[i].result.status == CANOPEN_SDO_OK)
+            ok++;
+    }
+
+    free(bulk->next);
+    free(bulk);
+
+    return ret < 0 ? ret : ok;
+}
@@ -0,0 +1,132 @@
+//------------------------------------------------------------------------------
+// Copyright (C) 2012, Robert Johansson, Raditex AB
+// All rights reserved.
+//
+// This file is part of the rSCADA system.
+//
+// rSCADA
+// http://www.rSCADA.se
+// info@rscada.se
+//
+//------------------------------------------------------------------------------
+
+//
+// Asynchronous SDO client: each transfer is a state machine, advanced by
+// the SDO server responses handed to canopen_sdo_client_frame and by the
+// timeouts checked in canopen_sdo_client_tick, and finished with a
+// callback. One transfer per node (SDO channel) can be in flight at the
+// same time, so one thread can talk to every node on the bus at once.
+//
+// Either call canopen_sdo_client_poll/_run, which receive from the
+// client's transport, or feed the client from an event loop
+// (canopen-event.h): frames from the socket callback, ticks from a timer.
+//
+
+#ifndef _CANOPEN_SDO_H_
+#define _CANOPEN_SDO_H_
+
+#include <stdint.h>
+
+#include "canopen.h"
+#include "canopen-transport.h"
+
+// transfer types
+#define CANOPEN_SDO_UPLOAD_EXP      0   // up to 4 bytes, expedited only
+#define CANOPEN_SDO_UPLOAD_SEG      1   // expedited or segmented, as the server answers
+#define CANOPEN_SDO_UPLOAD_BLOCK    2
+#define CANOPEN_SDO_DOWNLOAD_EXP    3   // 1 to 4 bytes
+#define CANOPEN_SDO_DOWNLOAD_SEG    4
+#define CANOPEN_SDO_DOWNLOAD_BLOCK  5
+
+#define CANOPEN_SDO_NODE_MAX        128
+
+typedef struct _canopen_sdo_client   canopen_sdo_client_t;
+typedef struct _canopen_sdo_transfer canopen_sdo_transfer_t;
+
+// called when a transfer ends, successfully or not (see xfer->result)
+typedef void (*canopen_sdo_done_cb_t)(canopen_sdo_client_t *client, canopen_sdo_transfer_t *xfer, void *arg);
+
+//
+// One transfer, on the caller's storage: it must stay valid until the
+// callback. Only the request and outcome fields are for the caller.
+//
+struct _canopen_sdo_transfer {
+
+    // request
+    uint8_t   type;         // CANOPEN_SDO_UPLOAD_* or _DOWNLOAD_*
+    uint8_t   node;
+    uint16_t  index;
+    uint8_t   subindex;
+    uint8_t  *data;         // buffer to upload into, or data to download
+    uint32_t  data_len;     // its size
+    canopen_sdo_done_cb_t cb;
+    void     *arg;
+    unsigned int timeout_ms; // wait for each response, 0: tp->sdo_timeout_ms
+                             // (set with canopen_sdo_client_timeout)
+
+    // outcome
+    canopen_sdo_result_t result;
+    uint32_t  size;         // bytes uploaded or downloaded
+
+    // engine state
+    uint8_t   state;
+    uint8_t   toggle;
+    uint8_t   crc_set;      // block transfers: both sides use the CRC
+    uint8_t   blk_size;
+    uint8_t   seq_no;       // block upload: next segment expected
+    uint8_t   blk_sent;     // block download: segments in the last sub-block
+    uint8_t   excess;       // block download: bytes of the last segment without data
+    uint16_t  crc;
+    uint32_t  offset;
+    uint32_t  blk_start;    // block download: offset of the last sub-block
+    uint32_t  crc_offset;   // block upload: data covered by crc
+    uint64_t  deadline_ms;
+};
+
+struct _canopen_sdo_client {
+
+    canopen_transport_t *tp;    // its sdo_timeout_ms, sdo_block_size and
+                                // sdo_block_pst apply to the transfers
+    int active;                 // transfers in flight
+    canopen_sdo_transfer_t *xfer[CANOPEN_SDO_NODE_MAX];  // by node
+};
+
+//
+// One read of a bulk upload (canopen_sdo_read_n): expedited into value if
+// data is NULL, else expedited or segmented into data.
+//
+typedef struct _canopen_sdo_read {
+
+    uint8_t   node;
+    uint16_t  index;
+    uint8_t   subindex;
+    uint8_t  *data;
+    uint32_t  data_len;
+
+    canopen_sdo_result_t result;
+    uint32_t  size;         // bytes read
+    uint32_t  value;        // if data is NULL
+
+} canopen_sdo_read_t;
+
+void                  canopen_sdo_client_init(canopen_sdo_client_t *client, canopen_transport_t *tp);
+canopen_sdo_client_t *canopen_sdo_client_new(canopen_transport_t *tp);
+void                  canopen_sdo_client_free(canopen_sdo_client_t *client);
+
+int canopen_sdo_client_start(canopen_sdo_client_t *client, canopen_sdo_transfer_t *xfer, uint8_t type,
+                             uint8_t node, uint16_t index, uint8_t subindex, uint8_t *data, uint32_t data_len,
+                             canopen_sdo_done_cb_t cb, void *arg);
+void canopen_sdo_client_timeout(canopen_sdo_client_t *client, canopen_sdo_transfer_t *xfer,
+                                unsigned int timeout_ms);
+int canopen_sdo_client_busy(canopen_sdo_client_t *client, uint8_t node);
+
+int canopen_sdo_client_frame(canopen_sdo_client_t *client, canopen_frame_t *frame);
+int canopen_sdo_client_tick(canopen_sdo_client_t *client);
+int canopen_sdo_client_next_ms(canopen_sdo_client_t *client);
+
+int canopen_sdo_client_poll(canopen_sdo_client_t *client, int timeout_ms);
+int canopen_sdo_client_run(canopen_sdo_client_t *client);
+
+int canopen_sdo_read_n(canopen_transport_t *tp, canopen_sdo_read_t *reads, int n, int window);
+
+#endif /* _CANOPEN_SDO_H_ */
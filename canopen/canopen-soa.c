@@ -0,0 +1,365 @@
+//------------------------------------------------------------------------------
+// Copyright (C) 2012, Robert Johansson, Raditex AB
+// All rights reserved.
+//
+// This file is part of the rSCADA system.
+//
+// rSCADA
+// http://www.rSCADA.se
+// info@rscada.se
+//
+//------------------------------------------------------------------------------
+
+#include <canopen.h>
+#include <canopen-soa.h>
+
+#include <linux/can.h>
+
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define CANOPEN_SOA_X86
+#endif
+
+//
+// The vector paths rely on the layout of struct can_frame: 16 bytes, the
+// identifier in the first and the length in the low byte of the second
+// 32-bit word.
+//
+typedef char canopen_soa_frame_size_check[sizeof(struct can_frame) == 16 ? 1 : -1];
+
+//------------------------------------------------------------------------------
+//SF
+//SF .. c:function:: canopen_frame_soa_t *canopen_frame_soa_new(int n)
+//SF
+//SF     Allocate the arrays for *n* frames. Free with canopen_frame_soa_free.
+//SF
+//------------------------------------------------------------------------------
+canopen_frame_soa_t *
+canopen_frame_soa_new(int n)
+{
+    canopen_frame_soa_t *soa;
+
+    if (n <= 0)
+        return NULL;
+
+    if ((soa = (canopen_frame_soa_t *)calloc(1, sizeof(canopen_frame_soa_t))) == NULL)
+        return NULL;
+
+    soa->ids     = (uint32_t *)malloc(n * sizeof(uint32_t));
+    soa->fcs     = (uint8_t *)malloc(n);
+    soa->types   = (uint8_t *)malloc(n);
+    soa->rtrs    = (uint8_t *)malloc(n);
+    soa->dlc     = (uint8_t *)malloc(n);
+    soa->payload = (uint8_t *)malloc(n * CANOPEN_FRAME_DATA_LEN);
+
+    if (soa->ids == NULL || soa->fcs == NULL || soa->types == NULL ||
+        soa->rtrs == NULL || soa->dlc == NULL || soa->payload == NULL)
+    {
+        fprintf(stderr, "%s: failed to allocate %d frames\n", __PRETTY_FUNCTION__, n);
+        canopen_frame_soa_free(soa);
+        return NULL;
+    }
+
+    return soa;
+}
+
+void
+canopen_frame_soa_free(canopen_frame_soa_t *soa)
+{
+    if (soa == NULL)
+        return;
+
+    free(soa->ids);
+    free(soa->fcs);
+    free(soa->types);
+    free(soa->rtrs);
+    free(soa->dlc);
+    free(soa->payload);
+    free(soa);
+}
+
+//------------------------------------------------------------------------------
+// Copy the 8 payload bytes of a frame, with the bytes beyond dlc cleared
+// (as canopen_frame_parse leaves them).
+//------------------------------------------------------------------------------
+static inline void
+canopen_soa_payload(uint8_t *payload, const struct can_frame *frame)
+{
+    uint64_t data;
+    uint8_t  dlc = frame->can_dlc;
+
+    memcpy(&data, frame->data, sizeof(data));
+    if (dlc < CANOPEN_FRAME_DATA_LEN)
+        data &= (1ULL << (8 * dlc)) - 1; // little endian
+    memcpy(payload, &data, sizeof(data));
+}
+
+//------------------------------------------------------------------------------
+// One frame, as canopen_frame_parse does it.
+//------------------------------------------------------------------------------
+static inline void
+canopen_soa_parse_one(canopen_frame_soa_t *soa, const struct can_frame *frame, int i)
+{
+    canid_t can_id = frame->can_id;
+
+    if (can_id & CAN_ERR_FLAG)
+    {
+        soa->types[i] = CANOPEN_FLAG_ERROR;
+        soa->fcs[i]   = 0;
+        soa->ids[i]   = can_id & CAN_ERR_MASK;
+    }
+    else if (can_id & CAN_EFF_FLAG)
+    {
+        soa->types[i] = CANOPEN_FLAG_EXTENDED;
+        soa->fcs[i]   = 0;
+        soa->ids[i]   = can_id & CAN_EFF_MASK;
+    }
+    else
+    {
+        soa->types[i] = CANOPEN_FLAG_STANDARD;
+        soa->fcs[i]   = (can_id & 0x00000780U) >> 7;
+        soa->ids[i]   = (can_id & 0x0000007FU);
+    }
+
+    soa->rtrs[i] = (can_id & CAN_RTR_FLAG) ? CANOPEN_FLAG_RTR : CANOPEN_FLAG_NORMAL;
+    soa->dlc[i]  = frame->can_dlc;
+
+    canopen_soa_payload(&(soa->payload[i * CANOPEN_FRAME_DATA_LEN]), frame);
+}
+
+#ifdef CANOPEN_SOA_X86
+
+//------------------------------------------------------------------------------
+// Four frames at a time (SSE2): the identifiers and length words are
+// transposed into one vector each, and every field is computed for all
+// four lanes with masks instead of branches.
+//------------------------------------------------------------------------------
+__attribute__((target("sse2")))
+static int
+canopen_soa_parse_sse2(canopen_frame_soa_t *soa, const struct can_frame *frames, int n)
+{
+    const __m128i err_flag = _mm_set1_epi32((int)CAN_ERR_FLAG);
+    const __m128i eff_flag = _mm_set1_epi32((int)CAN_EFF_FLAG);
+    const __m128i eff_mask = _mm_set1_epi32((int)CAN_EFF_MASK);
+    const __m128i one      = _mm_set1_epi32(1);
+    const __m128i two      = _mm_set1_epi32(2);
+    const __m128i byte     = _mm_set1_epi32(0xFF);
+    const __m128i nib      = _mm_set1_epi32(0xF);
+    const __m128i node     = _mm_set1_epi32(0x7F);
+    __m128i f0, f1, f2, f3, t0, t1, can_id, word1, err, eff, ext, v;
+    int i, j, w;
+
+    for (i = 0; i + 4 <= n; i += 4)
+    {
+        f0 = _mm_loadu_si128((const __m128i *)&frames[i + 0]);
+        f1 = _mm_loadu_si128((const __m128i *)&frames[i + 1]);
+        f2 = _mm_loadu_si128((const __m128i *)&frames[i + 2]);
+        f3 = _mm_loadu_si128((const __m128i *)&frames[i + 3]);
+
+        t0     = _mm_unpacklo_epi32(f0, f1);
+        t1     = _mm_unpacklo_epi32(f2, f3);
+        can_id = _mm_unpacklo_epi64(t0, t1);
+        word1  = _mm_unpackhi_epi64(t0, t1);
+
+        err = _mm_cmpeq_epi32(_mm_and_si128(can_id, err_flag), err_flag);
+        eff = _mm_cmpeq_epi32(_mm_and_si128(can_id, eff_flag), eff_flag);
+        ext = _mm_or_si128(err, eff);
+
+        // id: 29 bits for extended and error frames, else the node ID
+        v = _mm_or_si128(_mm_and_si128(ext, _mm_and_si128(can_id, eff_mask)),
+                         _mm_andnot_si128(ext, _mm_and_si128(can_id, node)));
+        _mm_storeu_si128((__m128i *)&(soa->ids[i]), v);
+
+        // function code, zero for extended and error frames
+        v = _mm_andnot_si128(ext, _mm_and_si128(_mm_srli_epi32(can_id, 7), nib));
+        v = _mm_packus_epi16(_mm_packs_epi32(v, v), v);
+        w = _mm_cvtsi128_si32(v);
+        memcpy(&(soa->fcs[i]), &w, 4);
+
+        v = _mm_or_si128(_mm_and_si128(err, two), _mm_andnot_si128(err, _mm_and_si128(eff, one)));
+        v = _mm_packus_epi16(_mm_packs_epi32(v, v), v);
+        w = _mm_cvtsi128_si32(v);
+        memcpy(&(soa->types[i]), &w, 4);
+
+        v = _mm_and_si128(_mm_srli_epi32(can_id, 30), one); // CAN_RTR_FLAG
+        v = _mm_packus_epi16(_mm_packs_epi32(v, v), v);
+        w = _mm_cvtsi128_si32(v);
+        memcpy(&(soa->rtrs[i]), &w, 4);
+
+        v = _mm_and_si128(word1, byte);
+        v = _mm_packus_epi16(_mm_packs_epi32(v, v), v);
+        w = _mm_cvtsi128_si32(v);
+        memcpy(&(soa->dlc[i]), &w, 4);
+
+        for (j = i; j < i + 4; j++)
+        {
+            canopen_soa_payload(&(soa->payload[j * CANOPEN_FRAME_DATA_LEN]), &frames[j]);
+        }
+    }
+
+    return i;
+}
+
+//------------------------------------------------------------------------------
+// Eight frames at a time (AVX2), same scheme as the SSE2 version.
+//------------------------------------------------------------------------------
+__attribute__((target("avx2")))
+static inline uint64_t
+canopen_soa_narrow_avx2(__m256i v)
+{
+    uint64_t lo, hi;
+
+    v  = _mm256_packus_epi16(_mm256_packs_epi32(v, v), v);
+    lo = (uint32_t)_mm_cvtsi128_si32(_mm256_castsi256_si128(v));
+    hi = (uint32_t)_mm_cvtsi128_si32(_mm256_extracti128_si256(v, 1));
+
+    return lo | (hi << 32);
+}
+
+__attribute__((target("avx2")))
+static int
+canopen_soa_parse_avx2(canopen_frame_soa_t *soa, const struct can_frame *frames, int n)
+{
+    const __m256i err_flag = _mm256_set1_epi32((int)CAN_ERR_FLAG);
+    const __m256i eff_flag = _mm256_set1_epi32((int)CAN_EFF_FLAG);
+    const __m256i eff_mask = _mm256_set1_epi32((int)CAN_EFF_MASK);
+    const __m256i one      = _mm256_set1_epi32(1);
+    const __m256i two      = _mm256_set1_epi32(2);
+    const __m256i byte     = _mm256_set1_epi32(0xFF);
+    const __m256i nib      = _mm256_set1_epi32(0xF);
+    const __m256i node     = _mm256_set1_epi32(0x7F);
+    const __m256i order    = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    __m256i r0, r1, r2, r3, t0, t1, can_id, word1, err, eff, ext, v;
+    uint64_t w;
+    int i, j;
+
+    for (i = 0; i + 8 <= n; i += 8)
+    {
+        // two frames per register: [f0 | f1], [f2 | f3], ...
+        r0 = _mm256_loadu_si256((const __m256i *)&frames[i + 0]);
+        r1 = _mm256_loadu_si256((const __m256i *)&frames[i + 2]);
+        r2 = _mm256_loadu_si256((const __m256i *)&frames[i + 4]);
+        r3 = _mm256_loadu_si256((const __m256i *)&frames[i + 6]);
+
+        // per 128-bit lane, giving frames 0 2 4 6 | 1 3 5 7
+        t0     = _mm256_unpacklo_epi32(r0, r1);
+        t1     = _mm256_unpacklo_epi32(r2, r3);
+        can_id = _mm256_permutevar8x32_epi32(_mm256_unpacklo_epi64(t0, t1), order);
+        word1  = _mm256_permutevar8x32_epi32(_mm256_unpackhi_epi64(t0, t1), order);
+
+        err = _mm256_cmpeq_epi32(_mm256_and_si256(can_id, err_flag), err_flag);
+        eff = _mm256_cmpeq_epi32(_mm256_and_si256(can_id, eff_flag), eff_flag);
+        ext = _mm256_or_si256(err, eff);
+
+        v = _mm256_blendv_epi8(_mm256_and_si256(can_id, node), _mm256_and_si256(can_id, eff_mask), ext);
+        _mm256_storeu_si256((__m256i *)&(soa->ids[i]), v);
+
+        v = _mm256_andnot_si256(ext, _mm256_and_si256(_mm256_srli_epi32(can_id, 7), nib));
+        w = canopen_soa_narrow_avx2(v);
+        memcpy(&(soa->fcs[i]), &w, 8);
+
+        v = _mm256_blendv_epi8(_mm256_and_si256(eff, one), two, err);
+        w = canopen_soa_narrow_avx2(v);
+        memcpy(&(soa->types[i]), &w, 8);
+
+        v = _mm256_and_si256(_mm256_srli_epi32(can_id, 30), one); // CAN_RTR_FLAG
+        w = canopen_soa_narrow_avx2(v);
+        memcpy(&(soa->rtrs[i]), &w, 8);
+
+        w = canopen_soa_narrow_avx2(_mm256_and_si256(word1, byte));
+        memcpy(&(soa->dlc[i]), &w, 8);
+
+        for (j = i; j < i + 8; j++)
+        {
+            canopen_soa_payload(&(soa->payload[j * CANOPEN_FRAME_DATA_LEN]), &frames[j]);
+        }
+    }
+
+    return i;
+}
+
+#endif /* CANOPEN_SOA_X86 */
+
+//------------------------------------------------------------------------------
+//SF
+//SF .. c:function:: int canopen_frame_parse_n(canopen_frame_soa_t *soa, const struct can_frame *frames, int n)
+//SF
+//SF     Parse *n* CAN frames into the arrays of *soa*, with the same result
+//SF     as canopen_frame_parse on each frame. The identifiers are decoded
+//SF     8 (AVX2) or 4 (SSE2) frames at a time when the CPU supports it.
+//SF
+//SF     Returns *n*, or -1 on error.
+//SF
+//------------------------------------------------------------------------------
+int
+canopen_frame_parse_n(canopen_frame_soa_t *soa, const struct can_frame *frames, int n)
+{
+    int i = 0;
+
+    if (soa == NULL || frames == NULL || n < 0)
+    {
+        return -1;
+    }
+
+#ifdef CANOPEN_SOA_X86
+    if (__builtin_cpu_supports("avx2"))
+        i = canopen_soa_parse_avx2(soa, frames, n);
+    else if (__builtin_cpu_supports("sse2"))
+        i = canopen_soa_parse_sse2(soa, frames, n);
+#endif
+
+    for (; i < n; i++)
+    {
+        canopen_soa_parse_one(soa, &frames[i], i);
+    }
+
+    return n;
+}
+
+//------------------------------------------------------------------------------
+//SF
+//SF .. c:function:: int canopen_frame_pack_n(const canopen_frame_soa_t *soa, struct can_frame *frames, int n)
+//SF
+//SF     Pack *n* frames from the arrays of *soa* into CAN frames, as
+//SF     canopen_frame_pack does (all 8 payload bytes are written).
+//SF
+//SF     Returns the number of frames packed: less than *n* if a frame has a
+//SF     length above 8, which stops packing. -1 on error.
+//SF
+//------------------------------------------------------------------------------
+int
+canopen_frame_pack_n(const canopen_frame_soa_t *soa, struct can_frame *frames, int n)
+{
+    canid_t can_id;
+    int i;
+
+    if (soa == NULL || frames == NULL || n < 0)
+    {
+        return -1;
+    }
+
+    for (i = 0; i < n; i++)
+    {
+        if (soa->dlc[i] > CANOPEN_FRAME_DATA_LEN)
+        {
+            // CAN FD payload, use canopen_frame_pack_fd
+            break;
+        }
+
+        can_id  = ((canid_t)soa->fcs[i] << 7) | soa->ids[i];
+        can_id |= (soa->types[i] == CANOPEN_FLAG_EXTENDED) ? CAN_EFF_FLAG : 0;
+        can_id |= (soa->types[i] == CANOPEN_FLAG_ERROR)    ? CAN_ERR_FLAG : 0;
+        can_id |= (soa->rtrs[i]  == CANOPEN_FLAG_RTR)      ? CAN_RTR_FLAG : 0;
+
+        frames[i].can_id  = can_id;
+        frames[i].can_dlc = soa->dlc[i];
+        memcpy(frames[i].data, &(soa->payload[i * CANOPEN_FRAME_DATA_LEN]), CANOPEN_FRAME_DATA_LEN);
+    }
+
+    return i;
+}
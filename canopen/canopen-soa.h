@@ -0,0 +1,51 @@
+//------------------------------------------------------------------------------
+// Copyright (C) 2012, Robert Johansson, Raditex AB
+// All rights reserved.
+//
+// This file is part of the rSCADA system.
+//
+// rSCADA
+// http://www.rSCADA.se
+// info@rscada.se
+//
+//------------------------------------------------------------------------------
+
+//
+// Bulk parsing and packing of classic CAN frames into and out of a
+// structure of arrays, for offline processing of large frame logs. The
+// identifier decoding runs several frames at a time with SSE2/AVX2 where
+// available.
+//
+
+#ifndef _CANOPEN_SOA_H_
+#define _CANOPEN_SOA_H_
+
+#include <linux/can.h>
+
+#include <stdint.h>
+
+#include "canopen.h"
+
+//
+// Frame i is described by element i of each array (as the canopen_frame_t
+// field of the same name); its payload is payload[8 * i] .. payload[8 * i + 7],
+// with the bytes beyond dlc[i] set to zero.
+//
+typedef struct _canopen_frame_soa {
+
+    uint32_t *ids;      // node ID, or 29-bit identifier / error class
+    uint8_t  *fcs;      // function code
+    uint8_t  *types;    // CANOPEN_FLAG_STANDARD, _EXTENDED or _ERROR
+    uint8_t  *rtrs;     // CANOPEN_FLAG_RTR or CANOPEN_FLAG_NORMAL
+    uint8_t  *dlc;      // payload length
+    uint8_t  *payload;  // CANOPEN_FRAME_DATA_LEN bytes per frame
+
+} canopen_frame_soa_t;
+
+canopen_frame_soa_t *canopen_frame_soa_new(int n);
+void                 canopen_frame_soa_free(canopen_frame_soa_t *soa);
+
+int canopen_frame_parse_n(canopen_frame_soa_t *soa, const struct can_frame *frames, int n);
+int canopen_frame_pack_n(const canopen_frame_soa_t *soa, struct can_frame *frames, int n);
+
+#endif /* _CANOPEN_SOA_H_ */
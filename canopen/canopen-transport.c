@@ -0,0 +1,311 @@
+//------------------------------------------------------------------------------
+// Copyright (C) 2012, Robert Johansson, Raditex AB
+// All rights reserved.
+//
+// This file is part of the rSCADA system.
+//
+// rSCADA
+// http://www.rSCADA.se
+// info@rscada.se
+//
+//------------------------------------------------------------------------------
+
+#include <canopen.h>
+#include <canopen-com.h>
+#include <canopen-transport.h>
+#include <can-if.h>
+
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+
+//==============================================================================
+// SOCKETCAN TRANSPORT
+//==============================================================================
+
+static int
+canopen_transport_socket_send(canopen_transport_t *tp, canopen_frame_t *frame)
+{
+    return canopen_frame_send(tp->sock, frame);
+}
+
+static int
+canopen_transport_socket_send_raw(canopen_transport_t *tp, struct canfd_frame *cf, const int *mtu, int n)
+{
+    return canopen_frame_send_raw(tp->sock, cf, mtu, n);
+}
+
+static int
+canopen_transport_socket_recv(canopen_transport_t *tp, canopen_frame_t *frame,
+                              canopen_frame_meta_t *meta, int timeout_ms)
+{
+    if (timeout_ms >= 0)
+        return canopen_frame_recv_timeout(tp->sock, frame, meta, timeout_ms);
+
+    if (meta)
+        return canopen_frame_recv_meta(tp->sock, frame, meta);
+
+    return canopen_frame_recv(tp->sock, frame);
+}
+
+static int
+canopen_transport_socket_set_filter(canopen_transport_t *tp, can_subscription_t *subs, int n)
+{
+    if (n == 0)
+        return can_filter_clear(tp->sock);
+
+    return can_filter_subscribe(tp->sock, subs, n);
+}
+
+static int
+canopen_transport_socket_filter_save(canopen_transport_t *tp, can_filter_saved_t *saved)
+{
+    return can_filter_save(tp->sock, saved);
+}
+
+static int
+canopen_transport_socket_filter_restore(canopen_transport_t *tp, can_filter_saved_t *saved)
+{
+    return can_filter_restore(tp->sock, saved);
+}
+
+static int
+canopen_transport_socket_timestamp(canopen_transport_t *tp, int mode)
+{
+    return can_socket_timestamp_enable(tp->sock, mode);
+}
+
+static void
+canopen_transport_socket_free(canopen_transport_t *tp)
+{
+    free(tp);
+}
+
+static const canopen_transport_ops_t canopen_transport_socket_ops = {
+    canopen_transport_socket_send,
+    canopen_transport_socket_recv,
+    canopen_transport_socket_set_filter,
+    canopen_transport_socket_timestamp,
+    NULL,
+    canopen_transport_socket_send_raw,
+    canopen_transport_socket_filter_save,
+    canopen_transport_socket_filter_restore
+};
+
+// as above, for transports allocated by canopen_transport_socket_new
+static const canopen_transport_ops_t canopen_transport_socket_new_ops = {
+    canopen_transport_socket_send,
+    canopen_transport_socket_recv,
+    canopen_transport_socket_set_filter,
+    canopen_transport_socket_timestamp,
+    canopen_transport_socket_free,
+    canopen_transport_socket_send_raw,
+    canopen_transport_socket_filter_save,
+    canopen_transport_socket_filter_restore
+};
+
+//------------------------------------------------------------------------------
+//SF
+//SF .. c:function:: void canopen_transport_socket_init(canopen_transport_t *tp, int sock)
+//SF
+//SF     Set up tp as a transport on the SocketCAN socket sock.
+//SF
+//------------------------------------------------------------------------------
+void
+canopen_transport_socket_init(canopen_transport_t *tp, int sock)
+{
+    bzero((void *)tp, sizeof(canopen_transport_t));
+
+    tp->ops       = &canopen_transport_socket_ops;
+    tp->sock      = sock;
+    tp->fd_frames = can_socket_is_fd(sock);
+
+    tp->sdo_timeout_ms = CANOPEN_SDO_TIMEOUT_MS;
+}
+
+//------------------------------------------------------------------------------
+//SF
+//SF .. c:function:: canopen_transport_t *canopen_transport_socket_new(int sock)
+//SF
+//SF     Allocate a transport on the SocketCAN socket sock. Free it with
+//SF     canopen_transport_close (which leaves the socket open).
+//SF
+//------------------------------------------------------------------------------
+canopen_transport_t *
+canopen_transport_socket_new(int sock)
+{
+    canopen_transport_t *tp;
+
+    if ((tp = (canopen_transport_t *)malloc(sizeof(canopen_transport_t))) == NULL)
+        return NULL;
+
+    canopen_transport_socket_init(tp, sock);
+    tp->ops = &canopen_transport_socket_new_ops;
+
+    return tp;
+}
+
+//==============================================================================
+// GENERIC OPERATIONS
+//==============================================================================
+
+int
+canopen_transport_send(canopen_transport_t *tp, canopen_frame_t *frame)
+{
+    return tp->ops->send(tp, frame);
+}
+
+//------------------------------------------------------------------------------
+//SF
+//SF .. c:function:: int canopen_transport_send_raw(canopen_transport_t *tp, struct canfd_frame *cf, const int *mtu, int n)
+//SF
+//SF     Send n frames built in SocketCAN format (canopen-build.h). Returns
+//SF     the number of frames sent, or -1 on error.
+//SF
+//------------------------------------------------------------------------------
+int
+canopen_transport_send_raw(canopen_transport_t *tp, struct canfd_frame *cf, const int *mtu, int n)
+{
+    canopen_frame_t frame;
+    int i;
+
+    if (tp->ops->send_raw)
+        return tp->ops->send_raw(tp, cf, mtu, n);
+
+    for (i = 0; i < n; i++)
+    {
+        if (canopen_frame_parse_mtu(&frame, &cf[i], mtu[i]) != 0 || tp->ops->send(tp, &frame) != 0)
+            return i ? i : -1;
+    }
+
+    return n;
+}
+
+//------------------------------------------------------------------------------
+//SF
+//SF .. c:function:: int canopen_transport_send_batch(canopen_transport_t *tp, canopen_frame_batch_t *batch)
+//SF
+//SF     Send all frames of the batch, and empty it. Returns 0 on success, 1
+//SF     on error (as canopen_transport_send).
+//SF
+//------------------------------------------------------------------------------
+int
+canopen_transport_send_batch(canopen_transport_t *tp, canopen_frame_batch_t *batch)
+{
+    int sent = 0, n;
+
+    while (sent < batch->n)
+    {
+        if ((n = canopen_transport_send_raw(tp, &(batch->cf[sent]), &(batch->mtu[sent]), batch->n - sent)) <= 0)
+        {
+            batch->n = 0;
+            return 1;
+        }
+
+        sent += n;
+    }
+
+    batch->n = 0;
+    return 0;
+}
+
+int
+canopen_transport_recv(canopen_transport_t *tp, canopen_frame_t *frame)
+{
+    return tp->ops->recv(tp, frame, NULL, -1);
+}
+
+int
+canopen_transport_recv_meta(canopen_transport_t *tp, canopen_frame_t *frame, canopen_frame_meta_t *meta)
+{
+    return tp->ops->recv(tp, frame, meta, -1);
+}
+
+int
+canopen_transport_recv_timeout(canopen_transport_t *tp, canopen_frame_t *frame, canopen_frame_meta_t *meta,
+                               int timeout_ms)
+{
+    return tp->ops->recv(tp, frame, meta, timeout_ms);
+}
+
+int
+canopen_transport_set_filter(canopen_transport_t *tp, can_subscription_t *subs, int n)
+{
+    if (tp->ops->set_filter == NULL)
+        return 0;
+
+    return tp->ops->set_filter(tp, subs, n);
+}
+
+//------------------------------------------------------------------------------
+// Only receive the SDO replies (server to client) from the given node. This
+// replaces the transport's filter: keep it with canopen_transport_filter_save
+// to put it back after the transfer.
+//------------------------------------------------------------------------------
+int
+canopen_transport_filter_sdo(canopen_transport_t *tp, uint8_t node)
+{
+    can_subscription_t sub;
+
+    if (node > CAN_SUB_NODE_MAX)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    bzero((void *)&sub, sizeof(sub));
+    sub.type    = CAN_SUB_NODES;
+    sub.fc_mask = CAN_SUB_FC(CANOPEN_FC_SDO_TX);
+    CAN_SUB_NODE_SET(&sub, node);
+
+    return canopen_transport_set_filter(tp, &sub, 1);
+}
+
+//------------------------------------------------------------------------------
+// Keep the receive filter of the transport, to put it back with
+// canopen_transport_filter_restore after a temporary filter. Returns -1
+// (errno ENOTSUP for a transport that cannot keep its filter) if it could
+// not be kept: then leave the filter alone.
+//------------------------------------------------------------------------------
+int
+canopen_transport_filter_save(canopen_transport_t *tp, can_filter_saved_t *saved)
+{
+    if (tp->ops->filter_save == NULL)
+    {
+        errno = ENOTSUP;
+        return -1;
+    }
+
+    return tp->ops->filter_save(tp, saved);
+}
+
+int
+canopen_transport_filter_restore(canopen_transport_t *tp, can_filter_saved_t *saved)
+{
+    if (tp->ops->filter_restore == NULL)
+    {
+        errno = ENOTSUP;
+        return -1;
+    }
+
+    return tp->ops->filter_restore(tp, saved);
+}
+
+int
+canopen_transport_timestamp(canopen_transport_t *tp, int mode)
+{
+    if (tp->ops->timestamp == NULL)
+        return mode == CAN_TIMESTAMP_NONE ? 0 : -1;
+
+    return tp->ops->timestamp(tp, mode);
+}
+
+void
+canopen_transport_close(canopen_transport_t *tp)
+{
+    if (tp && tp->ops->close)
+        tp->ops->close(tp);
+}
@@ -0,0 +1,101 @@
+//------------------------------------------------------------------------------
+// Copyright (C) 2012, Robert Johansson, Raditex AB
+// All rights reserved.
+//
+// This file is part of the rSCADA system.
+//
+// rSCADA
+// http://www.rSCADA.se
+// info@rscada.se
+//
+//------------------------------------------------------------------------------
+
+//
+// CANopen transport abstraction: the SDO engines talk to the bus through a
+// table of operations, so that they can run on a SocketCAN socket as well
+// as on an in-process bus (see canopen-loopback.h).
+//
+
+#ifndef _CANOPEN_TRANSPORT_H_
+#define _CANOPEN_TRANSPORT_H_
+
+#include <stdint.h>
+
+#include "canopen.h"
+#include "can-if.h"
+#include "canopen-build.h"
+
+#define CANOPEN_SDO_TIMEOUT_MS 1000 // default wait for an SDO server response
+
+typedef struct _canopen_transport canopen_transport_t;
+
+typedef struct _canopen_transport_ops {
+
+    // send one frame, 0 on success, 1 on error
+    int  (*send)(canopen_transport_t *tp, canopen_frame_t *frame);
+
+    // receive one frame (meta may be NULL), waiting at most timeout_ms
+    // (-1: the transport's own blocking behaviour), 0 on success, 1 on
+    // error or timeout (errno EAGAIN)
+    int  (*recv)(canopen_transport_t *tp, canopen_frame_t *frame, canopen_frame_meta_t *meta,
+                 int timeout_ms);
+
+    // only receive frames matching the subscriptions (n == 0: everything),
+    // returns 0 on success, -1 on error
+    int  (*set_filter)(canopen_transport_t *tp, can_subscription_t *subs, int n);
+
+    // select the receive time stamp source (CAN_TIMESTAMP_*), 0 on success
+    int  (*timestamp)(canopen_transport_t *tp, int mode);
+
+    // release the transport (may be NULL)
+    void (*close)(canopen_transport_t *tp);
+
+    // send n frames in SocketCAN format, mtu[i] bytes of cf[i], returns the
+    // number sent or -1 on error (may be NULL: they are parsed and sent
+    // one by one)
+    int  (*send_raw)(canopen_transport_t *tp, struct canfd_frame *cf, const int *mtu, int n);
+
+    // keep the current receive filter in saved, and put it back later, 0
+    // on success, -1 on error (may be NULL: the filter cannot be kept)
+    int  (*filter_save)(canopen_transport_t *tp, can_filter_saved_t *saved);
+    int  (*filter_restore)(canopen_transport_t *tp, can_filter_saved_t *saved);
+
+} canopen_transport_ops_t;
+
+struct _canopen_transport {
+
+    const canopen_transport_ops_t *ops;
+
+    int   fd_frames;    // transport carries CAN FD frames
+    int   sock;         // SocketCAN socket, -1 for other transports
+    void *priv;         // transport specific state
+
+    unsigned int sdo_timeout_ms; // wait for each SDO server response
+    canopen_sdo_result_t sdo_result; // outcome of the last SDO transfer
+    uint8_t sdo_block_size;     // sub-block size asked for in block uploads (0: the maximum)
+    uint8_t sdo_block_pst;      // block upload protocol switch threshold (0: no switch)
+};
+
+//
+// SocketCAN transport. canopen_transport_socket_init sets up a transport
+// on the caller's storage (nothing to free); the socket is not closed by
+// canopen_transport_close.
+//
+void canopen_transport_socket_init(canopen_transport_t *tp, int sock);
+canopen_transport_t *canopen_transport_socket_new(int sock);
+
+int  canopen_transport_send(canopen_transport_t *tp, canopen_frame_t *frame);
+int  canopen_transport_send_raw(canopen_transport_t *tp, struct canfd_frame *cf, const int *mtu, int n);
+int  canopen_transport_send_batch(canopen_transport_t *tp, canopen_frame_batch_t *batch);
+int  canopen_transport_recv(canopen_transport_t *tp, canopen_frame_t *frame);
+int  canopen_transport_recv_meta(canopen_transport_t *tp, canopen_frame_t *frame, canopen_frame_meta_t *meta);
+int  canopen_transport_recv_timeout(canopen_transport_t *tp, canopen_frame_t *frame, canopen_frame_meta_t *meta,
+                                    int timeout_ms);
+int  canopen_transport_set_filter(canopen_transport_t *tp, can_subscription_t *subs, int n);
+int  canopen_transport_filter_sdo(canopen_transport_t *tp, uint8_t node);
+int  canopen_transport_filter_save(canopen_transport_t *tp, can_filter_saved_t *saved);
+int  canopen_transport_filter_restore(canopen_transport_t *tp, can_filter_saved_t *saved);
+int  canopen_transport_timestamp(canopen_transport_t *tp, int mode);
+void canopen_transport_close(canopen_transport_t *tp);
+
+#endif /* _CANOPEN_TRANSPORT_H_ */
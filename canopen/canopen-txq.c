@@ -0,0 +1,650 @@
+//------------------------------------------------------------------------------
+// Copyright (C) 2012, Robert Johansson, Raditex AB
+// All rights reserved.
+//
+// This file is part of the rSCADA system.
+//
+// rSCADA
+// http://www.rSCADA.se
+// info@rscada.se
+//
+//------------------------------------------------------------------------------
+
+#include <canopen.h>
+#include <canopen-com.h>
+#include <canopen-transport.h>
+#include <canopen-txq.h>
+#include <canopen-cob.h>
+
+#include <linux/can.h>
+
+#include <time.h>
+
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+
+#define CANOPEN_TXQ_TOKEN 1000000ULL // one frame, in micro-frames
+
+typedef struct _canopen_txq_entry {
+    uint64_t key;   // arbitration priority << 32 | sequence number
+    uint32_t slot;  // index into the frame store
+} canopen_txq_entry_t;
+
+typedef struct _canopen_txq_class {
+
+    canopen_txq_entry_t *heap;      // min-heap on key
+    unsigned int         n;
+    unsigned int         max_pending;
+
+    // token bucket, in micro-frames; rate 0 means unlimited
+    unsigned int         rate;      // frames per second
+    uint64_t             burst;
+    uint64_t             tokens;
+    struct timespec      last;
+
+} canopen_txq_class_t;
+
+struct _canopen_txq {
+
+    canopen_transport_t *tp;        // transport the frames are sent on
+    canopen_transport_t  qtp;       // queued transport on top of it
+
+    unsigned int         capacity;
+    canopen_frame_t     *frames;
+    uint32_t            *free_slots;
+    unsigned int         n_free;
+    uint32_t             seq;
+
+    canopen_txq_class_t  classes[CANOPEN_TXQ_CLASSES];
+
+    const canopen_cob_map_t *cob_map; // classifies frames, NULL: predefined set
+};
+
+//------------------------------------------------------------------------------
+// Arbitration priority of a frame: lower wins the bus. An extended frame
+// loses against a standard frame with the same 11-bit base identifier.
+//------------------------------------------------------------------------------
+static uint32_t
+canopen_txq_priority(canopen_frame_t *frame)
+{
+    if (frame->type == CANOPEN_FLAG_EXTENDED)
+        return ((frame->id >> 18) << 19) | (1 << 18) | (frame->id & 0x3FFFF);
+
+    return (((frame->function_code & 0xF) << 7) | (frame->id & 0x7F)) << 19;
+}
+
+//------------------------------------------------------------------------------
+// Traffic class of a frame (CANOPEN_TXQ_CLASS_*), from the service its
+// COB-ID carries in map (NULL: the predefined connection set).
+//------------------------------------------------------------------------------
+static int
+canopen_txq_frame_class_map(const canopen_cob_map_t *map, canopen_frame_t *frame)
+{
+    if (frame->type != CANOPEN_FLAG_STANDARD)
+        return CANOPEN_TXQ_CLASS_OTHER;
+
+    switch (canopen_cob_classify(map, (frame->function_code<<7)|frame->id)->service)
+    {
+        case CANOPEN_SERVICE_NMT:
+        case CANOPEN_SERVICE_SYNC:
+        case CANOPEN_SERVICE_EMCY:
+        case CANOPEN_SERVICE_TIME:
+        case CANOPEN_SERVICE_PDO:
+            return CANOPEN_TXQ_CLASS_PROCESS;
+
+        case CANOPEN_SERVICE_SDO:
+            return CANOPEN_TXQ_CLASS_SDO;
+    }
+
+    return CANOPEN_TXQ_CLASS_OTHER;
+}
+
+int
+canopen_txq_frame_class(canopen_frame_t *frame)
+{
+    return canopen_txq_frame_class_map(NULL, frame);
+}
+
+//------------------------------------------------------------------------------
+// Heap operations
+//------------------------------------------------------------------------------
+static void
+canopen_txq_heap_push(canopen_txq_class_t *c, uint64_t key, uint32_t slot)
+{
+    unsigned int i = c->n++, parent;
+
+    while (i > 0)
+    {
+        parent = (i - 1) / 2;
+        if (c->heap[parent].key <= key)
+            break;
+        c->heap[i] = c->heap[parent];
+        i = parent;
+    }
+
+    c->heap[i].key  = key;
+    c->heap[i].slot = slot;
+}
+
+static void
+canopen_txq_heap_pop(canopen_txq_class_t *c)
+{
+    canopen_txq_entry_t last = c->heap[--c->n];
+    unsigned int i = 0, child;
+
+    while ((child = 2 * i + 1) < c->n)
+    {
+        if (child + 1 < c->n && c->heap[child + 1].key < c->heap[child].key)
+            child++;
+        if (last.key <= c->heap[child].key)
+            break;
+        c->heap[i] = c->heap[child];
+        i = child;
+    }
+
+    c->heap[i] = last;
+}
+
+//------------------------------------------------------------------------------
+// Add the tokens earned since the last refill.
+//------------------------------------------------------------------------------
+static void
+canopen_txq_refill(canopen_txq_class_t *c, struct timespec *now)
+{
+    uint64_t elapsed_ns;
+
+    if (c->rate == 0)
+        return;
+
+    elapsed_ns = (uint64_t)(now->tv_sec - c->last.tv_sec) * 1000000000ULL +
+                 now->tv_nsec - c->last.tv_nsec;
+    c->last = *now;
+
+    // a long idle period only fills the bucket
+    if (elapsed_ns > 10000000000ULL)
+        elapsed_ns = 10000000000ULL;
+
+    c->tokens += elapsed_ns * c->rate / 1000;
+    if (c->tokens > c->burst)
+        c->tokens = c->burst;
+}
+
+//------------------------------------------------------------------------------
+// Queued transport operations: sending goes through the queue, everything
+// else is passed on to the underlying transport.
+//------------------------------------------------------------------------------
+static int
+canopen_txq_tp_queue(canopen_txq_t *q, canopen_frame_t *frame)
+{
+    struct timespec delay;
+    int ms;
+
+    // backpressure: wait for room in the frame's class
+    while (canopen_txq_push(q, frame) != 0)
+    {
+        if (canopen_txq_flush(q) < 0)
+            return 1;
+
+        if ((ms = canopen_txq_next_ms(q)) <= 0)
+            ms = 1; // the transport itself is busy
+
+        delay.tv_sec  = ms / 1000;
+        delay.tv_nsec = (ms % 1000) * 1000000L;
+        nanosleep(&delay, NULL);
+    }
+
+    return 0;
+}
+
+static int
+canopen_txq_tp_send(canopen_transport_t *tp, canopen_frame_t *frame)
+{
+    canopen_txq_t *q = (canopen_txq_t *)tp->priv;
+
+    if (canopen_txq_tp_queue(q, frame) != 0)
+        return 1;
+
+    return canopen_txq_flush(q) < 0 ? 1 : 0;
+}
+
+// queue the whole batch (e.g. block download segments), then flush once
+static int
+canopen_txq_tp_send_raw(canopen_transport_t *tp, struct canfd_frame *cf, const int *mtu, int n)
+{
+    canopen_txq_t *q = (canopen_txq_t *)tp->priv;
+    canopen_frame_t frame;
+    int i;
+
+    for (i = 0; i < n; i++)
+    {
+        if (canopen_frame_parse_mtu(&frame, &cf[i], mtu[i]) != 0 ||
+            canopen_txq_tp_queue(q, &frame) != 0)
+            return i ? i : -1;
+    }
+
+    return canopen_txq_flush(q) < 0 ? -1 : n;
+}
+
+static int
+canopen_txq_tp_recv(canopen_transport_t *tp, canopen_frame_t *frame, canopen_frame_meta_t *meta,
+                    int timeout_ms)
+{
+    canopen_txq_t *q = (canopen_txq_t *)tp->priv;
+    struct timespec start, now;
+    int next, wait, elapsed;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // frames held back by the rate limits go out while we wait, so wait
+    // in slices until the next one is due
+    for (;;)
+    {
+        canopen_txq_flush(q);
+
+        next = canopen_txq_next_ms(q);
+        if (next == 0)
+            next = 1; // the transport itself is busy
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        elapsed = (now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000;
+
+        wait = timeout_ms;
+        if (timeout_ms >= 0)
+            wait = (elapsed < timeout_ms) ? timeout_ms - elapsed : 0;
+
+        if (next < 0 || (wait >= 0 && wait <= next))
+            return canopen_transport_recv_timeout(q->tp, frame, meta, wait);
+
+        if (canopen_transport_recv_timeout(q->tp, frame, meta, next) == 0)
+            return 0;
+
+        if (errno != EAGAIN)
+            return 1;
+    }
+}
+
+static int
+canopen_txq_tp_set_filter(canopen_transport_t *tp, can_subscription_t *subs, int n)
+{
+    return canopen_transport_set_filter(((canopen_txq_t *)tp->priv)->tp, subs, n);
+}
+
+static int
+canopen_txq_tp_filter_save(canopen_transport_t *tp, can_filter_saved_t *saved)
+{
+    return canopen_transport_filter_save(((canopen_txq_t *)tp->priv)->tp, saved);
+}
+
+static int
+canopen_txq_tp_filter_restore(canopen_transport_t *tp, can_filter_saved_t *saved)
+{
+    return canopen_transport_filter_restore(((canopen_txq_t *)tp->priv)->tp, saved);
+}
+
+static int
+canopen_txq_tp_timestamp(canopen_transport_t *tp, int mode)
+{
+    return canopen_transport_timestamp(((canopen_txq_t *)tp->priv)->tp, mode);
+}
+
+static const canopen_transport_ops_t canopen_txq_ops = {
+    canopen_txq_tp_send,
+    canopen_txq_tp_recv,
+    canopen_txq_tp_set_filter,
+    canopen_txq_tp_timestamp,
+    NULL,
+    canopen_txq_tp_send_raw,
+    canopen_txq_tp_filter_save,
+    canopen_txq_tp_filter_restore
+};
+
+//------------------------------------------------------------------------------
+//SF
+//SF .. c:function:: canopen_txq_t *canopen_txq_new(canopen_transport_t *tp, unsigned int capacity)
+//SF
+//SF     Create a transmit queue for frames sent on the transport tp, with
+//SF     room for capacity frames (0 selects CANOPEN_TXQ_CAPACITY). SDO
+//SF     traffic is limited to CANOPEN_TXQ_SDO_RATE frames per second
+//SF     (bursts of CANOPEN_TXQ_SDO_BURST) initially, the other classes are
+//SF     not rate limited. SDO and other traffic may only fill half of the
+//SF     queue each, so process data always finds room.
+//SF
+//------------------------------------------------------------------------------
+canopen_txq_t *
+canopen_txq_new(canopen_transport_t *tp, unsigned int capacity)
+{
+    canopen_txq_t *q;
+    unsigned int i;
+
+    if (capacity == 0)
+        capacity = CANOPEN_TXQ_CAPACITY;
+
+    if ((q = (canopen_txq_t *)malloc(sizeof(canopen_txq_t))) == NULL)
+        return NULL;
+
+    bzero((void *)q, sizeof(canopen_txq_t));
+    q->tp       = tp;
+    q->capacity = capacity;
+
+    q->frames     = (canopen_frame_t *)malloc(capacity * sizeof(canopen_frame_t));
+    q->free_slots = (uint32_t *)malloc(capacity * sizeof(uint32_t));
+    if (q->frames == NULL || q->free_slots == NULL)
+    {
+        canopen_txq_free(q);
+        return NULL;
+    }
+
+    for (i = 0; i < capacity; i++)
+        q->free_slots[i] = capacity - 1 - i;
+    q->n_free = capacity;
+
+    for (i = 0; i < CANOPEN_TXQ_CLASSES; i++)
+    {
+        if ((q->classes[i].heap = (canopen_txq_entry_t *)malloc(capacity * sizeof(canopen_txq_entry_t))) == NULL)
+        {
+            canopen_txq_free(q);
+            return NULL;
+        }
+
+        q->classes[i].max_pending = (i == CANOPEN_TXQ_CLASS_PROCESS) ? capacity : capacity / 2;
+    }
+
+    canopen_txq_class_limit(q, CANOPEN_TXQ_CLASS_SDO, CANOPEN_TXQ_SDO_RATE, CANOPEN_TXQ_SDO_BURST,
+                            capacity / 2);
+
+    q->qtp.ops            = &canopen_txq_ops;
+    q->qtp.sock           = tp->sock;
+    q->qtp.fd_frames      = tp->fd_frames;
+    q->qtp.sdo_timeout_ms = tp->sdo_timeout_ms;
+    q->qtp.priv           = q;
+
+    return q;
+}
+
+//------------------------------------------------------------------------------
+//SF
+//SF .. c:function:: void canopen_txq_free(canopen_txq_t *q)
+//SF
+//SF     Free the queue, dropping frames that were not sent. The underlying
+//SF     transport is not closed.
+//SF
+//------------------------------------------------------------------------------
+void
+canopen_txq_free(canopen_txq_t *q)
+{
+    int i;
+
+    if (q == NULL)
+        return;
+
+    for (i = 0; i < CANOPEN_TXQ_CLASSES; i++)
+        free(q->classes[i].heap);
+
+    free(q->frames);
+    free(q->free_slots);
+    free(q);
+}
+
+//------------------------------------------------------------------------------
+//SF
+//SF .. c:function:: int canopen_txq_class_limit(canopen_txq_t *q, int tx_class, unsigned int rate, unsigned int burst, unsigned int max_pending)
+//SF
+//SF     Limit a traffic class to rate frames per second on average (0: no
+//SF     limit), with bursts of up to burst frames, and to max_pending
+//SF     queued frames (0: the queue capacity). Returns 0, or -1 for an
+//SF     unknown class.
+//SF
+//------------------------------------------------------------------------------
+int
+canopen_txq_class_limit(canopen_txq_t *q, int tx_class, unsigned int rate,
+                        unsigned int burst, unsigned int max_pending)
+{
+    canopen_txq_class_t *c;
+
+    if (tx_class < 0 || tx_class >= CANOPEN_TXQ_CLASSES)
+        return -1;
+
+    c = &(q->classes[tx_class]);
+
+    c->rate        = rate;
+    c->burst       = (burst ? burst : 1) * CANOPEN_TXQ_TOKEN;
+    c->tokens      = c->burst;
+    c->max_pending = (max_pending && max_pending < q->capacity) ? max_pending : q->capacity;
+    clock_gettime(CLOCK_MONOTONIC, &c->last);
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+//SF
+//SF .. c:function:: void canopen_txq_cob_map(canopen_txq_t *q, const canopen_cob_map_t *map)
+//SF
+//SF     Classify queued frames with map (see canopen-cob.h), so that
+//SF     remapped PDOs and SDOs get their traffic class. The map must stay
+//SF     valid while the queue is in use; NULL restores the predefined set.
+//SF
+//------------------------------------------------------------------------------
+void
+canopen_txq_cob_map(canopen_txq_t *q, const canopen_cob_map_t *map)
+{
+    q->cob_map = map;
+}
+
+//------------------------------------------------------------------------------
+//SF
+//SF .. c:function:: int canopen_txq_push(canopen_txq_t *q, canopen_frame_t *frame)
+//SF
+//SF     Queue a copy of the frame. Nothing is sent until canopen_txq_flush.
+//SF     Returns 0, or 1 if the frame's class or the queue is full (errno
+//SF     is ENOBUFS); the caller should flush and retry later.
+//SF
+//------------------------------------------------------------------------------
+int
+canopen_txq_push(canopen_txq_t *q, canopen_frame_t *frame)
+{
+    canopen_txq_class_t *c = &(q->classes[canopen_txq_frame_class_map(q->cob_map, frame)]);
+    uint32_t slot;
+
+    if (q->n_free == 0 || c->n >= c->max_pending)
+    {
+        errno = ENOBUFS;
+        return 1;
+    }
+
+    slot = q->free_slots[--q->n_free];
+    memcpy(&q->frames[slot], frame, sizeof(canopen_frame_t));
+
+    // the sequence number keeps frames with the same COB-ID in order
+    canopen_txq_heap_push(c, ((uint64_t)canopen_txq_priority(frame) << 32) | q->seq++, slot);
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+// Take the frame that goes out next (highest priority among the classes
+// with tokens left) off its heap. Returns its class, or NULL if none may
+// go out now.
+//------------------------------------------------------------------------------
+static canopen_txq_class_t *
+canopen_txq_take(canopen_txq_t *q, canopen_txq_entry_t *entry)
+{
+    canopen_txq_class_t *c, *best = NULL;
+    int i;
+
+    for (i = 0; i < CANOPEN_TXQ_CLASSES; i++)
+    {
+        c = &(q->classes[i]);
+
+        if (c->n == 0 || (c->rate && c->tokens < CANOPEN_TXQ_TOKEN))
+            continue;
+
+        if (best == NULL || c->heap[0].key < best->heap[0].key)
+            best = c;
+    }
+
+    if (best == NULL)
+        return NULL;
+
+    *entry = best->heap[0];
+    canopen_txq_heap_pop(best);
+
+    if (best->rate)
+        best->tokens -= CANOPEN_TXQ_TOKEN;
+
+    return best;
+}
+
+//------------------------------------------------------------------------------
+//SF
+//SF .. c:function:: int canopen_txq_flush(canopen_txq_t *q)
+//SF
+//SF     Send queued frames, highest priority (lowest COB-ID) first, as long
+//SF     as their class has tokens left and the transport accepts them. The
+//SF     frames are handed to the transport in batches of up to
+//SF     CANOPEN_FRAME_BATCH_MAX (one sendmmsg on a socket transport).
+//SF     Returns the number of frames still queued, or -1 on a transport
+//SF     error other than a full transmit queue (the failing frame is
+//SF     dropped).
+//SF
+//------------------------------------------------------------------------------
+int
+canopen_txq_flush(canopen_txq_t *q)
+{
+    struct canfd_frame   cf[CANOPEN_FRAME_BATCH_MAX];
+    int                  mtu[CANOPEN_FRAME_BATCH_MAX];
+    canopen_txq_entry_t  taken[CANOPEN_FRAME_BATCH_MAX];
+    canopen_txq_class_t *owner[CANOPEN_FRAME_BATCH_MAX], *c;
+    struct timespec now;
+    int i, n, sent = 0, err = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    for (i = 0; i < CANOPEN_TXQ_CLASSES; i++)
+        canopen_txq_refill(&(q->classes[i]), &now);
+
+    do
+    {
+        for (n = 0; n < CANOPEN_FRAME_BATCH_MAX && (c = canopen_txq_take(q, &taken[n])) != NULL; )
+        {
+            if ((mtu[n] = canopen_frame_pack_mtu(&q->frames[taken[n].slot], &cf[n])) < 0)
+            {
+                // the frame can not be sent at all: drop it
+                q->free_slots[q->n_free++] = taken[n].slot;
+                err = 1;
+                continue;
+            }
+
+            owner[n++] = c;
+        }
+
+        if (n == 0)
+            break;
+
+        errno = 0;
+        if ((sent = canopen_transport_send_raw(q->tp, cf, mtu, n)) < 0)
+        {
+            sent = 0;
+
+            if (errno != ENOBUFS && errno != EAGAIN)
+            {
+                // not a full device queue: the frame can not be sent at
+                // all, drop it
+                sent = 1;
+                err  = 1;
+            }
+        }
+
+        for (i = 0; i < sent; i++)
+            q->free_slots[q->n_free++] = taken[i].slot;
+
+        // the rest goes back in its place, to be sent later
+        for (i = sent; i < n; i++)
+        {
+            canopen_txq_heap_push(owner[i], taken[i].key, taken[i].slot);
+            if (owner[i]->rate)
+                owner[i]->tokens += CANOPEN_TXQ_TOKEN;
+        }
+
+    } while (sent == CANOPEN_FRAME_BATCH_MAX && !err);
+
+    return err ? -1 : (int)(q->capacity - q->n_free);
+}
+
+//------------------------------------------------------------------------------
+//SF
+//SF .. c:function:: int canopen_txq_pending(canopen_txq_t *q, int tx_class)
+//SF
+//SF     Number of queued frames of a class, or of all classes if tx_class
+//SF     is -1.
+//SF
+//------------------------------------------------------------------------------
+int
+canopen_txq_pending(canopen_txq_t *q, int tx_class)
+{
+    if (tx_class < 0 || tx_class >= CANOPEN_TXQ_CLASSES)
+        return q->capacity - q->n_free;
+
+    return q->classes[tx_class].n;
+}
+
+//------------------------------------------------------------------------------
+//SF
+//SF .. c:function:: int canopen_txq_next_ms(canopen_txq_t *q)
+//SF
+//SF     Milliseconds until canopen_txq_flush can send another frame: 0 if a
+//SF     frame can go out now, -1 if the queue is empty. Suitable as a
+//SF     poll/event loop timeout.
+//SF
+//------------------------------------------------------------------------------
+int
+canopen_txq_next_ms(canopen_txq_t *q)
+{
+    canopen_txq_class_t *c;
+    struct timespec now;
+    uint64_t wait_us;
+    int i, ms, next = -1;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    for (i = 0; i < CANOPEN_TXQ_CLASSES; i++)
+    {
+        c = &(q->classes[i]);
+
+        if (c->n == 0)
+            continue;
+
+        canopen_txq_refill(c, &now);
+
+        if (c->rate == 0 || c->tokens >= CANOPEN_TXQ_TOKEN)
+            return 0;
+
+        wait_us = (CANOPEN_TXQ_TOKEN - c->tokens + c->rate - 1) / c->rate;
+        ms = (int)((wait_us + 999) / 1000);
+
+        if (next < 0 || ms < next)
+            next = ms;
+    }
+
+    return next;
+}
+
+//------------------------------------------------------------------------------
+//SF
+//SF .. c:function:: canopen_transport_t *canopen_txq_transport(canopen_txq_t *q)
+//SF
+//SF     A transport that sends through the queue and receives from the
+//SF     underlying transport. Running the SDO routines on it subjects their
+//SF     frames to the SDO class limits; a full class blocks the sender
+//SF     until there is room again. A batch of frames (such as a block
+//SF     download sub-block) is queued whole and then flushed once.
+//SF
+//------------------------------------------------------------------------------
+canopen_transport_t *
+canopen_txq_transport(canopen_txq_t *q)
+{
+    return &q->qtp;
+}
@@ -0,0 +1,58 @@
+//------------------------------------------------------------------------------
+// Copyright (C) 2012, Robert Johansson, Raditex AB
+// All rights reserved.
+//
+// This file is part of the rSCADA system.
+//
+// rSCADA
+// http://www.rSCADA.se
+// info@rscada.se
+//
+//------------------------------------------------------------------------------
+
+//
+// CANopen transmit queue: frames are sent in CAN arbitration order (lowest
+// COB-ID first), with a token bucket rate limit and a pending frame limit
+// per traffic class, so that bulk SDO transfers cannot delay process data.
+//
+
+#ifndef _CANOPEN_TXQ_H_
+#define _CANOPEN_TXQ_H_
+
+#include <stdint.h>
+
+#include "canopen.h"
+#include "canopen-transport.h"
+#include "canopen-cob.h"
+
+// traffic classes
+#define CANOPEN_TXQ_CLASS_PROCESS   0   // NMT, SYNC, EMCY, TIME and PDOs
+#define CANOPEN_TXQ_CLASS_SDO       1   // SDO requests and responses
+#define CANOPEN_TXQ_CLASS_OTHER     2   // heartbeat, LSS, extended frames, unknown COB-IDs
+#define CANOPEN_TXQ_CLASSES         3
+
+#define CANOPEN_TXQ_CAPACITY        256 // default number of queued frames
+
+// default SDO class limit: about a quarter of a 250 kbit/s bus, so that
+// block transfers leave room for process data until rates are configured
+#define CANOPEN_TXQ_SDO_RATE        500 // frames per second
+#define CANOPEN_TXQ_SDO_BURST       8
+
+typedef struct _canopen_txq canopen_txq_t;
+
+canopen_txq_t *canopen_txq_new(canopen_transport_t *tp, unsigned int capacity);
+void           canopen_txq_free(canopen_txq_t *q);
+
+int canopen_txq_class_limit(canopen_txq_t *q, int tx_class, unsigned int rate,
+                            unsigned int burst, unsigned int max_pending);
+int canopen_txq_frame_class(canopen_frame_t *frame);
+void canopen_txq_cob_map(canopen_txq_t *q, const canopen_cob_map_t *map);
+
+int canopen_txq_push(canopen_txq_t *q, canopen_frame_t *frame);
+int canopen_txq_flush(canopen_txq_t *q);
+int canopen_txq_pending(canopen_txq_t *q, int tx_class);
+int canopen_txq_next_ms(canopen_txq_t *q);
+
+canopen_transport_t *canopen_txq_transport(canopen_txq_t *q);
+
+#endif /* _CANOPEN_TXQ_H_ */
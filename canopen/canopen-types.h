@@ -0,0 +1,400 @@
+//------------------------------------------------------------------------------
+// Copyright (C) 2012, Robert Johansson, Raditex AB
+// All rights reserved.
+//
+// This file is part of the rSCADA system.
+//
+// rSCADA
+// http://www.rSCADA.se
+// info@rscada.se
+//
+//------------------------------------------------------------------------------
+
+//
+// CiA 301 data types: encoding and decoding of the basic types in their
+// little-endian transfer syntax, as used in SDO and PDO data. The 8, 16,
+// 32 and 64 bit types (and the reals) are read or written with one
+// (unaligned) load or store on little-endian hosts; the 24, 40, 48 and 56
+// bit integers are assembled a byte at a time. The _n variants convert
+// arrays.
+//
+
+#ifndef _CANOPEN_TYPES_H_
+#define _CANOPEN_TYPES_H_
+
+#include <endian.h>
+#include <string.h>
+#include <stdint.h>
+
+// data type indices (object dictionary entries 0x0001-0x001B)
+#define CANOPEN_TYPE_BOOLEAN            0x01
+#define CANOPEN_TYPE_INTEGER8           0x02
+#define CANOPEN_TYPE_INTEGER16          0x03
+#define CANOPEN_TYPE_INTEGER32          0x04
+#define CANOPEN_TYPE_UNSIGNED8          0x05
+#define CANOPEN_TYPE_UNSIGNED16         0x06
+#define CANOPEN_TYPE_UNSIGNED32         0x07
+#define CANOPEN_TYPE_REAL32             0x08
+#define CANOPEN_TYPE_VISIBLE_STRING     0x09
+#define CANOPEN_TYPE_OCTET_STRING       0x0A
+#define CANOPEN_TYPE_UNICODE_STRING     0x0B
+#define CANOPEN_TYPE_TIME_OF_DAY        0x0C
+#define CANOPEN_TYPE_TIME_DIFFERENCE    0x0D
+#define CANOPEN_TYPE_DOMAIN             0x0F
+#define CANOPEN_TYPE_INTEGER24          0x10
+#define CANOPEN_TYPE_REAL64             0x11
+#define CANOPEN_TYPE_INTEGER40          0x12
+#define CANOPEN_TYPE_INTEGER48          0x13
+#define CANOPEN_TYPE_INTEGER56          0x14
+#define CANOPEN_TYPE_INTEGER64          0x15
+#define CANOPEN_TYPE_UNSIGNED24         0x16
+#define CANOPEN_TYPE_UNSIGNED40         0x18
+#define CANOPEN_TYPE_UNSIGNED48         0x19
+#define CANOPEN_TYPE_UNSIGNED56         0x1A
+#define CANOPEN_TYPE_UNSIGNED64         0x1B
+
+//
+// Size in bytes of a basic data type, 0 for the variable length types
+// (strings, domain) and unknown types.
+//
+static inline int
+canopen_type_size(uint16_t type)
+{
+    switch (type)
+    {
+        case CANOPEN_TYPE_BOOLEAN:
+        case CANOPEN_TYPE_INTEGER8:
+        case CANOPEN_TYPE_UNSIGNED8:        return 1;
+        case CANOPEN_TYPE_INTEGER16:
+        case CANOPEN_TYPE_UNSIGNED16:       return 2;
+        case CANOPEN_TYPE_INTEGER24:
+        case CANOPEN_TYPE_UNSIGNED24:       return 3;
+        case CANOPEN_TYPE_INTEGER32:
+        case CANOPEN_TYPE_UNSIGNED32:
+        case CANOPEN_TYPE_REAL32:           return 4;
+        case CANOPEN_TYPE_INTEGER40:
+        case CANOPEN_TYPE_UNSIGNED40:       return 5;
+        case CANOPEN_TYPE_INTEGER48:
+        case CANOPEN_TYPE_UNSIGNED48:
+        case CANOPEN_TYPE_TIME_OF_DAY:
+        case CANOPEN_TYPE_TIME_DIFFERENCE:  return 6;
+        case CANOPEN_TYPE_INTEGER56:
+        case CANOPEN_TYPE_UNSIGNED56:       return 7;
+        case CANOPEN_TYPE_INTEGER64:
+        case CANOPEN_TYPE_UNSIGNED64:
+        case CANOPEN_TYPE_REAL64:           return 8;
+    }
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+// Unsigned and signed integers
+//------------------------------------------------------------------------------
+
+static inline uint8_t
+canopen_decode_u8(const uint8_t *data)
+{
+    return data[0];
+}
+
+static inline uint16_t
+canopen_decode_u16(const uint8_t *data)
+{
+    uint16_t v;
+
+    memcpy(&v, data, sizeof(v));
+    return le16toh(v);
+}
+
+static inline uint32_t
+canopen_decode_u32(const uint8_t *data)
+{
+    uint32_t v;
+
+    memcpy(&v, data, sizeof(v));
+    return le32toh(v);
+}
+
+static inline uint64_t
+canopen_decode_u64(const uint8_t *data)
+{
+    uint64_t v;
+
+    memcpy(&v, data, sizeof(v));
+    return le64toh(v);
+}
+
+// an unsigned integer of len (0..8) bytes
+static inline uint64_t
+canopen_decode_un(const uint8_t *data, int len)
+{
+    uint64_t v = 0;
+
+    while (len-- > 0)
+        v = (v << 8) | data[len];
+
+    return v;
+}
+
+static inline uint32_t canopen_decode_u24(const uint8_t *data) { return (uint32_t)canopen_decode_un(data, 3); }
+static inline uint64_t canopen_decode_u40(const uint8_t *data) { return canopen_decode_un(data, 5); }
+static inline uint64_t canopen_decode_u48(const uint8_t *data) { return canopen_decode_un(data, 6); }
+static inline uint64_t canopen_decode_u56(const uint8_t *data) { return canopen_decode_un(data, 7); }
+
+// a signed integer of len (1..8) bytes, sign extended; 0 if len is below
+// 1, and len is taken as 8 above it
+static inline int64_t
+canopen_decode_in(const uint8_t *data, int len)
+{
+    int shift;
+
+    if (len < 1)
+        return 0;
+    if (len > 8)
+        len = 8;
+
+    shift = 64 - 8 * len;
+
+    return (int64_t)(canopen_decode_un(data, len) << shift) >> shift;
+}
+
+static inline int8_t  canopen_decode_i8(const uint8_t *data)  { return (int8_t)data[0]; }
+static inline int16_t canopen_decode_i16(const uint8_t *data) { return (int16_t)canopen_decode_u16(data); }
+static inline int32_t canopen_decode_i24(const uint8_t *data) { return (int32_t)canopen_decode_in(data, 3); }
+static inline int32_t canopen_decode_i32(const uint8_t *data) { return (int32_t)canopen_decode_u32(data); }
+static inline int64_t canopen_decode_i40(const uint8_t *data) { return canopen_decode_in(data, 5); }
+static inline int64_t canopen_decode_i48(const uint8_t *data) { return canopen_decode_in(data, 6); }
+static inline int64_t canopen_decode_i56(const uint8_t *data) { return canopen_decode_in(data, 7); }
+static inline int64_t canopen_decode_i64(const uint8_t *data) { return (int64_t)canopen_decode_u64(data); }
+
+static inline void
+canopen_encode_u8(uint8_t *data, uint8_t value)
+{
+    data[0] = value;
+}
+
+static inline void
+canopen_encode_u16(uint8_t *data, uint16_t value)
+{
+    value = htole16(value);
+    memcpy(data, &value, sizeof(value));
+}
+
+static inline void
+canopen_encode_u32(uint8_t *data, uint32_t value)
+{
+    value = htole32(value);
+    memcpy(data, &value, sizeof(value));
+}
+
+static inline void
+canopen_encode_u64(uint8_t *data, uint64_t value)
+{
+    value = htole64(value);
+    memcpy(data, &value, sizeof(value));
+}
+
+// the low len (0..8) bytes of value; also for signed values
+static inline void
+canopen_encode_un(uint8_t *data, int len, uint64_t value)
+{
+    int n;
+
+    for (n = 0; n < len; n++, value >>= 8)
+        data[n] = value & 0xFF;
+}
+
+static inline void canopen_encode_u24(uint8_t *data, uint32_t value) { canopen_encode_un(data, 3, value); }
+static inline void canopen_encode_u40(uint8_t *data, uint64_t value) { canopen_encode_un(data, 5, value); }
+static inline void canopen_encode_u48(uint8_t *data, uint64_t value) { canopen_encode_un(data, 6, value); }
+static inline void canopen_encode_u56(uint8_t *data, uint64_t value) { canopen_encode_un(data, 7, value); }
+
+static inline void canopen_encode_i8(uint8_t *data, int8_t value)   { data[0] = (uint8_t)value; }
+static inline void canopen_encode_i16(uint8_t *data, int16_t value) { canopen_encode_u16(data, (uint16_t)value); }
+static inline void canopen_encode_i24(uint8_t *data, int32_t value) { canopen_encode_un(data, 3, (uint64_t)value); }
+static inline void canopen_encode_i32(uint8_t *data, int32_t value) { canopen_encode_u32(data, (uint32_t)value); }
+static inline void canopen_encode_i40(uint8_t *data, int64_t value) { canopen_encode_un(data, 5, (uint64_t)value); }
+static inline void canopen_encode_i48(uint8_t *data, int64_t value) { canopen_encode_un(data, 6, (uint64_t)value); }
+static inline void canopen_encode_i56(uint8_t *data, int64_t value) { canopen_encode_un(data, 7, (uint64_t)value); }
+static inline void canopen_encode_i64(uint8_t *data, int64_t value) { canopen_encode_u64(data, (uint64_t)value); }
+
+//------------------------------------------------------------------------------
+// Floating point (IEEE 754, little-endian)
+//------------------------------------------------------------------------------
+
+static inline float
+canopen_decode_real32(const uint8_t *data)
+{
+    uint32_t u = canopen_decode_u32(data);
+    float f;
+
+    memcpy(&f, &u, sizeof(f));
+    return f;
+}
+
+static inline double
+canopen_decode_real64(const uint8_t *data)
+{
+    uint64_t u = canopen_decode_u64(data);
+    double d;
+
+    memcpy(&d, &u, sizeof(d));
+    return d;
+}
+
+static inline void
+canopen_encode_real32(uint8_t *data, float value)
+{
+    uint32_t u;
+
+    memcpy(&u, &value, sizeof(u));
+    canopen_encode_u32(data, u);
+}
+
+static inline void
+canopen_encode_real64(uint8_t *data, double value)
+{
+    uint64_t u;
+
+    memcpy(&u, &value, sizeof(u));
+    canopen_encode_u64(data, u);
+}
+
+//------------------------------------------------------------------------------
+// TIME_OF_DAY and TIME_DIFFERENCE: milliseconds (28 bits, after midnight
+// for TIME_OF_DAY) and days (since January 1, 1984 for TIME_OF_DAY).
+//------------------------------------------------------------------------------
+
+typedef struct _canopen_time {
+
+    uint32_t ms;
+    uint16_t days;
+
+} canopen_time_t;
+
+static inline canopen_time_t
+canopen_decode_time(const uint8_t *data)
+{
+    canopen_time_t t;
+
+    t.ms   = canopen_decode_u32(data) & 0x0FFFFFFF;
+    t.days = canopen_decode_u16(data + 4);
+    return t;
+}
+
+static inline void
+canopen_encode_time(uint8_t *data, canopen_time_t t)
+{
+    canopen_encode_u32(data, t.ms & 0x0FFFFFFF);
+    canopen_encode_u16(data + 4, t.days);
+}
+
+//------------------------------------------------------------------------------
+// VISIBLE_STRING: not terminated on the bus, it ends with the data (or at
+// a NUL). Decoding copies at most size - 1 characters and terminates str;
+// both return the string length.
+//------------------------------------------------------------------------------
+
+static inline int
+canopen_decode_visible_string(const uint8_t *data, int len, char *str, int size)
+{
+    int n;
+
+    for (n = 0; n < len && n < size - 1 && data[n] != '\0'; n++)
+        str[n] = (char)data[n];
+
+    if (size > 0)
+        str[n] = '\0';
+
+    return n;
+}
+
+static inline int
+canopen_encode_visible_string(uint8_t *data, int len, const char *str)
+{
+    int n;
+
+    for (n = 0; n < len && str[n] != '\0'; n++)
+        data[n] = (uint8_t)str[n];
+
+    return n;
+}
+
+//------------------------------------------------------------------------------
+// Arrays of values, packed back to back (e.g. a PDO mapping several
+// objects of one type, or a segmented SDO of an array object). On a
+// little-endian host the fixed size types are plain copies.
+//------------------------------------------------------------------------------
+
+#define CANOPEN_TYPES_BULK(name, type)                                          \
+static inline void                                                              \
+canopen_decode_##name##_n(const uint8_t *data, type *values, int n)             \
+{                                                                               \
+    int i;                                                                      \
+                                                                                \
+    if (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)                              \
+    {                                                                           \
+        memcpy(values, data, n * sizeof(type));                                 \
+        return;                                                                 \
+    }                                                                           \
+                                                                                \
+    for (i = 0; i < n; i++)                                                     \
+        values[i] = canopen_decode_##name(data + i * sizeof(type));             \
+}                                                                               \
+                                                                                \
+static inline void                                                              \
+canopen_encode_##name##_n(uint8_t *data, const type *values, int n)             \
+{                                                                               \
+    int i;                                                                      \
+                                                                                \
+    if (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)                              \
+    {                                                                           \
+        memcpy(data, values, n * sizeof(type));                                 \
+        return;                                                                 \
+    }                                                                           \
+                                                                                \
+    for (i = 0; i < n; i++)                                                     \
+        canopen_encode_##name(data + i * sizeof(type), values[i]);              \
+}
+
+CANOPEN_TYPES_BULK(u16, uint16_t)
+CANOPEN_TYPES_BULK(u32, uint32_t)
+CANOPEN_TYPES_BULK(u64, uint64_t)
+CANOPEN_TYPES_BULK(i16, int16_t)
+CANOPEN_TYPES_BULK(i32, int32_t)
+CANOPEN_TYPES_BULK(i64, int64_t)
+CANOPEN_TYPES_BULK(real32, float)
+CANOPEN_TYPES_BULK(real64, double)
+
+#undef CANOPEN_TYPES_BULK
+
+// the odd sized integers: len (1..8) bytes per value
+static inline void
+canopen_decode_un_n(const uint8_t *data, int len, uint64_t *values, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++)
+        values[i] = canopen_decode_un(data + i * len, len);
+}
+
+static inline void
+canopen_decode_in_n(const uint8_t *data, int len, int64_t *values, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++)
+        values[i] = canopen_decode_in(data + i * len, len);
+}
+
+static inline void
+canopen_encode_un_n(uint8_t *data, int len, const uint64_t *values, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++)
+        canopen_encode_un(data + i * len, len, values[i]);
+}
+
+#endif /* _CANOPEN_TYPES_H_ */
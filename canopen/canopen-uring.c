@@ -0,0 +1,761 @@
+//------------------------------------------------------------------------------
+// Copyright (C) 2012, Robert Johansson, Raditex AB
+// All rights reserved.
+//
+// This file is part of the rSCADA system.
+//
+// rSCADA
+// http://www.rSCADA.se
+// info@rscada.se
+//
+//------------------------------------------------------------------------------
+
+#include <canopen.h>
+#include <canopen-com.h>
+#include <canopen-uring.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <linux/can.h>
+
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#if defined(IORING_RECV_MULTISHOT) && defined(__NR_io_uring_setup)
+#define CANOPEN_HAVE_URING 1
+#endif
+#endif
+#endif
+
+#ifdef CANOPEN_HAVE_URING
+
+#define CANOPEN_URING_RX_BUFS 256 // receive buffers in the buffer ring (power of 2)
+#define CANOPEN_URING_BGID    0   // buffer group id of the receive buffer ring
+
+// completion tags, the low bits of a TX tag hold the buffer slot
+#define CANOPEN_URING_UD_RX   ((uint64_t)1 << 32)
+#define CANOPEN_URING_UD_TX   ((uint64_t)2 << 32)
+#define CANOPEN_URING_UD_SLOT 0xffffffffULL
+
+struct _canopen_uring {
+
+    int sock;
+    int ring_fd;
+
+    // submission queue
+    void                *sq_ptr;
+    size_t               sq_size;
+    unsigned            *sq_head;
+    unsigned            *sq_tail;
+    unsigned            *sq_mask;
+    unsigned            *sq_array;
+    unsigned             sq_entries;
+    unsigned             sq_local_tail; // queued but not yet published
+    unsigned             sq_submitted;  // published to the kernel
+    struct io_uring_sqe *sqes;
+    size_t               sqes_size;
+
+    // completion queue
+    void                *cq_ptr;
+    size_t               cq_size;
+    unsigned            *cq_head;
+    unsigned            *cq_tail;
+    unsigned            *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    // receive buffer ring
+    struct io_uring_buf_ring *br;
+    size_t                    br_size;
+    struct canfd_frame       *rx_buf;
+    uint16_t                  br_tail;
+    int                       rx_armed;
+
+    // received buffers not yet handed to the caller (bid, length)
+    uint16_t                  rx_pending_bid[CANOPEN_URING_RX_BUFS];
+    int                       rx_pending_len[CANOPEN_URING_RX_BUFS];
+    unsigned                  rx_pending_head;
+    unsigned                  rx_pending_tail;
+
+    // transmit buffers
+    struct canfd_frame *tx_buf;
+    unsigned           *tx_free;
+    unsigned            tx_free_count;
+    unsigned            tx_count;
+    int                 tx_error;       // errno of the last failed send
+
+    // receive timeout, taken from SO_RCVTIMEO of the socket
+    struct __kernel_timespec rx_timeout;
+    int                      rx_timeout_set;
+};
+
+static int
+canopen_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int
+canopen_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+                    unsigned flags, void *arg, size_t argsz)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+static int
+canopen_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args)
+{
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+//------------------------------------------------------------------------------
+// Give a receive buffer back to the kernel through the buffer ring.
+//------------------------------------------------------------------------------
+static void
+canopen_uring_rx_buf_add(canopen_uring_t *ring, unsigned bid)
+{
+    struct io_uring_buf *buf;
+
+    buf = &ring->br->bufs[ring->br_tail & (CANOPEN_URING_RX_BUFS - 1)];
+    buf->addr = (uint64_t)(uintptr_t)&ring->rx_buf[bid];
+    buf->len  = sizeof(struct canfd_frame);
+    buf->bid  = bid;
+
+    ring->br_tail++;
+    __atomic_store_n(&ring->br->tail, ring->br_tail, __ATOMIC_RELEASE);
+}
+
+//------------------------------------------------------------------------------
+// Publish the queued submissions and optionally wait for completions.
+// Returns 0 on success, 1 if the wait timed out, -1 on error.
+//------------------------------------------------------------------------------
+static int
+canopen_uring_submit(canopen_uring_t *ring, unsigned wait, struct __kernel_timespec *ts)
+{
+    struct io_uring_getevents_arg arg;
+    unsigned to_submit, flags = 0;
+    int ret;
+
+    __atomic_store_n(ring->sq_tail, ring->sq_local_tail, __ATOMIC_RELEASE);
+    to_submit = ring->sq_local_tail - ring->sq_submitted;
+
+    if (to_submit == 0 && wait == 0)
+        return 0;
+
+    if (wait)
+    {
+        flags |= IORING_ENTER_GETEVENTS;
+
+        if (ts)
+        {
+            bzero((void *)&arg, sizeof(arg));
+            arg.ts = (uint64_t)(uintptr_t)ts;
+            flags |= IORING_ENTER_EXT_ARG;
+        }
+    }
+
+    ret = canopen_uring_enter(ring->ring_fd, to_submit, wait, flags,
+                              (flags & IORING_ENTER_EXT_ARG) ? &arg : NULL,
+                              (flags & IORING_ENTER_EXT_ARG) ? sizeof(arg) : 0);
+    if (ret < 0)
+    {
+        // a timeout or signal still has consumed the submissions
+        if (errno != ETIME && errno != EINTR)
+            return -1;
+        ring->sq_submitted += to_submit;
+        return errno == ETIME ? 1 : 0;
+    }
+
+    ring->sq_submitted += ret;
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+// Get a free submission queue entry, flushing the queue if it is full.
+//------------------------------------------------------------------------------
+static struct io_uring_sqe *
+canopen_uring_get_sqe(canopen_uring_t *ring)
+{
+    struct io_uring_sqe *sqe;
+    unsigned idx;
+
+    if (ring->sq_local_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries)
+    {
+        if (canopen_uring_submit(ring, 0, NULL) < 0)
+            return NULL;
+
+        if (ring->sq_local_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries)
+            return NULL;
+    }
+
+    idx = ring->sq_local_tail & *ring->sq_mask;
+    sqe = &ring->sqes[idx];
+    bzero((void *)sqe, sizeof(struct io_uring_sqe));
+    ring->sq_array[idx] = idx;
+    ring->sq_local_tail++;
+
+    return sqe;
+}
+
+//------------------------------------------------------------------------------
+// Arm the multishot receive on the CAN socket. It stays armed until the
+// kernel runs out of buffers or the request fails.
+//------------------------------------------------------------------------------
+static int
+canopen_uring_rx_arm(canopen_uring_t *ring)
+{
+    struct io_uring_sqe *sqe;
+
+    if (ring->rx_armed)
+        return 0;
+
+    if ((sqe = canopen_uring_get_sqe(ring)) == NULL)
+        return -1;
+
+    sqe->opcode    = IORING_OP_RECV;
+    sqe->fd        = ring->sock;
+    sqe->ioprio    = IORING_RECV_MULTISHOT;
+    sqe->flags     = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = CANOPEN_URING_BGID;
+    sqe->user_data = CANOPEN_URING_UD_RX;
+
+    ring->rx_armed = 1;
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+// Reap completions: TX completions free their buffer slot, received buffers
+// are queued on the pending list. Returns -1 if the receive request failed.
+//------------------------------------------------------------------------------
+static int
+canopen_uring_reap(canopen_uring_t *ring)
+{
+    struct io_uring_cqe *cqe;
+    unsigned head, tail, idx;
+    int error = 0;
+
+    head = *ring->cq_head;
+    tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+    for (; head != tail; head++)
+    {
+        cqe = &ring->cqes[head & *ring->cq_mask];
+
+        if ((cqe->user_data & ~CANOPEN_URING_UD_SLOT) == CANOPEN_URING_UD_TX)
+        {
+            if (cqe->res < 0)
+                ring->tx_error = -cqe->res;
+
+            ring->tx_free[ring->tx_free_count++] = (unsigned)(cqe->user_data & CANOPEN_URING_UD_SLOT);
+            continue;
+        }
+
+        if (cqe->user_data != CANOPEN_URING_UD_RX)
+            continue;
+
+        if (!(cqe->flags & IORING_CQE_F_MORE))
+            ring->rx_armed = 0;
+
+        if (cqe->res < 0)
+        {
+            // out of buffers is not an error, the request is simply re-armed
+            if (cqe->res != -ENOBUFS)
+            {
+                errno = -cqe->res;
+                error = 1;
+            }
+            continue;
+        }
+
+        if (!(cqe->flags & IORING_CQE_F_BUFFER))
+            continue;
+
+        // at most CANOPEN_URING_RX_BUFS buffers can be held at once
+        idx = ring->rx_pending_tail++ & (CANOPEN_URING_RX_BUFS - 1);
+        ring->rx_pending_bid[idx] = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        ring->rx_pending_len[idx] = cqe->res;
+    }
+
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+
+    return error ? -1 : 0;
+}
+
+//------------------------------------------------------------------------------
+// Parse up to n pending received buffers into frames[] and give the buffers
+// back to the kernel. Returns the number of frames parsed.
+//------------------------------------------------------------------------------
+static int
+canopen_uring_rx_pending(canopen_uring_t *ring, canopen_frame_t *frames, int n)
+{
+    unsigned idx, bid;
+    int len, count = 0;
+
+    while (count < n && ring->rx_pending_head != ring->rx_pending_tail)
+    {
+        idx = ring->rx_pending_head++ & (CANOPEN_URING_RX_BUFS - 1);
+        bid = ring->rx_pending_bid[idx];
+        len = ring->rx_pending_len[idx];
+
+        if (len == CAN_MTU || len == CANFD_MTU)
+        {
+            if (canopen_frame_parse_mtu(&frames[count], &ring->rx_buf[bid], len) == 0)
+                count++;
+            else
+                fprintf(stderr, "CANopen failed to parse frame\n");
+        }
+        else
+        {
+            fprintf(stderr, "read: incomplete CAN frame\n");
+        }
+
+        canopen_uring_rx_buf_add(ring, bid);
+    }
+
+    return count;
+}
+
+//------------------------------------------------------------------------------
+//SF
+//SF .. c:function:: canopen_uring_t *canopen_uring_new(int sock, unsigned int entries)
+//SF
+//SF     Set up an io_uring instance for the CAN socket sock, with room for
+//SF     entries queued submissions (0 selects CANOPEN_URING_ENTRIES). The
+//SF     receive timeout of the socket (SO_RCVTIMEO) is honoured by
+//SF     canopen_uring_frame_recv. Returns NULL if io_uring is unavailable.
+//SF
+//------------------------------------------------------------------------------
+canopen_uring_t *
+canopen_uring_new(int sock, unsigned int entries)
+{
+    canopen_uring_t *ring;
+    struct io_uring_params p;
+    struct io_uring_buf_reg reg;
+    struct timeval tv;
+    socklen_t tv_len = sizeof(tv);
+    unsigned i;
+
+    if (entries == 0)
+        entries = CANOPEN_URING_ENTRIES;
+
+    if ((ring = (canopen_uring_t *)malloc(sizeof(canopen_uring_t))) == NULL)
+        return NULL;
+
+    bzero((void *)ring, sizeof(canopen_uring_t));
+    ring->sock    = sock;
+    ring->sq_ptr  = MAP_FAILED;
+    ring->cq_ptr  = MAP_FAILED;
+    ring->sqes    = MAP_FAILED;
+    ring->br      = MAP_FAILED;
+
+    bzero((void *)&p, sizeof(p));
+    if ((ring->ring_fd = canopen_uring_setup(entries, &p)) < 0)
+    {
+        free(ring);
+        return NULL;
+    }
+
+    if (!(p.features & IORING_FEAT_EXT_ARG))
+    {
+        fprintf(stderr, "Error: io_uring lacks timed waits.\n");
+        goto fail;
+    }
+
+    //
+    // map the submission and completion rings
+    //
+    ring->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->cq_size = p.cq_off.cqes  + p.cq_entries * sizeof(struct io_uring_cqe);
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (ring->cq_size > ring->sq_size)
+            ring->sq_size = ring->cq_size;
+        ring->cq_size = ring->sq_size;
+    }
+
+    ring->sq_ptr = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        ring->ring_fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ptr == MAP_FAILED)
+        goto fail;
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        ring->cq_ptr = ring->sq_ptr;
+    }
+    else
+    {
+        ring->cq_ptr = mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                            ring->ring_fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ptr == MAP_FAILED)
+            goto fail;
+    }
+
+    ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring->ring_fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED)
+        goto fail;
+
+    ring->sq_head    = (unsigned *)((uint8_t *)ring->sq_ptr + p.sq_off.head);
+    ring->sq_tail    = (unsigned *)((uint8_t *)ring->sq_ptr + p.sq_off.tail);
+    ring->sq_mask    = (unsigned *)((uint8_t *)ring->sq_ptr + p.sq_off.ring_mask);
+    ring->sq_array   = (unsigned *)((uint8_t *)ring->sq_ptr + p.sq_off.array);
+    ring->sq_entries = p.sq_entries;
+    ring->sq_local_tail = ring->sq_submitted = *ring->sq_tail;
+
+    ring->cq_head = (unsigned *)((uint8_t *)ring->cq_ptr + p.cq_off.head);
+    ring->cq_tail = (unsigned *)((uint8_t *)ring->cq_ptr + p.cq_off.tail);
+    ring->cq_mask = (unsigned *)((uint8_t *)ring->cq_ptr + p.cq_off.ring_mask);
+    ring->cqes    = (struct io_uring_cqe *)((uint8_t *)ring->cq_ptr + p.cq_off.cqes);
+
+    //
+    // register the receive buffer ring (must be page aligned)
+    //
+    ring->br_size = CANOPEN_URING_RX_BUFS * sizeof(struct io_uring_buf);
+    ring->br = mmap(NULL, ring->br_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring->br == MAP_FAILED)
+        goto fail;
+
+    ring->rx_buf = (struct canfd_frame *)malloc(CANOPEN_URING_RX_BUFS * sizeof(struct canfd_frame));
+    if (ring->rx_buf == NULL)
+        goto fail;
+
+    bzero((void *)&reg, sizeof(reg));
+    reg.ring_addr    = (uint64_t)(uintptr_t)ring->br;
+    reg.ring_entries = CANOPEN_URING_RX_BUFS;
+    reg.bgid         = CANOPEN_URING_BGID;
+
+    if (canopen_uring_register(ring->ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+    {
+        fprintf(stderr, "Error: io_uring buffer ring registration failed.\n");
+        goto fail;
+    }
+
+    for (i = 0; i < CANOPEN_URING_RX_BUFS; i++)
+        canopen_uring_rx_buf_add(ring, i);
+
+    //
+    // transmit buffer slots, one per submission queue entry
+    //
+    ring->tx_count = p.sq_entries;
+    ring->tx_buf   = (struct canfd_frame *)malloc(ring->tx_count * sizeof(struct canfd_frame));
+    ring->tx_free  = (unsigned *)malloc(ring->tx_count * sizeof(unsigned));
+    if (ring->tx_buf == NULL || ring->tx_free == NULL)
+        goto fail;
+
+    for (i = 0; i < ring->tx_count; i++)
+        ring->tx_free[i] = ring->tx_count - 1 - i;
+    ring->tx_free_count = ring->tx_count;
+
+    if (getsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, &tv_len) == 0 &&
+        (tv.tv_sec != 0 || tv.tv_usec != 0))
+    {
+        ring->rx_timeout.tv_sec  = tv.tv_sec;
+        ring->rx_timeout.tv_nsec = tv.tv_usec * 1000;
+        ring->rx_timeout_set     = 1;
+    }
+
+    return ring;
+
+fail:
+    canopen_uring_free(ring);
+    return NULL;
+}
+
+//------------------------------------------------------------------------------
+//SF
+//SF .. c:function:: void canopen_uring_free(canopen_uring_t *ring)
+//SF
+//SF     Tear down the io_uring instance. The CAN socket is not closed.
+//SF
+//------------------------------------------------------------------------------
+void
+canopen_uring_free(canopen_uring_t *ring)
+{
+    if (ring == NULL)
+        return;
+
+    // closing the ring cancels the outstanding receive request
+    if (ring->ring_fd >= 0)
+        close(ring->ring_fd);
+
+    if (ring->sqes != MAP_FAILED)
+        munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ptr != MAP_FAILED && ring->cq_ptr != ring->sq_ptr)
+        munmap(ring->cq_ptr, ring->cq_size);
+    if (ring->sq_ptr != MAP_FAILED)
+        munmap(ring->sq_ptr, ring->sq_size);
+    if (ring->br != MAP_FAILED)
+        munmap(ring->br, ring->br_size);
+
+    free(ring->rx_buf);
+    free(ring->tx_buf);
+    free(ring->tx_free);
+    free(ring);
+}
+
+//------------------------------------------------------------------------------
+// Queue one frame for transmission without submitting it.
+//------------------------------------------------------------------------------
+static int
+canopen_uring_frame_queue(canopen_uring_t *ring, canopen_frame_t *frame)
+{
+    struct io_uring_sqe *sqe;
+    unsigned slot;
+    int mtu;
+
+    // wait for a transmit slot to be freed if all are in flight
+    while (ring->tx_free_count == 0)
+    {
+        if (canopen_uring_submit(ring, 1, NULL) < 0)
+            return -1;
+        canopen_uring_reap(ring);
+    }
+
+    slot = ring->tx_free[ring->tx_free_count - 1];
+
+    if ((mtu = canopen_frame_pack_mtu(frame, &ring->tx_buf[slot])) < 0)
+    {
+        fprintf(stderr, "CANopen failed to parse frame\n");
+        return -1;
+    }
+
+    if ((sqe = canopen_uring_get_sqe(ring)) == NULL)
+        return -1;
+
+    ring->tx_free_count--;
+
+    sqe->opcode    = IORING_OP_SEND;
+    sqe->fd        = ring->sock;
+    sqe->addr      = (uint64_t)(uintptr_t)&ring->tx_buf[slot];
+    sqe->len       = mtu;
+    sqe->user_data = CANOPEN_URING_UD_TX | slot;
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+//SF
+//SF .. c:function:: int canopen_uring_frame_send(canopen_uring_t *ring, canopen_frame_t *frame)
+//SF
+//SF     Queue a frame for transmission and submit it to the kernel without
+//SF     waiting for it to complete. Returns 0 on success, 1 on error (which
+//SF     includes a previously submitted frame that failed to send).
+//SF
+//------------------------------------------------------------------------------
+int
+canopen_uring_frame_send(canopen_uring_t *ring, canopen_frame_t *frame)
+{
+    return canopen_uring_frame_send_batch(ring, frame, 1) == 1 ? 0 : 1;
+}
+
+//------------------------------------------------------------------------------
+//SF
+//SF .. c:function:: int canopen_uring_frame_send_batch(canopen_uring_t *ring, canopen_frame_t *frames, int n)
+//SF
+//SF     Queue n frames for transmission and submit them with a single system
+//SF     call. Returns the number of frames queued, or -1 on error.
+//SF
+//------------------------------------------------------------------------------
+int
+canopen_uring_frame_send_batch(canopen_uring_t *ring, canopen_frame_t *frames, int n)
+{
+    int i;
+
+    canopen_uring_reap(ring);
+
+    if (ring->tx_error)
+    {
+        errno = ring->tx_error;
+        ring->tx_error = 0;
+        return -1;
+    }
+
+    for (i = 0; i < n; i++)
+    {
+        if (canopen_uring_frame_queue(ring, &frames[i]) != 0)
+            break;
+    }
+
+    if (canopen_uring_submit(ring, 0, NULL) < 0)
+        return -1;
+
+    return (i == 0 && n > 0) ? -1 : i;
+}
+
+//------------------------------------------------------------------------------
+//SF
+//SF .. c:function:: int canopen_uring_flush(canopen_uring_t *ring)
+//SF
+//SF     Wait until all submitted frames have been sent. Returns 0 on
+//SF     success, 1 if any of them failed.
+//SF
+//------------------------------------------------------------------------------
+int
+canopen_uring_flush(canopen_uring_t *ring)
+{
+    while (ring->tx_free_count < ring->tx_count)
+    {
+        if (canopen_uring_submit(ring, 1, NULL) < 0)
+            return 1;
+        canopen_uring_reap(ring);
+    }
+
+    if (ring->tx_error)
+    {
+        errno = ring->tx_error;
+        ring->tx_error = 0;
+        return 1;
+    }
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+//SF
+//SF .. c:function:: int canopen_uring_frame_recv_batch(canopen_uring_t *ring, canopen_frame_t *frames, int n)
+//SF
+//SF     Receive up to n frames, waiting (up to the socket receive timeout)
+//SF     for the first one. Returns the number of frames received, or -1 on
+//SF     error or timeout (errno is EAGAIN).
+//SF
+//------------------------------------------------------------------------------
+int
+canopen_uring_frame_recv_batch(canopen_uring_t *ring, canopen_frame_t *frames, int n)
+{
+    struct __kernel_timespec ts;
+    struct timespec now, deadline;
+    int count, ret;
+
+    if (ring->rx_timeout_set)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec  += ring->rx_timeout.tv_sec;
+        deadline.tv_nsec += ring->rx_timeout.tv_nsec;
+        if (deadline.tv_nsec >= 1000000000L)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+    }
+
+    for (;;)
+    {
+        ret = canopen_uring_reap(ring);
+
+        if ((count = canopen_uring_rx_pending(ring, frames, n)) != 0)
+            return count;
+
+        if (ret < 0)
+            return -1;
+
+        // TX completions also end the wait, and a wait that submits returns
+        // the submission count rather than ETIME: only wait for what is left
+        // until the deadline
+        if (ring->rx_timeout_set)
+        {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            ts.tv_sec  = deadline.tv_sec  - now.tv_sec;
+            ts.tv_nsec = deadline.tv_nsec - now.tv_nsec;
+            if (ts.tv_nsec < 0)
+            {
+                ts.tv_sec--;
+                ts.tv_nsec += 1000000000L;
+            }
+
+            if (ts.tv_sec < 0)
+            {
+                errno = EAGAIN;
+                return -1;
+            }
+        }
+
+        if (canopen_uring_rx_arm(ring) != 0)
+            return -1;
+
+        if (canopen_uring_submit(ring, 1, ring->rx_timeout_set ? &ts : NULL) < 0)
+            return -1;
+    }
+}
+
+//------------------------------------------------------------------------------
+//SF
+//SF .. c:function:: int canopen_uring_frame_recv(canopen_uring_t *ring, canopen_frame_t *frame)
+//SF
+//SF     Receive a single frame, with the same semantics as
+//SF     canopen_frame_recv. Returns 0 on success, 1 on error or timeout.
+//SF
+//------------------------------------------------------------------------------
+int
+canopen_uring_frame_recv(canopen_uring_t *ring, canopen_frame_t *frame)
+{
+    return canopen_uring_frame_recv_batch(ring, frame, 1) == 1 ? 0 : 1;
+}
+
+#else /* CANOPEN_HAVE_URING */
+
+//------------------------------------------------------------------------------
+// Built without io_uring support: canopen_uring_new always fails, so callers
+// fall back to the plain socket routines.
+//------------------------------------------------------------------------------
+canopen_uring_t *
+canopen_uring_new(int sock, unsigned int entries)
+{
+    errno = ENOSYS;
+    return NULL;
+}
+
+void
+canopen_uring_free(canopen_uring_t *ring)
+{
+}
+
+int
+canopen_uring_frame_send(canopen_uring_t *ring, canopen_frame_t *frame)
+{
+    errno = ENOSYS;
+    return 1;
+}
+
+int
+canopen_uring_frame_send_batch(canopen_uring_t *ring, canopen_frame_t *frames, int n)
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+int
+canopen_uring_flush(canopen_uring_t *ring)
+{
+    errno = ENOSYS;
+    return 1;
+}
+
+int
+canopen_uring_frame_recv(canopen_uring_t *ring, canopen_frame_t *frame)
+{
+    errno = ENOSYS;
+    return 1;
+}
+
+int
+canopen_uring_frame_recv_batch(canopen_uring_t *ring, canopen_frame_t *frames, int n)
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+#endif /* CANOPEN_HAVE_URING */
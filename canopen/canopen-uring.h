@@ -0,0 +1,45 @@
+//------------------------------------------------------------------------------
+// Copyright (C) 2012, Robert Johansson, Raditex AB
+// All rights reserved.
+//
+// This file is part of the rSCADA system.
+//
+// rSCADA
+// http://www.rSCADA.se
+// info@rscada.se
+//
+//------------------------------------------------------------------------------
+
+//
+// CANopen io_uring transport: an alternative to read/write on a CAN socket
+// that keeps a multishot receive armed on a registered buffer ring and
+// batches transmitted frames into as few system calls as possible.
+//
+// Only available when built against kernel headers with io_uring multishot
+// receive support, and at run time on a kernel that provides it;
+// canopen_uring_new returns NULL otherwise and the caller should fall back
+// to canopen_frame_send/canopen_frame_recv.
+//
+
+#ifndef _CANOPEN_URING_H_
+#define _CANOPEN_URING_H_
+
+#include <stdint.h>
+
+#include "canopen.h"
+
+#define CANOPEN_URING_ENTRIES 256 // default submission queue size
+
+typedef struct _canopen_uring canopen_uring_t;
+
+canopen_uring_t *canopen_uring_new(int sock, unsigned int entries);
+void             canopen_uring_free(canopen_uring_t *ring);
+
+int canopen_uring_frame_send(canopen_uring_t *ring, canopen_frame_t *frame);
+int canopen_uring_frame_send_batch(canopen_uring_t *ring, canopen_frame_t *frames, int n);
+int canopen_uring_flush(canopen_uring_t *ring);
+
+int canopen_uring_frame_recv(canopen_uring_t *ring, canopen_frame_t *frame);
+int canopen_uring_frame_recv_batch(canopen_uring_t *ring, canopen_frame_t *frames, int n);
+
+#endif /* _CANOPEN_URING_H_ */
@@ -0,0 +1,133 @@
+//------------------------------------------------------------------------------
+// Copyright (C) 2012, Robert Johansson, Raditex AB
+// All rights reserved.
+//
+// This file is part of the rSCADA system.
+//
+// rSCADA
+// http://www.rSCADA.se
+// info@rscada.se
+//
+//------------------------------------------------------------------------------
+
+//
+// CANopen frame view: decodes the fields of a received CAN or CAN FD frame
+// in place, on demand, without copying it into a canopen_frame_t. Meant for
+// consumers that look at many frames but only need a few fields of each
+// (dump and monitor tools, PDO decoding); canopen_frame_view_parse does the
+// full decode when needed.
+//
+
+#ifndef _CANOPEN_VIEW_H_
+#define _CANOPEN_VIEW_H_
+
+#include <linux/can.h>
+
+#include <stdint.h>
+
+#include "canopen.h"
+#include "canopen-types.h"
+
+typedef struct _canopen_frame_view {
+
+    const struct canfd_frame *cf;   // the received frame (not owned)
+    uint8_t                   fd;   // cf is a CAN FD frame
+
+} canopen_frame_view_t;
+
+static inline void
+canopen_frame_view_init(canopen_frame_view_t *view, const void *cf, int nbytes)
+{
+    view->cf = (const struct canfd_frame *)cf;
+    view->fd = (nbytes == CANFD_MTU);
+}
+
+// raw SocketCAN identifier, including the CAN_*_FLAG bits
+static inline uint32_t
+canopen_frame_view_can_id(const canopen_frame_view_t *view)
+{
+    return view->cf->can_id;
+}
+
+static inline int
+canopen_frame_view_is_extended(const canopen_frame_view_t *view)
+{
+    return (view->cf->can_id & CAN_EFF_FLAG) != 0;
+}
+
+static inline int
+canopen_frame_view_is_error(const canopen_frame_view_t *view)
+{
+    return (view->cf->can_id & CAN_ERR_FLAG) != 0;
+}
+
+static inline int
+canopen_frame_view_is_rtr(const canopen_frame_view_t *view)
+{
+    return (view->cf->can_id & CAN_RTR_FLAG) != 0;
+}
+
+// 11-bit COB-ID of a standard frame
+static inline uint16_t
+canopen_frame_view_cob_id(const canopen_frame_view_t *view)
+{
+    return view->cf->can_id & CAN_SFF_MASK;
+}
+
+static inline uint8_t
+canopen_frame_view_function_code(const canopen_frame_view_t *view)
+{
+    return (view->cf->can_id >> 7) & 0xF;
+}
+
+static inline uint8_t
+canopen_frame_view_node(const canopen_frame_view_t *view)
+{
+    return view->cf->can_id & 0x7F;
+}
+
+static inline uint8_t
+canopen_frame_view_len(const canopen_frame_view_t *view)
+{
+    return view->cf->len; // same offset as can_dlc of a classic frame
+}
+
+static inline const uint8_t *
+canopen_frame_view_data(const canopen_frame_view_t *view)
+{
+    return view->cf->data;
+}
+
+//
+// little-endian payload fields (CANopen byte order), for PDO mapping; the
+// caller checks offset + size against canopen_frame_view_len
+//
+static inline uint8_t
+canopen_frame_view_u8(const canopen_frame_view_t *view, int offset)
+{
+    return view->cf->data[offset];
+}
+
+static inline uint16_t
+canopen_frame_view_u16(const canopen_frame_view_t *view, int offset)
+{
+    return canopen_decode_u16(&(view->cf->data[offset]));
+}
+
+static inline uint32_t
+canopen_frame_view_u32(const canopen_frame_view_t *view, int offset)
+{
+    return canopen_decode_u32(&(view->cf->data[offset]));
+}
+
+// full decode into a CANopen frame
+static inline int
+canopen_frame_view_parse(const canopen_frame_view_t *view, canopen_frame_t *frame)
+{
+    if (view->fd)
+        return canopen_frame_parse_fd(frame, (struct canfd_frame *)view->cf);
+
+    return canopen_frame_parse(frame, (struct can_frame *)view->cf);
+}
+
+#endif /* _CANOPEN_VIEW_H_ */
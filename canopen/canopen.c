@@ -26,17 +26,23 @@
 #include <stdlib.h>
 
 #include "canopen.h"
+#include "canopen-cob.h"
+#include "canopen-types.h"
+#include "canopen-pool.h"
 
 static int canopen_debug = 0;
 
-static SDO_abort_code_t SDO_abort_codes[] = {
+//
+// Sorted by code: canopen_sdo_abort_code_str does a binary search.
+//
+static const SDO_abort_code_t SDO_abort_codes[] = {
     { 0x05030000, "Toggle bit not alternated" },
     { 0x05040000, "SDO protocol timed out" },
     { 0x05040001, "Client/Server command specifier not valid or unknown" },
     { 0x05040002, "Invalid block size (Block Transfer mode only)" },
     { 0x05040003, "Invalid sequence number (Block Transfer mode only)" },
-    { 0x05030004, "CRC error (Block Transfer mode only)" },
-    { 0x05030005, "Out of memory"},
+    { 0x05040004, "CRC error (Block Transfer mode only)" },
+    { 0x05040005, "Out of memory"},
     { 0x06010000, "Unsupported access to an object"},
     { 0x06010001, "Attempt to read a write-only object"},
     { 0x06010002, "Attempt to write a read-only object"},
@@ -46,9 +52,9 @@ static SDO_abort_code_t SDO_abort_codes[] = {
     { 0x06040043, "General parameter incompatibility reason"},
     { 0x06040047, "General internal incompatibility in the device"},
     { 0x06060000, "Object access failed due to a hardware error"},
-    { 0x06060010, "Data type does not match, lengh of service parameter does not match"},
-    { 0x06060012, "Data type does not match, lengh of service parameter is too high"},
-    { 0x06060013, "Data type does not match, lengh of service parameter is too low"},
+    { 0x06070010, "Data type does not match, lengh of service parameter does not match"},
+    { 0x06070012, "Data type does not match, lengh of service parameter is too high"},
+    { 0x06070013, "Data type does not match, lengh of service parameter is too low"},
     { 0x06090011, "Sub-index does not exist"},
     { 0x06090030, "Value range of parameter exceeded (only for write access)"},
     { 0x06090031, "Value of parameter written too high"},
@@ -58,10 +64,81 @@ static SDO_abort_code_t SDO_abort_codes[] = {
     { 0x08000020, "Data can not be transferred or stored to the application"},
     { 0x08000021, "Data can not be transferred or stored to the application because of local control"},
     { 0x08000022, "Data can not be transferred or stored to the application because of the present device state"},
-    { 0x08000023, "Object Dictionary dynamic generation fails or no Object Dictionary is present (e.g. OD is generated from file and generation fails because of a file error)"},
-    {0x0000000, NULL}
+    { 0x08000023, "Object Dictionary dynamic generation fails or no Object Dictionary is present (e.g. OD is generated from file and generation fails because of a file error)"}
 };
 
+#define SDO_ABORT_CODE_COUNT (sizeof(SDO_abort_codes) / sizeof(SDO_abort_codes[0]))
+
+//------------------------------------------------------------------------------
+// Parse the CAN ID (shared by classic CAN and CAN FD frames)
+//------------------------------------------------------------------------------
+static void
+canopen_frame_parse_id(canopen_frame_t *canopen_frame, canid_t can_id)
+{
+    if (can_id & CAN_ERR_FLAG)
+    {
+        canopen_frame->type = CANOPEN_FLAG_ERROR;
+        canopen_frame->function_code = 0;
+        canopen_frame->id   = can_id & CAN_ERR_MASK;
+    }
+    else if (can_id & CAN_EFF_FLAG)
+    {
+        canopen_frame->type = CANOPEN_FLAG_EXTENDED;
+        canopen_frame->function_code = 0;
+        canopen_frame->id   = can_id & CAN_EFF_MASK;
+    }
+    else
+    { 
+        canopen_frame->type = CANOPEN_FLAG_STANDARD;
+        canopen_frame->function_code = (can_id & 0x00000780U) >> 7;
+        canopen_frame->id            = (can_id & 0x0000007FU);
+    }
+
+    canopen_frame->rtr = (can_id & CAN_RTR_FLAG) ? 
+                         CANOPEN_FLAG_RTR : CANOPEN_FLAG_NORMAL;
+}
+
+//------------------------------------------------------------------------------
+// Copy the received payload, and clear the rest of it: every field of the
+// CANopen frame is written, so there is no need to clear it first.
+//------------------------------------------------------------------------------
+static void
+canopen_frame_parse_data(canopen_frame_t *canopen_frame, const uint8_t *data, int len, int len_max)
+{
+    if (len > len_max)
+        len = len_max;
+
+    memcpy(canopen_frame->payload.data, data, len);
+    memset(canopen_frame->payload.data + len, 0, CANOPEN_FRAME_DATA_LEN_FD - len);
+}
+
+//------------------------------------------------------------------------------
+// Pack the CAN ID (shared by classic CAN and CAN FD frames)
+//------------------------------------------------------------------------------
+static canid_t
+canopen_frame_pack_id(canopen_frame_t *canopen_frame)
+{
+    canid_t can_id;
+
+    can_id = (canopen_frame->function_code<<7) | canopen_frame->id;
+
+    if (canopen_frame->type == CANOPEN_FLAG_EXTENDED)
+    {
+        can_id |= CAN_EFF_FLAG;  // set extended frame flag
+    }
+    else if (canopen_frame->type == CANOPEN_FLAG_ERROR)
+    {
+        can_id = (can_id & CAN_ERR_MASK) | CAN_ERR_FLAG;  // id holds the error class
+    }
+
+    if (canopen_frame->rtr == CANOPEN_FLAG_RTR)
+    {
+        can_id |= CAN_RTR_FLAG;  // set RTR frame flag
+    }
+
+    return can_id;
+}
+
 //------------------------------------------------------------------------------
 //SF 
 //SF .. c:function:: int canopen_frame_parse(canopen_frame_t *canopen_frame, struct can_frame *can_frame)
@@ -72,39 +149,19 @@ static SDO_abort_code_t SDO_abort_codes[] = {
 int
 canopen_frame_parse(canopen_frame_t *canopen_frame, struct can_frame *can_frame)
 {
-    int i;
-
     if (canopen_frame == NULL || can_frame == NULL)
     {
         return -1;
     }
 
-    bzero((void *)canopen_frame, sizeof(canopen_frame_t));
-
     //
     // Parse basic protocol fields
     //
-
-    if (can_frame->can_id & CAN_EFF_FLAG)
-    {
-        canopen_frame->type = CANOPEN_FLAG_EXTENDED;
-        canopen_frame->id   = can_frame->can_id & CAN_EFF_MASK;
-    }
-    else
-    { 
-        canopen_frame->type = CANOPEN_FLAG_STANDARD;
-        canopen_frame->function_code = (can_frame->can_id & 0x00000780U) >> 7;
-        canopen_frame->id            = (can_frame->can_id & 0x0000007FU);
-    }
-
-    canopen_frame->rtr = (can_frame->can_id & CAN_RTR_FLAG) ? 
-                         CANOPEN_FLAG_RTR : CANOPEN_FLAG_NORMAL;
+    canopen_frame_parse_id(canopen_frame, can_frame->can_id);
     
+    canopen_frame->fd       = 0;
     canopen_frame->data_len = can_frame->can_dlc;
-    for (i = 0; i < can_frame->can_dlc; i++)
-    {
-        canopen_frame->payload.data[i] = can_frame->data[i];
-    }
+    canopen_frame_parse_data(canopen_frame, can_frame->data, can_frame->can_dlc, CANOPEN_FRAME_DATA_LEN);
 
     //
     // Parse payload data
@@ -136,6 +193,36 @@ canopen_frame_parse(canopen_frame_t *canopen_frame, struct can_frame *can_frame)
     return 0;
 }
 
+//------------------------------------------------------------------------------
+//SF 
+//SF .. c:function:: int canopen_frame_parse_fd(canopen_frame_t *canopen_frame, struct canfd_frame *canfd_frame)
+//SF    
+//SF     Parse the CAN FD frame data payload (up to 64 bytes) as a CANopen
+//SF     packet.
+//SF 
+//------------------------------------------------------------------------------
+int
+canopen_frame_parse_fd(canopen_frame_t *canopen_frame, struct canfd_frame *canfd_frame)
+{
+    if (canopen_frame == NULL || canfd_frame == NULL)
+    {
+        return -1;
+    }
+
+    canopen_frame_parse_id(canopen_frame, canfd_frame->can_id);
+
+    canopen_frame->fd = CANOPEN_FD_FLAG_FDF;
+    if (canfd_frame->flags & CANFD_BRS)
+        canopen_frame->fd |= CANOPEN_FD_FLAG_BRS;
+    if (canfd_frame->flags & CANFD_ESI)
+        canopen_frame->fd |= CANOPEN_FD_FLAG_ESI;
+
+    canopen_frame->data_len = canfd_frame->len;
+    canopen_frame_parse_data(canopen_frame, canfd_frame->data, canfd_frame->len, CANOPEN_FRAME_DATA_LEN_FD);
+
+    return 0;
+}
+
 
 //------------------------------------------------------------------------------
 //SF 
@@ -158,17 +245,13 @@ canopen_frame_pack(canopen_frame_t *canopen_frame, struct can_frame *can_frame)
         return -1;
     }
 
-    can_frame->can_id = (canopen_frame->function_code<<7) | canopen_frame->id;
-
-    if (canopen_frame->type == CANOPEN_FLAG_EXTENDED)
+    if (canopen_frame->data_len > CANOPEN_FRAME_DATA_LEN)
     {
-        can_frame->can_id |= CAN_EFF_FLAG;  // set extended frame flag
+        // CAN FD payload, use canopen_frame_pack_fd
+        return -1;
     }
 
-    if (canopen_frame->rtr == CANOPEN_FLAG_RTR)
-    {
-        can_frame->can_id |= CAN_RTR_FLAG;  // set RTR frame flag
-    }
+    can_frame->can_id = canopen_frame_pack_id(canopen_frame);
     
     can_frame->can_dlc = canopen_frame->data_len;
     for (i = 0; i < canopen_frame->data_len; i++)
@@ -181,55 +264,312 @@ canopen_frame_pack(canopen_frame_t *canopen_frame, struct can_frame *can_frame)
 
 //------------------------------------------------------------------------------
 //SF 
-//SF .. c:function:: int canopen_frame_dump_short(canopen_frame_t *frame)
+//SF .. c:function:: int canopen_frame_pack_fd(canopen_frame_t *canopen_frame, struct canfd_frame *canfd_frame)
 //SF    
-//SF     Print a CAN frame in a human-readable (compact) format to the
-//SF     standard output.
-//SF 
+//SF     Pack a CANopen frame into a CAN FD frame. The payload length is
+//SF     rounded up to the next valid CAN FD length, and padded with zeros.
+//SF      
 //------------------------------------------------------------------------------
 int
-canopen_frame_dump_short(canopen_frame_t *frame) // rename to analyze
+canopen_frame_pack_fd(canopen_frame_t *canopen_frame, struct canfd_frame *canfd_frame)
 {
-    static int block_mode[256], bm_init = 0;
     int i;
 
-    if (frame == NULL)
+    if (canopen_frame == NULL || canfd_frame == NULL ||
+        canopen_frame->data_len > CANOPEN_FRAME_DATA_LEN_FD)
     {
         return -1;
     }
 
-    if (bm_init == 0)
+    bzero((void *)canfd_frame, sizeof(struct canfd_frame));
+
+    canfd_frame->can_id = canopen_frame_pack_id(canopen_frame);
+
+    if (canopen_frame->fd & CANOPEN_FD_FLAG_BRS)
+        canfd_frame->flags |= CANFD_BRS;
+
+    canfd_frame->len = canopen_frame_fd_len(canopen_frame->data_len);
+    for (i = 0; i < canopen_frame->data_len; i++)
     {
-        bzero((void *)block_mode, sizeof(block_mode));
-        bm_init = 1;
+        canfd_frame->data[i] = canopen_frame->payload.data[i];
     }
-    
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+// Round a payload length up to the next length that can be encoded in the
+// DLC of a CAN FD frame (0..8, 12, 16, 20, 24, 32, 48 or 64 bytes).
+//------------------------------------------------------------------------------
+uint8_t
+canopen_frame_fd_len(uint8_t len)
+{
+    static const uint8_t fd_len[] = { 8, 12, 16, 20, 24, 32, 48, 64 };
+    int i;
+
+    if (len <= 8)
+        return len;
+
+    for (i = 0; i < (int)sizeof(fd_len) - 1 && fd_len[i] < len; i++)
+        ;
+
+    return fd_len[i];
+}
+
+//------------------------------------------------------------------------------
+// Text formatting into a caller buffer, as snprintf: pos counts every
+// character, also those that did not fit (the buffer is always terminated).
+//------------------------------------------------------------------------------
+typedef struct _canopen_fmt {
+
+    char   *buf;
+    size_t  len;
+    size_t  pos;
+
+} canopen_fmt_t;
+
+static const char canopen_fmt_hex_upper[] = "0123456789ABCDEF";
+static const char canopen_fmt_hex_lower[] = "0123456789abcdef";
+
+static void
+canopen_fmt_mem(canopen_fmt_t *f, const char *s, size_t n)
+{
+    size_t room;
+
+    if (f->pos + 1 < f->len)
+    {
+        room = f->len - 1 - f->pos;
+        memcpy(f->buf + f->pos, s, n < room ? n : room);
+    }
+    f->pos += n;
+}
+
+// string literals
+#define canopen_fmt_lit(f, s) canopen_fmt_mem((f), (s), sizeof(s) - 1)
+
+static void
+canopen_fmt_str(canopen_fmt_t *f, const char *s)
+{
+    canopen_fmt_mem(f, s, strlen(s));
+}
+
+// %.<digits>X (or %.<digits>x with the lower case table)
+static void
+canopen_fmt_hex(canopen_fmt_t *f, uint32_t v, int digits, const char *hex)
+{
+    char tmp[8];
+    int  i = sizeof(tmp);
+
+    do
+    {
+        tmp[--i] = hex[v & 0xF];
+        v >>= 4;
+    } while (v);
+
+    while (i > (int)sizeof(tmp) - digits)
+        tmp[--i] = '0';
+
+    canopen_fmt_mem(f, tmp + i, sizeof(tmp) - i);
+}
+
+// %d
+static void
+canopen_fmt_dec(canopen_fmt_t *f, int v)
+{
+    char     tmp[11];
+    int      i = sizeof(tmp);
+    uint32_t u = v < 0 ? -(uint32_t)v : (uint32_t)v;
+
+    do
+    {
+        tmp[--i] = '0' + u % 10;
+        u /= 10;
+    } while (u);
+
+    if (v < 0)
+        tmp[--i] = '-';
+
+    canopen_fmt_mem(f, tmp + i, sizeof(tmp) - i);
+}
+
+// "0x%.2X " for each byte
+static void
+canopen_fmt_bytes(canopen_fmt_t *f, const uint8_t *data, int n, const char *hex)
+{
+    char tmp[5] = { '0', 'x', 0, 0, ' ' };
+    int  i;
+
+    for (i = 0; i < n; i++)
+    {
+        tmp[2] = hex[data[i] >> 4];
+        tmp[3] = hex[data[i] & 0xF];
+        canopen_fmt_mem(f, tmp, sizeof(tmp));
+    }
+}
+
+// "Index=0x%.4X SubIndex=0x%.2X "
+static void
+canopen_fmt_sdo_index(canopen_fmt_t *f, canopen_sdo_t *sdo)
+{
+    canopen_fmt_lit(f, "Index=0x");
+    canopen_fmt_hex(f, SDO_index((*sdo)), 4, canopen_fmt_hex_upper);
+    canopen_fmt_lit(f, " SubIndex=0x");
+    canopen_fmt_hex(f, sdo->subindex, 2, canopen_fmt_hex_upper);
+    canopen_fmt_lit(f, " ");
+}
+
+// "[<label> %d] "
+static void
+canopen_fmt_flag(canopen_fmt_t *f, const char *label, int v)
+{
+    canopen_fmt_lit(f, "[");
+    canopen_fmt_str(f, label);
+    canopen_fmt_lit(f, " ");
+    canopen_fmt_dec(f, v);
+    canopen_fmt_lit(f, "] ");
+}
+
+// decoder behind canopen_frame_format_short and canopen_frame_dump_short
+static canopen_decoder_t canopen_frame_decoder;
+
+//------------------------------------------------------------------------------
+//SF 
+//SF .. c:function:: void canopen_decoder_init(canopen_decoder_t *dec)
+//SF    
+//SF     Set up a decoder on the caller's storage, with no SDO transfers in
+//SF     progress and the predefined COB-ID connection set.
+//SF 
+//------------------------------------------------------------------------------
+void
+canopen_decoder_init(canopen_decoder_t *dec)
+{
+    bzero((void *)dec, sizeof(canopen_decoder_t));
+}
+
+//------------------------------------------------------------------------------
+//SF 
+//SF .. c:function:: canopen_decoder_t *canopen_decoder_new()
+//SF    
+//SF     Allocate a decoder: the protocol state needed to decode the frames
+//SF     of one bus, in the order received. Use one decoder per bus; a
+//SF     decoder may only be used by one thread at a time.
+//SF 
+//------------------------------------------------------------------------------
+canopen_decoder_t *
+canopen_decoder_new()
+{
+    canopen_decoder_t *dec;
+
+    if ((dec = (canopen_decoder_t *)malloc(sizeof(canopen_decoder_t))) == NULL)
+    {
+        return NULL;
+    }
+
+    canopen_decoder_init(dec);
+
+    return dec;
+}
+
+void
+canopen_decoder_free(canopen_decoder_t *dec)
+{
+    free(dec);
+}
+
+// forget the SDO transfers in progress (e.g. after a bus restart)
+void
+canopen_decoder_reset(canopen_decoder_t *dec)
+{
+    bzero((void *)dec->sdo_state, sizeof(dec->sdo_state));
+}
+
+//------------------------------------------------------------------------------
+//SF 
+//SF .. c:function:: void canopen_decoder_cob_map(canopen_decoder_t *dec, const canopen_cob_map_t *map)
+//SF    
+//SF     Classify PDOs and SYNC/EMCY with *map* (see canopen-cob.h), NULL
+//SF     for the predefined connection set. The map must outlive its use.
+//SF 
+//------------------------------------------------------------------------------
+void
+canopen_decoder_cob_map(canopen_decoder_t *dec, const canopen_cob_map_t *map)
+{
+    dec->cob_map = map;
+}
+
+//------------------------------------------------------------------------------
+//SF 
+//SF .. c:function:: int canopen_decoder_format(canopen_decoder_t *dec, canopen_frame_t *frame, char *buf, size_t len)
+//SF    
+//SF     Format a CAN frame in the compact format of canopen_frame_dump_short
+//SF     (including the trailing newline) into *buf*, without allocating or
+//SF     going through stdio, and follow the SDO transfers it belongs to in
+//SF     *dec*. The text is always terminated, and truncated if it does not
+//SF     fit in *len* bytes (CANOPEN_FRAME_FORMAT_MAX always suffices).
+//SF 
+//SF     Returns the length of the full text, as snprintf, or -1 on error.
+//SF 
+//------------------------------------------------------------------------------
+int
+canopen_decoder_format(canopen_decoder_t *dec, canopen_frame_t *frame, char *buf, size_t len)
+{
+    const canopen_cob_class_t *cls;
+    canopen_sdo_t *sdo;
+    canopen_fmt_t f;
+
+    if (dec == NULL || frame == NULL || (buf == NULL && len > 0))
+    {
+        return -1;
+    }
+
+    f.buf = buf;
+    f.len = len;
+    f.pos = 0;
+
+    sdo = &(frame->payload.sdo);
+
     if (frame->type == CANOPEN_FLAG_EXTENDED) // XXX flag!?!
     {
-        printf("EXTENDED ");    
-        printf("Node ID=0x%.7X ", frame->id);    
+        canopen_fmt_lit(&f, "EXTENDED Node ID=0x");
+        canopen_fmt_hex(&f, frame->id, 7, canopen_fmt_hex_upper);
+        canopen_fmt_lit(&f, " ");
+    }
+    else if (frame->type == CANOPEN_FLAG_ERROR)
+    {
+        canopen_fmt_lit(&f, "ERROR ");
     }
     else
     {
-        printf("STANDARD [0x%.3X] ", (frame->function_code<<7)|frame->id);    
-        printf("FC=0x%.1X ", frame->function_code);
-        printf("ID=0x%.2X ", frame->id);
+        canopen_fmt_lit(&f, "STANDARD [0x");
+        canopen_fmt_hex(&f, (frame->function_code<<7)|frame->id, 3, canopen_fmt_hex_upper);
+        canopen_fmt_lit(&f, "] FC=0x");
+        canopen_fmt_hex(&f, frame->function_code, 1, canopen_fmt_hex_upper);
+        canopen_fmt_lit(&f, " ID=0x");
+        canopen_fmt_hex(&f, frame->id, 2, canopen_fmt_hex_upper);
+        canopen_fmt_lit(&f, " ");
     }
 
     if (frame->rtr)
     {
-        printf("RTR ");
+        canopen_fmt_lit(&f, "RTR ");
     }
 
     // raw payload data
-    printf("[%u] ", frame->data_len);
-    for (i = 0; i < frame->data_len; i++)
+    canopen_fmt_lit(&f, "[");
+    canopen_fmt_dec(&f, frame->data_len);
+    canopen_fmt_lit(&f, "] ");
+    canopen_fmt_bytes(&f, frame->payload.data, frame->data_len, canopen_fmt_hex_upper);
+
+    canopen_fmt_lit(&f, " => ");
+
+    if (frame->type == CANOPEN_FLAG_ERROR)
     {
-        printf("0x%.2X ", frame->payload.data[i]);
+        canopen_fmt_lit(&f, "CAN ERROR [class = 0x");
+        canopen_fmt_hex(&f, frame->id, 3, canopen_fmt_hex_upper);
+        canopen_fmt_lit(&f, "]\n");
+        goto done;
     }
 
-    printf(" => ");
-
     // NMT protocol
     switch (frame->function_code)
     {
@@ -238,26 +578,28 @@ canopen_frame_dump_short(canopen_frame_t *frame) // rename to analyze
         // 
         case CANOPEN_FC_NMT_MC:
             
-            printf("NMT [Module Control] Node=0x%.2X ", frame->payload.nmt_mc.id);
+            canopen_fmt_lit(&f, "NMT [Module Control] Node=0x");
+            canopen_fmt_hex(&f, frame->payload.nmt_mc.id, 2, canopen_fmt_hex_upper);
+            canopen_fmt_lit(&f, " ");
             switch (frame->payload.nmt_mc.cs)
             {
                 case CANOPEN_NMT_MC_CS_START:
-                    printf("Command='%s'", CANOPEN_NMT_MC_CS_START_STR);
+                    canopen_fmt_lit(&f, "Command='" CANOPEN_NMT_MC_CS_START_STR "'");
                     break;
                 case CANOPEN_NMT_MC_CS_STOP:
-                    printf("Command='%s'", CANOPEN_NMT_MC_CS_STOP_STR);
+                    canopen_fmt_lit(&f, "Command='" CANOPEN_NMT_MC_CS_STOP_STR "'");
                     break;
                 case CANOPEN_NMT_MC_CS_PREOP:
-                    printf("Command='%s'", CANOPEN_NMT_MC_CS_PREOP_STR);
+                    canopen_fmt_lit(&f, "Command='" CANOPEN_NMT_MC_CS_PREOP_STR "'");
                     break;
                 case CANOPEN_NMT_MC_CS_RESET_APP:
-                    printf("Command='%s'", CANOPEN_NMT_MC_CS_RESET_APP_STR);
+                    canopen_fmt_lit(&f, "Command='" CANOPEN_NMT_MC_CS_RESET_APP_STR "'");
                     break;
                 case CANOPEN_NMT_MC_CS_RESET_COM:
-                    printf("Command='%s'", CANOPEN_NMT_MC_CS_RESET_COM_STR);
+                    canopen_fmt_lit(&f, "Command='" CANOPEN_NMT_MC_CS_RESET_COM_STR "'");
                     break;
                 default:
-                    printf("Command=Unknown");
+                    canopen_fmt_lit(&f, "Command=Unknown");
             }
 
             break;
@@ -267,38 +609,43 @@ canopen_frame_dump_short(canopen_frame_t *frame) // rename to analyze
         // 
         case CANOPEN_FC_NMT_NG:
 
+            canopen_fmt_lit(&f, "NMT [Node Guarding] Node=0x");
+            canopen_fmt_hex(&f, frame->id, 2, canopen_fmt_hex_upper);
+
             if (frame->data_len == 0 && frame->rtr)
             {
-                printf("NMT [Node Guarding] Node=0x%.2X Pull", frame->id);
+                canopen_fmt_lit(&f, " Pull");
                 break;
             }
 
-            printf("NMT [Node Guarding] Node=0x%.2X ", frame->id);
+            canopen_fmt_lit(&f, " ");
             switch (frame->payload.nmt_ng.state & CANOPEN_NMT_NG_STATE_MASK)
             {
                 case CANOPEN_NMT_NG_STATE_BOOTUP:
-                    printf("State='%s'", CANOPEN_NMT_NG_STATE_BOOTUP_STR);
+                    canopen_fmt_lit(&f, "State='" CANOPEN_NMT_NG_STATE_BOOTUP_STR "'");
                     break;
                 case CANOPEN_NMT_NG_STATE_DISCON:
-                    printf("State='%s'", CANOPEN_NMT_NG_STATE_DISCON_STR);
+                    canopen_fmt_lit(&f, "State='" CANOPEN_NMT_NG_STATE_DISCON_STR "'");
                     break;
                 case CANOPEN_NMT_NG_STATE_CON:
-                    printf("State='%s'", CANOPEN_NMT_NG_STATE_CON_STR);
+                    canopen_fmt_lit(&f, "State='" CANOPEN_NMT_NG_STATE_CON_STR "'");
                     break;
                 case CANOPEN_NMT_NG_STATE_PREP:
-                    printf("State='%s'", CANOPEN_NMT_NG_STATE_PREP_STR);
+                    canopen_fmt_lit(&f, "State='" CANOPEN_NMT_NG_STATE_PREP_STR "'");
                     break;
                 case CANOPEN_NMT_NG_STATE_STOP:
-                    printf("State='%s'", CANOPEN_NMT_NG_STATE_STOP_STR);
+                    canopen_fmt_lit(&f, "State='" CANOPEN_NMT_NG_STATE_STOP_STR "'");
                     break;
                 case CANOPEN_NMT_NG_STATE_OP:
-                    printf("State='%s'", CANOPEN_NMT_NG_STATE_OP_STR);
+                    canopen_fmt_lit(&f, "State='" CANOPEN_NMT_NG_STATE_OP_STR "'");
                     break;
                 case CANOPEN_NMT_NG_STATE_PREOP:
-                    printf("State='%s'", CANOPEN_NMT_NG_STATE_PREOP_STR);
+                    canopen_fmt_lit(&f, "State='" CANOPEN_NMT_NG_STATE_PREOP_STR "'");
                     break;
                 default:
-                    printf("State=Unknown [%.2X]", frame->payload.nmt_ng.state & CANOPEN_NMT_NG_STATE_MASK);
+                    canopen_fmt_lit(&f, "State=Unknown [");
+                    canopen_fmt_hex(&f, frame->payload.nmt_ng.state & CANOPEN_NMT_NG_STATE_MASK, 2, canopen_fmt_hex_upper);
+                    canopen_fmt_lit(&f, "]");
             }
             break;
 
@@ -308,13 +655,18 @@ canopen_frame_dump_short(canopen_frame_t *frame) // rename to analyze
         case CANOPEN_FC_SYNC:
         //case CANOPEN_FC_EMERGENCY: // same as SYNC
 
-            if (frame->id == 0x00)
+            cls = canopen_cob_classify(dec->cob_map, (frame->function_code<<7)|frame->id);
+            if (cls->service == CANOPEN_SERVICE_SYNC)
             {
-                printf("SYNC [counter = 0x%x] ", frame->payload.data[0]);
+                canopen_fmt_lit(&f, "SYNC [counter = 0x");
+                canopen_fmt_hex(&f, frame->payload.data[0], 1, canopen_fmt_hex_lower);
+                canopen_fmt_lit(&f, "] ");
             }
             else
             {
-                printf("EMERGANCY Node=0x%x ", frame->id);
+                canopen_fmt_lit(&f, "EMERGANCY Node=0x");
+                canopen_fmt_hex(&f, frame->id, 1, canopen_fmt_hex_lower);
+                canopen_fmt_lit(&f, " ");
             }
 
             break;
@@ -324,58 +676,32 @@ canopen_frame_dump_short(canopen_frame_t *frame) // rename to analyze
         // 
         case CANOPEN_FC_TIMESTAMP:
 
-            printf("TIMESTAMP Node=0x%x ", frame->id);
+            canopen_fmt_lit(&f, "TIMESTAMP Node=0x");
+            canopen_fmt_hex(&f, frame->id, 1, canopen_fmt_hex_lower);
+            canopen_fmt_lit(&f, " ");
             break;
 
         // ---------------------------------------------------------------------
         // PDOs
         // 
         case CANOPEN_FC_PDO1_TX:
-            printf("PDO1 TX Node=0x%x ", frame->id);
-            for (i = 0; i < frame->data_len; i++)
-                printf("0x%.2x ", frame->payload.data[i]);
-
-            break;
         case CANOPEN_FC_PDO1_RX:
-            printf("PDO1 RX Node=0x%x ", frame->id);
-            for (i = 0; i < frame->data_len; i++)
-                printf("0x%.2x ", frame->payload.data[i]);
-
-            break;
         case CANOPEN_FC_PDO2_TX:
-            printf("PDO2 TX Node=0x%x ", frame->id);
-            for (i = 0; i < frame->data_len; i++)
-                printf("0x%.2x ", frame->payload.data[i]);
-
-            break;
         case CANOPEN_FC_PDO2_RX:
-            printf("PDO2 RX Node=0x%x ", frame->id);
-            for (i = 0; i < frame->data_len; i++)
-                printf("0x%.2x ", frame->payload.data[i]);
-
-            break;
         case CANOPEN_FC_PDO3_TX:
-            printf("PDO3 TX Node=0x%x ", frame->id);
-            for (i = 0; i < frame->data_len; i++)
-                printf("0x%.2x ", frame->payload.data[i]);
-
-            break;
         case CANOPEN_FC_PDO3_RX:
-            printf("PDO3 RX Node=0x%x ", frame->id);
-            for (i = 0; i < frame->data_len; i++)
-                printf("0x%.2x ", frame->payload.data[i]);
-
-            break;
         case CANOPEN_FC_PDO4_TX:
-            printf("PDO4 TX Node=0x%x ", frame->id);
-            for (i = 0; i < frame->data_len; i++)
-                printf("0x%.2x ", frame->payload.data[i]);
-
-            break;
         case CANOPEN_FC_PDO4_RX:
-            printf("PDO4 RX Node=0x%x ", frame->id);
-            for (i = 0; i < frame->data_len; i++)
-                printf("0x%.2x ", frame->payload.data[i]);
+            cls = canopen_cob_classify(dec->cob_map, (frame->function_code<<7)|frame->id);
+            canopen_fmt_lit(&f, "PDO");
+            canopen_fmt_dec(&f, cls->pdo);
+            if (cls->direction == CANOPEN_COB_DIR_TX)
+                canopen_fmt_lit(&f, " TX Node=0x");
+            else
+                canopen_fmt_lit(&f, " RX Node=0x");
+            canopen_fmt_hex(&f, cls->node, 1, canopen_fmt_hex_lower);
+            canopen_fmt_lit(&f, " ");
+            canopen_fmt_bytes(&f, frame->payload.data, frame->data_len, canopen_fmt_hex_lower);
 
             break;
 
@@ -384,236 +710,283 @@ canopen_frame_dump_short(canopen_frame_t *frame) // rename to analyze
         // 
         case CANOPEN_FC_SDO_TX: // 58 : Server to Client = upload (server perspective)
 
-            printf("SDO TX Node=0x%.2X ", frame->id);
-               
-            printf("Command=0x%.2X ", frame->payload.sdo.command);
-/*
-            if (block_mode[frame->id])
+            canopen_fmt_lit(&f, "SDO TX Node=0x");
+            canopen_fmt_hex(&f, frame->id, 2, canopen_fmt_hex_upper);
+            canopen_fmt_lit(&f, " Command=0x");
+            canopen_fmt_hex(&f, sdo->command, 2, canopen_fmt_hex_upper);
+            canopen_fmt_lit(&f, " ");
+
+            if (dec->sdo_state[frame->id & 0x7F] == CANOPEN_DECODER_SDO_BLOCK_UPLOAD)
             {
-                printf("[%s] [C %d] [SeqNo = %d] 0x%.2X 0x%.2X 0x%.2X 0x%.2X 0x%.2X 0x%.2X 0x%.2X ", 
-                       CANOPEN_SDO_CS_BD_STR, (frame->payload.data[0] & 0x80) ? 1 : 0,
-                       frame->payload.data[0] & 0x7F,
-                       frame->payload.data[1], frame->payload.data[2], frame->payload.data[3],
-                       frame->payload.data[4], frame->payload.data[5], frame->payload.data[6],
-                       frame->payload.data[7]);
-                
-                if (frame->payload.sdo.command & 0x80)
-                {   
-                    //block_mode[frame->id] = 0;
+                canopen_fmt_lit(&f, "[" CANOPEN_SDO_CS_BU_STR "] ");
+                canopen_fmt_flag(&f, "C", (frame->payload.data[0] & 0x80) ? 1 : 0);
+                canopen_fmt_lit(&f, "[SeqNo = ");
+                canopen_fmt_dec(&f, frame->payload.data[0] & 0x7F);
+                canopen_fmt_lit(&f, "] ");
+                canopen_fmt_bytes(&f, &(frame->payload.data[1]), 7, canopen_fmt_hex_upper);
+
+                if (sdo->command & 0x80)
+                {
+                    dec->sdo_state[frame->id & 0x7F] = CANOPEN_DECODER_SDO_IDLE;
                 }
                 break;
             }
-*/
 
-            switch (frame->payload.sdo.command & CANOPEN_SDO_CS_MASK)
+            switch (sdo->command & CANOPEN_SDO_CS_MASK)
             {
                 case CANOPEN_SDO_CS_TX_IDD:
-                    printf("[%s] ", CANOPEN_SDO_CS_IDD_STR);
-                    printf("Index=0x%.4X ",    SDO_index(frame->payload.sdo));
-                    printf("SubIndex=0x%.2X ", frame->payload.sdo.subindex);
-                    printf("0x%.2X 0x%.2X 0x%.2X 0x%.2X ", 
-                           frame->payload.sdo.data[0], frame->payload.sdo.data[1],
-                           frame->payload.sdo.data[2], frame->payload.sdo.data[3]);
+                    canopen_fmt_lit(&f, "[" CANOPEN_SDO_CS_IDD_STR "] ");
+                    canopen_fmt_sdo_index(&f, sdo);
+                    canopen_fmt_bytes(&f, sdo->data, 4, canopen_fmt_hex_upper);
                     break;
                 case CANOPEN_SDO_CS_TX_DDS:
-                    printf("[%s] ", CANOPEN_SDO_CS_DDS_STR);
-
-                    printf("[T %d] ", (frame->payload.sdo.command & CANOPEN_SDO_CS_DS_T_FLAG) ? 1 : 0);
+                    canopen_fmt_lit(&f, "[" CANOPEN_SDO_CS_DDS_STR "] ");
+                    canopen_fmt_flag(&f, "T", (sdo->command & CANOPEN_SDO_CS_DS_T_FLAG) ? 1 : 0);
                     break;
                 case CANOPEN_SDO_CS_TX_IDU:
-                    printf("[%s] ", CANOPEN_SDO_CS_IDU_STR);
+                    canopen_fmt_lit(&f, "[" CANOPEN_SDO_CS_IDU_STR "] ");
 
-                    if (frame->payload.sdo.command & CANOPEN_SDO_CS_ID_E_FLAG)
+                    if (sdo->command & CANOPEN_SDO_CS_ID_E_FLAG)
                     {
-                        printf("[EXP] ");
+                        canopen_fmt_lit(&f, "[EXP] ");
 
-                        if (frame->payload.sdo.command & CANOPEN_SDO_CS_ID_S_FLAG)
+                        if (sdo->command & CANOPEN_SDO_CS_ID_S_FLAG)
                         {
-                            int n = (frame->payload.sdo.command & CANOPEN_SDO_CS_ID_N_MASK) >> CANOPEN_SDO_CS_ID_N_SHIFT;
-                            printf("[SI: %d] ", n);
+                            canopen_fmt_flag(&f, "SI:", (sdo->command & CANOPEN_SDO_CS_ID_N_MASK) >> CANOPEN_SDO_CS_ID_N_SHIFT);
                         }
 
-                        printf("Index=0x%.4X ",    SDO_index(frame->payload.sdo));
-                        printf("SubIndex=0x%.2X ", frame->payload.sdo.subindex);
-                        printf("0x%.2X 0x%.2X 0x%.2X 0x%.2X ", 
-                               frame->payload.sdo.data[0], frame->payload.sdo.data[1],
-                               frame->payload.sdo.data[2], frame->payload.sdo.data[3]);
+                        canopen_fmt_sdo_index(&f, sdo);
+                        canopen_fmt_bytes(&f, sdo->data, 4, canopen_fmt_hex_upper);
                     }
                     else
                     {
-                        printf("[SEG] [SIZE %d]", frame->payload.sdo.data[0]);
+                        canopen_fmt_lit(&f, "[SEG] [SIZE ");
+                        canopen_fmt_dec(&f, sdo->data[0]);
+                        canopen_fmt_lit(&f, "]");
                     }
 
                     break;
                 case CANOPEN_SDO_CS_TX_UDS:
-                    printf("[%s] ", CANOPEN_SDO_CS_UDS_STR);
+                    canopen_fmt_lit(&f, "[" CANOPEN_SDO_CS_UDS_STR "] ");
 
-                    if (frame->payload.sdo.command & CANOPEN_SDO_CS_DS_C_FLAG)
-                        printf("[LAST] [T %d] ", (frame->payload.sdo.command & CANOPEN_SDO_CS_DS_T_FLAG) ? 1 : 0);
+                    if (sdo->command & CANOPEN_SDO_CS_DS_C_FLAG)
+                        canopen_fmt_lit(&f, "[LAST] ");
                     else
-                        printf("[CONT] [T %d] ", (frame->payload.sdo.command & CANOPEN_SDO_CS_DS_T_FLAG) ? 1 : 0);    
-
-                    {
-                        int n = (frame->payload.sdo.command & CANOPEN_SDO_CS_DS_N_MASK) >> CANOPEN_SDO_CS_DS_N_SHIFT;
-                        printf("[SI: %d] ", n);
-                    }
+                        canopen_fmt_lit(&f, "[CONT] ");
+                    canopen_fmt_flag(&f, "T", (sdo->command & CANOPEN_SDO_CS_DS_T_FLAG) ? 1 : 0);
+                    canopen_fmt_flag(&f, "SI:", (sdo->command & CANOPEN_SDO_CS_DS_N_MASK) >> CANOPEN_SDO_CS_DS_N_SHIFT);
                     break;
                 case CANOPEN_SDO_CS_TX_ADT:
-                    printf("[%s] ", CANOPEN_SDO_CS_ADT_STR);
-                    printf("[%s] ", canopen_sdo_abort_code_lookup(&(frame->payload.sdo)));
+                    canopen_fmt_lit(&f, "[" CANOPEN_SDO_CS_ADT_STR "] [");
+                    canopen_fmt_str(&f, canopen_sdo_abort_code_lookup(sdo));
+                    canopen_fmt_lit(&f, "] ");
                     break;
                 case CANOPEN_SDO_CS_TX_BD:
-                    printf("[%s] ", CANOPEN_SDO_CS_BD_STR);
+                    canopen_fmt_lit(&f, "[" CANOPEN_SDO_CS_BD_STR "] ");
 
-                    switch (frame->payload.sdo.command & 0x03)
+                    switch (sdo->command & 0x03)
                     {
                         case 0x00: // IBD
                         {
-                            printf("[S-CRC %d] ", (frame->payload.sdo.command &  CANOPEN_SDO_CS_BD_CRC_FLAG) ? 1 : 0);
-                            printf("[SS %d] ", (frame->payload.sdo.command & 0x03));
-
-                            printf("Index=0x%.4X ",   SDO_index(frame->payload.sdo));
-                            printf("SubIndex=0x%.2X ",frame->payload.sdo.subindex);
-                            printf("BlkSize=%d ", frame->payload.sdo.data[0]);   
-                            block_mode[frame->id] = 1;
+                            canopen_fmt_flag(&f, "S-CRC", (sdo->command &  CANOPEN_SDO_CS_BD_CRC_FLAG) ? 1 : 0);
+                            canopen_fmt_flag(&f, "SS", sdo->command & 0x03);
+                            canopen_fmt_sdo_index(&f, sdo);
+                            canopen_fmt_lit(&f, "BlkSize=");
+                            canopen_fmt_dec(&f, sdo->data[0]);
+                            canopen_fmt_lit(&f, " ");
+                            dec->sdo_state[frame->id & 0x7F] = CANOPEN_DECODER_SDO_BLOCK;
                             break;
                         }
                         case 0x01: // EBD
                         {
-                            printf("[SS %d] ", (frame->payload.sdo.command & 0x03));
-                            block_mode[frame->id] = 0;
+                            canopen_fmt_flag(&f, "SS", sdo->command & 0x03);
+                            dec->sdo_state[frame->id & 0x7F] = CANOPEN_DECODER_SDO_IDLE;
                             break;
                         }
                         case 0x02: // BD ack
                         {
-                            printf("[SS %d] ", (frame->payload.sdo.command & 0x03));
-                            printf("AckSeq=%d ", frame->payload.data[1]);
-                            printf("BlkSize=%d ", frame->payload.data[2]);
+                            canopen_fmt_flag(&f, "SS", sdo->command & 0x03);
+                            canopen_fmt_lit(&f, "AckSeq=");
+                            canopen_fmt_dec(&f, frame->payload.data[1]);
+                            canopen_fmt_lit(&f, " BlkSize=");
+                            canopen_fmt_dec(&f, frame->payload.data[2]);
+                            canopen_fmt_lit(&f, " ");
+                            break;
+                        }
+                    }
+                    break;
+                case CANOPEN_SDO_CS_TX_BU:
+                    canopen_fmt_lit(&f, "[" CANOPEN_SDO_CS_BU_STR "] ");
+
+                    switch (sdo->command & CANOPEN_SDO_CS_BU_SS_MASK)
+                    {
+                        case CANOPEN_SDO_CS_BU_SS_IBU:
+                        {
+                            canopen_fmt_flag(&f, "SS", sdo->command & CANOPEN_SDO_CS_BU_SS_MASK);
+                            canopen_fmt_flag(&f, "S-CRC", (sdo->command &  CANOPEN_SDO_CS_BD_CRC_FLAG) ? 1 : 0);
+                            canopen_fmt_flag(&f, "S", (sdo->command &  CANOPEN_SDO_CS_BD_S_FLAG) ? 1 : 0);
+                            canopen_fmt_sdo_index(&f, sdo);
+                            canopen_fmt_lit(&f, "Size=");
+                            canopen_fmt_dec(&f, canopen_decode_u32(sdo->data));
+                            canopen_fmt_lit(&f, " ");
+                            break;
+                        }
+                        case CANOPEN_SDO_CS_BU_SS_EBU:
+                        {
+                            canopen_fmt_flag(&f, "SS", sdo->command & CANOPEN_SDO_CS_BU_SS_MASK);
+                            canopen_fmt_flag(&f, "EXCESS", (sdo->command >> CANOPEN_SDO_CS_DB_N_SHIFT) & CANOPEN_SDO_CS_DB_N_MASK);
+                            canopen_fmt_lit(&f, "CRC=0x");
+                            canopen_fmt_hex(&f, frame->payload.data[1], 2, canopen_fmt_hex_upper);
+                            canopen_fmt_hex(&f, frame->payload.data[2], 2, canopen_fmt_hex_upper);
+                            canopen_fmt_lit(&f, " ");
+
+                            dec->sdo_state[frame->id & 0x7F] = CANOPEN_DECODER_SDO_IDLE;
                             break;
                         }
                     }
                     break;
                 default:
-                    printf("[unknown cs] ");
+                    canopen_fmt_lit(&f, "[unknown cs] ");
             }
     
             break;
 
         case CANOPEN_FC_SDO_RX: // 60 : Client to Server = download [server perspective]
 
-            printf("SDO RX Node=0x%.2X ", frame->id);
-
-            printf("Command=0x%.2X ", frame->payload.sdo.command);
+            canopen_fmt_lit(&f, "SDO RX Node=0x");
+            canopen_fmt_hex(&f, frame->id, 2, canopen_fmt_hex_upper);
+            canopen_fmt_lit(&f, " Command=0x");
+            canopen_fmt_hex(&f, sdo->command, 2, canopen_fmt_hex_upper);
+            canopen_fmt_lit(&f, " ");
 
-            if (block_mode[frame->id])
+            if (dec->sdo_state[frame->id & 0x7F] == CANOPEN_DECODER_SDO_BLOCK)
             {
-                printf("[%s] [C %d] [SeqNo = %d] 0x%.2X 0x%.2X 0x%.2X 0x%.2X 0x%.2X 0x%.2X 0x%.2X ", 
-                       CANOPEN_SDO_CS_BD_STR, (frame->payload.data[0] & 0x80) ? 1 : 0,
-                       frame->payload.data[0] & 0x7F,
-                       frame->payload.data[1], frame->payload.data[2], frame->payload.data[3],
-                       frame->payload.data[4], frame->payload.data[5], frame->payload.data[6],
-                       frame->payload.data[7]);
+                canopen_fmt_lit(&f, "[" CANOPEN_SDO_CS_BD_STR "] ");
+                canopen_fmt_flag(&f, "C", (frame->payload.data[0] & 0x80) ? 1 : 0);
+                canopen_fmt_lit(&f, "[SeqNo = ");
+                canopen_fmt_dec(&f, frame->payload.data[0] & 0x7F);
+                canopen_fmt_lit(&f, "] ");
+                canopen_fmt_bytes(&f, &(frame->payload.data[1]), 7, canopen_fmt_hex_upper);
                 
-                if (frame->payload.sdo.command & 0x80)
+                if (sdo->command & 0x80)
                 {   
-                    block_mode[frame->id] = 0;
+                    dec->sdo_state[frame->id & 0x7F] = CANOPEN_DECODER_SDO_IDLE;
                 }
                 break;
             }
 
-            switch (frame->payload.sdo.command & CANOPEN_SDO_CS_MASK)
+            switch (sdo->command & CANOPEN_SDO_CS_MASK)
             {
                 case CANOPEN_SDO_CS_RX_IDD:
-                    printf("[%s] ", CANOPEN_SDO_CS_IDD_STR);
+                    canopen_fmt_lit(&f, "[" CANOPEN_SDO_CS_IDD_STR "] ");
 
-                    if (frame->payload.sdo.command & CANOPEN_SDO_CS_ID_E_FLAG)
+                    if (sdo->command & CANOPEN_SDO_CS_ID_E_FLAG)
                     {
-                        printf("[EXP] ");
-                        if (frame->payload.sdo.command & CANOPEN_SDO_CS_ID_S_FLAG)
+                        canopen_fmt_lit(&f, "[EXP] ");
+                        if (sdo->command & CANOPEN_SDO_CS_ID_S_FLAG)
                         {
-                            int n = (frame->payload.sdo.command & CANOPEN_SDO_CS_ID_N_MASK) >> CANOPEN_SDO_CS_ID_N_SHIFT;
-                            printf("[SI: %d] ", n);
+                            canopen_fmt_flag(&f, "SI:", (sdo->command & CANOPEN_SDO_CS_ID_N_MASK) >> CANOPEN_SDO_CS_ID_N_SHIFT);
                         } 
                     }
                     else
                     {
-                        printf("[SEG] ");                        
+                        canopen_fmt_lit(&f, "[SEG] ");
                     }
 
-                    printf("Index=0x%.4X ",   SDO_index(frame->payload.sdo));
-                    printf("SubIndex=0x%.2X ",frame->payload.sdo.subindex);
-                    printf("0x%.2X 0x%.2X 0x%.2X 0x%.2X ", 
-                           frame->payload.sdo.data[0], frame->payload.sdo.data[1],
-                           frame->payload.sdo.data[2], frame->payload.sdo.data[3]);
+                    canopen_fmt_sdo_index(&f, sdo);
+                    canopen_fmt_bytes(&f, sdo->data, 4, canopen_fmt_hex_upper);
 
                     break;
                 case CANOPEN_SDO_CS_RX_DDS:
-                    printf("[%s] ", CANOPEN_SDO_CS_DDS_STR);
+                    canopen_fmt_lit(&f, "[" CANOPEN_SDO_CS_DDS_STR "] ");
 
-                    if (frame->payload.sdo.command & CANOPEN_SDO_CS_DS_C_FLAG)
-                        printf("[LAST] [T %d] ", (frame->payload.sdo.command & CANOPEN_SDO_CS_DS_T_FLAG) ? 1 : 0);
+                    if (sdo->command & CANOPEN_SDO_CS_DS_C_FLAG)
+                        canopen_fmt_lit(&f, "[LAST] ");
                     else
-                        printf("[CONT] [T %d] ", (frame->payload.sdo.command & CANOPEN_SDO_CS_DS_T_FLAG) ? 1 : 0);
-
-                    {
-                        int n = (frame->payload.sdo.command & CANOPEN_SDO_CS_DS_N_MASK) >> CANOPEN_SDO_CS_DS_N_SHIFT;
-                        printf("[SI: %d] ", n);
-                    }
+                        canopen_fmt_lit(&f, "[CONT] ");
+                    canopen_fmt_flag(&f, "T", (sdo->command & CANOPEN_SDO_CS_DS_T_FLAG) ? 1 : 0);
+                    canopen_fmt_flag(&f, "SI:", (sdo->command & CANOPEN_SDO_CS_DS_N_MASK) >> CANOPEN_SDO_CS_DS_N_SHIFT);
                     break;
                 case CANOPEN_SDO_CS_RX_IDU:
-                    printf("[%s] ", CANOPEN_SDO_CS_IDU_STR);
-                    printf("Index=0x%.4X ",   SDO_index(frame->payload.sdo));
-                    printf("SubIndex=0x%.2X ",frame->payload.sdo.subindex);
-                    printf("0x%.2X 0x%.2X 0x%.2X 0x%.2X ", 
-                           frame->payload.sdo.data[0], frame->payload.sdo.data[1],
-                           frame->payload.sdo.data[2], frame->payload.sdo.data[3]);
+                    canopen_fmt_lit(&f, "[" CANOPEN_SDO_CS_IDU_STR "] ");
+                    canopen_fmt_sdo_index(&f, sdo);
+                    canopen_fmt_bytes(&f, sdo->data, 4, canopen_fmt_hex_upper);
                     break;
                 case CANOPEN_SDO_CS_RX_UDS:
-                    printf("[%s] ", CANOPEN_SDO_CS_UDS_STR);
-
-                    printf("[T %d] ", (frame->payload.sdo.command & CANOPEN_SDO_CS_DS_T_FLAG) ? 1 : 0);
+                    canopen_fmt_lit(&f, "[" CANOPEN_SDO_CS_UDS_STR "] ");
+                    canopen_fmt_flag(&f, "T", (sdo->command & CANOPEN_SDO_CS_DS_T_FLAG) ? 1 : 0);
                     break;
                 case CANOPEN_SDO_CS_RX_ADT:
-                    printf("[%s] ", CANOPEN_SDO_CS_ADT_STR);
-                    printf("[%s] ", canopen_sdo_abort_code_lookup(&(frame->payload.sdo)));
-                    block_mode[frame->id] = 0;
+                    canopen_fmt_lit(&f, "[" CANOPEN_SDO_CS_ADT_STR "] [");
+                    canopen_fmt_str(&f, canopen_sdo_abort_code_lookup(sdo));
+                    canopen_fmt_lit(&f, "] ");
+                    dec->sdo_state[frame->id & 0x7F] = CANOPEN_DECODER_SDO_IDLE;
                     break;
                 case CANOPEN_SDO_CS_RX_BD:
-                    printf("[%s] ", CANOPEN_SDO_CS_BD_STR);
+                    canopen_fmt_lit(&f, "[" CANOPEN_SDO_CS_BD_STR "] ");
 
-                    switch (frame->payload.sdo.command & 0x01)
+                    switch (sdo->command & 0x01)
                     {
                         case 0x00: // IBD
                         {
-                            printf("[CS %d] ", (frame->payload.sdo.command & 0x01));
-
-                            printf("[C-CRC %d] ", (frame->payload.sdo.command &  CANOPEN_SDO_CS_BD_CRC_FLAG) ? 1 : 0);
-                            printf("[S %d] ",  (frame->payload.sdo.command &  CANOPEN_SDO_CS_BD_S_FLAG) ? 1 : 0);
-
-                            printf("Index=0x%.4X ",   SDO_index(frame->payload.sdo));
-                            printf("SubIndex=0x%.2X ",frame->payload.sdo.subindex);
-                            printf("Size=%d ", 
-                                   frame->payload.sdo.data[0]|(frame->payload.sdo.data[1]<<8)|
-                                   (frame->payload.sdo.data[2]<<16)|(frame->payload.sdo.data[3]<<24));                    
-
-                            //block_mode[frame->id] = 1;
+                            canopen_fmt_flag(&f, "CS", sdo->command & 0x01);
+                            canopen_fmt_flag(&f, "C-CRC", (sdo->command &  CANOPEN_SDO_CS_BD_CRC_FLAG) ? 1 : 0);
+                            canopen_fmt_flag(&f, "S", (sdo->command &  CANOPEN_SDO_CS_BD_S_FLAG) ? 1 : 0);
+                            canopen_fmt_sdo_index(&f, sdo);
+                            canopen_fmt_lit(&f, "Size=");
+                            canopen_fmt_dec(&f, canopen_decode_u32(sdo->data));
+                            canopen_fmt_lit(&f, " ");
+
+                            //dec->sdo_state[frame->id & 0x7F] = CANOPEN_DECODER_SDO_BLOCK;
                             break;
                         }
                         case 0x01: // EBD
                         {
-                            printf("[CS %d] ", (frame->payload.sdo.command & 0x01));
-
-                            printf("[EXCESS %d] ", (frame->payload.sdo.command >> CANOPEN_SDO_CS_DB_N_SHIFT) & CANOPEN_SDO_CS_DB_N_MASK);
-
-                            printf("CRC=0x%.2X%.2X ", frame->payload.data[1], frame->payload.data[2]);
+                            canopen_fmt_flag(&f, "CS", sdo->command & 0x01);
+                            canopen_fmt_flag(&f, "EXCESS", (sdo->command >> CANOPEN_SDO_CS_DB_N_SHIFT) & CANOPEN_SDO_CS_DB_N_MASK);
+                            canopen_fmt_lit(&f, "CRC=0x");
+                            canopen_fmt_hex(&f, frame->payload.data[1], 2, canopen_fmt_hex_upper);
+                            canopen_fmt_hex(&f, frame->payload.data[2], 2, canopen_fmt_hex_upper);
+                            canopen_fmt_lit(&f, " ");
+
+                            dec->sdo_state[frame->id & 0x7F] = CANOPEN_DECODER_SDO_IDLE;
+                            break;
+                        }
+                    }
+                    break;
+                case CANOPEN_SDO_CS_RX_BU:
+                    canopen_fmt_lit(&f, "[" CANOPEN_SDO_CS_BU_STR "] ");
+                    canopen_fmt_flag(&f, "CS", sdo->command & CANOPEN_SDO_CS_BU_CS_MASK);
 
-                            block_mode[frame->id] = 0;
+                    switch (sdo->command & CANOPEN_SDO_CS_BU_CS_MASK)
+                    {
+                        case CANOPEN_SDO_CS_BU_CS_IBU:
+                        {
+                            canopen_fmt_flag(&f, "C-CRC", (sdo->command &  CANOPEN_SDO_CS_BD_CRC_FLAG) ? 1 : 0);
+                            canopen_fmt_sdo_index(&f, sdo);
+                            canopen_fmt_lit(&f, "BlkSize=");
+                            canopen_fmt_dec(&f, sdo->data[0]);
+                            canopen_fmt_lit(&f, " ");
+                            break;
+                        }
+                        case CANOPEN_SDO_CS_BU_CS_ACK:
+                        {
+                            canopen_fmt_lit(&f, "AckSeq=");
+                            canopen_fmt_dec(&f, frame->payload.data[1]);
+                            canopen_fmt_lit(&f, " BlkSize=");
+                            canopen_fmt_dec(&f, frame->payload.data[2]);
+                            canopen_fmt_lit(&f, " ");
+                            break;
+                        }
+                        case CANOPEN_SDO_CS_BU_CS_START:
+                        {
+                            dec->sdo_state[frame->id & 0x7F] = CANOPEN_DECODER_SDO_BLOCK_UPLOAD;
                             break;
                         }
                     }
                     break;
                 default:
-                    printf("[unknown cs] ");
+                    canopen_fmt_lit(&f, "[unknown cs] ");
             }
 
             break;
@@ -622,13 +995,68 @@ canopen_frame_dump_short(canopen_frame_t *frame) // rename to analyze
         // default fallback: should never occur
         // 
         default:
-            printf("Unknown frame");
+            canopen_fmt_lit(&f, "Unknown frame");
+    }
+    canopen_fmt_lit(&f, "\n");
+
+done:
+    if (f.len > 0)
+        f.buf[f.pos < f.len ? f.pos : f.len - 1] = '\0';
+
+    return (int)f.pos;
+}
+
+//------------------------------------------------------------------------------
+//SF 
+//SF .. c:function:: int canopen_decoder_dump(canopen_decoder_t *dec, canopen_frame_t *frame)
+//SF    
+//SF     Print a CAN frame in a human-readable (compact) format to the
+//SF     standard output, decoded with *dec*.
+//SF 
+//------------------------------------------------------------------------------
+int
+canopen_decoder_dump(canopen_decoder_t *dec, canopen_frame_t *frame)
+{
+    char buf[CANOPEN_FRAME_FORMAT_MAX];
+
+    if (canopen_decoder_format(dec, frame, buf, sizeof(buf)) < 0)
+    {
+        return -1;
     }
-    printf("\n");
+
+    fputs(buf, stdout);
 
     return 0;
 }
 
+//------------------------------------------------------------------------------
+//SF 
+//SF .. c:function:: int canopen_frame_format_short(canopen_frame_t *frame, char *buf, size_t len)
+//SF    
+//SF     As canopen_decoder_format, with a decoder shared by the whole
+//SF     process (not reentrant).
+//SF 
+//------------------------------------------------------------------------------
+int
+canopen_frame_format_short(canopen_frame_t *frame, char *buf, size_t len)
+{
+    return canopen_decoder_format(&canopen_frame_decoder, frame, buf, len);
+}
+
+//------------------------------------------------------------------------------
+//SF 
+//SF .. c:function:: int canopen_frame_dump_short(canopen_frame_t *frame)
+//SF    
+//SF     Print a CAN frame in a human-readable (compact) format to the
+//SF     standard output, with the process wide decoder (not reentrant).
+//SF 
+//------------------------------------------------------------------------------
+int
+canopen_frame_dump_short(canopen_frame_t *frame) // rename to analyze
+{
+    return canopen_decoder_dump(&canopen_frame_decoder, frame);
+}
+
 //------------------------------------------------------------------------------
 //SF 
 //SF .. c:function:: int canopen_frame_dump_verbose(canopen_frame_t *frame)
@@ -678,15 +1106,18 @@ canopen_frame_dump_verbose(canopen_frame_t *frame)
 //SF 
 //SF .. c:function:: canopen_frame_t *canopen_frame_new()
 //SF    
-//SF     Allocate a new CANopen frame data struct.
+//SF     Allocate a new CANopen frame data struct, from the frame pool if
+//SF     one is installed (canopen-pool.h) and not empty.
 //SF 
 //------------------------------------------------------------------------------
 canopen_frame_t *
 canopen_frame_new()
 {
+    canopen_frame_pool_t *pool = canopen_frame_pool_current();
     canopen_frame_t *frame;
 
-    if ((frame = (canopen_frame_t *)malloc(sizeof(canopen_frame_t))) == NULL)
+    if ((pool == NULL || (frame = canopen_frame_pool_get(pool)) == NULL) &&
+        (frame = (canopen_frame_t *)malloc(sizeof(canopen_frame_t))) == NULL)
     {
         // error message here
         return NULL;
@@ -707,7 +1138,13 @@ canopen_frame_new()
 void
 canopen_frame_free(canopen_frame_t *frame)
 {
-    if (frame)
+    canopen_frame_pool_t *pool = canopen_frame_pool_current();
+
+    if (canopen_frame_pool_owns(pool, frame))
+    {
+        canopen_frame_pool_put(pool, frame);
+    }
+    else if (frame)
     {
         free(frame);
     }
@@ -748,6 +1185,7 @@ canopen_frame_set_nmt_mc(canopen_frame_t *frame, uint8_t cs, uint8_t node)
     frame->rtr = CANOPEN_FLAG_NORMAL;
     frame->function_code = CANOPEN_FC_NMT_MC;
     frame->type = CANOPEN_FLAG_STANDARD;    
+    frame->fd = 0;
     frame->id = 0;
 
     frame->payload.nmt_mc.cs = cs;
@@ -771,6 +1209,7 @@ canopen_frame_set_nmt_ng(canopen_frame_t *frame, uint8_t node)
     frame->rtr = CANOPEN_FLAG_RTR;
     frame->function_code = CANOPEN_FC_NMT_NG;
     frame->type = CANOPEN_FLAG_STANDARD;    
+    frame->fd = 0;
     frame->id = node;
 
     frame->data_len = 0;
@@ -792,6 +1231,7 @@ canopen_frame_set_sdo_idu(canopen_frame_t *frame,
     frame->rtr = CANOPEN_FLAG_NORMAL;
     frame->function_code = CANOPEN_FC_SDO_RX;
     frame->type = CANOPEN_FLAG_STANDARD;    
+    frame->fd = 0;
     frame->id = node;
 
     frame->payload.sdo.command = CANOPEN_SDO_CS_RX_IDU;
@@ -819,6 +1259,7 @@ canopen_frame_set_sdo_idd(canopen_frame_t *frame,
     frame->rtr = CANOPEN_FLAG_NORMAL;
     frame->function_code = CANOPEN_FC_SDO_RX;
     frame->type = CANOPEN_FLAG_STANDARD;    
+    frame->fd = 0;
     frame->id = node;
 
     frame->payload.sdo.command = CANOPEN_SDO_CS_RX_IDD;
@@ -854,6 +1295,7 @@ canopen_frame_set_sdo_idd_seg(canopen_frame_t *frame,
     frame->rtr = CANOPEN_FLAG_NORMAL;
     frame->function_code = CANOPEN_FC_SDO_RX;
     frame->type = CANOPEN_FLAG_STANDARD;    
+    frame->fd = 0;
     frame->id = node;
 
     frame->payload.sdo.command = CANOPEN_SDO_CS_RX_IDD;
@@ -898,6 +1340,7 @@ canopen_frame_set_sdo_uds(canopen_frame_t *frame,
     frame->rtr = CANOPEN_FLAG_NORMAL;
     frame->function_code = CANOPEN_FC_SDO_RX;
     frame->type = CANOPEN_FLAG_STANDARD;    
+    frame->fd = 0;
     frame->id = node;
 
     frame->payload.sdo.command = CANOPEN_SDO_CS_RX_UDS;
@@ -935,10 +1378,19 @@ canopen_frame_set_sdo_dds(canopen_frame_t *frame, uint8_t node,
     frame->rtr = CANOPEN_FLAG_NORMAL;
     frame->function_code = CANOPEN_FC_SDO_RX;
     frame->type = CANOPEN_FLAG_STANDARD;    
+    frame->fd = 0;
     frame->id = node;
 
+    if (len > CANOPEN_SDO_SEG_MAX_FD)
+        len = CANOPEN_SDO_SEG_MAX_FD;
+
+    // segments with more than 7 bytes of data are sent as CAN FD frames
+    frame->data_len = (len < CANOPEN_SDO_SEG_MAX) ? 8 : canopen_frame_fd_len(len + 1);
+    if (frame->data_len > CANOPEN_FRAME_DATA_LEN)
+        frame->fd = CANOPEN_FD_FLAG_FDF;
+
     frame->payload.sdo.command = CANOPEN_SDO_CS_RX_DDS;
-    frame->payload.sdo.command |= ((7-len)&0x07)<<CANOPEN_SDO_CS_DS_N_SHIFT;
+    frame->payload.sdo.command |= ((frame->data_len-1-len)&0x07)<<CANOPEN_SDO_CS_DS_N_SHIFT;
     //frame->payload.sdo.command |= ((7-len)<<CANOPEN_SDO_CS_DS_N_SHIFT)&CANOPEN_SDO_CS_DS_N_MASK;
 
     if (toggle)
@@ -947,10 +1399,12 @@ canopen_frame_set_sdo_dds(canopen_frame_t *frame, uint8_t node,
     if (cont)
         frame->payload.sdo.command |= CANOPEN_SDO_CS_DS_C_FLAG;
 
-    for (n = 0; n < len && n < 7; n++)
+    for (n = 0; n < len; n++)
         frame->payload.data[n+1] = data[n];
-   
-    frame->data_len = 8;
+
+    // zero padding
+    for (n = len + 1; n < frame->data_len; n++)
+        frame->payload.data[n] = 0x00;
 
     return 0;
 }
@@ -970,6 +1424,7 @@ canopen_frame_set_sdo_ibd(canopen_frame_t *frame,
     frame->rtr = CANOPEN_FLAG_NORMAL;
     frame->function_code = CANOPEN_FC_SDO_RX;
     frame->type = CANOPEN_FLAG_STANDARD;    
+    frame->fd = 0;
     frame->id = node;
 
     frame->payload.sdo.command = CANOPEN_SDO_CS_RX_BD | CANOPEN_SDO_CS_DB_CS_IBD;
@@ -1015,6 +1470,7 @@ canopen_frame_set_sdo_ebd(canopen_frame_t *frame,
     frame->rtr = CANOPEN_FLAG_NORMAL;
     frame->function_code = CANOPEN_FC_SDO_RX;
     frame->type = CANOPEN_FLAG_STANDARD;    
+    frame->fd = 0;
     frame->id = node;
 
     frame->payload.data[0]  = CANOPEN_SDO_CS_RX_BD | CANOPEN_SDO_CS_DB_CS_EBD;
@@ -1051,18 +1507,25 @@ canopen_frame_set_sdo_bd(canopen_frame_t *frame,
     frame->rtr = CANOPEN_FLAG_NORMAL;
     frame->function_code = CANOPEN_FC_SDO_RX;
     frame->type = CANOPEN_FLAG_STANDARD;    
+    frame->fd = 0;
     frame->id = node;
 
-    bzero((void *)(frame->payload.data), 8);
+    if (len > CANOPEN_SDO_SEG_MAX_FD)
+        len = CANOPEN_SDO_SEG_MAX_FD;
+
+    // segments with more than 7 bytes of data are sent as CAN FD frames
+    frame->data_len = (len < CANOPEN_SDO_SEG_MAX) ? 8 : canopen_frame_fd_len(len + 1);
+    if (frame->data_len > CANOPEN_FRAME_DATA_LEN)
+        frame->fd = CANOPEN_FD_FLAG_FDF;
+
+    bzero((void *)(frame->payload.data), frame->data_len);
 
     frame->payload.data[0] = seqno;
     if (cont) // cont == 1 => this is the last segment of the block
         frame->payload.data[0] |= CANOPEN_SDO_CS_BD_C_FLAG;
 
-    for (i = 0; i < len && i < 7; i++)
+    for (i = 0; i < len; i++)
         frame->payload.data[i+1] = data[i];
-    
-    frame->data_len = 8;
 
     return 0;
 }
@@ -1080,6 +1543,7 @@ canopen_frame_set_pdo_request(canopen_frame_t *frame, uint8_t node)
     frame->rtr = CANOPEN_FLAG_RTR;
     frame->function_code = CANOPEN_FC_PDO1_TX;
     frame->type = CANOPEN_FLAG_STANDARD;    
+    frame->fd = 0;
     frame->id = node;
 
     frame->data_len = 0;
@@ -1087,6 +1551,69 @@ canopen_frame_set_pdo_request(canopen_frame_t *frame, uint8_t node)
     return 0;
 }
 
+//------------------------------------------------------------------------------
+// frame-building functions
+//
+//------------------------------------------------------------------------------
+int
+canopen_frame_set_sync(canopen_frame_t *frame)
+{
+    if (frame == NULL)
+        return -1;
+
+    frame->rtr = CANOPEN_FLAG_NORMAL;
+    frame->function_code = CANOPEN_FC_SYNC;
+    frame->type = CANOPEN_FLAG_STANDARD;    
+    frame->fd = 0;
+    frame->id = 0;
+
+    frame->data_len = 0; // 1 if a SYNC counter is used
+
+    return 0;
+}
+
+
+//------------------------------------------------------------------------------
+//SF
+//SF .. c:function:: uint32_t canopen_sdo_abort_code(canopen_sdo_t *sdo)
+//SF
+//SF     The abort code of an Abort Domain Transfer SDO frame.
+//SF
+//------------------------------------------------------------------------------
+uint32_t
+canopen_sdo_abort_code(canopen_sdo_t *sdo)
+{
+    return canopen_decode_u32(sdo->data);
+}
+
+//------------------------------------------------------------------------------
+//SF
+//SF .. c:function:: const char *canopen_sdo_abort_code_str(uint32_t code)
+//SF
+//SF     Description of an SDO abort code, "Unknown error" if the code is not
+//SF     known.
+//SF
+//------------------------------------------------------------------------------
+const char *
+canopen_sdo_abort_code_str(uint32_t code)
+{
+    int lo = 0, hi = SDO_ABORT_CODE_COUNT - 1, mid;
+
+    while (lo <= hi)
+    {
+        mid = (lo + hi) / 2;
+
+        if (SDO_abort_codes[mid].code == code)
+            return SDO_abort_codes[mid].description;
+
+        if (SDO_abort_codes[mid].code < code)
+            lo = mid + 1;
+        else
+            hi = mid - 1;
+    }
+
+    return "Unknown error";
+}
 
 //------------------------------------------------------------------------------
 // Look up the error description in the Abort Domain Transfer SDO frame.
@@ -1094,20 +1621,30 @@ canopen_frame_set_pdo_request(canopen_frame_t *frame, uint8_t node)
 const char *
 canopen_sdo_abort_code_lookup(canopen_sdo_t *sdo)
 {
-    int i;
-    uint32_t code;
-
     if (sdo == NULL)
         return "SDO null";
 
-    code = (sdo->data[3]<<24)|(sdo->data[2]<<16)|(sdo->data[1]<<8)|(sdo->data[0]);
+    return canopen_sdo_abort_code_str(canopen_sdo_abort_code(sdo));
+}
 
-    for (i = 0; SDO_abort_codes[i].code != 0; i++)
+//------------------------------------------------------------------------------
+//SF
+//SF .. c:function:: const char *canopen_sdo_result_str(const canopen_sdo_result_t *result)
+//SF
+//SF     Description of the outcome of an SDO transfer: the abort code
+//SF     description if the server aborted it.
+//SF
+//------------------------------------------------------------------------------
+const char *
+canopen_sdo_result_str(const canopen_sdo_result_t *result)
+{
+    switch (result->status)
     {
-        if (SDO_abort_codes[i].code == code)
-        {
-            return SDO_abort_codes[i].description;
-        }
+        case CANOPEN_SDO_OK:            return "OK";
+        case CANOPEN_SDO_ERR_TIMEOUT:   return "SDO timeout";
+        case CANOPEN_SDO_ERR_ABORT:     return canopen_sdo_abort_code_str(result->abort_code);
+        case CANOPEN_SDO_ERR_PROTOCOL:  return "SDO protocol error";
+        case CANOPEN_SDO_ERR_IO:        return "CAN I/O error";
     }
 
     return "Unknown error";
@@ -1182,21 +1719,15 @@ canopen_sdo_get_size(canopen_sdo_t *sdo)
 
 
 //------------------------------------------------------------------------------
-// Decode unsigned int
+// Decode unsigned int (of up to 4 bytes, see canopen-types.h for the others)
 //------------------------------------------------------------------------------
 uint32_t
 canopen_decode_uint(uint8_t *data, uint8_t len)
 {
-    uint8_t n;
-    uint32_t value = 0;
-
     if (data == NULL)
-        return value;
+        return 0;
 
-    for (n = 0; n < len; n++)
-        value += data[n] << (8 * n);
-
-    return value;
+    return (uint32_t)canopen_decode_un(data, len > 4 ? 4 : len);
 }
 
 //------------------------------------------------------------------------------
@@ -1205,15 +1736,12 @@ canopen_decode_uint(uint8_t *data, uint8_t len)
 int
 canopen_encode_uint(uint8_t *data, uint8_t len, uint32_t value)
 {
-    uint8_t n;
-
     if (data == NULL)
         return -1;
 
-    for (n = 0; n < len; n++)
-        data[n] = (value >> (8 * n)) & 0xFF;
+    canopen_encode_un(data, len, value);
 
     return 0;
-}    
+}
 
 
@@ -28,6 +28,7 @@
 
 #include <string.h>
 #include <stdint.h> 
+#include <time.h> 
 
 //#include <canopen-com.h> 
 
@@ -39,6 +40,16 @@
 
 #define CANOPEN_FLAG_STANDARD 0x0
 #define CANOPEN_FLAG_EXTENDED 0x1
+#define CANOPEN_FLAG_ERROR    0x2 // error frame, id holds the error class
+
+// CAN FD frame flags (canopen_frame_t.fd)
+#define CANOPEN_FD_FLAG_FDF   0x1 // CAN FD frame format
+#define CANOPEN_FD_FLAG_BRS   0x2 // bit rate switch
+#define CANOPEN_FD_FLAG_ESI   0x4 // error state indicator
+
+// maximum payload length of a classic CAN and a CAN FD frame
+#define CANOPEN_FRAME_DATA_LEN     8
+#define CANOPEN_FRAME_DATA_LEN_FD  64
 
 //
 // function codes (combined with the ID to give a CAN cob-id)
@@ -126,6 +137,9 @@ typedef struct _canopen_nmt_ng {
 #define CANOPEN_SDO_CS_RX_BD    0xC0
 #define CANOPEN_SDO_CS_TX_BD    0xA0
 #define CANOPEN_SDO_CS_BD_STR  "Block Download"
+#define CANOPEN_SDO_CS_RX_BU    0xA0
+#define CANOPEN_SDO_CS_TX_BU    0xC0
+#define CANOPEN_SDO_CS_BU_STR  "Block Upload"
 
 //#define CANOPEN_SDO_CS_RX_IBD_   0xC0
 
@@ -142,6 +156,10 @@ typedef struct _canopen_nmt_ng {
 #define CANOPEN_SDO_CS_DS_C_FLAG    0x01
 #define CANOPEN_SDO_CS_DS_T_FLAG    0x10
 
+// max data bytes in a segmented/block SDO segment (classic CAN and CAN FD)
+#define CANOPEN_SDO_SEG_MAX     7
+#define CANOPEN_SDO_SEG_MAX_FD  (CANOPEN_FRAME_DATA_LEN_FD - 1)
+
 // block download flags
 #define CANOPEN_SDO_CS_BD_S_FLAG   0x02
 #define CANOPEN_SDO_CS_BD_CRC_FLAG 0x04
@@ -158,6 +176,20 @@ typedef struct _canopen_nmt_ng {
 #define CANOPEN_SDO_CS_DB_SS_BD_END  0x01
 #define CANOPEN_SDO_CS_DB_SS_MASK    0x03
 
+// block upload: client and server subcommands, the flags and the end 'n'
+// field are those of the block download
+#define CANOPEN_SDO_CS_BU_CS_IBU     0x00
+#define CANOPEN_SDO_CS_BU_CS_EBU     0x01
+#define CANOPEN_SDO_CS_BU_CS_ACK     0x02
+#define CANOPEN_SDO_CS_BU_CS_START   0x03
+#define CANOPEN_SDO_CS_BU_CS_MASK    0x03
+
+#define CANOPEN_SDO_CS_BU_SS_IBU     0x00
+#define CANOPEN_SDO_CS_BU_SS_EBU     0x01
+#define CANOPEN_SDO_CS_BU_SS_MASK    0x01
+
+#define CANOPEN_SDO_BLOCK_SIZE_MAX   127    // segments per sub-block
+
 typedef struct _canopen_sdo {
 
     uint8_t command;
@@ -182,6 +214,15 @@ typedef struct _canopen_sdo {
 //ST 
 //ST     The CANopen function code part of the COB-ID in the CAN frame.    
 //ST 
+//ST .. c:member:: uint8_t canopen_frame_t.data_len
+//ST 
+//ST     Length of the payload: up to 8 bytes for classic CAN frames, and up
+//ST     to 64 bytes for CAN FD frames.
+//ST 
+//ST .. c:member:: uint8_t canopen_frame_t.fd
+//ST 
+//ST     CAN FD flags (CANOPEN_FD_FLAG_*), zero for classic CAN frames.
+//ST 
 typedef struct _canopen_frame {
 
     // basic
@@ -194,13 +235,36 @@ typedef struct _canopen_frame {
         canopen_nmt_mc_t    nmt_mc;
         canopen_nmt_ng_t    nmt_ng;
         canopen_sdo_t       sdo;    
-        uint8_t             data[8]; // raw data access
+        uint8_t             data[CANOPEN_FRAME_DATA_LEN_FD]; // raw data access
     } payload;
 
     uint8_t  data_len;
+    uint8_t  fd;            // CANOPEN_FD_FLAG_* or 0 for a classic CAN frame
 
 } canopen_frame_t;
 
+//
+//ST .. c:type:: canopen_frame_meta_t
+//ST    
+//ST     Receive meta data for a CANopen frame, filled in from the socket
+//ST     ancillary data (see can_socket_timestamp_enable).
+//ST 
+//ST .. c:member:: struct timespec canopen_frame_meta_t.ts
+//ST 
+//ST     Kernel receive time stamp, or zero if time stamping is not enabled.
+//ST 
+//ST .. c:member:: uint8_t canopen_frame_meta_t.ts_hw
+//ST 
+//ST     Set if *ts* was taken by the CAN controller hardware.
+//ST 
+typedef struct _canopen_frame_meta {
+
+    struct timespec ts;
+    uint8_t  ts_hw;
+    uint32_t drops;         // frames dropped by the socket so far (SO_RXQ_OVFL)
+
+} canopen_frame_meta_t;
+
 //
 // Error codes
 //
@@ -210,17 +274,78 @@ typedef struct _SDO_abort_code {
 } SDO_abort_code_t;
 
 
+uint32_t    canopen_sdo_abort_code(canopen_sdo_t *sdo);
+const char *canopen_sdo_abort_code_str(uint32_t code);
 const char *canopen_sdo_abort_code_lookup(canopen_sdo_t *sdo);
 
+//
+// Outcome of an SDO transfer, for the caller to act on (retry, report)
+// without parsing messages.
+//
+#define CANOPEN_SDO_OK              0
+#define CANOPEN_SDO_ERR_TIMEOUT     1   // no response from the server in time
+#define CANOPEN_SDO_ERR_ABORT       2   // aborted by the server, see abort_code
+#define CANOPEN_SDO_ERR_PROTOCOL    3   // unexpected response from the server
+#define CANOPEN_SDO_ERR_IO          4   // failed to send or receive a frame
+
+typedef struct _canopen_sdo_result {
+
+    uint8_t  status;        // CANOPEN_SDO_OK or CANOPEN_SDO_ERR_*
+    uint8_t  node;
+    uint16_t index;
+    uint8_t  subindex;
+    uint32_t abort_code;    // CANOPEN_SDO_ERR_ABORT
+
+} canopen_sdo_result_t;
+
+const char *canopen_sdo_result_str(const canopen_sdo_result_t *result);
+
 
 // protocol parsing and packing
 int canopen_frame_parse(canopen_frame_t *canopen_frame, struct can_frame *can_frame);
 int canopen_frame_pack(canopen_frame_t *canopen_frame, struct can_frame *can_frame);
+int canopen_frame_parse_fd(canopen_frame_t *canopen_frame, struct canfd_frame *canfd_frame);
+int canopen_frame_pack_fd(canopen_frame_t *canopen_frame, struct canfd_frame *canfd_frame);
+
+// CAN FD payload lengths come in steps: round up to the next valid length
+uint8_t canopen_frame_fd_len(uint8_t len);
 
 // debug print-out to the standard output
 int canopen_frame_dump_short(canopen_frame_t *frame);
 int canopen_frame_dump_verbose(canopen_frame_t *frame);
 
+// the canopen_frame_dump_short text, formatted into a buffer
+#define CANOPEN_FRAME_FORMAT_MAX 1024 // room for any frame
+int canopen_frame_format_short(canopen_frame_t *frame, char *buf, size_t len);
+
+//
+// Decoder: the protocol state the frame print-outs follow across frames,
+// kept per bus (the functions above share one for the whole process).
+//
+#define CANOPEN_NODE_COUNT 128
+
+#define CANOPEN_DECODER_SDO_IDLE         0
+#define CANOPEN_DECODER_SDO_BLOCK        1 // block download sub-block in progress
+#define CANOPEN_DECODER_SDO_BLOCK_UPLOAD 2 // block upload sub-block in progress
+
+struct _canopen_cob_map;
+
+typedef struct _canopen_decoder {
+
+    uint8_t sdo_state[CANOPEN_NODE_COUNT];      // CANOPEN_DECODER_SDO_*, per node
+    const struct _canopen_cob_map *cob_map;     // NULL: predefined connection set
+
+} canopen_decoder_t;
+
+void               canopen_decoder_init(canopen_decoder_t *dec);
+canopen_decoder_t *canopen_decoder_new();
+void               canopen_decoder_free(canopen_decoder_t *dec);
+void               canopen_decoder_reset(canopen_decoder_t *dec);
+void               canopen_decoder_cob_map(canopen_decoder_t *dec, const struct _canopen_cob_map *map);
+
+int canopen_decoder_format(canopen_decoder_t *dec, canopen_frame_t *frame, char *buf, size_t len);
+int canopen_decoder_dump(canopen_decoder_t *dec, canopen_frame_t *frame);
+
 //
 // frame-building functions
 //
@@ -17,9 +17,10 @@ Read CAN frame, parse into CANopen frame, and dump to STDOUT.
 from pycanopen import *
 
 canopen = CANopen()
+canopen_frame = None
 
 while True:
-    canopen_frame = canopen.read_frame()
+    canopen_frame = canopen.read_frame(canopen_frame)
     if canopen_frame:
         print canopen_frame
     else:
@@ -74,7 +74,7 @@ class CANopenPayload(Union):
     _fields_ = [("nmt_mc", CANopenNMT),
                 ("nmt_ng", CANopenNMTNodeGuard),
                 ("sdo",    CANopenSDO),
-                ("data",   c_uint8 * 8)]
+                ("data",   c_uint8 * 64)] # 8 bytes classic CAN, up to 64 bytes CAN FD
 
 class CANopenFrame(Structure):
     _fields_ = [("rtr",           c_uint8),
@@ -82,10 +82,11 @@ class CANopenFrame(Structure):
                 ("type",          c_uint8),
                 ("id",            c_uint32),
                 ("data",          CANopenPayload), # should be a union...
-                ("data_len",      c_uint8)]
+                ("data_len",      c_uint8),
+                ("fd",            c_uint8)]
 
     def __str__(self):
-        data_str = " ".join(["%.2x" % (x,) for x in self.data.data])    
+        data_str = " ".join(["%.2x" % (x,) for x in self.data.data[:self.data_len]])    
         return "CANopen Frame: RTR=%d FC=0x%.2x ID=0x%.2x [len=%d] %s" % (self.rtr, self.function_code, self.id, self.data_len, data_str)
 
 class CANopen:
@@ -96,6 +97,7 @@ class CANopen:
         name for which to bind a socket to. Defaults to interface "can0"
         """
         self.sock = libcanopen.can_socket_open_timeout(interface.encode('ascii'), timeout_sec)
+        self.can_frame = CANFrame() # receive buffer of read_frame
         
     def open(self, interface, timeout_sec=0):
         """
@@ -113,38 +115,44 @@ class CANopen:
             libcanopen.can_socket_close(self.sock)
             self.sock = None
             
-    def read_can_frame(self):
+    def read_can_frame(self, can_frame=None):
         """
-        Low-level function: Read a CAN frame from socket.
+        Low-level function: Read a CAN frame from socket, into can_frame
+        if given.
         """
         if self.sock:
-            can_frame = CANFrame()
+            if can_frame is None:
+                can_frame = CANFrame()
             if libc.read(self.sock, byref(can_frame), c_int(16)) != 16:
                 raise Exception("CAN frame read error")
             return can_frame
         else:
             raise Exception("CAN fram read error: socket not connected")
             
-    def parse_can_frame(self, can_frame):
+    def parse_can_frame(self, can_frame, canopen_frame=None):
         """
         Low level function: Parse a given CAN frame into CANopen frame
+        (canopen_frame if given, it is overwritten)
         """
-        canopen_frame = CANopenFrame()        
+        if canopen_frame is None:
+            canopen_frame = CANopenFrame()
         if libcanopen.canopen_frame_parse(byref(canopen_frame), byref(can_frame)) == 0:
             return canopen_frame
         else:
             raise Exception("CANopen Frame parse error")
                         
-    def read_frame(self):
+    def read_frame(self, canopen_frame=None):
         """
         Read a CANopen frame from socket. First read a CAN frame, then parse
-        into a CANopen frame and return it.
+        into a CANopen frame and return it. Pass the previous frame as
+        canopen_frame to reuse it, instead of allocating a new one for
+        every read.
         """
-        can_frame = self.read_can_frame()
+        can_frame = self.read_can_frame(self.can_frame)
         if not can_frame:
             raise Exception("CAN Frame read error")
 
-        canopen_frame = self.parse_can_frame(can_frame)
+        canopen_frame = self.parse_can_frame(can_frame, canopen_frame)
         if not canopen_frame:
             raise Exception("CANopen Frame parse error")
         